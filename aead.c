@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "aead.h"
+#include "types.h"
+
+/* SHA-256 state for the key derivation */
+typedef struct _Sha256
+{
+    uint32_t state[8];        // To store the chaining value
+    uint64_t length;          // To store the bytes hashed so far
+    unsigned char block[64];  // To store a partial block
+    size_t used;              // To store the bytes in block
+} Sha256;
+
+/* Poly1305 state, 26 bit limbs */
+typedef struct _Poly1305
+{
+    uint32_t r[5];            // To store the clamped key half r
+    uint32_t h[5];            // To store the accumulator
+    uint32_t pad[4];          // To store the key half s
+    unsigned char block[16];  // To store a partial block
+    size_t used;              // To store the bytes in block
+} Poly1305;
+
+/* Function Definitions */
+
+/*AEAD steps
+1.key = PBKDF2-HMAC-SHA256(passphrase, salt), once per payload
+2.every segment has its own nonce (prefix | segment number)
+3.ChaCha20 block 0 gives the one time Poly1305 key,
+  blocks 1.. encrypt the segment
+4.tag = Poly1305(aad | pad | ciphertext | pad | lengths), RFC 8439
+  the tag is checked before any plaintext of the segment is released*/
+
+static uint32_t load32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t rotl32(uint32_t v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+static uint32_t rotr32(uint32_t v, int n)
+{
+    return (v >> n) | (v << (32 - n));
+}
+
+/* SHA-256 */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static void sha256_compress(uint32_t state[8], const unsigned char *block)
+{
+    uint32_t w[64], s[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t)block[4 * i] << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, state, sizeof(s));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = s[7] + (rotr32(s[4], 6) ^ rotr32(s[4], 11) ^ rotr32(s[4], 25)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (rotr32(s[0], 2) ^ rotr32(s[0], 13) ^ rotr32(s[0], 22)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(s + 1, s, 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+        state[i] += s[i];
+}
+
+static void sha256_init(Sha256 *sha)
+{
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(sha->state, iv, sizeof(iv));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+static void sha256_update(Sha256 *sha, const unsigned char *data, size_t n)
+{
+    sha->length += n;
+    while (n > 0)
+    {
+        size_t take = sizeof(sha->block) - sha->used;
+        if (take > n)
+            take = n;
+        memcpy(sha->block + sha->used, data, take);
+        sha->used += take;
+        data += take;
+        n -= take;
+        if (sha->used == sizeof(sha->block))
+        {
+            sha256_compress(sha->state, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+static void sha256_final(Sha256 *sha, unsigned char digest[32])
+{
+    uint64_t bits = sha->length * 8;
+
+    // 0x80, zeros up to 56 bytes into a block, then the length in bits
+    sha->block[sha->used++] = 0x80;
+    if (sha->used > 56)
+    {
+        memset(sha->block + sha->used, 0, 64 - sha->used);
+        sha256_compress(sha->state, sha->block);
+        sha->used = 0;
+    }
+    memset(sha->block + sha->used, 0, 56 - sha->used);
+    for (int i = 0; i < 8; i++)
+        sha->block[56 + i] = bits >> (56 - 8 * i);
+    sha256_compress(sha->state, sha->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = sha->state[i] >> 24;
+        digest[4 * i + 1] = sha->state[i] >> 16;
+        digest[4 * i + 2] = sha->state[i] >> 8;
+        digest[4 * i + 3] = sha->state[i];
+    }
+}
+
+/* PBKDF2-HMAC-SHA256 for one 32 byte block, the inner and outer
+ * HMAC states are hashed once and copied for every round */
+static void pbkdf2_sha256(const char *passphrase, const unsigned char *salt, size_t salt_len,
+                          int iterations, unsigned char out[32])
+{
+    unsigned char key[64] = {0}, pad[64], u[32];
+    Sha256 inner, outer, sha;
+    size_t len = strlen(passphrase);
+
+    if (len > sizeof(key))
+    {
+        sha256_init(&sha);
+        sha256_update(&sha, (const unsigned char *)passphrase, len);
+        sha256_final(&sha, key);
+    }
+    else
+    {
+        memcpy(key, passphrase, len);
+    }
+    for (int i = 0; i < 64; i++)
+        pad[i] = key[i] ^ 0x36;
+    sha256_init(&inner);
+    sha256_update(&inner, pad, 64);
+    for (int i = 0; i < 64; i++)
+        pad[i] = key[i] ^ 0x5c;
+    sha256_init(&outer);
+    sha256_update(&outer, pad, 64);
+
+    // U1 = HMAC(salt | block number 1)
+    const unsigned char block_no[4] = {0, 0, 0, 1};
+    sha = inner;
+    sha256_update(&sha, salt, salt_len);
+    sha256_update(&sha, block_no, 4);
+    sha256_final(&sha, u);
+    sha = outer;
+    sha256_update(&sha, u, 32);
+    sha256_final(&sha, u);
+    memcpy(out, u, 32);
+
+    for (int i = 1; i < iterations; i++)
+    {
+        sha = inner;
+        sha256_update(&sha, u, 32);
+        sha256_final(&sha, u);
+        sha = outer;
+        sha256_update(&sha, u, 32);
+        sha256_final(&sha, u);
+        for (int j = 0; j < 32; j++)
+            out[j] ^= u[j];
+    }
+    memset(key, 0, sizeof(key));
+    memset(pad, 0, sizeof(pad));
+}
+
+/* ChaCha20 */
+
+#define QUARTER_ROUND(a, b, c, d)   \
+    a += b; d = rotl32(d ^ a, 16); \
+    c += d; b = rotl32(b ^ c, 12); \
+    a += b; d = rotl32(d ^ a, 8);  \
+    c += d; b = rotl32(b ^ c, 7)
+
+/* One 64 byte keystream block */
+static void chacha20_block(const uint32_t input[16], unsigned char out[64])
+{
+    uint32_t x[16];
+    memcpy(x, input, sizeof(x));
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+        store32(out + 4 * i, x[i] + input[i]);
+}
+
+/* State for key, nonce and block counter */
+static void chacha20_setup(uint32_t input[16], const unsigned char key[32], const unsigned char nonce[12], uint32_t counter)
+{
+    input[0] = 0x61707865;
+    input[1] = 0x3320646e;
+    input[2] = 0x79622d32;
+    input[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+        input[4 + i] = load32(key + 4 * i);
+    input[12] = counter;
+    input[13] = load32(nonce);
+    input[14] = load32(nonce + 4);
+    input[15] = load32(nonce + 8);
+}
+
+/* XOR n bytes with the keystream from block 1 on */
+static void chacha20_xor(uint32_t input[16], unsigned char *data, size_t n)
+{
+    unsigned char stream[64];
+    while (n > 0)
+    {
+        size_t take = (n < 64) ? n : 64;
+        chacha20_block(input, stream);
+        input[12]++;
+        for (size_t i = 0; i < take; i++)
+            data[i] ^= stream[i];
+        data += take;
+        n -= take;
+    }
+}
+
+/* Poly1305 */
+
+static void poly1305_init(Poly1305 *poly, const unsigned char key[32])
+{
+    poly->r[0] = load32(key) & 0x3ffffff;
+    poly->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    poly->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    poly->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    poly->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; i++)
+        poly->h[i] = 0;
+    for (int i = 0; i < 4; i++)
+        poly->pad[i] = load32(key + 16 + 4 * i);
+    poly->used = 0;
+}
+
+/* Absorb 16 byte blocks, hibit is 0 only for the padded final block */
+static void poly1305_blocks(Poly1305 *poly, const unsigned char *m, size_t n, uint32_t hibit)
+{
+    uint32_t r0 = poly->r[0], r1 = poly->r[1], r2 = poly->r[2], r3 = poly->r[3], r4 = poly->r[4];
+    uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+
+    for (; n >= 16; m += 16, n -= 16)
+    {
+        h0 += load32(m) & 0x3ffffff;
+        h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c = d0 >> 26;
+        h0 = d0 & 0x3ffffff;
+        d1 += c;
+        c = d1 >> 26;
+        h1 = d1 & 0x3ffffff;
+        d2 += c;
+        c = d2 >> 26;
+        h2 = d2 & 0x3ffffff;
+        d3 += c;
+        c = d3 >> 26;
+        h3 = d3 & 0x3ffffff;
+        d4 += c;
+        c = d4 >> 26;
+        h4 = d4 & 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+    }
+    poly->h[0] = h0;
+    poly->h[1] = h1;
+    poly->h[2] = h2;
+    poly->h[3] = h3;
+    poly->h[4] = h4;
+}
+
+static void poly1305_update(Poly1305 *poly, const unsigned char *m, size_t n)
+{
+    if (poly->used > 0)
+    {
+        size_t take = 16 - poly->used;
+        if (take > n)
+            take = n;
+        memcpy(poly->block + poly->used, m, take);
+        poly->used += take;
+        m += take;
+        n -= take;
+        if (poly->used < 16)
+            return;
+        poly1305_blocks(poly, poly->block, 16, 1 << 24);
+        poly->used = 0;
+    }
+    size_t whole = n & ~(size_t)15;
+    poly1305_blocks(poly, m, whole, 1 << 24);
+    memcpy(poly->block, m + whole, n - whole);
+    poly->used = n - whole;
+}
+
+/* Zero bytes up to the next 16 byte boundary of n */
+static void poly1305_pad16(Poly1305 *poly, size_t n)
+{
+    static const unsigned char zeros[16];
+    if (n % 16)
+        poly1305_update(poly, zeros, 16 - n % 16);
+}
+
+static void poly1305_final(Poly1305 *poly, unsigned char mac[16])
+{
+    if (poly->used > 0)
+    {
+        poly->block[poly->used++] = 1;
+        memset(poly->block + poly->used, 0, 16 - poly->used);
+        poly1305_blocks(poly, poly->block, 16, 0);
+    }
+
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+    uint32_t c = h1 >> 26;
+    h1 &= 0x3ffffff;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= 0x3ffffff;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= 0x3ffffff;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= 0x3ffffff;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= 0x3ffffff;
+    h1 += c;
+
+    // h - p, kept only if h >= p (no borrow), without branching
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // h + s mod 2^128
+    uint32_t w0 = h0 | (h1 << 26);
+    uint32_t w1 = (h1 >> 6) | (h2 << 20);
+    uint32_t w2 = (h2 >> 12) | (h3 << 14);
+    uint32_t w3 = (h3 >> 18) | (h4 << 8);
+    uint64_t f = (uint64_t)w0 + poly->pad[0];
+    store32(mac, f);
+    f = (uint64_t)w1 + poly->pad[1] + (f >> 32);
+    store32(mac + 4, f);
+    f = (uint64_t)w2 + poly->pad[2] + (f >> 32);
+    store32(mac + 8, f);
+    f = (uint64_t)w3 + poly->pad[3] + (f >> 32);
+    store32(mac + 12, f);
+}
+
+/* ChaCha20-Poly1305 (RFC 8439) */
+
+/* Tag of aad and ciphertext, input is left at block 1 for the data */
+static void aead_tag(uint32_t input[16], const unsigned char *aad, size_t aad_len,
+                     const unsigned char *ciphertext, size_t n, unsigned char tag[16])
+{
+    unsigned char poly_key[64], lengths[16];
+    Poly1305 poly;
+
+    chacha20_block(input, poly_key);
+    poly1305_init(&poly, poly_key);
+    poly1305_update(&poly, aad, aad_len);
+    poly1305_pad16(&poly, aad_len);
+    poly1305_update(&poly, ciphertext, n);
+    poly1305_pad16(&poly, n);
+    store32(lengths, aad_len);
+    store32(lengths + 4, (uint64_t)aad_len >> 32);
+    store32(lengths + 8, n);
+    store32(lengths + 12, (uint64_t)n >> 32);
+    poly1305_update(&poly, lengths, 16);
+    poly1305_final(&poly, tag);
+    memset(poly_key, 0, sizeof(poly_key));
+}
+
+/* Segment nonce and associated data */
+static void segment_params(const AeadInfo *aead, long segment, unsigned char nonce[12], unsigned char *aad)
+{
+    memcpy(nonce, aead->nonce, AEAD_NONCE_SIZE);
+    store32(nonce + AEAD_NONCE_SIZE, segment);
+    *aad = (segment == aead_segments(aead) - 1);
+}
+
+void aead_seal_segment(const AeadInfo *aead, long segment, unsigned char *data, size_t n)
+{
+    unsigned char nonce[12], aad;
+    uint32_t input[16];
+
+    segment_params(aead, segment, nonce, &aad);
+    chacha20_setup(input, aead->key, nonce, 1);
+    chacha20_xor(input, data, n);
+    chacha20_setup(input, aead->key, nonce, 0);
+    aead_tag(input, &aad, 1, data, n, data + n);
+}
+
+Status aead_open_segment(const AeadInfo *aead, long segment, unsigned char *data, size_t n)
+{
+    unsigned char nonce[12], aad, tag[AEAD_TAG_SIZE];
+    uint32_t input[16];
+
+    segment_params(aead, segment, nonce, &aad);
+    chacha20_setup(input, aead->key, nonce, 0);
+    aead_tag(input, &aad, 1, data, n, tag);
+
+    // Constant time compare
+    unsigned char diff = 0;
+    for (int i = 0; i < AEAD_TAG_SIZE; i++)
+        diff |= tag[i] ^ data[n + i];
+    if (diff != 0)
+        return e_failure;
+
+    chacha20_setup(input, aead->key, nonce, 1);
+    chacha20_xor(input, data, n);
+    return e_success;
+}
+
+/* Payload layout */
+
+long aead_segments(const AeadInfo *aead)
+{
+    long n = (aead->plain_size + AEAD_SEGMENT_SIZE - 1) / AEAD_SEGMENT_SIZE;
+    return (n > 0) ? n : 1;
+}
+
+size_t aead_segment_length(const AeadInfo *aead, long segment)
+{
+    long left = aead->plain_size - segment * (long)AEAD_SEGMENT_SIZE;
+    return (left < AEAD_SEGMENT_SIZE) ? left : AEAD_SEGMENT_SIZE;
+}
+
+long aead_segment_offset(long segment)
+{
+    return AEAD_HEADER_SIZE + segment * (long)(AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+}
+
+long aead_sealed_size(long plain_size)
+{
+    long segments = (plain_size + AEAD_SEGMENT_SIZE - 1) / AEAD_SEGMENT_SIZE;
+    if (segments == 0)
+        segments = 1;
+    return AEAD_HEADER_SIZE + plain_size + segments * AEAD_TAG_SIZE;
+}
+
+long aead_plain_size(long sealed_size)
+{
+    long body = sealed_size - AEAD_HEADER_SIZE;
+    if (body < AEAD_TAG_SIZE)
+        return -1;
+
+    // Every whole segment takes SEGMENT + TAG, the last one whatever is left
+    long whole = body / (AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    long rest = body % (AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    if (rest == 0)
+        return whole * AEAD_SEGMENT_SIZE;
+    if (rest < AEAD_TAG_SIZE || (rest == AEAD_TAG_SIZE && whole > 0))
+        return -1;
+    return whole * AEAD_SEGMENT_SIZE + rest - AEAD_TAG_SIZE;
+}
+
+/* Keys */
+
+Status aead_read_passphrase(const char *fname, char *passphrase, size_t size)
+{
+    FILE *fptr = fopen(fname, "r");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        return e_failure;
+    }
+    Status ret = (fgets(passphrase, size, fptr) != NULL) ? e_success : e_failure;
+    fclose(fptr);
+    if (ret == e_failure)
+        return e_failure;
+
+    passphrase[strcspn(passphrase, "\r\n")] = '\0';
+    return (passphrase[0] != '\0') ? e_success : e_failure;
+}
+
+Status aead_init_seal(AeadInfo *aead, const char *passphrase, long plain_size)
+{
+    FILE *fptr = fopen("/dev/urandom", "rb");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        return e_failure;
+    }
+    size_t got = fread(aead->salt, 1, AEAD_SALT_SIZE, fptr) + fread(aead->nonce, 1, AEAD_NONCE_SIZE, fptr);
+    fclose(fptr);
+    if (got != AEAD_HEADER_SIZE)
+        return e_failure;
+
+    aead->plain_size = plain_size;
+    pbkdf2_sha256(passphrase, aead->salt, AEAD_SALT_SIZE, AEAD_KDF_ITERATIONS, aead->key);
+    return e_success;
+}
+
+Status aead_init_open(AeadInfo *aead, const char *passphrase, const unsigned char *header, long sealed_size)
+{
+    aead->plain_size = aead_plain_size(sealed_size);
+    if (aead->plain_size < 0)
+        return e_failure;
+
+    memcpy(aead->salt, header, AEAD_SALT_SIZE);
+    memcpy(aead->nonce, header + AEAD_SALT_SIZE, AEAD_NONCE_SIZE);
+    pbkdf2_sha256(passphrase, aead->salt, AEAD_SALT_SIZE, AEAD_KDF_ITERATIONS, aead->key);
+    return e_success;
+}
+
+void aead_derive_key(const char *passphrase, const unsigned char *salt, size_t salt_len, unsigned char *key)
+{
+    pbkdf2_sha256(passphrase, salt, salt_len, AEAD_KDF_ITERATIONS, key);
+}
+
+void aead_put_header(const AeadInfo *aead, unsigned char *header)
+{
+    memcpy(header, aead->salt, AEAD_SALT_SIZE);
+    memcpy(header + AEAD_SALT_SIZE, aead->nonce, AEAD_NONCE_SIZE);
+}
@@ -0,0 +1,88 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* ChaCha20-Poly1305 key, derived from the passphrase */
+#define AEAD_KEY_SIZE 32
+
+/* Random salt for the key derivation, new for every payload */
+#define AEAD_SALT_SIZE 16
+
+/* Random nonce prefix, the segment number fills the rest of the 96 bit nonce */
+#define AEAD_NONCE_SIZE 8
+
+/* Salt and nonce prefix, in front of the first segment */
+#define AEAD_HEADER_SIZE (AEAD_SALT_SIZE + AEAD_NONCE_SIZE)
+
+/* Poly1305 tag after every segment */
+#define AEAD_TAG_SIZE 16
+
+/* Plaintext bytes sealed as one segment */
+#define AEAD_SEGMENT_SIZE 65536
+
+/* PBKDF2-HMAC-SHA256 rounds from passphrase to key */
+#define AEAD_KDF_ITERATIONS 20000
+
+/* Longest passphrase read from a key file */
+#define AEAD_MAX_PASSPHRASE 1024
+
+/*
+ * Sealed payload
+ * salt | nonce prefix | segment 0 | segment 1 | ...
+ * segment i = ChaCha20-Poly1305 ciphertext of plaintext bytes
+ *   [i * AEAD_SEGMENT_SIZE, (i + 1) * AEAD_SEGMENT_SIZE) | tag
+ *   nonce = nonce prefix | i (32 bits, little endian)
+ *   associated data = 1 byte, 1 for the last segment else 0, so a
+ *   payload cut short at a segment boundary does not authenticate
+ * an empty payload still has one (empty) segment and its tag
+ * segments are independent, any of them can be opened on its own
+ */
+typedef struct _AeadInfo
+{
+    unsigned char key[AEAD_KEY_SIZE];     // To store the derived key
+    unsigned char salt[AEAD_SALT_SIZE];   // To store the key derivation salt
+    unsigned char nonce[AEAD_NONCE_SIZE]; // To store the nonce prefix
+    long plain_size;                      // To store the plaintext bytes of the payload
+} AeadInfo;
+
+/* AEAD function prototypes */
+
+/* Read a passphrase (first line of the file) */
+Status aead_read_passphrase(const char *fname, char *passphrase, size_t size);
+
+/* New salt and nonce, key from the passphrase, for sealing plain_size bytes */
+Status aead_init_seal(AeadInfo *aead, const char *passphrase, long plain_size);
+
+/* Salt and nonce from a sealed payload of sealed_size bytes, key from the passphrase */
+Status aead_init_open(AeadInfo *aead, const char *passphrase, const unsigned char *header, long sealed_size);
+
+/* AEAD_KEY_SIZE bytes of key from a passphrase and salt (PBKDF2-HMAC-SHA256) */
+void aead_derive_key(const char *passphrase, const unsigned char *salt, size_t salt_len, unsigned char *key);
+
+/* Write the salt and nonce prefix (AEAD_HEADER_SIZE bytes) */
+void aead_put_header(const AeadInfo *aead, unsigned char *header);
+
+/* Sealed size of plain_size plaintext bytes */
+long aead_sealed_size(long plain_size);
+
+/* Plaintext size of a sealed payload, -1 if no payload has that size */
+long aead_plain_size(long sealed_size);
+
+/* Number of segments of the payload */
+long aead_segments(const AeadInfo *aead);
+
+/* Plaintext bytes in a segment */
+size_t aead_segment_length(const AeadInfo *aead, long segment);
+
+/* Offset of a segment in the sealed payload */
+long aead_segment_offset(long segment);
+
+/* Encrypt n bytes of a segment in place and put the tag at data + n */
+void aead_seal_segment(const AeadInfo *aead, long segment, unsigned char *data, size_t n);
+
+/* Check the tag at data + n and decrypt n bytes in place, e_failure if it does not match */
+Status aead_open_segment(const AeadInfo *aead, long segment, unsigned char *data, size_t n);
+
+#endif
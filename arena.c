@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Round a size up to a whole number of ARENA_ALIGN blocks */
+static size_t align_size(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+Status arena_init(Arena *arena, size_t size)
+{
+    size = align_size(size);
+    arena->base = aligned_alloc(ARENA_ALIGN, size);
+    if (arena->base == NULL)
+    {
+        perror("aligned_alloc");
+        return e_failure;
+    }
+    arena->size = size;
+    arena->used = 0;
+    return e_success;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = align_size(size);
+    if (size > arena->size - arena->used)
+        return NULL;
+    void *block = arena->base + arena->used;
+    arena->used += size;
+    return block;
+}
+
+void arena_reset(Arena *arena)
+{
+    arena->used = 0;
+}
+
+void arena_free(Arena *arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+size_t arena_size_for(const size_t sizes[], int count)
+{
+    size_t size = 0;
+    for (int i = 0; i < count; i++)
+        size += align_size(sizes[i]);
+    return size;
+}
+
+void *scratch_alloc(Arena *arena, size_t size)
+{
+    if (arena == NULL)
+        return malloc(size);
+    void *block = arena_alloc(arena, size);
+    if (block == NULL)
+        printf("ERROR:Scratch arena is full (%zu bytes asked, %zu left)\n", size, arena->size - arena->used);
+    return block;
+}
+
+void scratch_free(Arena *arena, void *block)
+{
+    if (arena == NULL)
+    {
+        free(block);
+        return;
+    }
+    // Blocks come back last first, everything from this one on is free again
+    unsigned char *p = block;
+    if (p != NULL && p >= arena->base && p < arena->base + arena->used)
+        arena->used = p - arena->base;
+}
@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* Every block starts on a cache line */
+#define ARENA_ALIGN 64
+
+/*
+ * Scratch arena
+ * one block of memory allocated up front and handed out front to back.
+ * Blocks go back in the reverse order they were taken (every user frees
+ * what it took before its caller does), so the arena holds the scratch
+ * of any number of encodes/decodes one after the other without a single
+ * malloc after arena_init
+ */
+typedef struct _Arena
+{
+    unsigned char *base; // To store the memory of the arena
+    size_t size;         // To store its size in bytes
+    size_t used;         // To store the bytes handed out
+} Arena;
+
+/* Arena function prototypes */
+
+/* Allocate size bytes for the arena */
+Status arena_init(Arena *arena, size_t size);
+
+/* Next size bytes of the arena, NULL if it is full */
+void *arena_alloc(Arena *arena, size_t size);
+
+/* Hand every block out again */
+void arena_reset(Arena *arena);
+
+/* Release the memory of the arena */
+void arena_free(Arena *arena);
+
+/* Bytes an arena needs for blocks of the given sizes, taken at once */
+size_t arena_size_for(const size_t sizes[], int count);
+
+/* size bytes from the arena, from malloc when arena is NULL */
+void *scratch_alloc(Arena *arena, size_t size);
+
+/* Give back a block from scratch_alloc with the same arena */
+void scratch_free(Arena *arena, void *block);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "types.h"
+
+/* Most words on a manifest line: -e cover secret output */
+#define BATCH_MAX_ARGS 5
+
+/* Per worker state, reused for every item the worker runs */
+typedef struct _BatchWorker
+{
+    BatchInfo *batchInfo; // shared manifest and counters
+    EncodeInfo encInfo;   // keeps its stream buffers between items
+    DecodeInfo decInfo;
+    pthread_t tid;
+} BatchWorker;
+
+/* Function Definitions */
+
+/*Batch steps
+1.open the manifest (a file, or stdin for "-")
+  every line holds the same words as one command line:
+    -e <source_image.bmp> <secret.txt> [output_stego.bmp]
+    -d <stego_image.bmp> [output.txt]
+  empty lines and lines starting with # are skipped
+2.start num_threads workers
+3.each worker takes the next line under the lock, validates it
+  with the normal arg checks and runs do_encoding/do_decoding
+  with buffers it keeps for the whole run
+4.print one status line per item and a summary at the end
+  the items print their ERROR lines from several workers at once, so
+  those go to stderr and stdout only gets the status lines*/
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Validate and store batch args */
+Status read_and_validate_batch_args(char *argv[], BatchInfo *batchInfo)
+{
+    if (argv[2] == NULL)
+        return e_failure;
+    batchInfo->manifest_fname = argv[2];
+    return e_success;
+}
+
+/* Hand out the next manifest line, 0 when the manifest is done */
+static int next_item(BatchInfo *batchInfo, char *line, long *line_no)
+{
+    int found = 0;
+    pthread_mutex_lock(&batchInfo->lock);
+    while (!found && fgets(line, BATCH_LINE_SIZE, batchInfo->fptr_manifest) != NULL)
+    {
+        batchInfo->line_no++;
+        char *word = line + strspn(line, " \t\r\n");
+        found = (*word != '\0' && *word != '#');
+    }
+    *line_no = batchInfo->line_no;
+    pthread_mutex_unlock(&batchInfo->lock);
+    return found;
+}
+
+/* Run one manifest line */
+static Status run_item(BatchWorker *worker, char *line, const char **op)
+{
+    BatchInfo *batchInfo = worker->batchInfo;
+    char *argv[BATCH_MAX_ARGS + 2] = {"steg"};
+    char *save;
+    int argc = 1;
+
+    *op = "invalid";
+    for (char *word = strtok_r(line, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (argc > BATCH_MAX_ARGS)
+            return e_failure;
+        argv[argc++] = word;
+    }
+    argv[argc] = NULL;
+
+    if (argc < 3)
+        return e_failure;
+
+    if (strcmp(argv[1], "-e") == 0)
+    {
+        EncodeInfo *encInfo = &worker->encInfo;
+        char *src_io_buffer = encInfo->src_io_buffer;
+        char *stego_io_buffer = encInfo->stego_io_buffer;
+
+        *op = "encode";
+        memset(encInfo, 0, sizeof(EncodeInfo));
+        encInfo->use_mmap = batchInfo->use_mmap;
+        encInfo->format.lsb_bits = batchInfo->lsb_bits;
+        encInfo->compress_level = batchInfo->compress_level;
+        encInfo->passphrase = batchInfo->passphrase;
+        encInfo->use_scatter = batchInfo->use_scatter;
+        encInfo->use_checksum = batchInfo->use_checksum;
+        encInfo->use_fec = batchInfo->use_fec;
+        // Items run at once, only the BATCH line reports them
+        encInfo->quiet = 1;
+        if (read_and_validate_encode_args(argv, encInfo) == e_failure)
+            return e_failure;
+
+        // Stream buffers stay with the worker, not with the item
+        encInfo->src_io_buffer = src_io_buffer;
+        encInfo->stego_io_buffer = stego_io_buffer;
+        encInfo->keep_io_buffers = 1;
+        return do_encoding(encInfo);
+    }
+    if (strcmp(argv[1], "-d") == 0)
+    {
+        DecodeInfo *decInfo = &worker->decInfo;
+
+        *op = "decode";
+        memset(decInfo, 0, sizeof(DecodeInfo));
+        decInfo->use_mmap = batchInfo->use_mmap;
+        decInfo->passphrase = batchInfo->passphrase;
+        decInfo->payload_length = -1;
+        decInfo->quiet = 1;
+        if (read_and_validate_decode_args(argv, decInfo) == e_failure)
+            return e_failure;
+        return do_decoding(decInfo);
+    }
+    return e_failure;
+}
+
+/* Worker: run manifest lines until there are none left */
+static void *batch_worker(void *arg)
+{
+    BatchWorker *worker = arg;
+    BatchInfo *batchInfo = worker->batchInfo;
+    char line[BATCH_LINE_SIZE];
+    long line_no;
+
+    while (next_item(batchInfo, line, &line_no))
+    {
+        const char *op;
+        double start = now_ms();
+        Status ret = run_item(worker, line, &op);
+        double ms = now_ms() - start;
+
+        pthread_mutex_lock(&batchInfo->lock);
+        batchInfo->items++;
+        batchInfo->busy_ms += ms;
+        if (ret == e_failure)
+            batchInfo->failed++;
+        fprintf(batchInfo->fptr_report, "BATCH: line %ld %s %s %.3f ms\n", line_no, op,
+                (ret == e_success) ? "OK" : "FAILED", ms);
+        pthread_mutex_unlock(&batchInfo->lock);
+    }
+
+    free(worker->encInfo.src_io_buffer);
+    free(worker->encInfo.stego_io_buffer);
+    return NULL;
+}
+
+/* Keep stdout for the report and point fd 1 (every item printf) at stderr */
+static Status open_report(BatchInfo *batchInfo)
+{
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+        (batchInfo->fptr_report = fdopen(fd, "w")) == NULL)
+    {
+        perror("dup");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Main batch driver */
+Status do_batch(BatchInfo *batchInfo)
+{
+    if (strcmp(batchInfo->manifest_fname, "-") == 0)
+        batchInfo->fptr_manifest = stdin;
+    else
+        batchInfo->fptr_manifest = fopen(batchInfo->manifest_fname, "r");
+    if (batchInfo->fptr_manifest == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", batchInfo->manifest_fname);
+        return e_failure;
+    }
+
+    // Messages of the items go to stderr, the report keeps stdout
+    if (open_report(batchInfo) == e_failure)
+    {
+        if (batchInfo->fptr_manifest != stdin)
+            fclose(batchInfo->fptr_manifest);
+        return e_failure;
+    }
+
+    if (batchInfo->num_threads <= 0)
+        batchInfo->num_threads = 1;
+    batchInfo->line_no = 0;
+    batchInfo->items = 0;
+    batchInfo->failed = 0;
+    batchInfo->busy_ms = 0;
+    pthread_mutex_init(&batchInfo->lock, NULL);
+
+    BatchWorker *workers = calloc(batchInfo->num_threads, sizeof(BatchWorker));
+    int *started = calloc(batchInfo->num_threads, sizeof(int));
+    if (workers == NULL || started == NULL)
+    {
+        free(workers);
+        free(started);
+        fclose(batchInfo->fptr_report);
+        if (batchInfo->fptr_manifest != stdin)
+            fclose(batchInfo->fptr_manifest);
+        return e_failure;
+    }
+
+    double start = now_ms();
+    for (int t = 0; t < batchInfo->num_threads; t++)
+    {
+        workers[t].batchInfo = batchInfo;
+        started[t] = (pthread_create(&workers[t].tid, NULL, batch_worker, &workers[t]) == 0);
+    }
+    for (int t = 0; t < batchInfo->num_threads; t++)
+    {
+        if (started[t])
+            pthread_join(workers[t].tid, NULL);
+    }
+    // Nothing could be started, run the manifest on this thread
+    int any_started = 0;
+    for (int t = 0; t < batchInfo->num_threads; t++)
+        any_started |= started[t];
+    if (!any_started)
+        batch_worker(&workers[0]);
+    double wall_ms = now_ms() - start;
+
+    fprintf(batchInfo->fptr_report, "INFO: Batch done: %ld items, %ld ok, %ld failed\n", batchInfo->items,
+            batchInfo->items - batchInfo->failed, batchInfo->failed);
+    fprintf(batchInfo->fptr_report, "INFO: Batch time: %.3f s wall, %.3f ms per item, %.1f items/s on %d workers\n",
+            wall_ms / 1000, batchInfo->items ? batchInfo->busy_ms / batchInfo->items : 0.0,
+            wall_ms > 0 ? batchInfo->items * 1000 / wall_ms : 0.0, batchInfo->num_threads);
+
+    fclose(batchInfo->fptr_report);
+    free(workers);
+    free(started);
+    pthread_mutex_destroy(&batchInfo->lock);
+    if (batchInfo->fptr_manifest != stdin)
+        fclose(batchInfo->fptr_manifest);
+
+    return (batchInfo->failed == 0) ? e_success : e_failure;
+}
@@ -0,0 +1,51 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "types.h"
+
+/* Longest manifest line accepted */
+#define BATCH_LINE_SIZE 4096
+
+/*
+ * Structure to store information required for
+ * running a manifest of encode/decode operations
+ * in one process
+ */
+
+typedef struct _BatchInfo
+{
+    /* Manifest info */
+    char *manifest_fname;   // To store the manifest name, "-" for stdin
+    FILE *fptr_manifest;    // To store the address of the manifest
+    long line_no;           // To store the last manifest line handed out
+    pthread_mutex_t lock;   // To serialise manifest reads, counters and report lines
+    FILE *fptr_report;      // To store stdout, for the BATCH lines and the summary
+
+    /* Worker pool info */
+    int num_threads;        // To store the number of workers
+    int use_mmap;           // To select the memory mapped encoder/decoder
+    int lsb_bits;           // To store the LSBs per byte of encode items, 0 for default
+    int compress_level;     // To store the compression level of encode items, 0 for none
+    const char *passphrase; // To store the passphrase for all items, NULL for none
+    int use_scatter;        // To permute the data carriers of encode items
+    int use_checksum;       // To add a checksum to encode items
+    int use_fec;            // To Reed-Solomon code the data of encode items
+
+    /* Results */
+    long items;         // To store the number of operations run
+    long failed;        // To store the number of failed operations
+    double busy_ms;     // To store the summed per item time
+
+} BatchInfo;
+
+/* Batch function prototypes */
+
+/* Read and validate batch args from argv */
+Status read_and_validate_batch_args(char *argv[], BatchInfo *batchInfo);
+
+/* Run every manifest line through the worker pool */
+Status do_batch(BatchInfo *batchInfo);
+
+#endif
@@ -0,0 +1,705 @@
+/* Steganography benchmark
+ *
+ * Build (all sources except main.c):
+ *   gcc -O2 -o steg_bench bench.c encode.c decode.c block_io.c mmap_io.c \
+ *       lsb_kernels.c parallel_encode.c parallel_decode.c batch.c stats.c \
+ *       steg_format.c bmp_layout.c stream_io.c compress.c aead.c scatter.c inspect.c crc32c.c \
+ *       container.c arena.c steg.c flate.c png_io.c scan.c detect.c fec.c serve.c -lpthread -lm
+ *
+ * Usage:
+ *   ./steg_bench [--max-dim N] [--repeat N] [--dir DIR] [--threads N] [--mmap] [--bits N]
+ *   ./steg_bench --serve N [--requests N] [--socket PATH] [--dir DIR] [--threads N]
+ *
+ * Generates synthetic 24-bit BMP covers from 64x64 up to max-dim x max-dim
+ * (default 4096, 16384 for the full sweep, 40000 for 4.8 GB covers) and
+ * random payloads from 16 bytes up to the cover capacity at --bits LSBs
+ * per byte (--bits 4 on the 40000 cover takes payloads past 2 GB). For every pair it times do_encoding and
+ * do_decoding end to end, and each encode/decode stage on its own.
+ * One JSON object per line is printed on stdout:
+ *   op, stage, width, height, payload, bytes, seconds, mb_s, ns_per_byte,
+ *   peak_rss_kb, kernel
+ * bytes is the amount of image data the stage moved. The best of --repeat
+ * runs is reported. Stage chatter from the library goes to /dev/null.
+ *
+ * --serve N is the load generator of the --serve daemon: N client threads
+ * each send --requests (default 1000) encode and decode requests of a
+ * BENCH_SERVE_PAYLOAD byte payload in a BENCH_SERVE_DIM square cover,
+ * first as shared memory buffers (memfd), then as files. The server is
+ * the one on --socket, or one started in process with --threads workers.
+ * One JSON object per op and mode:
+ *   op, stage (serve_shm or serve_fd), width, height, payload, clients,
+ *   requests, seconds, requests_s, p50_us, p99_us, max_us, server_us
+ * the latencies are round trips seen by the clients, server_us is the
+ * mean time the workers spent on a request.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "encode.h"
+#include "decode.h"
+#include "lsb_kernels.h"
+#include "parallel_encode.h"
+#include "serve.h"
+#include "types.h"
+#include "common.h"
+
+/* Bytes written per generator block */
+#define BENCH_GEN_BLOCK (1024 * 1024)
+
+/* Cover width/height and payload bytes of the --serve requests */
+#define BENCH_SERVE_DIM 256
+#define BENCH_SERVE_PAYLOAD 1024
+
+/* Benchmark settings */
+typedef struct _BenchInfo
+{
+    int max_dim;      // largest cover width/height
+    int repeat;       // runs per measurement, best one is reported
+    char *dir;        // where covers and payloads are generated
+    int num_threads;  // passed to do_encoding/do_decoding
+    int use_mmap;     // passed to do_encoding/do_decoding
+    int lsb_bits;     // passed to do_encoding, decoding finds it
+    FILE *fptr_out;   // results stream (the real stdout)
+    int serve_clients;   // client threads of the --serve load, 0 for the sweep
+    long serve_requests; // encode and decode requests each client sends per mode
+    char *socket_path;   // server to load, NULL to start one in process
+} BenchInfo;
+
+/* One --serve client thread */
+typedef struct _BenchClient
+{
+    BenchInfo *benchInfo;
+    const char *cover;     // cover file
+    const char *secret;    // payload file
+    char stego[1024];      // stego file of the fd mode
+    char output[1024];     // output file of the fd mode
+    int use_shm;           // send memfd buffers instead of the files
+    double *latency;       // round trip of every request, encodes then decodes
+    double server_ns[2];   // summed server time of the encodes and the decodes
+    Status status;
+    pthread_t tid;
+} BenchClient;
+
+/* One measured row */
+typedef struct _BenchRow
+{
+    const char *op;
+    const char *stage;
+    int width;
+    int height;
+    long payload;
+    double seconds;
+    double bytes;
+} BenchRow;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/* xorshift64, fast enough to never be the bottleneck of the generator */
+static uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Write size random bytes to fptr */
+static Status write_random(FILE *fptr, uint64_t size, uint64_t seed)
+{
+    uint64_t *block = malloc(BENCH_GEN_BLOCK);
+    if (block == NULL)
+        return e_failure;
+
+    while (size > 0)
+    {
+        size_t n = (size < BENCH_GEN_BLOCK) ? size : BENCH_GEN_BLOCK;
+        for (size_t i = 0; i < BENCH_GEN_BLOCK / 8; i++)
+            block[i] = bench_rand(&seed);
+        if (fwrite(block, 1, n, fptr) != n)
+        {
+            free(block);
+            return e_failure;
+        }
+        size -= n;
+    }
+    free(block);
+    return e_success;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = v >> (8 * i);
+}
+
+/* Generate a width x height 24-bit bottom-up BMP with random pixels */
+static Status generate_bmp(const char *fname, int width, int height)
+{
+    uint64_t stride = ((uint64_t)width * 3 + 3) & ~3ull;
+    uint64_t pixels = stride * height;
+    unsigned char header[54] = {'B', 'M'};
+
+    put_le(header + 2, 54 + pixels, 4); // bfSize, wraps past 4 GB, readers go by the DIB header
+    put_le(header + 10, 54, 4);         // bfOffBits
+    put_le(header + 14, 40, 4);         // biSize
+    put_le(header + 18, width, 4);
+    put_le(header + 22, height, 4);
+    put_le(header + 26, 1, 2);  // biPlanes
+    put_le(header + 28, 24, 2); // biBitCount
+    put_le(header + 34, (pixels >> 32) ? 0 : pixels, 4); // biSizeImage, 0 is allowed for BI_RGB
+
+    FILE *fptr = fopen(fname, "wb");
+    if (fptr == NULL)
+        return e_failure;
+    Status ret = (fwrite(header, 1, 54, fptr) == 54) ? write_random(fptr, pixels, width * 31 + height) : e_failure;
+    if (fclose(fptr) != 0)
+        ret = e_failure;
+    return ret;
+}
+
+static Status generate_payload(const char *fname, long size)
+{
+    FILE *fptr = fopen(fname, "wb");
+    if (fptr == NULL)
+        return e_failure;
+    Status ret = write_random(fptr, size, size * 7 + 1);
+    if (fclose(fptr) != 0)
+        ret = e_failure;
+    return ret;
+}
+
+static void report(BenchInfo *benchInfo, const BenchRow *row)
+{
+    double mb_s = (row->seconds > 0) ? row->bytes / row->seconds / 1e6 : 0;
+    double ns_per_byte = (row->bytes > 0) ? row->seconds * 1e9 / row->bytes : 0;
+
+    fprintf(benchInfo->fptr_out,
+            "{\"op\":\"%s\",\"stage\":\"%s\",\"width\":%d,\"height\":%d,\"payload\":%ld,"
+            "\"bytes\":%.0f,\"seconds\":%.9f,\"mb_s\":%.3f,\"ns_per_byte\":%.3f,"
+            "\"peak_rss_kb\":%ld,\"kernel\":\"%s\"}\n",
+            row->op, row->stage, row->width, row->height, row->payload, row->bytes, row->seconds,
+            mb_s, ns_per_byte, peak_rss_kb(), lsb_kernel_name());
+    fflush(benchInfo->fptr_out);
+}
+
+/* Keep the best time seen for a stage */
+static void keep_best(BenchRow *rows, int *nrows, const char *op, const char *stage, double seconds, double bytes)
+{
+    for (int i = 0; i < *nrows; i++)
+    {
+        if (strcmp(rows[i].stage, stage) == 0 && strcmp(rows[i].op, op) == 0)
+        {
+            if (seconds < rows[i].seconds)
+                rows[i].seconds = seconds;
+            return;
+        }
+    }
+    rows[*nrows].op = op;
+    rows[*nrows].stage = stage;
+    rows[*nrows].seconds = seconds;
+    rows[*nrows].bytes = bytes;
+    (*nrows)++;
+}
+
+/* Time each encode stage on its own, in pipeline order */
+static Status bench_encode_stages(EncodeInfo *encInfo, BenchRow *rows, int *nrows)
+{
+    double t;
+    off_t pos;
+    Status ret = e_success;
+
+#define BENCH_STAGE(name, call)                                                   \
+    do                                                                            \
+    {                                                                             \
+        pos = ftello(encInfo->fptr_src_image);                                    \
+        t = now_sec();                                                            \
+        if (ret == e_success && (call) == e_failure)                              \
+            ret = e_failure;                                                      \
+        t = now_sec() - t;                                                        \
+        keep_best(rows, nrows, "encode", name, t, ftello(encInfo->fptr_src_image) - pos); \
+    } while (0)
+
+    t = now_sec();
+    if (open_files(encInfo) == e_failure)
+    {
+        close_files(encInfo);
+        return e_failure;
+    }
+    keep_best(rows, nrows, "encode", "open_files", now_sec() - t, 0);
+
+    BENCH_STAGE("check_capacity", check_capacity(encInfo));
+    rewind(encInfo->fptr_src_image);
+    BENCH_STAGE("copy_bmp_header", copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image,
+                                                       carrier_offset(&encInfo->layout, 0)));
+    BENCH_STAGE("encode_magic_string", encode_magic_string(MAGIC_STRING, encInfo));
+    BENCH_STAGE("encode_format_words", encode_format_words(encInfo));
+    BENCH_STAGE("encode_secret_file_extn_size", encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo));
+    BENCH_STAGE("encode_secret_file_extn", encode_secret_file_extn(encInfo->extn_secret_file, encInfo));
+    BENCH_STAGE("encode_secret_file_size", encode_secret_file_size(encInfo->size_secret_file, encInfo));
+    BENCH_STAGE("encode_secret_file_data", encode_secret_file_data(encInfo));
+    BENCH_STAGE("copy_remaining_img_data",
+                copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->io_block_size));
+#undef BENCH_STAGE
+
+    t = now_sec();
+    close_files(encInfo);
+    keep_best(rows, nrows, "encode", "close_files", now_sec() - t, 0);
+    return ret;
+}
+
+/* Time each decode stage on its own, in pipeline order */
+static Status bench_decode_stages(DecodeInfo *decInfo, BenchRow *rows, int *nrows)
+{
+    double t;
+    off_t pos;
+    off_t carried = 0; // bytes an earlier stage read for this one
+    Status ret = e_success;
+
+#define BENCH_STAGE(name, call)                                                   \
+    do                                                                            \
+    {                                                                             \
+        pos = ftello(decInfo->fptr_stego_image);                                  \
+        t = now_sec();                                                            \
+        if (ret == e_success && (call) == e_failure)                              \
+            ret = e_failure;                                                      \
+        t = now_sec() - t;                                                        \
+        keep_best(rows, nrows, "decode", name, t, ftello(decInfo->fptr_stego_image) - pos + carried); \
+        carried = 0;                                                              \
+    } while (0)
+
+    t = now_sec();
+    if (open_decode_files(decInfo) == e_failure)
+        return e_failure;
+    keep_best(rows, nrows, "decode", "open_decode_files", now_sec() - t, 0);
+
+    BENCH_STAGE("read_bmp_layout", read_bmp_layout(decInfo->fptr_stego_image, &decInfo->layout));
+    // The header is read past the first carrier, decode_header_fields seeks back the same way
+    if (fseeko(decInfo->fptr_stego_image, carrier_offset(&decInfo->layout, 0), SEEK_SET) != 0)
+        ret = e_failure;
+    BENCH_STAGE("decode_magic_string", decode_magic_string(MAGIC_STRING, decInfo));
+    // A version 1 image has no format words, the carriers read for them hold the
+    // extension size: count them for that stage, as the encoder does
+    pos = ftello(decInfo->fptr_stego_image);
+    t = now_sec();
+    if (ret == e_success && decode_format_words(decInfo) == e_failure)
+        ret = e_failure;
+    t = now_sec() - t;
+    if (ret == e_success && decInfo->format.version < 2)
+        carried = ftello(decInfo->fptr_stego_image) - pos;
+    keep_best(rows, nrows, "decode", "decode_format_words", t, ftello(decInfo->fptr_stego_image) - pos - carried);
+    BENCH_STAGE("decode_secret_file_extn_size", decode_secret_file_extn_size(decInfo));
+    BENCH_STAGE("decode_secret_file_extn", decode_secret_file_extn(decInfo));
+    BENCH_STAGE("decode_secret_file_size", decode_secret_file_size(decInfo));
+    BENCH_STAGE("decode_secret_file_data", decode_secret_file_data(decInfo));
+#undef BENCH_STAGE
+
+    t = now_sec();
+    close_decode_files(decInfo);
+    keep_best(rows, nrows, "decode", "close_decode_files", now_sec() - t, 0);
+    return ret;
+}
+
+/* Run every measurement for one cover/payload pair */
+static Status bench_pair(BenchInfo *benchInfo, char *cover, char *secret, int width, int height, long payload)
+{
+    char stego[1024], output[1024];
+    char *enc_argv[] = {"steg", "-e", cover, secret, stego, NULL};
+    char *dec_argv[] = {"steg", "-d", stego, output, NULL};
+    BenchRow rows[32];
+    int nrows = 0;
+    double image_bytes = 54.0 + (double)width * height * 3;
+
+    snprintf(stego, sizeof(stego), "%s/bench_stego.bmp", benchInfo->dir);
+    snprintf(output, sizeof(output), "%s/bench_decoded.txt", benchInfo->dir);
+
+    for (int r = 0; r < benchInfo->repeat; r++)
+    {
+        EncodeInfo encInfo = {0};
+        DecodeInfo decInfo = {0};
+        double t;
+
+        encInfo.use_mmap = benchInfo->use_mmap;
+        encInfo.num_threads = benchInfo->num_threads;
+        encInfo.format.lsb_bits = benchInfo->lsb_bits;
+        if (read_and_validate_encode_args(enc_argv, &encInfo) == e_failure)
+            return e_failure;
+        t = now_sec();
+        if (do_encoding(&encInfo) == e_failure)
+            return e_failure;
+        keep_best(rows, &nrows, "encode", "do_encoding", now_sec() - t, image_bytes);
+
+        decInfo.use_mmap = benchInfo->use_mmap;
+        decInfo.num_threads = benchInfo->num_threads;
+        decInfo.payload_length = -1;
+        if (read_and_validate_decode_args(dec_argv, &decInfo) == e_failure)
+            return e_failure;
+        t = now_sec();
+        if (do_decoding(&decInfo) == e_failure)
+            return e_failure;
+        keep_best(rows, &nrows, "decode", "do_decoding", now_sec() - t, payload * 8.0 / benchInfo->lsb_bits);
+
+        memset(&encInfo, 0, sizeof(encInfo));
+        encInfo.format.lsb_bits = benchInfo->lsb_bits;
+        if (read_and_validate_encode_args(enc_argv, &encInfo) == e_failure ||
+            bench_encode_stages(&encInfo, rows, &nrows) == e_failure)
+            return e_failure;
+
+        memset(&decInfo, 0, sizeof(decInfo));
+        decInfo.payload_length = -1;
+        if (read_and_validate_decode_args(dec_argv, &decInfo) == e_failure ||
+            bench_decode_stages(&decInfo, rows, &nrows) == e_failure)
+            return e_failure;
+    }
+
+    for (int i = 0; i < nrows; i++)
+    {
+        rows[i].width = width;
+        rows[i].height = height;
+        rows[i].payload = payload;
+        report(benchInfo, &rows[i]);
+    }
+    remove(stego);
+    remove(output);
+    return e_success;
+}
+
+/* Sweep cover sizes and payload sizes */
+static Status run_bench(BenchInfo *benchInfo)
+{
+    static const int dims[] = {64, 256, 1024, 4096, 16384, 40000};
+    static const double fractions[] = {0.01, 0.1, 0.5, 0.95};
+    char cover[1024], secret[1024];
+
+    snprintf(cover, sizeof(cover), "%s/bench_cover.bmp", benchInfo->dir);
+    snprintf(secret, sizeof(secret), "%s/bench_secret.txt", benchInfo->dir);
+
+    for (int d = 0; d < sizeof(dims) / sizeof(dims[0]) && dims[d] <= benchInfo->max_dim; d++)
+    {
+        int dim = dims[d];
+        if (generate_bmp(cover, dim, dim) == e_failure)
+        {
+            fprintf(stderr, "ERROR: Unable to generate %s\n", cover);
+            return e_failure;
+        }
+
+        // Everything but the header fields (64 bit size field, format words) is payload room
+        StegFormat format;
+        select_format(&format, benchInfo->lsb_bits, FORMAT_FLAG_SIZE64);
+        long overhead = header_carriers_for(&format, strlen(".txt"));
+        long capacity = ((long)dim * dim * 3 - overhead) * benchInfo->lsb_bits / 8;
+        long payloads[1 + sizeof(fractions) / sizeof(fractions[0])] = {16};
+        for (int f = 0; f < sizeof(fractions) / sizeof(fractions[0]); f++)
+            payloads[f + 1] = capacity * fractions[f];
+
+        for (int p = 0; p < sizeof(payloads) / sizeof(payloads[0]); p++)
+        {
+            if (payloads[p] < 1 || payloads[p] > capacity || (p > 0 && payloads[p] <= payloads[p - 1]))
+                continue;
+            if (generate_payload(secret, payloads[p]) == e_failure ||
+                bench_pair(benchInfo, cover, secret, dim, dim, payloads[p]) == e_failure)
+            {
+                fprintf(stderr, "ERROR: Benchmark failed for %dx%d, %ld byte payload\n", dim, dim, payloads[p]);
+                return e_failure;
+            }
+        }
+    }
+    remove(cover);
+    remove(secret);
+    return e_success;
+}
+
+/* memfd holding len bytes of fname, or an empty one of len bytes with no fname,
+ * sealed at that size as the server requires */
+static int bench_memfd(const char *name, const char *fname, size_t len)
+{
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+    int ok = (ftruncate(fd, len) == 0);
+    if (ok && fname != NULL)
+    {
+        FILE *fptr = fopen(fname, "rb");
+        char *data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ok = (fptr != NULL && data != MAP_FAILED && fread(data, 1, len, fptr) == len);
+        if (fptr != NULL)
+            fclose(fptr);
+        if (data != MAP_FAILED)
+            munmap(data, len);
+    }
+    if (!ok || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Client thread: encode/decode request pairs, each round trip timed */
+static void *bench_client(void *arg)
+{
+    BenchClient *client = arg;
+    long requests = client->benchInfo->serve_requests;
+    size_t cover_len = 54 + (size_t)BENCH_SERVE_DIM * BENCH_SERVE_DIM * 3;
+    int cover, secret, stego, output;
+    ServeRequest request = {0};
+    ServeReply reply;
+
+    client->status = e_failure;
+    if (client->use_shm)
+    {
+        cover = bench_memfd("cover", client->cover, cover_len);
+        secret = bench_memfd("secret", client->secret, BENCH_SERVE_PAYLOAD);
+        stego = bench_memfd("stego", NULL, cover_len);
+        output = bench_memfd("output", NULL, BENCH_SERVE_PAYLOAD);
+        request.flags = SERVE_FLAG_SHM;
+    }
+    else
+    {
+        cover = open(client->cover, O_RDONLY | O_CLOEXEC);
+        secret = open(client->secret, O_RDONLY | O_CLOEXEC);
+        stego = open(client->stego, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        output = open(client->output, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    int sock = serve_connect(client->benchInfo->socket_path);
+
+    request.magic = SERVE_MAGIC;
+    strcpy(request.extn, ".txt");
+    long r;
+    for (r = 0; cover >= 0 && secret >= 0 && stego >= 0 && output >= 0 && sock >= 0 && r < requests; r++)
+    {
+        // The files are read and written from their offsets, start them over
+        if (!client->use_shm && (lseek(secret, 0, SEEK_SET) != 0 || ftruncate(output, 0) != 0 ||
+                                 lseek(output, 0, SEEK_SET) != 0))
+            break;
+
+        int enc_fds[] = {cover, secret, stego};
+        request.op = SERVE_OP_ENCODE;
+        request.id = 2 * r;
+        double t = now_sec();
+        if (serve_call(sock, &request, enc_fds, 3, &reply) == e_failure || reply.status != e_success)
+            break;
+        client->latency[r] = now_sec() - t;
+        client->server_ns[0] += reply.run_ns;
+
+        int dec_fds[] = {stego, output};
+        request.op = SERVE_OP_DECODE;
+        request.id = 2 * r + 1;
+        t = now_sec();
+        if (serve_call(sock, &request, dec_fds, 2, &reply) == e_failure || reply.status != e_success ||
+            reply.size != BENCH_SERVE_PAYLOAD)
+            break;
+        client->latency[requests + r] = now_sec() - t;
+        client->server_ns[1] += reply.run_ns;
+    }
+    if (r == requests)
+        client->status = e_success;
+
+    int fds[] = {cover, secret, stego, output, sock};
+    for (int i = 0; i < 5; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Run the clients of one mode and report the encode and decode latencies */
+static Status bench_serve_mode(BenchInfo *benchInfo, const char *cover, const char *secret, int use_shm)
+{
+    int nclients = benchInfo->serve_clients;
+    long requests = benchInfo->serve_requests;
+    BenchClient *clients = calloc(nclients, sizeof(BenchClient));
+    double *latency = malloc(sizeof(double) * 2 * requests * nclients);
+    double *sorted = malloc(sizeof(double) * requests * nclients);
+    Status ret = (clients != NULL && latency != NULL && sorted != NULL) ? e_success : e_failure;
+
+    double start = now_sec();
+    for (int c = 0; ret == e_success && c < nclients; c++)
+    {
+        BenchClient *client = &clients[c];
+        client->benchInfo = benchInfo;
+        client->cover = cover;
+        client->secret = secret;
+        client->use_shm = use_shm;
+        client->latency = latency + 2 * requests * c;
+        snprintf(client->stego, sizeof(client->stego), "%s/bench_serve_stego%d.bmp", benchInfo->dir, c);
+        snprintf(client->output, sizeof(client->output), "%s/bench_serve_out%d.txt", benchInfo->dir, c);
+        if (pthread_create(&client->tid, NULL, bench_client, client) != 0)
+        {
+            // Join the ones started, then report the failure
+            nclients = c;
+            ret = e_failure;
+        }
+    }
+    for (int c = 0; clients != NULL && c < nclients; c++)
+    {
+        pthread_join(clients[c].tid, NULL);
+        if (clients[c].status == e_failure)
+            ret = e_failure;
+    }
+    double seconds = now_sec() - start;
+
+    double server_ns[2] = {0, 0};
+    for (int c = 0; c < nclients; c++)
+    {
+        server_ns[0] += clients[c].server_ns[0];
+        server_ns[1] += clients[c].server_ns[1];
+        if (!use_shm)
+        {
+            remove(clients[c].stego);
+            remove(clients[c].output);
+        }
+    }
+    for (int op = 0; ret == e_success && op < 2; op++)
+    {
+        long n = 0;
+        for (int c = 0; c < nclients; c++)
+            for (long r = 0; r < requests; r++)
+                sorted[n++] = latency[2 * requests * c + op * requests + r];
+        qsort(sorted, n, sizeof(double), compare_double);
+        fprintf(benchInfo->fptr_out,
+                "{\"op\":\"%s\",\"stage\":\"%s\",\"width\":%d,\"height\":%d,\"payload\":%d,"
+                "\"clients\":%d,\"requests\":%ld,\"seconds\":%.6f,\"requests_s\":%.1f,\"p50_us\":%.1f,"
+                "\"p99_us\":%.1f,\"max_us\":%.1f,\"server_us\":%.1f}\n",
+                op ? "decode" : "encode", use_shm ? "serve_shm" : "serve_fd", BENCH_SERVE_DIM, BENCH_SERVE_DIM,
+                BENCH_SERVE_PAYLOAD, nclients, n, seconds, 2 * n / seconds, sorted[n / 2] * 1e6,
+                sorted[n * 99 / 100] * 1e6, sorted[n - 1] * 1e6, server_ns[op] / 1e3 / n);
+        fflush(benchInfo->fptr_out);
+    }
+    free(clients);
+    free(latency);
+    free(sorted);
+    return ret;
+}
+
+static void *bench_server(void *arg)
+{
+    serve_run(arg);
+    return NULL;
+}
+
+/* Load the server with request pairs, shared memory first, then files */
+static Status run_serve_bench(BenchInfo *benchInfo)
+{
+    static ServeInfo serveInfo;
+    char cover[1024], secret[1024], socket_path[1024];
+    pthread_t server;
+    int own_server = (benchInfo->socket_path == NULL);
+
+    snprintf(cover, sizeof(cover), "%s/bench_serve_cover.bmp", benchInfo->dir);
+    snprintf(secret, sizeof(secret), "%s/bench_serve_secret.txt", benchInfo->dir);
+    if (generate_bmp(cover, BENCH_SERVE_DIM, BENCH_SERVE_DIM) == e_failure ||
+        generate_payload(secret, BENCH_SERVE_PAYLOAD) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to generate %s\n", cover);
+        return e_failure;
+    }
+
+    if (own_server)
+    {
+        snprintf(socket_path, sizeof(socket_path), "%s/bench_serve.sock", benchInfo->dir);
+        benchInfo->socket_path = socket_path;
+        serveInfo.socket_path = socket_path;
+        serveInfo.num_threads = benchInfo->num_threads;
+        if (serve_open(&serveInfo) == e_failure || pthread_create(&server, NULL, bench_server, &serveInfo) != 0)
+        {
+            fprintf(stderr, "ERROR: Unable to start a server on %s\n", socket_path);
+            return e_failure;
+        }
+    }
+
+    Status ret = bench_serve_mode(benchInfo, cover, secret, 1);
+    if (ret == e_success)
+        ret = bench_serve_mode(benchInfo, cover, secret, 0);
+    if (ret == e_failure)
+        fprintf(stderr, "ERROR: Serve benchmark failed on %s\n", benchInfo->socket_path);
+
+    if (own_server)
+    {
+        serve_stop(&serveInfo);
+        pthread_join(server, NULL);
+    }
+    remove(cover);
+    remove(secret);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchInfo benchInfo = {4096, 3, "/tmp", 0, 0, 1, NULL, 0, 1000, NULL};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--max-dim") == 0 && i + 1 < argc)
+            benchInfo.max_dim = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            benchInfo.repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            benchInfo.dir = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            benchInfo.num_threads = atoi(argv[++i]);
+            if (benchInfo.num_threads <= 0)
+                benchInfo.num_threads = default_thread_count();
+        }
+        else if (strcmp(argv[i], "--mmap") == 0)
+            benchInfo.use_mmap = 1;
+        else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc && validate_lsb_bits(atoi(argv[i + 1])) == e_success)
+            benchInfo.lsb_bits = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            benchInfo.serve_clients = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0)
+            benchInfo.serve_requests = atol(argv[++i]);
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            benchInfo.socket_path = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--max-dim N] [--repeat N] [--dir DIR] [--threads N] [--mmap] [--bits N]\n",
+                    argv[0]);
+            fprintf(stderr, "       %s --serve N [--requests N] [--socket PATH] [--dir DIR] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (benchInfo.repeat < 1)
+        benchInfo.repeat = 1;
+
+    // Results keep the real stdout, the INFO/width lines of the stages do not
+    benchInfo.fptr_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (benchInfo.fptr_out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("stdout");
+        return 1;
+    }
+
+    Status ret = (benchInfo.serve_clients > 0) ? run_serve_bench(&benchInfo) : run_bench(&benchInfo);
+    fclose(benchInfo.fptr_out);
+    return (ret == e_success) ? 0 : 1;
+}
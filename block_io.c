@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#endif
+#include "block_io.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Set up block buffering
+ * Input: stream, place to return the buffer, block size
+ * Description: stdio is switched to full buffering with a block of
+ * block_size bytes, so the small 8 and 32 byte reads and writes of
+ * the encode stages become memcpy's and the kernel sees whole blocks.
+ * A buffer already in *io_buffer (of block_size bytes) is reused
+ */
+Status setup_block_io(FILE *fptr, char **io_buffer, size_t block_size)
+{
+    if (block_size == 0)
+        block_size = DEFAULT_IO_BLOCK_SIZE;
+
+    int allocated = 0;
+    if (*io_buffer == NULL)
+    {
+        *io_buffer = malloc(block_size);
+        if (*io_buffer == NULL)
+        {
+            perror("malloc");
+            return e_failure;
+        }
+        allocated = 1;
+    }
+
+    if (setvbuf(fptr, *io_buffer, _IOFBF, block_size) != 0)
+    {
+        if (allocated)
+        {
+            free(*io_buffer);
+            *io_buffer = NULL;
+        }
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Read a block of image bytes, short reads are failures */
+Status read_image_block(FILE *fptr, void *buffer, size_t size)
+{
+    if (fread(buffer, 1, size, fptr) != size)
+        return e_failure;
+    return e_success;
+}
+
+/* Write a block of image bytes, short writes are failures */
+Status write_image_block(FILE *fptr, const void *buffer, size_t size)
+{
+    if (fwrite(buffer, 1, size, fptr) != size)
+        return e_failure;
+    return e_success;
+}
+
+/* Positional read, loops over short reads so threads can share one fd */
+Status read_block_at(int fd, void *buffer, size_t size, off_t offset)
+{
+    char *pos = buffer;
+    while (size > 0)
+    {
+        ssize_t ret = pread(fd, pos, size, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return e_failure;
+        pos += ret;
+        offset += ret;
+        size -= ret;
+    }
+    return e_success;
+}
+
+/* Positional write, loops over short writes */
+Status write_block_at(int fd, const void *buffer, size_t size, off_t offset)
+{
+    const char *pos = buffer;
+    while (size > 0)
+    {
+        ssize_t ret = pwrite(fd, pos, size, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return e_failure;
+        pos += ret;
+        offset += ret;
+        size -= ret;
+    }
+    return e_success;
+}
+
+/* Skip forward in a read stream
+ * Description: seekable files just seek, pipes and sockets cannot so
+ * the bytes are read and dropped, keeping decode a forward pass
+ */
+Status skip_image_bytes(FILE *fptr, off_t size)
+{
+    if (size <= 0)
+        return e_success;
+    if (lseek(fileno(fptr), 0, SEEK_CUR) >= 0)
+        return (fseeko(fptr, size, SEEK_CUR) == 0) ? e_success : e_failure;
+
+    char buffer[4096];
+    while (size > 0)
+    {
+        size_t n = (size < sizeof(buffer)) ? size : sizeof(buffer);
+        if (read_image_block(fptr, buffer, n) == e_failure)
+            return e_failure;
+        size -= n;
+    }
+    return e_success;
+}
+
+#ifdef __linux__
+/* Move the bytes through a pipe with splice, for when one side cannot seek
+ * Input: offsets of the seekable sides, -1 for pipes and sockets
+ * Returns 1 when everything was copied, 0 if splice cannot be used for
+ * this pair (nothing copied) and -1 on failure. A pipe source must be
+ * unbuffered, bytes stdio already read ahead would be skipped
+ */
+static int splice_copy(int fd_src, off_t *in_off, int fd_dest, off_t *out_off)
+{
+    off_t total = 0;
+    ssize_t ret;
+
+    while ((ret = splice(fd_src, (*in_off >= 0) ? in_off : NULL, fd_dest, (*out_off >= 0) ? out_off : NULL,
+                         1 << 30, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+        total += ret;
+    if (ret == 0)
+        return 1;
+    if (total == 0 && errno == EINVAL)
+        return 0;
+    return -1;
+}
+
+/* Let the kernel move the bytes: copy_file_range first, sendfile after
+ * Returns number of bytes copied, or -1 if neither call is usable
+ * for this pair of files (nothing has been copied in that case)
+ */
+static off_t kernel_copy(int fd_src, off_t *in_off, int fd_dest, off_t *out_off)
+{
+    off_t total = 0;
+    ssize_t ret;
+
+    while ((ret = copy_file_range(fd_src, in_off, fd_dest, out_off, 1 << 30, 0)) > 0)
+        total += ret;
+    if (ret == 0)
+        return total;
+    if (total > 0 || (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+                      errno != EOPNOTSUPP && errno != EBADF))
+        return -1;
+
+    // sendfile writes at the current offset of fd_dest
+    if (lseek(fd_dest, *out_off, SEEK_SET) < 0)
+        return -1;
+    while ((ret = sendfile(fd_dest, fd_src, in_off, 1 << 30)) > 0)
+    {
+        total += ret;
+        *out_off += ret;
+    }
+    if (ret < 0)
+        return -1;
+    return total;
+}
+#endif
+
+/* Copy the remaining bytes of src into dest
+ * Input: src and dest streams, block size
+ * Description: on Linux the copy is done in kernel with copy_file_range
+ * (or sendfile) from the current stream offsets, so the tail of the
+ * image never passes through user space. When either side is a pipe
+ * splice does the same job. Anywhere else, or when the kernel refuses
+ * (sockets on both sides, old kernels), fall back to block sized
+ * fread/fwrite through one buffer
+ */
+Status copy_file_blocks(FILE *fptr_src, FILE *fptr_dest, size_t block_size)
+{
+#ifdef __linux__
+    if (fflush(fptr_dest) == 0)
+    {
+        off_t in_off = ftello(fptr_src);
+        off_t out_off = ftello(fptr_dest);
+
+        if (in_off >= 0 && out_off >= 0)
+        {
+            off_t start = in_off;
+            if (kernel_copy(fileno(fptr_src), &in_off, fileno(fptr_dest), &out_off) >= 0)
+            {
+                // Resync both streams with where the kernel left the files
+                if (fseeko(fptr_src, in_off, SEEK_SET) != 0 ||
+                    fseeko(fptr_dest, out_off, SEEK_SET) != 0)
+                    return e_failure;
+                return e_success;
+            }
+            if (in_off != start)
+                return e_failure;
+        }
+        else
+        {
+            // A seekable side is passed by offset, so stdio read-ahead does not matter there
+            int ret = splice_copy(fileno(fptr_src), &in_off, fileno(fptr_dest), &out_off);
+            if (ret < 0)
+                return e_failure;
+            if (ret > 0)
+            {
+                if ((in_off >= 0 && fseeko(fptr_src, in_off, SEEK_SET) != 0) ||
+                    (out_off >= 0 && fseeko(fptr_dest, out_off, SEEK_SET) != 0))
+                    return e_failure;
+                return e_success;
+            }
+        }
+    }
+#endif
+
+    if (block_size == 0)
+        block_size = DEFAULT_IO_BLOCK_SIZE;
+
+    char *buffer = malloc(block_size);
+    if (buffer == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+
+    size_t n;
+    Status ret = e_success;
+    while ((n = fread(buffer, 1, block_size, fptr_src)) > 0)
+    {
+        if (fwrite(buffer, 1, n, fptr_dest) != n)
+        {
+            ret = e_failure;
+            break;
+        }
+    }
+    if (ferror(fptr_src))
+        ret = e_failure;
+
+    free(buffer);
+    return ret;
+}
@@ -0,0 +1,35 @@
+#ifndef BLOCK_IO_H
+#define BLOCK_IO_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* Default block size used for buffered image I/O (1 MB) */
+#define DEFAULT_IO_BLOCK_SIZE (1024 * 1024)
+
+/* Block I/O function prototypes */
+
+/* Give a stream a fully buffered block of block_size bytes, the block
+ * (reused if io_buffer already holds one) must be freed after fclose */
+Status setup_block_io(FILE *fptr, char **io_buffer, size_t block_size);
+
+/* Read exactly size bytes from the image stream */
+Status read_image_block(FILE *fptr, void *buffer, size_t size);
+
+/* Write exactly size bytes to the image stream */
+Status write_image_block(FILE *fptr, const void *buffer, size_t size);
+
+/* Read exactly size bytes at offset, without moving the file offset */
+Status read_block_at(int fd, void *buffer, size_t size, off_t offset);
+
+/* Write exactly size bytes at offset, without moving the file offset */
+Status write_block_at(int fd, const void *buffer, size_t size, off_t offset);
+
+/* Move a read stream size bytes forward, reading through them if it cannot seek */
+Status skip_image_bytes(FILE *fptr, off_t size);
+
+/* Copy everything left in src to dest, block_size bytes at a time */
+Status copy_file_blocks(FILE *fptr_src, FILE *fptr_dest, size_t block_size);
+
+#endif
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include "bmp_layout.h"
+#include "block_io.h"
+#include "types.h"
+
+/* DIB compression values that keep the pixels uncompressed */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+#define BI_ALPHABITFIELDS 6
+
+/* Function Definitions */
+
+/*BMP layout steps
+1.check the file header
+  "BM" signature, bfOffBits past both headers
+2.read the DIB header
+  BITMAPCOREHEADER (12 bytes, 16 bit sizes) or
+  BITMAPINFOHEADER and its V2..V5 extensions (32 bit sizes)
+  negative height means rows are stored top-down
+3.work out the pixel format
+  24 bit BGR, or 32 bit BGRX/BGRA
+  BI_BITFIELDS masks must each select one whole byte, they give
+  the channel order and the alpha byte that is skipped
+4.work out the rows
+  stride rounds each row up to 4 bytes, the rest is padding
+5.capacity is 3 carriers per pixel*/
+
+static uint32_t get_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Byte of the pixel a BI_BITFIELDS mask selects, -1 unless it is one whole byte */
+static int mask_byte(uint32_t mask, int bytes_per_pixel)
+{
+    for (int i = 0; i < bytes_per_pixel; i++)
+    {
+        if (mask == (uint32_t)0xFF << (8 * i))
+            return i;
+    }
+    return -1;
+}
+
+/* Fill channel_offset and channel_order from the R, G, B masks */
+static Status set_channels(BmpLayout *layout, const uint32_t masks[3])
+{
+    const char names[3] = {'R', 'G', 'B'};
+    int used[4] = {0};
+    int n = 0;
+
+    for (int c = 0; c < 3; c++)
+    {
+        int byte = mask_byte(masks[c], layout->bytes_per_pixel);
+        if (byte < 0 || used[byte])
+            return e_failure;
+        used[byte] = c + 1;
+    }
+    // Carriers follow file order, so list the colour bytes ascending
+    for (int byte = 0; byte < layout->bytes_per_pixel; byte++)
+    {
+        if (used[byte])
+        {
+            layout->channel_offset[n] = byte;
+            layout->channel_order[n] = names[used[byte] - 1];
+            n++;
+        }
+    }
+    layout->channel_order[3] = '\0';
+    return e_success;
+}
+
+Status parse_bmp_layout(const unsigned char *header, size_t len, BmpLayout *layout)
+{
+    int32_t width, height;
+    uint32_t compression = BI_RGB;
+
+    memset(layout, 0, sizeof(BmpLayout));
+    if (len < BMP_FILE_HEADER_SIZE + 12 || header[0] != 'B' || header[1] != 'M')
+        return e_failure;
+
+    layout->data_offset = get_le32(header + 10);
+    layout->dib_size = get_le32(header + 14);
+    if (layout->dib_size != 12 && (layout->dib_size < 40 || layout->dib_size > BMP_MAX_DIB_SIZE))
+        return e_failure;
+    if (len < BMP_FILE_HEADER_SIZE + layout->dib_size)
+        return e_failure;
+
+    const unsigned char *dib = header + BMP_FILE_HEADER_SIZE;
+    if (layout->dib_size == 12)
+    {
+        width = get_le16(dib + 4);
+        height = get_le16(dib + 6);
+        if (get_le16(dib + 8) != 1)
+            return e_failure;
+        layout->bits_per_pixel = get_le16(dib + 10);
+    }
+    else
+    {
+        width = (int32_t)get_le32(dib + 4);
+        height = (int32_t)get_le32(dib + 8);
+        if (get_le16(dib + 12) != 1)
+            return e_failure;
+        layout->bits_per_pixel = get_le16(dib + 14);
+        compression = get_le32(dib + 16);
+    }
+
+    if (width <= 0 || height == 0 || height == INT32_MIN)
+        return e_failure;
+    layout->width = width;
+    layout->top_down = (height < 0);
+    layout->height = layout->top_down ? -height : height;
+
+    // Masks follow a 40 byte header, and are part of the bigger ones
+    size_t mask_end = BMP_FILE_HEADER_SIZE + 40 + 12;
+    if (compression == BI_ALPHABITFIELDS)
+        mask_end += 4;
+
+    if (layout->bits_per_pixel == 24 && compression == BI_RGB)
+    {
+        layout->bytes_per_pixel = 3;
+    }
+    else if (layout->bits_per_pixel == 32 && compression == BI_RGB)
+    {
+        layout->bytes_per_pixel = 4;
+    }
+    else if (layout->bits_per_pixel == 32 && (compression == BI_BITFIELDS || compression == BI_ALPHABITFIELDS) &&
+             len >= mask_end)
+    {
+        layout->bytes_per_pixel = 4;
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    if (compression == BI_RGB)
+    {
+        // Blue, green, red, then the unused byte of 32 bit pixels
+        const uint32_t masks[3] = {0xFF0000, 0xFF00, 0xFF};
+        set_channels(layout, masks);
+    }
+    else
+    {
+        const uint32_t masks[3] = {get_le32(header + 54), get_le32(header + 58), get_le32(header + 62)};
+        if (set_channels(layout, masks) == e_failure)
+            return e_failure;
+    }
+
+    if (layout->data_offset < BMP_FILE_HEADER_SIZE + layout->dib_size ||
+        (compression != BI_RGB && layout->data_offset < mask_end))
+        return e_failure;
+
+    layout->stride = ((size_t)width * layout->bits_per_pixel + 31) / 32 * 4;
+    layout->padding = layout->stride - (size_t)width * layout->bytes_per_pixel;
+    layout->row_carriers = (size_t)width * 3;
+    layout->contiguous = (layout->bytes_per_pixel == 3 && layout->padding == 0);
+    layout->capacity = (long)layout->row_carriers * layout->height;
+    return e_success;
+}
+
+Status read_bmp_layout(FILE *fptr, BmpLayout *layout)
+{
+    unsigned char header[BMP_FILE_HEADER_SIZE + BMP_MAX_DIB_SIZE];
+
+    if (fseeko(fptr, 0, SEEK_SET) != 0)
+        return e_failure;
+    size_t len = fread(header, 1, sizeof(header), fptr);
+    return parse_bmp_layout(header, len, layout);
+}
+
+/* Offset of a carrier's window inside its row, a window starts at the
+ * pixel for the first colour byte so leading alpha bytes are covered */
+static size_t window_column_offset(const BmpLayout *layout, size_t col)
+{
+    size_t ch = col % 3;
+    return (col / 3) * layout->bytes_per_pixel + (ch ? layout->channel_offset[ch] : 0);
+}
+
+off_t carrier_offset(const BmpLayout *layout, long k)
+{
+    // Scattered carriers are placed one at a time, skip the divisions when possible
+    if (layout->contiguous)
+        return layout->data_offset + k;
+    return layout->data_offset + (off_t)(k / layout->row_carriers) * layout->stride +
+           window_column_offset(layout, k % layout->row_carriers);
+}
+
+size_t carrier_span(const BmpLayout *layout, long k, size_t n)
+{
+    return carrier_offset(layout, k + n) - carrier_offset(layout, k);
+}
+
+/* Walk carriers k .. k + n - 1 row by row, copying them between window and carriers */
+static void move_carriers(const BmpLayout *layout, long k, size_t n, unsigned char *window,
+                          unsigned char *carriers, int to_window)
+{
+    size_t col = k % layout->row_carriers;
+    size_t start = window_column_offset(layout, col);
+    size_t row = 0; // start of the current row, counted from the first row of the window
+
+    while (n > 0)
+    {
+        size_t run = layout->row_carriers - col;
+        if (run > n)
+            run = n;
+
+        if (layout->bytes_per_pixel == 3)
+        {
+            // Colour bytes of a row are back to back, one bulk copy per row
+            unsigned char *pos = window + row + col - start;
+            if (to_window)
+                memcpy(pos, carriers, run);
+            else
+                memcpy(carriers, pos, run);
+        }
+        else
+        {
+            ptrdiff_t pixel = (ptrdiff_t)(row + (col / 3) * 4) - (ptrdiff_t)start;
+            int ch = col % 3;
+            for (size_t i = 0; i < run; i++)
+            {
+                unsigned char *pos = window + pixel + layout->channel_offset[ch];
+                if (to_window)
+                    *pos = carriers[i];
+                else
+                    carriers[i] = *pos;
+                if (++ch == 3)
+                {
+                    ch = 0;
+                    pixel += 4;
+                }
+            }
+        }
+
+        carriers += run;
+        n -= run;
+        row += layout->stride;
+        col = 0;
+    }
+}
+
+void gather_carriers(const BmpLayout *layout, long k, size_t n, const void *window, void *carriers)
+{
+    if (carriers != window)
+        move_carriers(layout, k, n, (unsigned char *)window, carriers, 0);
+}
+
+void scatter_carriers(const BmpLayout *layout, long k, size_t n, const void *carriers, void *window)
+{
+    if (carriers != window)
+        move_carriers(layout, k, n, window, (unsigned char *)carriers, 1);
+}
+
+Status read_carriers(FILE *fptr, const BmpLayout *layout, long k, size_t n, void *window, void *carriers)
+{
+    // Contiguous pixels need no window, the carriers are the bytes themselves
+    if (layout->contiguous)
+        return read_image_block(fptr, carriers, n);
+
+    if (read_image_block(fptr, window, carrier_span(layout, k, n)) == e_failure)
+        return e_failure;
+    gather_carriers(layout, k, n, window, carriers);
+    return e_success;
+}
+
+Status write_carriers(FILE *fptr, const BmpLayout *layout, long k, size_t n, void *window, const void *carriers)
+{
+    if (layout->contiguous)
+        return write_image_block(fptr, carriers, n);
+
+    scatter_carriers(layout, k, n, carriers, window);
+    return write_image_block(fptr, window, carrier_span(layout, k, n));
+}
+
+Status read_carriers_at(int fd, const BmpLayout *layout, long k, size_t n, void *window, void *carriers)
+{
+    if (layout->contiguous)
+        return read_block_at(fd, carriers, n, carrier_offset(layout, k));
+
+    if (read_block_at(fd, window, carrier_span(layout, k, n), carrier_offset(layout, k)) == e_failure)
+        return e_failure;
+    gather_carriers(layout, k, n, window, carriers);
+    return e_success;
+}
+
+Status write_carriers_at(int fd, const BmpLayout *layout, long k, size_t n, void *window, const void *carriers)
+{
+    if (layout->contiguous)
+        return write_block_at(fd, carriers, n, carrier_offset(layout, k));
+
+    scatter_carriers(layout, k, n, carriers, window);
+    return write_block_at(fd, window, carrier_span(layout, k, n), carrier_offset(layout, k));
+}
@@ -0,0 +1,76 @@
+#ifndef BMP_LAYOUT_H
+#define BMP_LAYOUT_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* BITMAPFILEHEADER size, the DIB header follows it */
+#define BMP_FILE_HEADER_SIZE 14
+
+/* Largest DIB header handled (BITMAPV5HEADER) */
+#define BMP_MAX_DIB_SIZE 124
+
+/* Most image bytes spanned by n carriers: row padding and alpha bytes
+ * add at most one byte per three carriers, plus one partial gap */
+#define CARRIER_SPAN_MAX(n) ((n) + (n) / 3 + 4)
+
+/*
+ * Pixel layout of a BMP image
+ * Payload bits are hidden in carriers: the colour channel bytes of the
+ * pixel array taken in file order, row by row. Row padding and the
+ * alpha (or unused) byte of 32 bit pixels are never carriers, so they
+ * pass through encoding untouched
+ */
+typedef struct _BmpLayout
+{
+    off_t data_offset;     // To store bfOffBits, where the pixel array starts
+    int dib_size;          // To store the DIB header size (12, 40, 52, 56, 108 or 124)
+    int width;             // To store the width in pixels
+    int height;            // To store the number of rows (always positive)
+    int top_down;          // To store 1 when the first row is the top one
+    int bits_per_pixel;    // To store 24 or 32
+    int bytes_per_pixel;   // To store 3 or 4
+    int channel_offset[3]; // To store where the colour bytes sit in a pixel, ascending
+    char channel_order[4]; // To store the colour byte letters in file order, e.g. "BGR"
+    size_t row_carriers;   // To store carriers per row (width * 3)
+    size_t stride;         // To store bytes per row, padding included
+    size_t padding;        // To store padding bytes at the end of each row
+    int contiguous;        // To store 1 when every pixel array byte is a carrier
+    long capacity;         // To store the number of carriers in the image
+} BmpLayout;
+
+/* BMP layout function prototypes */
+
+/* Parse a BMP file header and DIB header already in memory */
+Status parse_bmp_layout(const unsigned char *header, size_t len, BmpLayout *layout);
+
+/* Read and parse the headers at the start of a BMP stream */
+Status read_bmp_layout(FILE *fptr, BmpLayout *layout);
+
+/* Image offset where the window of carrier k starts */
+off_t carrier_offset(const BmpLayout *layout, long k);
+
+/* Image bytes from the window of carrier k up to the window of carrier k + n */
+size_t carrier_span(const BmpLayout *layout, long k, size_t n);
+
+/* Copy carriers k .. k + n - 1 out of their window (no-op if carriers == window) */
+void gather_carriers(const BmpLayout *layout, long k, size_t n, const void *window, void *carriers);
+
+/* Copy carriers k .. k + n - 1 back into their window (no-op if carriers == window) */
+void scatter_carriers(const BmpLayout *layout, long k, size_t n, const void *carriers, void *window);
+
+/* Read the window of n carriers from the stream (at carrier_offset(k)) into carriers,
+ * window must hold CARRIER_SPAN_MAX(n) bytes and is kept for write_carriers */
+Status read_carriers(FILE *fptr, const BmpLayout *layout, long k, size_t n, void *window, void *carriers);
+
+/* Put carriers back into the window filled by read_carriers and write it out */
+Status write_carriers(FILE *fptr, const BmpLayout *layout, long k, size_t n, void *window, const void *carriers);
+
+/* Positional read_carriers, for threads sharing one fd */
+Status read_carriers_at(int fd, const BmpLayout *layout, long k, size_t n, void *window, void *carriers);
+
+/* Positional write_carriers */
+Status write_carriers_at(int fd, const BmpLayout *layout, long k, size_t n, void *window, const void *carriers);
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "compress.h"
+#include "types.h"
+
+/* Match finder hash table size */
+#define HASH_BITS 15
+
+/* Shortest match worth a sequence */
+#define MIN_MATCH 4
+
+/* Match finder state for one block */
+typedef struct _Compressor
+{
+    int32_t head[1 << HASH_BITS];      // To store the last position of each hash, -1 for none
+    int32_t prev[COMPRESS_BLOCK_SIZE]; // To store the previous position with the same hash
+    unsigned char in[COMPRESS_BLOCK_SIZE];
+    unsigned char out[COMPRESS_BLOCK_BOUND(COMPRESS_BLOCK_SIZE)];
+} Compressor;
+
+/* Function Definitions */
+
+/*Compression steps
+1.split the payload into COMPRESS_BLOCK_SIZE blocks
+  blocks are independent, the decoder needs one block of memory
+2.find matches in the block
+  hash the next 4 bytes, walk the chain of earlier positions with that
+  hash (deeper for higher levels), keep the longest match
+3.write a sequence for the literals before each match and the match
+4.store the block raw if the sequences are not smaller*/
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t hash4(const unsigned char *p)
+{
+    return (get_le32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Length bytes that follow a nibble of 15 */
+static unsigned char *put_length(unsigned char *out, size_t len)
+{
+    while (len >= 255)
+    {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = len;
+    return out;
+}
+
+/* Write one sequence, match_len 0 for the literals that end a block */
+static unsigned char *put_sequence(unsigned char *out, const unsigned char *literals, size_t lit_len,
+                                   size_t offset, size_t match_len)
+{
+    size_t match_code = match_len ? match_len - MIN_MATCH : 0;
+    *out++ = ((lit_len < 15 ? lit_len : 15) << 4) | (match_code < 15 ? match_code : 15);
+    if (lit_len >= 15)
+        out = put_length(out, lit_len - 15);
+    memcpy(out, literals, lit_len);
+    out += lit_len;
+
+    if (match_len)
+    {
+        *out++ = offset;
+        *out++ = offset >> 8;
+        if (match_code >= 15)
+            out = put_length(out, match_code - 15);
+    }
+    return out;
+}
+
+/* Compress n bytes of comp->in into comp->out, return the compressed size */
+static size_t compress_block(Compressor *comp, size_t n, int level)
+{
+    const unsigned char *src = comp->in;
+    unsigned char *out = comp->out;
+    int depth = 1 << (level - 1);
+    size_t anchor = 0, pos = 0;
+    // The hash reads 4 bytes, the last few bytes always go out as literals
+    size_t last = (n > MIN_MATCH + 1) ? n - (MIN_MATCH + 1) : 0;
+
+    memset(comp->head, -1, sizeof(comp->head));
+    while (pos < last)
+    {
+        uint32_t h = hash4(src + pos);
+        size_t best_len = 0, best_pos = 0;
+        int32_t cand = comp->head[h];
+
+        for (int d = 0; d < depth && cand >= 0; d++, cand = comp->prev[cand])
+        {
+            // A longer match must at least agree at the current best length
+            if (src[cand + best_len] != src[pos + best_len])
+                continue;
+            size_t len = 0;
+            while (pos + len < n && src[cand + len] == src[pos + len])
+                len++;
+            if (len > best_len)
+            {
+                best_len = len;
+                best_pos = cand;
+                if (pos + len == n)
+                    break;
+            }
+        }
+        comp->prev[pos] = comp->head[h];
+        comp->head[h] = pos;
+
+        if (best_len < MIN_MATCH)
+        {
+            pos++;
+            continue;
+        }
+
+        out = put_sequence(out, src + anchor, pos - anchor, pos - best_pos, best_len);
+        // Positions inside the match are still candidates for later matches
+        for (size_t p = pos + 1; p < pos + best_len && p < last; p++)
+        {
+            uint32_t hp = hash4(src + p);
+            comp->prev[p] = comp->head[hp];
+            comp->head[hp] = p;
+        }
+        pos += best_len;
+        anchor = pos;
+    }
+    out = put_sequence(out, src + anchor, n - anchor, 0, 0);
+    return out - comp->out;
+}
+
+int compress_auto_level(long size)
+{
+    // Deep searches on small payloads, bounded time on big ones
+    if (size <= 1024 * 1024)
+        return COMPRESS_LEVEL_MAX;
+    if (size <= 16 * 1024 * 1024)
+        return 6;
+    return 3;
+}
+
+size_t compress_scratch_size(void)
+{
+    return (sizeof(Compressor) > sizeof(Decompressor)) ? sizeof(Compressor) : sizeof(Decompressor);
+}
+
+long compress_stream(FILE *fptr_in, long size, FILE *fptr_out, int level, Arena *arena)
+{
+    unsigned char word[12];
+    long total = 4;
+    Compressor *comp = scratch_alloc(arena, sizeof(Compressor));
+    if (comp == NULL)
+        return -1;
+
+    // Sizes that do not fit the word go after it
+    put_le32(word, (size < COMPRESS_SIZE64) ? size : COMPRESS_SIZE64);
+    if (size >= COMPRESS_SIZE64)
+    {
+        put_le32(word + 4, size);
+        put_le32(word + 8, (uint64_t)size >> 32);
+        total = 12;
+    }
+    if (fwrite(word, 1, total, fptr_out) != total)
+        total = -1;
+
+    for (long remaining = size; total >= 0 && remaining > 0;)
+    {
+        size_t n = (remaining < COMPRESS_BLOCK_SIZE) ? remaining : COMPRESS_BLOCK_SIZE;
+        if (fread(comp->in, 1, n, fptr_in) != n)
+        {
+            total = -1;
+            break;
+        }
+
+        size_t len = compress_block(comp, n, level);
+        const unsigned char *block = comp->out;
+        put_le32(word, len);
+        if (len >= n)
+        {
+            // Incompressible, store it
+            len = n;
+            block = comp->in;
+            put_le32(word, COMPRESS_STORED | n);
+        }
+        if (fwrite(word, 1, 4, fptr_out) != 4 || fwrite(block, 1, len, fptr_out) != len)
+            total = -1;
+        else
+            total += 4 + len;
+        remaining -= n;
+    }
+
+    scratch_free(arena, comp);
+    if (fflush(fptr_out) != 0)
+        return -1;
+    return total;
+}
+
+/*Decompression steps
+1.read the raw size
+2.collect one block at a time from the bytes fed in
+  the image is decoded in small chunks, a block spans many of them
+3.expand the block (or take a stored one as it is)
+4.drop the bytes before the requested offset, write the rest up to
+  the requested length, then report done so decoding can stop early*/
+
+/* Expand n bytes of LZ sequences into exactly raw_len bytes */
+static Status decompress_block(const unsigned char *in, size_t n, unsigned char *out, size_t raw_len)
+{
+    const unsigned char *end = in + n;
+    size_t pos = 0;
+
+    while (in < end)
+    {
+        unsigned char token = *in++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (in == end)
+                    return e_failure;
+                b = *in++;
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (lit_len > end - in || lit_len > raw_len - pos)
+            return e_failure;
+        memcpy(out + pos, in, lit_len);
+        in += lit_len;
+        pos += lit_len;
+
+        // Literals only: the block ends here
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return e_failure;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t match_len = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15)
+        {
+            unsigned char b;
+            do
+            {
+                if (in == end)
+                    return e_failure;
+                b = *in++;
+                match_len += b;
+            } while (b == 255);
+        }
+        if (offset == 0 || offset > pos || match_len > raw_len - pos)
+            return e_failure;
+        // Byte by byte, a match may overlap the bytes it produces
+        for (size_t i = 0; i < match_len; i++, pos++)
+            out[pos] = out[pos - offset];
+    }
+    return (pos == raw_len) ? e_success : e_failure;
+}
+
+/* Write the part of len raw bytes that falls inside the requested range */
+static Status emit_raw(Decompressor *dec, const unsigned char *data, size_t len)
+{
+    if (dec->skip >= (long)len)
+    {
+        dec->skip -= len;
+        return e_success;
+    }
+    data += dec->skip;
+    len -= dec->skip;
+    dec->skip = 0;
+
+    if (dec->limit >= 0 && (long)len >= dec->limit)
+    {
+        len = dec->limit;
+        dec->done = 1;
+    }
+    if (dec->limit >= 0)
+        dec->limit -= len;
+    return (fwrite(data, 1, len, dec->fptr_output) == len) ? e_success : e_failure;
+}
+
+Decompressor *decompress_open(FILE *fptr_output, long skip, long limit, Arena *arena)
+{
+    Decompressor *dec = scratch_alloc(arena, sizeof(Decompressor));
+    if (dec == NULL)
+        return NULL;
+    dec->arena = arena;
+    dec->fptr_output = fptr_output;
+    dec->skip = skip;
+    dec->limit = limit;
+    dec->raw_size = 0;
+    dec->produced = 0;
+    dec->have_size = 0;
+    dec->size_words = 0;
+    dec->word_len = 0;
+    dec->block_len = 0;
+    dec->stored = 0;
+    dec->filled = 0;
+    dec->done = (limit == 0);
+    return dec;
+}
+
+Status decompress_update(Decompressor *dec, const char *data, size_t n)
+{
+    while (n > 0 && !dec->done)
+    {
+        // Between blocks: collect the next word
+        if (dec->block_len == 0)
+        {
+            dec->word[dec->word_len++] = *data++;
+            n--;
+            if (dec->word_len < 4)
+                continue;
+            dec->word_len = 0;
+            uint32_t word = get_le32(dec->word);
+
+            if (!dec->have_size)
+            {
+                // A 64 bit raw size comes in the next two words
+                if (word == COMPRESS_SIZE64 && dec->size_words == 0)
+                {
+                    dec->size_words = 2;
+                    continue;
+                }
+                if (dec->size_words == 2)
+                {
+                    dec->raw_size = word;
+                    dec->size_words = 1;
+                    continue;
+                }
+                dec->raw_size = (dec->size_words == 1) ? dec->raw_size | (uint64_t)word << 32 : word;
+                dec->have_size = 1;
+                dec->done = (dec->raw_size == 0);
+                continue;
+            }
+            dec->stored = (word & COMPRESS_STORED) != 0;
+            dec->block_len = word & ~COMPRESS_STORED;
+            dec->filled = 0;
+            if (dec->block_len == 0 || dec->block_len > sizeof(dec->in))
+                return e_failure;
+            continue;
+        }
+
+        size_t take = dec->block_len - dec->filled;
+        if (take > n)
+            take = n;
+        memcpy(dec->in + dec->filled, data, take);
+        dec->filled += take;
+        data += take;
+        n -= take;
+        if (dec->filled < dec->block_len)
+            continue;
+
+        // Whole block in: expand it and pass it on
+        uint64_t left = dec->raw_size - dec->produced;
+        size_t raw_len = (left < COMPRESS_BLOCK_SIZE) ? left : COMPRESS_BLOCK_SIZE;
+        const unsigned char *raw = dec->in;
+        if (raw_len == 0)
+            return e_failure;
+        if (dec->stored)
+        {
+            if (dec->block_len != raw_len)
+                return e_failure;
+        }
+        else
+        {
+            if (decompress_block(dec->in, dec->block_len, dec->out, raw_len) == e_failure)
+                return e_failure;
+            raw = dec->out;
+        }
+        if (emit_raw(dec, raw, raw_len) == e_failure)
+            return e_failure;
+
+        dec->produced += raw_len;
+        dec->block_len = 0;
+        if (dec->produced == dec->raw_size)
+            dec->done = 1;
+    }
+    return e_success;
+}
+
+int decompress_done(const Decompressor *dec)
+{
+    return dec->done;
+}
+
+Status decompress_close(Decompressor *dec)
+{
+    Status ret = dec->done ? e_success : e_failure;
+    scratch_free(dec->arena, dec);
+    return ret;
+}
@@ -0,0 +1,89 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "arena.h"
+
+/* Payload bytes compressed as one independent block */
+#define COMPRESS_BLOCK_SIZE 65536
+
+/* Largest compressed form of an n byte block (all literals) */
+#define COMPRESS_BLOCK_BOUND(n) ((n) + (n) / 255 + 16)
+
+/* Levels pick the match search depth, 1 << (level - 1) candidates */
+#define COMPRESS_LEVEL_MIN 1
+#define COMPRESS_LEVEL_MAX 9
+#define COMPRESS_LEVEL_AUTO -1
+
+/* Most raw bytes one compressed byte can stand for (long match runs) */
+#define COMPRESS_MAX_RATIO 255
+
+/* Block word bit for a block stored as it is */
+#define COMPRESS_STORED 0x80000000u
+
+/* Raw size word of a payload past 32 bits, its 64 bit size follows */
+#define COMPRESS_SIZE64 0xFFFFFFFFu
+
+/*
+ * Compressed payload
+ * raw size (32 bits) | block | block | ...
+ *   a raw size of COMPRESS_SIZE64 or more is written as COMPRESS_SIZE64
+ *   and two more words, low 32 bits first
+ * block = word (32 bits) | bytes
+ *   word with COMPRESS_STORED set: the next (word & ~COMPRESS_STORED)
+ *   bytes are the raw block, else that many bytes of LZ sequences
+ *   every block but the last holds COMPRESS_BLOCK_SIZE raw bytes
+ * sequence = token | literal length+ | literals | offset (16 bits) | match length+
+ *   token high nibble: literals, low nibble: match length - 4, 15 means
+ *   more length bytes follow (255 each until a smaller one)
+ *   the last sequence of a block has literals only
+ * all words are little endian
+ */
+typedef struct _Decompressor
+{
+    FILE *fptr_output;     // To store where the decompressed bytes go
+    long skip;             // To store decompressed bytes still to drop
+    long limit;            // To store decompressed bytes still to write, -1 for all
+    uint64_t raw_size;     // To store the raw size from the stream header
+    uint64_t produced;     // To store the raw bytes decompressed so far
+    int have_size;         // To store 1 once the raw size is read
+    int size_words;        // To store the words of a 64 bit raw size still to read
+    unsigned char word[4]; // To store the header or block word being read
+    int word_len;          // To store the bytes of word read so far
+    uint32_t block_len;    // To store the bytes of the current block, 0 between blocks
+    int stored;            // To store 1 when the current block is stored raw
+    size_t filled;         // To store the bytes of the current block read so far
+    int done;              // To store 1 once nothing more is needed
+    Arena *arena;          // To store the arena the decompressor came from, NULL if malloced
+    unsigned char in[COMPRESS_BLOCK_BOUND(COMPRESS_BLOCK_SIZE)]; // To store the current block
+    unsigned char out[COMPRESS_BLOCK_SIZE];                     // To store its raw bytes
+} Decompressor;
+
+/* Compression function prototypes */
+
+/* Level COMPRESS_LEVEL_AUTO starts at for a payload of size bytes */
+int compress_auto_level(long size);
+
+/* Scratch bytes compress_stream or decompress_open take (from an arena or malloc) */
+size_t compress_scratch_size(void);
+
+/* Compress size bytes from fptr_in to fptr_out with scratch from arena (NULL
+ * to malloc it), return the compressed size or -1 */
+long compress_stream(FILE *fptr_in, long size, FILE *fptr_out, int level, Arena *arena);
+
+/* Start decompressing into fptr_output, writing limit bytes (-1 for all) after
+ * the first skip, the decompressor comes from arena (NULL to malloc it) */
+Decompressor *decompress_open(FILE *fptr_output, long skip, long limit, Arena *arena);
+
+/* Feed the next n compressed bytes */
+Status decompress_update(Decompressor *dec, const char *data, size_t n);
+
+/* Check if the requested bytes are all written */
+int decompress_done(const Decompressor *dec);
+
+/* Give the decompressor back, e_failure unless decompress_done */
+Status decompress_close(Decompressor *dec);
+
+#endif
@@ -0,0 +1,620 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "container.h"
+#include "decode.h"
+#include "block_io.h"
+#include "stream_io.h"
+#include "steg_format.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/*Packing steps
+1.name every file after the last part of its path, reject duplicates
+2.index size = header + one entry per file, the first entry's bytes
+  start right after it, each next one after the previous
+3.write header and index, then copy the files in index order to a
+  temporary file that the encoder reads as the secret file
+Extraction steps
+1.decode the header fields only, a payload without FORMAT_FLAG_CONTAINER
+  decodes as before
+2.--list and --entry: decode the first CONTAINER_INDEX_PROBE payload
+  bytes (again up to the index size if the index is longer) and parse the
+  index, --entry then decodes just the entry's range into the output
+3.everything: decode the whole container once to a temporary file and
+  copy each entry out of it into the output directory
+names come from the image: an entry is only ever written to a new file
+(never over an existing one or through a symlink), and gets its
+executable bit back only with --keep-mode*/
+
+/* Little endian fields of the index */
+static void put_le(unsigned char *p, uint64_t value, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint64_t get_le(const unsigned char *p, int n)
+{
+    uint64_t value = 0;
+    for (int i = n - 1; i >= 0; i--)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+/* An entry name is written as a file name on extraction, no paths */
+static int valid_entry_name(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 0 && len <= CONTAINER_MAX_NAME && strchr(name, '/') == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+/* Entry name of a file: the last part of its path */
+static const char *entry_name_of(const char *fname)
+{
+    const char *base = strrchr(fname, '/');
+    if (is_stream_name(fname))
+        return "stdin";
+    return (base != NULL) ? base + 1 : fname;
+}
+
+/* Fill one entry from an open file, offset is set by the caller */
+static Status describe_entry(FILE *fptr, const char *fname, ContainerEntry *entry)
+{
+    struct stat st;
+    const char *name = entry_name_of(fname);
+    if (!valid_entry_name(name))
+    {
+        printf("ERROR:%s cannot be stored under the name %s\n", fname, name);
+        return e_failure;
+    }
+    strcpy(entry->name, name);
+
+    if (fseeko(fptr, 0, SEEK_END) != 0)
+        return e_failure;
+    off_t size = ftello(fptr);
+    if (size < 0 || fseeko(fptr, 0, SEEK_SET) != 0)
+        return e_failure;
+    entry->length = size;
+    entry->flags = 0;
+    // Memory streams have no descriptor, their bytes are not executable
+    if (fileno(fptr) >= 0 && fstat(fileno(fptr), &st) == 0 && (st.st_mode & S_IXUSR))
+        entry->flags |= CONTAINER_ENTRY_EXECUTABLE;
+    return e_success;
+}
+
+/* Write the container header and index */
+static Status write_index(FILE *fptr, const ContainerEntry *entries, int count, uint32_t index_size)
+{
+    unsigned char field[CONTAINER_ENTRY_SIZE];
+
+    memcpy(field, CONTAINER_MAGIC, 4);
+    field[4] = CONTAINER_VERSION;
+    field[5] = 0;
+    put_le(field + 6, count, 2);
+    put_le(field + 8, index_size, 4);
+    if (fwrite(field, 1, CONTAINER_HEADER_SIZE, fptr) != CONTAINER_HEADER_SIZE)
+        return e_failure;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t len = strlen(entries[i].name);
+        put_le(field, entries[i].offset, 8);
+        put_le(field + 8, entries[i].length, 8);
+        put_le(field + 16, entries[i].flags, 4);
+        field[20] = len;
+        if (fwrite(field, 1, CONTAINER_ENTRY_SIZE, fptr) != CONTAINER_ENTRY_SIZE ||
+            fwrite(entries[i].name, 1, len, fptr) != len)
+            return e_failure;
+    }
+    return e_success;
+}
+
+FILE *container_build(FILE *fptr_first, const char *first_name, char *fnames[], int count)
+{
+    int total = count + 1;
+    if (total > CONTAINER_MAX_ENTRIES)
+    {
+        printf("ERROR:A container holds at most %d files\n", CONTAINER_MAX_ENTRIES);
+        return NULL;
+    }
+
+    FILE **files = calloc(total, sizeof(FILE *));
+    ContainerEntry *entries = calloc(total, sizeof(ContainerEntry));
+    FILE *fptr_container = NULL;
+    Status ret = (files != NULL && entries != NULL) ? e_success : e_failure;
+
+    // 1.open and name every file, the first one is already open
+    uint64_t index_size = CONTAINER_HEADER_SIZE;
+    for (int i = 0; i < total && ret == e_success; i++)
+    {
+        const char *fname = (i == 0) ? first_name : fnames[i - 1];
+        files[i] = (i == 0) ? fptr_first : fopen(fname, "rb");
+        if (files[i] == NULL)
+        {
+            perror("fopen");
+            printf("ERROR: Unable to open file %s\n", fname);
+            ret = e_failure;
+            break;
+        }
+        if (describe_entry(files[i], fname, &entries[i]) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(entries[j].name, entries[i].name) == 0)
+            {
+                printf("ERROR:Two secret files are named %s\n", entries[i].name);
+                ret = e_failure;
+            }
+        }
+        index_size += CONTAINER_ENTRY_SIZE + strlen(entries[i].name);
+    }
+
+    // 2.entry bytes follow the index in the same order
+    uint64_t offset = index_size;
+    for (int i = 0; i < total && ret == e_success; i++)
+    {
+        entries[i].offset = offset;
+        offset += entries[i].length;
+    }
+
+    // 3.index, then the files
+    if (ret == e_success)
+    {
+        fptr_container = tmpfile();
+        if (fptr_container == NULL)
+        {
+            perror("tmpfile");
+            ret = e_failure;
+        }
+    }
+    if (ret == e_success)
+        ret = write_index(fptr_container, entries, total, index_size);
+    for (int i = 0; i < total && ret == e_success; i++)
+    {
+        if (copy_file_blocks(files[i], fptr_container, DEFAULT_IO_BLOCK_SIZE) == e_failure ||
+            fflush(fptr_container) != 0 || ftello(fptr_container) != (off_t)(entries[i].offset + entries[i].length))
+        {
+            printf("ERROR:Unable to pack %s\n", entries[i].name);
+            ret = e_failure;
+        }
+    }
+    if (ret == e_success)
+    {
+        printf("INFO: Packed %d files into a %llu byte container\n", total, (unsigned long long)offset);
+        rewind(fptr_container);
+    }
+    else if (fptr_container != NULL)
+    {
+        fclose(fptr_container);
+        fptr_container = NULL;
+    }
+
+    // The first file belongs to the caller
+    for (int i = 1; files != NULL && i < total; i++)
+    {
+        if (files[i] != NULL)
+            fclose(files[i]);
+    }
+    free(files);
+    free(entries);
+    return fptr_container;
+}
+
+uint32_t container_index_size(const unsigned char *buffer, size_t size)
+{
+    if (size < CONTAINER_HEADER_SIZE || memcmp(buffer, CONTAINER_MAGIC, 4) != 0 || buffer[4] != CONTAINER_VERSION)
+        return 0;
+    uint32_t index_size = get_le(buffer + 8, 4);
+    return (index_size >= CONTAINER_HEADER_SIZE) ? index_size : 0;
+}
+
+Status container_parse_index(const unsigned char *buffer, size_t size, ContainerIndex *index)
+{
+    index->count = 0;
+    index->entries = NULL;
+    index->index_size = container_index_size(buffer, size);
+    if (index->index_size == 0 || index->index_size > size)
+        return e_failure;
+
+    int count = get_le(buffer + 6, 2);
+    index->entries = calloc(count ? count : 1, sizeof(ContainerEntry));
+    if (index->entries == NULL)
+        return e_failure;
+
+    size_t pos = CONTAINER_HEADER_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        ContainerEntry *entry = &index->entries[i];
+        if (pos + CONTAINER_ENTRY_SIZE > index->index_size)
+            break;
+        size_t len = buffer[pos + 20];
+        if (pos + CONTAINER_ENTRY_SIZE + len > index->index_size)
+            break;
+        entry->offset = get_le(buffer + pos, 8);
+        entry->length = get_le(buffer + pos + 8, 8);
+        entry->flags = get_le(buffer + pos + 16, 4);
+        memcpy(entry->name, buffer + pos + CONTAINER_ENTRY_SIZE, len);
+        entry->name[len] = '\0';
+        pos += CONTAINER_ENTRY_SIZE + len;
+
+        // Names become file names, ranges must lie after the index
+        if (!valid_entry_name(entry->name) || strlen(entry->name) != len || entry->offset < index->index_size ||
+            entry->offset + entry->length < entry->offset)
+            break;
+        index->count++;
+    }
+    if (index->count != count)
+    {
+        container_free_index(index);
+        return e_failure;
+    }
+    return e_success;
+}
+
+const ContainerEntry *container_find_entry(const ContainerIndex *index, const char *name)
+{
+    for (int i = 0; i < index->count; i++)
+    {
+        if (strcmp(index->entries[i].name, name) == 0)
+            return &index->entries[i];
+    }
+    return NULL;
+}
+
+void container_free_index(ContainerIndex *index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+}
+
+/* Decode payload bytes [offset, offset + length) into fptr, length -1 for all */
+static Status decode_range_into(const DecodeInfo *decInfo, long offset, long length, FILE *fptr, StatsInfo *stats)
+{
+    DecodeInfo sub = *decInfo;
+    sub.fptr_stego_image = NULL;
+    sub.fptr_output = fptr;
+    sub.keep_output = 1;
+    sub.output_fname = NULL;
+    sub.payload_offset = offset;
+    sub.payload_length = length;
+    sub.stats = stats;
+    // Worker threads pwrite at file offsets, a pipe has none
+    struct stat st;
+    if (fstat(fileno(fptr), &st) != 0 || !S_ISREG(st.st_mode))
+        sub.num_threads = 0;
+
+    Status ret = do_decoding(&sub);
+    if (fflush(fptr) != 0)
+        ret = e_failure;
+    return ret;
+}
+
+/* Bytes in a decoded file, worker threads pwrite without moving the stream */
+static off_t decoded_size(FILE *fptr)
+{
+    if (fflush(fptr) != 0 || fseeko(fptr, 0, SEEK_END) != 0)
+        return -1;
+    return ftello(fptr);
+}
+
+/* Read the whole of a small file into a new buffer */
+static unsigned char *read_spool(FILE *fptr, size_t *size)
+{
+    off_t end = decoded_size(fptr);
+    unsigned char *buffer = malloc(end > 0 ? end : 1);
+    if (end < 0 || buffer == NULL)
+    {
+        free(buffer);
+        return NULL;
+    }
+    rewind(fptr);
+    if (end > 0 && read_image_block(fptr, buffer, end) == e_failure)
+    {
+        free(buffer);
+        return NULL;
+    }
+    *size = end;
+    return buffer;
+}
+
+/* Decode and parse the index at the start of the container */
+static Status decode_index(DecodeInfo *decInfo, ContainerIndex *index)
+{
+    long want = CONTAINER_INDEX_PROBE;
+    Status ret = e_failure;
+
+    for (;;)
+    {
+        size_t size = 0;
+        unsigned char *buffer = NULL;
+        FILE *fptr = tmpfile();
+        if (fptr == NULL)
+        {
+            perror("tmpfile");
+            return e_failure;
+        }
+        if (decode_range_into(decInfo, 0, want, fptr, NULL) == e_success)
+            buffer = read_spool(fptr, &size);
+        fclose(fptr);
+        if (buffer == NULL)
+            return e_failure;
+
+        // A longer index than the probe takes one more decode of exactly its size
+        uint32_t index_size = container_index_size(buffer, size);
+        if (index_size > size && size == (size_t)want)
+        {
+            free(buffer);
+            want = index_size;
+            continue;
+        }
+        ret = container_parse_index(buffer, size, index);
+        free(buffer);
+        break;
+    }
+    if (ret == e_failure)
+        printf("ERROR:Unable to read the container index\n");
+    return ret;
+}
+
+/* Give an extracted entry back its executable bit, where it can be read, if asked to */
+static void restore_entry_mode(const DecodeInfo *decInfo, FILE *fptr, const ContainerEntry *entry)
+{
+    struct stat st;
+    if (!decInfo->keep_mode)
+        return;
+    if ((entry->flags & CONTAINER_ENTRY_EXECUTABLE) && fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode))
+        fchmod(fileno(fptr), (st.st_mode | ((st.st_mode & 0444) >> 2)) & 07777);
+}
+
+/* Create path for an entry named by the image, refusing an existing file or a symlink */
+static FILE *create_entry_file(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        if (errno == EEXIST)
+            printf("ERROR: %s already exists, not overwriting it\n", path);
+        else
+        {
+            perror("open");
+            printf("ERROR: Unable to open file %s\n", path);
+        }
+        return NULL;
+    }
+    FILE *fptr = fdopen(fd, "wb");
+    if (fptr == NULL)
+    {
+        perror("fdopen");
+        close(fd);
+    }
+    return fptr;
+}
+
+/* Print the index, one line per entry */
+static void list_entries(const DecodeInfo *decInfo, const ContainerIndex *index)
+{
+    printf("%s: container entries=%d\n", decInfo->stego_image_fname, index->count);
+    for (int i = 0; i < index->count; i++)
+    {
+        const ContainerEntry *entry = &index->entries[i];
+        printf("  %12llu  %s%s\n", (unsigned long long)entry->length, entry->name,
+               (entry->flags & CONTAINER_ENTRY_EXECUTABLE) ? " (executable)" : "");
+    }
+}
+
+/* Decode one entry (or the requested part of it) straight into its output */
+static Status extract_entry(DecodeInfo *decInfo, const ContainerIndex *index, const char *entry_name,
+                            const char *out_name)
+{
+    const ContainerEntry *entry = container_find_entry(index, entry_name);
+    if (entry == NULL)
+    {
+        printf("ERROR:%s holds no entry named %s\n", decInfo->stego_image_fname, entry_name);
+        return e_failure;
+    }
+
+    // --offset/--length pick a part of the entry
+    long start = (decInfo->payload_offset < (long)entry->length) ? decInfo->payload_offset : (long)entry->length;
+    long count = entry->length - start;
+    if (decInfo->payload_length >= 0 && decInfo->payload_length < count)
+        count = decInfo->payload_length;
+
+    // An output named on the command line is the user's, the entry's own name is not
+    FILE *fptr;
+    if (out_name == NULL)
+    {
+        out_name = entry->name;
+        fptr = create_entry_file(out_name);
+    }
+    else if ((fptr = open_stream(out_name, "wb")) == NULL)
+    {
+        perror("fopen");
+        printf("ERROR: Unable to open file %s\n", out_name);
+    }
+    if (fptr == NULL)
+        return e_failure;
+    int streaming = is_stream_name(out_name);
+
+    Status ret = e_success;
+    if (count > 0)
+        ret = decode_range_into(decInfo, entry->offset + start, count, fptr, decInfo->stats);
+    if (ret == e_success && !streaming && decoded_size(fptr) != count)
+    {
+        printf("ERROR:Container entry %s is cut short\n", entry->name);
+        ret = e_failure;
+    }
+    if (ret == e_success && !streaming)
+        restore_entry_mode(decInfo, fptr, entry);
+    if (fclose(fptr) != 0)
+        ret = e_failure;
+    if (ret == e_success)
+        printf("INFO: Extracted %s (%ld bytes) to %s\n", entry->name, count, out_name);
+    return ret;
+}
+
+/* Copy n bytes from the current position of src to dest */
+static Status copy_entry_bytes(FILE *fptr_src, FILE *fptr_dest, uint64_t n)
+{
+    char *buffer = malloc(CONTAINER_COPY_SIZE);
+    Status ret = (buffer != NULL) ? e_success : e_failure;
+    while (n > 0 && ret == e_success)
+    {
+        size_t chunk = (n < CONTAINER_COPY_SIZE) ? n : CONTAINER_COPY_SIZE;
+        if (read_image_block(fptr_src, buffer, chunk) == e_failure ||
+            write_image_block(fptr_dest, buffer, chunk) == e_failure)
+            ret = e_failure;
+        n -= chunk;
+    }
+    free(buffer);
+    return ret;
+}
+
+/* Decode the whole container once and write every entry into dir */
+static Status extract_all(DecodeInfo *decInfo, const char *dir)
+{
+    FILE *fptr_container = tmpfile();
+    if (fptr_container == NULL)
+    {
+        perror("tmpfile");
+        return e_failure;
+    }
+    if (decode_range_into(decInfo, 0, -1, fptr_container, decInfo->stats) == e_failure)
+    {
+        fclose(fptr_container);
+        return e_failure;
+    }
+
+    // Index straight from the decoded bytes
+    ContainerIndex index = {0};
+    unsigned char header[CONTAINER_HEADER_SIZE];
+    unsigned char *buffer = NULL;
+    off_t size = decoded_size(fptr_container);
+    uint32_t index_size = 0;
+    rewind(fptr_container);
+    if (size >= CONTAINER_HEADER_SIZE && read_image_block(fptr_container, header, sizeof(header)) == e_success)
+        index_size = container_index_size(header, sizeof(header));
+    if (index_size > 0 && index_size <= size && (buffer = malloc(index_size)) != NULL)
+    {
+        rewind(fptr_container);
+        if (read_image_block(fptr_container, buffer, index_size) == e_failure)
+            index_size = 0;
+    }
+    if (buffer == NULL || index_size == 0 || container_parse_index(buffer, index_size, &index) == e_failure)
+    {
+        printf("ERROR:Unable to read the container index\n");
+        free(buffer);
+        fclose(fptr_container);
+        return e_failure;
+    }
+    free(buffer);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+    {
+        perror("mkdir");
+        printf("ERROR: Unable to create directory %s\n", dir);
+        container_free_index(&index);
+        fclose(fptr_container);
+        return e_failure;
+    }
+
+    Status ret = e_success;
+    for (int i = 0; i < index.count && ret == e_success; i++)
+    {
+        const ContainerEntry *entry = &index.entries[i];
+        size_t path_size = strlen(dir) + strlen(entry->name) + 2;
+        char *path = malloc(path_size);
+        if (path == NULL)
+        {
+            ret = e_failure;
+            break;
+        }
+        snprintf(path, path_size, "%s/%s", dir, entry->name);
+
+        FILE *fptr = NULL;
+        if (entry->offset + entry->length > (uint64_t)size)
+        {
+            printf("ERROR:Container entry %s is cut short\n", entry->name);
+            ret = e_failure;
+        }
+        else if ((fptr = create_entry_file(path)) == NULL)
+        {
+            ret = e_failure;
+        }
+        else
+        {
+            if (fseeko(fptr_container, entry->offset, SEEK_SET) != 0 ||
+                copy_entry_bytes(fptr_container, fptr, entry->length) == e_failure || fflush(fptr) != 0)
+                ret = e_failure;
+            else
+                restore_entry_mode(decInfo, fptr, entry);
+            if (fclose(fptr) != 0)
+                ret = e_failure;
+            if (ret == e_success)
+                printf("INFO: Extracted %s (%llu bytes) to %s\n", entry->name, (unsigned long long)entry->length,
+                       path);
+        }
+        free(path);
+    }
+
+    container_free_index(&index);
+    fclose(fptr_container);
+    return ret;
+}
+
+Status do_container_decoding(DecodeInfo *decInfo, const char *entry_name, int list_only, const char *out_name)
+{
+    int selective = (entry_name != NULL || list_only);
+
+    // A stream cannot be read twice, its payload comes out as stored
+    if (is_stream_name(decInfo->stego_image_fname))
+    {
+        if (selective)
+        {
+            printf("ERROR: --entry and --list need a stego image file, not a stream\n");
+            return e_failure;
+        }
+        return do_decoding(decInfo);
+    }
+
+    if (read_payload_format(decInfo) == e_failure)
+        return e_failure;
+    if (!(decInfo->format.flags & FORMAT_FLAG_CONTAINER))
+    {
+        if (selective)
+        {
+            printf("ERROR:%s holds a single payload, not a container\n", decInfo->stego_image_fname);
+            return e_failure;
+        }
+        return do_decoding(decInfo);
+    }
+
+    // A plain --offset/--length decode reads the container bytes as stored
+    if (!selective && (decInfo->payload_offset != 0 || decInfo->payload_length >= 0))
+        return do_decoding(decInfo);
+    if (!selective)
+        return extract_all(decInfo, (out_name != NULL) ? out_name : ".");
+
+    ContainerIndex index = {0};
+    if (decode_index(decInfo, &index) == e_failure)
+        return e_failure;
+
+    Status ret = e_success;
+    if (list_only)
+        list_entries(decInfo, &index);
+    else
+        ret = extract_entry(decInfo, &index, entry_name, out_name);
+    container_free_index(&index);
+    return ret;
+}
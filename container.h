@@ -0,0 +1,83 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "decode.h"
+
+/* First bytes of a container */
+#define CONTAINER_MAGIC "STGC"
+
+/* Container layout written by the encoder */
+#define CONTAINER_VERSION 1
+
+/* Extension stored in the header fields of a container payload */
+#define CONTAINER_EXTN ".stc"
+
+/* Bytes before the first index entry, and of an entry without its name */
+#define CONTAINER_HEADER_SIZE 12
+#define CONTAINER_ENTRY_SIZE 21
+
+/* Longest entry name and most entries in one container */
+#define CONTAINER_MAX_NAME 255
+#define CONTAINER_MAX_ENTRIES 65535
+
+/* Payload bytes decoded to read the index, most indexes fit */
+#define CONTAINER_INDEX_PROBE 4096
+
+/* Bytes copied per round when extracting entries */
+#define CONTAINER_COPY_SIZE (64 * 1024)
+
+/* Entry flags */
+#define CONTAINER_ENTRY_EXECUTABLE 0x1u // source file was executable, so is the extracted one
+
+/*
+ * Container layout (numbers little endian)
+ *   CONTAINER_MAGIC | version (1) | reserved (1) | entry count (2) |
+ *   index size (4) | entries | entry bytes
+ *   entry = offset (8) | length (8) | flags (4) | name length (1) | name
+ *   index size counts the header and all entries, offsets count from the
+ *   first container byte, so one entry is a payload range a decoder can
+ *   seek to with --offset/--length
+ */
+typedef struct _ContainerEntry
+{
+    char name[CONTAINER_MAX_NAME + 1]; // entry name, a plain file name
+    uint64_t offset;                   // first container byte of the entry
+    uint64_t length;                   // entry bytes
+    uint32_t flags;                    // CONTAINER_ENTRY_* bits
+} ContainerEntry;
+
+/* Parsed index of a container */
+typedef struct _ContainerIndex
+{
+    int count;                // entries
+    uint32_t index_size;      // bytes before the first entry's data
+    ContainerEntry *entries;  // count entries in index order
+} ContainerIndex;
+
+/* Container function prototypes */
+
+/* Pack fptr_first (named first_name) and the count files in fnames into a
+ * temporary file holding the container, rewound, NULL on failure */
+FILE *container_build(FILE *fptr_first, const char *first_name, char *fnames[], int count);
+
+/* Index size from the first container bytes, 0 if they are not a container header */
+uint32_t container_index_size(const unsigned char *buffer, size_t size);
+
+/* Parse the index from the first size container bytes (at least the index size) */
+Status container_parse_index(const unsigned char *buffer, size_t size, ContainerIndex *index);
+
+/* Entry called name, NULL if there is none */
+const ContainerEntry *container_find_entry(const ContainerIndex *index, const char *name);
+
+/* Release the entries of a parsed index */
+void container_free_index(ContainerIndex *index);
+
+/* Decode a stego image: list the entries of a container, extract one
+ * (entry_name) or all of them (into the directory out_name), a payload
+ * that is no container decodes as before */
+Status do_container_decoding(DecodeInfo *decInfo, const char *entry_name, int list_only, const char *out_name);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+/* Slicing by 8 tables, table[0] is the plain byte table */
+static uint32_t crc_table[8][256];
+
+/* x^(2^n) mod P for n = 0 .. 31, for crc32c_combine */
+static uint32_t x2n_table[32];
+
+/* Function Definitions */
+
+/* a * b mod P, bit 31 is x^0 as in the reflected CRC */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(n * 2^k) mod P */
+static uint32_t x2nmodp(long n, unsigned k)
+{
+    uint32_t p = 1u << 31;
+    while (n)
+    {
+        if (n & 1)
+            p = multmodp(x2n_table[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+/* Portable kernel, 8 bytes per table round */
+static uint32_t update_scalar(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n > 0 && ((uintptr_t)p & 7) != 0)
+    {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        n--;
+    }
+    while (n >= 8)
+    {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^ crc_table[5][(lo >> 16) & 0xFF] ^
+              crc_table[4][lo >> 24] ^ crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0)
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC32C_X86_DISPATCH
+/* SSE4.2: the crc32 instruction does the same reflected CRC 8 bytes at a time */
+__attribute__((target("sse4.2")))
+static uint32_t update_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+    uint64_t crc64;
+    while (n > 0 && ((uintptr_t)p & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+    crc64 = crc;
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = crc64;
+    while (n-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+/* Kernel picked at start up */
+static uint32_t (*update_kernel)(uint32_t, const unsigned char *, size_t) = update_scalar;
+static const char *kernel_name = "scalar";
+
+/* Tables and runtime CPU dispatch, done once before main so threads never race on them */
+__attribute__((constructor))
+static void init_crc32c(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xFF] ^ (crc_table[t - 1][i] >> 8);
+
+    // x^1, then each entry squares the one before
+    x2n_table[0] = 1u << 30;
+    for (int i = 1; i < 32; i++)
+        x2n_table[i] = multmodp(x2n_table[i - 1], x2n_table[i - 1]);
+
+#ifdef CRC32C_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        update_kernel = update_sse42;
+        kernel_name = "sse4.2";
+    }
+#endif
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n)
+{
+    return ~update_kernel(~crc, data, n);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, long len2)
+{
+    // Shifting crc1 over len2 zero bytes, the ~ pre/post conditioning cancels out
+    return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+const char *crc32c_kernel_name(void)
+{
+    return kernel_name;
+}
@@ -0,0 +1,22 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli) function prototypes
+ * Values are finished CRCs like zlib's crc32(): start from 0 and feed the
+ * result of one call to the next, crc32c_update(0, "123456789", 9) is
+ * 0xE3069283. The SSE4.2 crc32 instruction is used when the CPU has it */
+
+/* CRC of crc's bytes followed by n more bytes */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n);
+
+/* CRC of two runs one after the other, from the CRC of each and the
+ * length of the second, so threads can checksum their slices apart */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, long len2);
+
+/* Name of the kernel picked for this CPU */
+const char *crc32c_kernel_name(void);
+
+#endif
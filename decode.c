@@ -1,9 +1,26 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include "decode.h"
+#include "mmap_io.h"
+#include "lsb_kernels.h"
+#include "parallel_decode.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "block_io.h"
+#include "stream_io.h"
+#include "png_io.h"
+#include "compress.h"
+#include "aead.h"
+#include "crc32c.h"
+#include "fec.h"
 #include "types.h"
 #include "common.h"
 
+/* Data bytes read per round for the decompressor */
+#define DECODE_CHUNK_SIZE 4096
+
 //read_and_validate_decode_args
 /*Decoding steps
 1.Validate input arguments
@@ -17,7 +34,8 @@
     check for errors
     return success/failure status
 3.Decode and verify magic string
-    read 8 bytes at a time from stego image
+    parse the BMP headers to find the carriers (colour bytes)
+    read 8 carriers at a time from stego image
     decode each byte from 8 bytes of image data
     compare with original magoc string
     return success/ failure status
@@ -45,7 +63,8 @@
     close stego image file and output file */
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
-    if (argv[2] == NULL || strstr(argv[2], ".bmp") == NULL)
+    // "-" is stdin for the stego image and stdout for the output
+    if (argv[2] == NULL || (!is_stream_name(argv[2]) && strstr(argv[2], ".bmp") == NULL && !is_png_name(argv[2])))
         return e_failure;
 
     decInfo->stego_image_fname = argv[2];
@@ -54,6 +73,10 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
     {
     decInfo->output_fname = argv[3];
     }
+    else if (is_stream_name(argv[2]))
+    {
+        decInfo->output_fname = STREAM_NAME;
+    }
     else
     {
         decInfo->output_fname = "decoded.txt";
@@ -71,6 +94,15 @@ Status open_decode_files(DecodeInfo *decInfo)
         return e_failure;
     }
 
+    // Verifying writes nothing, a caller's output is already open
+    if (decInfo->verify_only)
+    {
+        decInfo->fptr_output = NULL;
+        return e_success;
+    }
+    if (decInfo->keep_output)
+        return e_success;
+
     decInfo->fptr_output = fopen(decInfo->output_fname, "w");
     if (decInfo->fptr_output == NULL)
     {
@@ -81,42 +113,62 @@ Status open_decode_files(DecodeInfo *decInfo)
 
     return e_success;
 }
+
+ // close_decode_files
+
+void close_decode_files(DecodeInfo *decInfo)
+{
+    if (decInfo->fptr_stego_image != NULL)
+        fclose(decInfo->fptr_stego_image);
+    if (decInfo->fptr_output != NULL && !decInfo->keep_output)
+        fclose(decInfo->fptr_output);
+    decInfo->fptr_stego_image = NULL;
+    if (!decInfo->keep_output)
+        decInfo->fptr_output = NULL;
+}
+
  // decode_byte_from_lsb
 
 Status decode_byte_from_lsb(char *data, unsigned char *image_buffer)
 {
-    unsigned char ch = 0;
-    for (int i = 0; i < 8; i++)
-    {
-        ch |= (image_buffer[i] & 1) << i; // match LSB-first encode
-    }
-    *data = ch;
+    decode_bytes_from_lsb(data, 1, image_buffer); // match LSB-first encode
     return e_success;
 }
 
 Status decode_size_from_lsb(int *size, unsigned char *image_buffer)
 {
-    *size = 0;
-    for (int i = 0; i < 32; i++)
-    {
-        *size |= (image_buffer[i] & 1) << i; // match encode order
-    }
+    unsigned char bytes[4];
+    decode_bytes_from_lsb((char *)bytes, 4, image_buffer); // match encode order
+    *size = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned)bytes[3] << 24);
     return e_success;
 } 
 
 
+//read_next_carriers
+ /* Read the next n carriers of the stego image and move past them */
+
+static Status read_next_carriers(DecodeInfo *decInfo, unsigned char *window, unsigned char *carriers, size_t n)
+{
+    if (read_carriers(decInfo->fptr_stego_image, &decInfo->layout, decInfo->carrier_pos, n, window, carriers) == e_failure)
+        return e_failure;
+    decInfo->carrier_pos += n;
+    return e_success;
+}
+
 //decode_magic_string
 
 Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
 {
-    fseek(decInfo->fptr_stego_image, 54, SEEK_SET);
+    // Caller left the stego image at the first carrier of the pixel array
+    decInfo->carrier_pos = 0;
 
     char buffer[strlen(magic_string) + 1];
     unsigned char image_buffer[8];
+    unsigned char window[CARRIER_SPAN_MAX(8)];
 
     for (int i = 0; i < strlen(magic_string); i++)
     {
-        if (fread(image_buffer, 1, 8, decInfo->fptr_stego_image) != 8)
+        if (read_next_carriers(decInfo, window, image_buffer, 8) == e_failure)
         { 
             return e_failure;
         }
@@ -138,16 +190,65 @@ Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
 }
 
 
+ // Function: decode_format_words
+ /* The word after the magic string is either a format word (version 2)
+  * or, in the version 1 layout, the extension size itself. Either way it
+  * is 32 bits at 1 LSB per byte, so read it once and look at it */
+
+Status decode_format_words(DecodeInfo *decInfo)
+{
+    unsigned char image_buffer[32];
+    unsigned char window[CARRIER_SPAN_MAX(32)];
+    if (read_next_carriers(decInfo, window, image_buffer, 32) == e_failure)
+    {
+        return e_failure;
+    }
+    uint32_t word = decode_uint32_from_nlsb(image_buffer, 1);
+    if (parse_format_word(word, &decInfo->format) == e_failure)
+    {
+        // Version 1: that was the extension size
+        decInfo->format.version = 1;
+        decInfo->format.lsb_bits = 1;
+        decInfo->format.flags = 0;
+        decInfo->extn_size = word;
+        return e_success;
+    }
+    if (decInfo->format.version != FORMAT_VERSION || validate_lsb_bits(decInfo->format.lsb_bits) == e_failure)
+    {
+        return e_failure;
+    }
+    if (read_next_carriers(decInfo, window, image_buffer, 32) == e_failure)
+    {
+        return e_failure;
+    }
+    decInfo->format.flags = decode_uint32_from_nlsb(image_buffer, 1);
+    if ((decInfo->format.flags & ~FORMAT_KNOWN_FLAGS) != 0)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
  // Function: decode_secret_file_extn_size
 
 Status decode_secret_file_extn_size(DecodeInfo *decInfo)
 {
-    unsigned char image_buffer[32];
-    if (fread(image_buffer, 1, 32, decInfo->fptr_stego_image) != 32)
+    // Version 1 already read it in decode_format_words
+    if (decInfo->format.version >= 2)
+    {
+        unsigned char image_buffer[32];
+        unsigned char window[CARRIER_SPAN_MAX(32)];
+        size_t len = image_bytes_for(4, &decInfo->format);
+        if (read_next_carriers(decInfo, window, image_buffer, len) == e_failure)
+        {
+            return e_failure;
+        }
+        decInfo->extn_size = decode_uint32_from_nlsb(image_buffer, decInfo->format.lsb_bits);
+    }
+    if (decInfo->extn_size < 0 || decInfo->extn_size >= sizeof(decInfo->extn_secret_file))
     {
         return e_failure;
     }
-    decode_size_from_lsb(&decInfo->extn_size,image_buffer);
     return e_success;
 }
 
@@ -155,15 +256,14 @@ Status decode_secret_file_extn_size(DecodeInfo *decInfo)
  
 Status decode_secret_file_extn(DecodeInfo *decInfo)
 {
-    for (int i = 0; i < decInfo->extn_size; i++)
+    unsigned char image_buffer[8 * sizeof(decInfo->extn_secret_file)];
+    unsigned char window[CARRIER_SPAN_MAX(8 * sizeof(decInfo->extn_secret_file))];
+    size_t len = image_bytes_for(decInfo->extn_size, &decInfo->format);
+    if (read_next_carriers(decInfo, window, image_buffer, len) == e_failure)
     {
-        unsigned char image_buffer[8];
-        if (fread(image_buffer, 1, 8, decInfo->fptr_stego_image) != 8)
-        {
-            return e_failure;
-        }
-        decode_byte_from_lsb(&decInfo->extn_secret_file[i], image_buffer);
+        return e_failure;
     }
+    decode_bytes_from_nlsb(decInfo->extn_secret_file, decInfo->extn_size, image_buffer, decInfo->format.lsb_bits);
     decInfo->extn_secret_file[decInfo->extn_size] = '\0';
     return e_success;
 }
@@ -172,74 +272,710 @@ Status decode_secret_file_extn(DecodeInfo *decInfo)
 //decode_secret_file_size
  
 Status decode_secret_file_size(DecodeInfo *decInfo)
+{
+    unsigned char image_buffer[FORMAT_SIZE_FIELD_MAX * 8];
+    unsigned char window[CARRIER_SPAN_MAX(FORMAT_SIZE_FIELD_MAX * 8)];
+    size_t len = image_bytes_for(format_size_field_size(&decInfo->format), &decInfo->format);
+    if (read_next_carriers(decInfo, window, image_buffer, len) == e_failure)
+    {
+        return e_failure;
+    }
+    // A size no image holds is rejected before any carrier arithmetic on it
+    uint64_t size = decode_size_field(image_buffer, &decInfo->format);
+    decInfo->size_secret_file = (size > FORMAT_SIZE_MAX) ? -1 : (long)size;
+    return e_success;
+
+}
+
+// check_data_checksum
+
+Status check_data_checksum(uint32_t stored, uint32_t crc)
+{
+    if (stored != crc)
+    {
+        printf("ERROR:Checksum mismatch, the secret data is damaged\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+// decode_checksum
+
+Status decode_checksum(DecodeInfo *decInfo, uint32_t crc)
 {
     unsigned char image_buffer[32];
-    if (fread(image_buffer, 1, 32, decInfo->fptr_stego_image) != 32)
+    unsigned char window[CARRIER_SPAN_MAX(32)];
+    size_t len = image_bytes_for(FORMAT_CHECKSUM_SIZE, &decInfo->format);
+    if (read_next_carriers(decInfo, window, image_buffer, len) == e_failure)
+    {
+        return e_failure;
+    }
+    return check_data_checksum(decode_uint32_from_nlsb(image_buffer, decInfo->format.lsb_bits), crc);
+}
+
+// get_payload_range
+
+void get_payload_range(DecodeInfo *decInfo, long *start, long *count)
+{
+    clip_payload_range(decInfo, decInfo->size_secret_file, start, count);
+}
+
+// clip_payload_range
+
+void clip_payload_range(DecodeInfo *decInfo, long size, long *start, long *count)
+{
+    *start = (decInfo->payload_offset < size) ? decInfo->payload_offset : size;
+    *count = size - *start;
+    if (decInfo->payload_length >= 0 && decInfo->payload_length < *count)
+    {
+        *count = decInfo->payload_length;
+    }
+}
+
+// decode_data_bytes
+
+Status decode_data_bytes(DecodeInfo *decInfo, char *data, size_t n)
+{
+    unsigned char image_buffer[LSB_BATCH_SIZE * 8];
+    unsigned char window[CARRIER_SPAN_MAX(LSB_BATCH_SIZE * 8)];
+
+    while (n > 0)
+    {
+        size_t chunk = (n < LSB_BATCH_SIZE) ? n : LSB_BATCH_SIZE;
+        size_t len = image_bytes_for(chunk, &decInfo->format);
+        if (read_next_carriers(decInfo, window, image_buffer, len) == e_failure)
+        {
+            return e_failure;
+        }
+        decode_bytes_from_nlsb(data, chunk, image_buffer, decInfo->format.lsb_bits);
+        data += chunk;
+        n -= chunk;
+    }
+    return e_success;
+}
+
+// skip_data_bytes
+
+/* Move past n data bytes, 8 / lsb_bits carriers per byte */
+static Status skip_data_bytes(DecodeInfo *decInfo, long n)
+{
+    off_t from = carrier_offset(&decInfo->layout, decInfo->carrier_pos);
+    decInfo->carrier_pos += image_bytes_for(n, &decInfo->format);
+    return skip_image_bytes(decInfo->fptr_stego_image, carrier_offset(&decInfo->layout, decInfo->carrier_pos) - from);
+}
+
+static Status read_data_stream(void *arg, char *data, size_t n)
+{
+    return decode_data_bytes(arg, data, n);
+}
+
+static Status skip_data_stream(void *arg, long n)
+{
+    return skip_data_bytes(arg, n);
+}
+
+// read_summed
+
+/* Reader that runs every stored byte through CRC32C on its way */
+typedef struct _ChecksumReader
+{
+    const DataReader *reader; //reader of the stored bytes
+    uint32_t crc; //store CRC32C of the bytes read so far
+    long count; //store bytes read so far, -1 once any were skipped
+} ChecksumReader;
+
+static Status read_summed(void *arg, char *data, size_t n)
+{
+    ChecksumReader *sum = arg;
+    if (sum->reader->read(sum->reader->arg, data, n) == e_failure)
     {
         return e_failure;
     }
-    decode_size_from_lsb(&decInfo->size_secret_file, image_buffer);
+    if (sum->count >= 0)
+    {
+        sum->crc = crc32c_update(sum->crc, data, n);
+        sum->count += n;
+    }
     return e_success;
+}
 
+static Status skip_summed(void *arg, long n)
+{
+    ChecksumReader *sum = arg;
+    if (n > 0)
+    {
+        sum->count = -1;
+    }
+    return sum->reader->skip(sum->reader->arg, n);
+}
+
+// write_range
+
+/* Write the part of n plaintext bytes (payload bytes from data_start on)
+ * that falls inside [start, end) */
+static Status write_range(FILE *fptr, const unsigned char *data, size_t n, long data_start, long start, long end)
+{
+    long from = (start > data_start) ? start : data_start;
+    long to = (end < data_start + (long)n) ? end : data_start + (long)n;
+    if (from >= to)
+    {
+        return e_success;
+    }
+    size_t len = to - from;
+    return (fwrite(data + (from - data_start), 1, len, fptr) == len) ? e_success : e_failure;
+}
+
+// decode_sealed_data
+
+/* Sealed payload: salt and nonce, then segments that are each checked
+ * before any of their plaintext is written. Without compression only the
+ * segments holding the requested range are read */
+static Status decode_sealed_data(DecodeInfo *decInfo, const DataReader *reader, Decompressor *dec)
+{
+    unsigned char header[AEAD_HEADER_SIZE];
+    AeadInfo aead;
+
+    if (decInfo->passphrase == NULL)
+    {
+        printf("ERROR:Secret data is encrypted, give the passphrase with --key-file\n");
+        return e_failure;
+    }
+    if (reader->read(reader->arg, (char *)header, AEAD_HEADER_SIZE) == e_failure ||
+        aead_init_open(&aead, decInfo->passphrase, header, decInfo->size_secret_file) == e_failure)
+    {
+        return e_failure;
+    }
+
+    long start = 0, count = 0, first = 0;
+    if (dec == NULL)
+    {
+        clip_payload_range(decInfo, aead.plain_size, &start, &count);
+        first = start / AEAD_SEGMENT_SIZE;
+        if (reader->skip(reader->arg, aead_segment_offset(first) - AEAD_HEADER_SIZE) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    unsigned char *segment = scratch_alloc(decInfo->arena, AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    if (segment == NULL)
+    {
+        return e_failure;
+    }
+    Status ret = e_success;
+    for (long i = first; i < aead_segments(&aead); i++)
+    {
+        long seg_start = i * (long)AEAD_SEGMENT_SIZE;
+        if (dec != NULL ? decompress_done(dec) : seg_start >= start + count)
+        {
+            break;
+        }
+        size_t n = aead_segment_length(&aead, i);
+        if (reader->read(reader->arg, (char *)segment, n + AEAD_TAG_SIZE) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+        if (aead_open_segment(&aead, i, segment, n) == e_failure)
+        {
+            printf("ERROR:Secret data failed authentication (wrong passphrase or damaged image)\n");
+            ret = e_failure;
+            break;
+        }
+        if (dec != NULL)
+            ret = decompress_update(dec, (char *)segment, n);
+        else
+            ret = write_range(decInfo->fptr_output, segment, n, seg_start, start, start + count);
+        if (ret == e_failure)
+        {
+            break;
+        }
+    }
+    memset(&aead, 0, sizeof(aead));
+    scratch_free(decInfo->arena, segment);
+    return ret;
+}
+
+// decode_stored_data
+
+/* Compressed payloads are decoded from their start and decompressed chunk
+ * by chunk, --offset/--length apply to the decompressed bytes */
+static Status decode_stored_data(DecodeInfo *decInfo, const DataReader *reader)
+{
+    Decompressor *dec = NULL;
+    if (decInfo->format.flags & FORMAT_FLAG_COMPRESSED)
+    {
+        dec = decompress_open(decInfo->fptr_output, decInfo->payload_offset, decInfo->payload_length, decInfo->arena);
+        if (dec == NULL)
+        {
+            return e_failure;
+        }
+    }
+    if (decInfo->format.flags & FORMAT_FLAG_ENCRYPTED)
+    {
+        Status ret = decode_sealed_data(decInfo, reader, dec);
+        if (dec == NULL)
+        {
+            return ret;
+        }
+        return (decompress_close(dec) == e_success) ? ret : e_failure;
+    }
+    if (dec == NULL)
+    {
+        // Plain data from a reader (scattered carriers): only the requested range
+        long start, count;
+        get_payload_range(decInfo, &start, &count);
+        if (reader->skip(reader->arg, start) == e_failure)
+        {
+            return e_failure;
+        }
+        unsigned char data[DECODE_CHUNK_SIZE];
+        for (long i = 0; i < count; i += DECODE_CHUNK_SIZE)
+        {
+            size_t n = (count - i < DECODE_CHUNK_SIZE) ? count - i : DECODE_CHUNK_SIZE;
+            if (reader->read(reader->arg, (char *)data, n) == e_failure ||
+                write_range(decInfo->fptr_output, data, n, start + i, start, start + count) == e_failure)
+            {
+                return e_failure;
+            }
+        }
+        return e_success;
+    }
+
+    // Stop as soon as the requested part is out
+    char data[DECODE_CHUNK_SIZE];
+    for (long i = 0; i < decInfo->size_secret_file && !decompress_done(dec); i += DECODE_CHUNK_SIZE)
+    {
+        size_t n = decInfo->size_secret_file - i;
+        if (n > DECODE_CHUNK_SIZE)
+            n = DECODE_CHUNK_SIZE;
+        if (reader->read(reader->arg, data, n) == e_failure || decompress_update(dec, data, n) == e_failure)
+        {
+            decompress_close(dec);
+            return e_failure;
+        }
+    }
+    return decompress_close(dec);
+}
+
+// read_coded
+
+/* Reader that repairs coded frames and hands out their data bytes */
+typedef struct _FecReader
+{
+    const DataReader *reader; //reader of the coded bytes
+    unsigned char *frame; //store the frame being read, data then parity
+    size_t len; //store the data bytes of that frame
+    size_t pos; //store the data bytes of it handed out
+    long data_left; //store the data bytes of the frames not read yet
+    long corrected; //store the bytes repaired so far
+    uint32_t crc; //store CRC32C of the coded bytes once repaired, for the checksum
+    long count; //store coded bytes read so far, -1 once a frame was skipped
+} FecReader;
+
+/* Read and repair the next frame */
+static Status read_frame(FecReader *fec)
+{
+    fec->len = (fec->data_left < FEC_FRAME_DATA) ? fec->data_left : FEC_FRAME_DATA;
+    fec->pos = 0;
+    size_t size = fec_frame_size(fec->len);
+    if (fec->len == 0 || fec->reader->read(fec->reader->arg, (char *)fec->frame, size) == e_failure)
+    {
+        return e_failure;
+    }
+    fec->data_left -= fec->len;
+    if (fec_correct_frame(fec->frame, fec->len, &fec->corrected) == e_failure)
+    {
+        printf("ERROR:Secret data is damaged past what FEC can repair\n");
+        return e_failure;
+    }
+    if (fec->count >= 0)
+    {
+        fec->crc = crc32c_update(fec->crc, fec->frame, size);
+        fec->count += size;
+    }
+    return e_success;
+}
+
+static Status read_coded(void *arg, char *data, size_t n)
+{
+    FecReader *fec = arg;
+    while (n > 0)
+    {
+        if (fec->pos == fec->len && read_frame(fec) == e_failure)
+        {
+            return e_failure;
+        }
+        size_t chunk = fec->len - fec->pos;
+        if (chunk > n)
+            chunk = n;
+        memcpy(data, fec->frame + fec->pos, chunk);
+        fec->pos += chunk;
+        data += chunk;
+        n -= chunk;
+    }
+    return e_success;
+}
+
+/* Frames skipped whole are never read, so they are not repaired either */
+static Status skip_coded(void *arg, long n)
+{
+    FecReader *fec = arg;
+    while (n > 0)
+    {
+        long next = (fec->data_left < FEC_FRAME_DATA) ? fec->data_left : FEC_FRAME_DATA;
+        if (fec->pos < fec->len)
+        {
+            long chunk = (long)(fec->len - fec->pos) < n ? (long)(fec->len - fec->pos) : n;
+            fec->pos += chunk;
+            n -= chunk;
+        }
+        else if (next > 0 && n >= next)
+        {
+            if (fec->reader->skip(fec->reader->arg, fec_frame_size(next)) == e_failure)
+            {
+                return e_failure;
+            }
+            fec->data_left -= next;
+            fec->count = -1;
+            n -= next;
+        }
+        else if (read_frame(fec) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+// decode_coded_stages
+
+/* Coded payload: the stages run on the repaired data, so for them file
+ * size is the data size. The checksum is of the coded bytes as they were
+ * encoded, which is what every frame is once repaired */
+static Status decode_coded_stages(DecodeInfo *decInfo, const DataReader *reader)
+{
+    long coded = decInfo->size_secret_file;
+    long size = fec_data_size(coded);
+    if (size < 0)
+    {
+        printf("ERROR:File size %ld is not the size of a coded payload\n", coded);
+        return e_failure;
+    }
+    FecReader fec = {reader, scratch_alloc(decInfo->arena, FEC_FRAME_SIZE), 0, 0, size, 0, 0, 0};
+    DataReader data = {read_coded, skip_coded, &fec};
+    if (fec.frame == NULL)
+    {
+        return e_failure;
+    }
+
+    Status ret = e_success;
+    decInfo->size_secret_file = size;
+    if (decInfo->verify_only)
+    {
+        char chunk[DECODE_CHUNK_SIZE];
+        for (long i = 0; ret == e_success && i < size; i += DECODE_CHUNK_SIZE)
+        {
+            size_t n = (size - i < DECODE_CHUNK_SIZE) ? size - i : DECODE_CHUNK_SIZE;
+            ret = data.read(data.arg, chunk, n);
+        }
+    }
+    else
+    {
+        ret = decode_stored_data(decInfo, &data);
+    }
+    decInfo->size_secret_file = coded;
+    scratch_free(decInfo->arena, fec.frame);
+    if (ret == e_failure)
+    {
+        return e_failure;
+    }
+    if (fec.corrected > 0 && !decInfo->quiet)
+    {
+        printf("INFO: FEC repaired %ld damaged bytes\n", fec.corrected);
+    }
+
+    if (!(decInfo->format.flags & FORMAT_FLAG_CHECKSUM) || fec.count != coded)
+    {
+        return e_success;
+    }
+    unsigned char stored[FORMAT_CHECKSUM_SIZE];
+    if (reader->read(reader->arg, (char *)stored, FORMAT_CHECKSUM_SIZE) == e_failure)
+    {
+        return e_failure;
+    }
+    return check_data_checksum(stored[0] | (stored[1] << 8) | (stored[2] << 16) | ((uint32_t)stored[3] << 24), fec.crc);
+}
+
+// decode_payload_stages
+
+/* With a checksum every stored byte read is summed, the sum is checked
+ * once all of them went by (a part decoded with --offset/--length is
+ * not checked). Verifying only reads the stored bytes, so it needs no
+ * passphrase unless the carriers are scattered */
+Status decode_payload_stages(DecodeInfo *decInfo, const DataReader *reader)
+{
+    ChecksumReader sum = {reader, 0, 0};
+    DataReader summed = {read_summed, skip_summed, &sum};
+    Status ret = e_success;
+
+    if (!(decInfo->format.flags & FORMAT_FLAG_CHECKSUM) && decInfo->verify_only)
+    {
+        printf("ERROR:No checksum in %s, it was encoded without --checksum\n", decInfo->stego_image_fname);
+        return e_failure;
+    }
+    // Coded frames are repaired before any other stage sees them
+    if (decInfo->format.flags & FORMAT_FLAG_FEC)
+    {
+        return decode_coded_stages(decInfo, reader);
+    }
+    if (!(decInfo->format.flags & FORMAT_FLAG_CHECKSUM))
+    {
+        return decode_stored_data(decInfo, reader);
+    }
+    if (decInfo->verify_only)
+    {
+        char data[DECODE_CHUNK_SIZE];
+        for (long i = 0; ret == e_success && i < decInfo->size_secret_file; i += DECODE_CHUNK_SIZE)
+        {
+            size_t n = (decInfo->size_secret_file - i < DECODE_CHUNK_SIZE) ? decInfo->size_secret_file - i : DECODE_CHUNK_SIZE;
+            ret = summed.read(summed.arg, data, n);
+        }
+    }
+    else
+    {
+        ret = decode_stored_data(decInfo, &summed);
+    }
+    if (ret == e_failure || sum.count != decInfo->size_secret_file)
+    {
+        return ret;
+    }
+
+    unsigned char stored[FORMAT_CHECKSUM_SIZE];
+    if (reader->read(reader->arg, (char *)stored, FORMAT_CHECKSUM_SIZE) == e_failure)
+    {
+        return e_failure;
+    }
+    return check_data_checksum(stored[0] | (stored[1] << 8) | (stored[2] << 16) | ((uint32_t)stored[3] << 24), sum.crc);
 }
 
 // decode_secret_file_data
 
 Status decode_secret_file_data(DecodeInfo *decInfo)
 {
-    unsigned char image_buffer[8];
-    char ch;
-    for (int i = 0; i < decInfo->size_secret_file; i++)
+    unsigned char image_buffer[LSB_BATCH_SIZE * 8];
+    unsigned char window[CARRIER_SPAN_MAX(LSB_BATCH_SIZE * 8)];
+    char data[LSB_BATCH_SIZE];
+    long start, count;
+    if (decInfo->format.flags & FORMAT_FLAG_SCATTERED)
+    {
+        return decode_scattered_data(decInfo);
+    }
+    if (decInfo->verify_only || decInfo->format.flags & (FORMAT_FLAG_COMPRESSED | FORMAT_FLAG_ENCRYPTED | FORMAT_FLAG_FEC))
+    {
+        DataReader reader = {read_data_stream, skip_data_stream, decInfo};
+        return decode_payload_stages(decInfo, &reader);
+    }
+    get_payload_range(decInfo, &start, &count);
+
+    // The whole data is summed on the way out, a part of it cannot be checked
+    int summed = (decInfo->format.flags & FORMAT_FLAG_CHECKSUM) && count == decInfo->size_secret_file;
+    uint32_t crc = 0;
+
+    // Skip straight to the first requested byte, 8 / lsb_bits carriers per payload byte
+    if (start > 0 && skip_data_bytes(decInfo, start) == e_failure)
     {
-        if (fread(image_buffer, 1, 8, decInfo->fptr_stego_image) != 8)
+        return e_failure;
+    }
+    for (long i = 0; i < count; i += LSB_BATCH_SIZE)
+    {
+        size_t n = count - i;
+        if (n > LSB_BATCH_SIZE)
+            n = LSB_BATCH_SIZE;
+        size_t len = image_bytes_for(n, &decInfo->format);
+        if (read_next_carriers(decInfo, window, image_buffer, len) == e_failure)
+        {
+            return e_failure;
+        }
+        decode_bytes_from_nlsb(data, n, image_buffer, decInfo->format.lsb_bits);
+        if (fwrite(data, 1, n, decInfo->fptr_output) != n)
         {
             return e_failure;
         }
-        decode_byte_from_lsb(&ch, image_buffer);
-        fputc(ch, decInfo->fptr_output);
+        if (summed)
+        {
+            crc = crc32c_update(crc, data, n);
+        }
     }
-    return e_success;
+    return summed ? decode_checksum(decInfo, crc) : e_success;
 }
 
- //do_decoding
+ //decode_header_fields
 
-Status do_decoding(DecodeInfo *decInfo)
+Status decode_header_fields(DecodeInfo *decInfo)
 {
-    if (open_decode_files(decInfo) == e_failure)
+    stats_begin(decInfo->stats, "read_bmp_layout");
+    if (read_bmp_layout(decInfo->fptr_stego_image, &decInfo->layout) == e_failure)
     {
-        printf("ERROR:Unable to open files\n");
+        printf("ERROR:Unsupported BMP image %s\n", decInfo->stego_image_fname);
         return e_failure;
     }
+    if (fseeko(decInfo->fptr_stego_image, carrier_offset(&decInfo->layout, 0), SEEK_SET) != 0)
+    {
+        printf("ERROR:Unable to read stego image\n");
+        return e_failure;
+    }
+    return decode_embedded_fields(decInfo);
+}
 
+ //decode_embedded_fields
+
+Status decode_embedded_fields(DecodeInfo *decInfo)
+{
+    stats_begin(decInfo->stats, "decode_magic_string");
     if (decode_magic_string(MAGIC_STRING, decInfo) == e_failure)
     {
         printf("ERROR:Unable to decode magic string\n");
         return e_failure;
     }
+    stats_begin(decInfo->stats, "decode_format_words");
+    if (decode_format_words(decInfo) == e_failure)
+    {
+        printf("ERROR:Unsupported embedded format\n");
+        return e_failure;
+    }
+    stats_begin(decInfo->stats, "decode_secret_file_extn_size");
     if (decode_secret_file_extn_size(decInfo) == e_failure)
     {
         printf("ERROR:Unable to decode secret file extension size\n");
         return e_failure;
     }
+    stats_begin(decInfo->stats, "decode_secret_file_extn");
     if (decode_secret_file_extn(decInfo) == e_failure)
     {
         printf("ERROR:Unable to decode secret file extension\n");
         return e_failure;
     }
+    stats_begin(decInfo->stats, "decode_secret_file_size");
     if (decode_secret_file_size(decInfo) == e_failure)
     {
         printf("ERROR:Unable to decode secret file size\n");
         return e_failure;
     }
+    if (decInfo->size_secret_file < 0)
+    {
+        printf("ERROR:Unable to decode secret file size\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+ //decode_stages
+
+static Status decode_stages(DecodeInfo *decInfo)
+{
+    if (decode_header_fields(decInfo) == e_failure)
+        return e_failure;
 
+    stats_begin(decInfo->stats, "decode_secret_file_data");
     if (decode_secret_file_data(decInfo) == e_failure)
     {
         printf("ERROR:Unable to decode secret file data\n");
         return e_failure;
     }
 
-    printf("INFO: Decoding successful! Data written to %s\n", decInfo->output_fname);
+    print_decode_result(decInfo);
     return e_success;
-    fclose(decInfo->fptr_output);
-    fclose(decInfo->fptr_stego_image);
+}
+
+ //print_decode_result
+
+void print_decode_result(const DecodeInfo *decInfo)
+{
+    // The caller of a decode into its own output reports it
+    if (decInfo->keep_output || decInfo->quiet)
+        return;
+    if (decInfo->verify_only)
+        printf("INFO: Checksum verified, %s holds %ld intact data bytes\n", decInfo->stego_image_fname,
+               decInfo->size_secret_file);
+    else
+        printf("INFO: Decoding successful! Data written to %s\n", decInfo->output_fname);
+}
+
+ //do_decoding
+
+Status do_decoding(DecodeInfo *decInfo)
+{
+    if (is_stream_name(decInfo->stego_image_fname) || is_stream_name(decInfo->output_fname) ||
+        is_png_name(decInfo->stego_image_fname))
+        return do_decoding_stream(decInfo);
+    if (decInfo->use_mmap)
+        return do_decoding_mmap(decInfo);
+    if (decInfo->num_threads > 1)
+        return do_decoding_parallel(decInfo);
+
+    stats_begin(decInfo->stats, "open_decode_files");
+    if (open_decode_files(decInfo) == e_failure)
+    {
+        printf("ERROR:Unable to open files\n");
+        return e_failure;
+    }
+
+    Status ret = decode_stages(decInfo);
+
+    stats_begin(decInfo->stats, "close_decode_files");
+    close_decode_files(decInfo);
+    stats_end(decInfo->stats);
+    return ret;
+}
+
+ //read_payload_format
+
+Status read_payload_format(DecodeInfo *decInfo)
+{
+    DecodeInfo probe = *decInfo;
+    probe.stats = NULL;
+    probe.fptr_stego_image = open_image_stream(decInfo->stego_image_fname, "rb");
+    if (probe.fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        printf("ERROR:Unable to open files\n");
+        return e_failure;
+    }
+    Status ret = decode_header_fields(&probe);
+    fclose(probe.fptr_stego_image);
+    decInfo->format = probe.format;
+    return ret;
+}
+
+ //do_verify
+
+Status do_verify(char *fnames[], const char *passphrase)
+{
+    Status ret = e_success;
+    for (int i = 0; fnames[i] != NULL; i++)
+    {
+        DecodeInfo decInfo = {0};
+        decInfo.stego_image_fname = fnames[i];
+        decInfo.passphrase = passphrase;
+        decInfo.payload_length = -1;
+        decInfo.verify_only = 1;
+        // Verifying only reads, the mapped decoder does it with the fewest copies
+        decInfo.use_mmap = 1;
+        // One clear result for an image with nothing to check, before any decoding
+        if (read_payload_format(&decInfo) == e_failure)
+        {
+            ret = e_failure;
+            continue;
+        }
+        if (!(decInfo.format.flags & FORMAT_FLAG_CHECKSUM))
+        {
+            printf("ERROR:No checksum in %s, it was encoded without --checksum\n", decInfo.stego_image_fname);
+            ret = e_failure;
+            continue;
+        }
+        if (do_decoding(&decInfo) == e_failure)
+            ret = e_failure;
+    }
+    return ret;
 }
@@ -3,6 +3,10 @@
 
 #include <stdio.h>
 #include "types.h"
+#include "stats.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "arena.h"
 
 /* Structure to store information required for decoding */
 typedef struct _DecodeInfo
@@ -10,19 +14,45 @@ typedef struct _DecodeInfo
     /* Stego Image info */
     char *stego_image_fname; //to store stego image name
     FILE *fptr_stego_image; //to store address of stego image
+    BmpLayout layout; //to store pixel layout of stego image
+    long carrier_pos; //to store next carrier to decode from
 
     /* Output file info */
     char *output_fname; //store output file name
     FILE *fptr_output; //store address of output file
+    int keep_output; //output opened by the caller, left open and not reported
+    int quiet; //skip the INFO lines (batch items)
 
     /* Decoding data */
     char extn_secret_file[10]; //store secret file extension
     int extn_size; //store secret file extention  size
 
-    int size_secret_file; //store secret file size
+    long size_secret_file; //store secret file size
+    StegFormat format; //store embedded layout found after the magic string
+
+    int use_mmap; //select the memory mapped decoder
+    int num_threads; //store number of decode threads
+    StatsInfo *stats; //store per stage counters, NULL when off
+    const char *passphrase; //store the passphrase of an encrypted payload, NULL for none
+
+    /* Part of the payload to extract */
+    long payload_offset; //store first payload byte to extract
+    long payload_length; //store number of payload bytes to extract, -1 for all
+    int verify_only; //check the embedded checksum, decode and write nothing
+    int keep_mode; //give extracted container files back their executable bit
+    Arena *arena; //store per call scratch buffers, NULL to malloc them
 
 } DecodeInfo;
 
+/* Source of payload data bytes, so stdio, mmap and scattered decoders
+ * share the decrypt/decompress stages */
+typedef struct _DataReader
+{
+    Status (*read)(void *arg, char *data, size_t n); //decode the next n data bytes
+    Status (*skip)(void *arg, long n); //move past the next n data bytes
+    void *arg; //store the decoder state passed to read and skip
+} DataReader;
+
 /* Function prototypes */
 
 /* Read and validate decode arguments */
@@ -31,6 +61,9 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 /* Open decode files */
 Status open_decode_files(DecodeInfo *decInfo);
 
+/* Close decode files */
+void close_decode_files(DecodeInfo *decInfo);
+
 /* Decode functions */
 Status decode_byte_from_lsb(char *data, unsigned char *image_buffer);
 /* Decode size from LSB */
@@ -39,6 +72,9 @@ Status decode_size_from_lsb(int *size, unsigned char *image_buffer);
 /* Decode magic string */
 
 Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
+/* Decode format and flags words, or detect the version 1 layout */
+
+Status decode_format_words(DecodeInfo *decInfo);
 /* Decode secret file extension size */
 
 Status decode_secret_file_extn_size(DecodeInfo *decInfo);
@@ -48,11 +84,44 @@ Status decode_secret_file_extn(DecodeInfo *decInfo);
 /* Decode secret file size */
 
 Status decode_secret_file_size(DecodeInfo *decInfo);
+/* Compare the checksum stored after the data with the one worked out */
+
+Status check_data_checksum(uint32_t stored, uint32_t crc);
+/* Decode the checksum after the data and compare it with crc */
+
+Status decode_checksum(DecodeInfo *decInfo, uint32_t crc);
+/* Decode all fields before the secret data */
+
+Status decode_header_fields(DecodeInfo *decInfo);
+/* Decode all fields before the secret data, stego image already at the first carrier */
+
+Status decode_embedded_fields(DecodeInfo *decInfo);
+/* Decode the header fields only, from a stream of its own, to learn the flags */
+
+Status read_payload_format(DecodeInfo *decInfo);
+/* Clip the requested offset/length to the decoded file size */
+
+void get_payload_range(DecodeInfo *decInfo, long *start, long *count);
+/* Clip the requested offset/length to size bytes */
+
+void clip_payload_range(DecodeInfo *decInfo, long size, long *start, long *count);
+/* Decode the next n data bytes from the stego image */
+
+Status decode_data_bytes(DecodeInfo *decInfo, char *data, size_t n);
+/* Decrypt and/or decompress the payload read through reader, write the requested range */
+
+Status decode_payload_stages(DecodeInfo *decInfo, const DataReader *reader);
 /* Decode secret file data */
 
 Status decode_secret_file_data(DecodeInfo *decInfo);
+/* Report a finished decode (or verify) */
+
+void print_decode_result(const DecodeInfo *decInfo);
 /* Do decoding */
 
 Status do_decoding(DecodeInfo *decInfo);
+/* Check the checksum of every stego image named in the NULL terminated list */
+
+Status do_verify(char *fnames[], const char *passphrase);
 
 #endif
@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "detect.h"
+#include "parallel_encode.h"
+#include "bmp_layout.h"
+#include "png_io.h"
+#include "types.h"
+#include "common.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DETECT_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/* Function Definitions */
+
+/*Detect steps
+1.map a BMP read only, a PNG (or a stream) is read into memory through
+  its BMP stream
+2.split the rows into DETECT_BANDS bands in file order, a sequential
+  payload fills the carriers of band b before those of band b + 1
+3.workers take runs of bands: a histogram of the colour bytes and the
+  sample pair counts of each band
+4.chi-square pair of values test on the histogram of every leading run
+  of bands, the carriers of the leading bands whose p-value stays at
+  DETECT_CHI2_THRESHOLD or more give the chi-square rate, which only
+  says a sequential payload starts at the first carrier
+5.sample pair analysis on the counts of all bands gives the rate
+6.print one line per image, the chi-square rate only when it is not 0*/
+
+/* Sample pair counts of the n pairs (c[i], c[i + 3]): counts gets the
+ * unequal, X and close pairs added. With carriers in R, G, B (or B, G, R)
+ * order the two bytes of a pair are the same channel of adjacent pixels
+ */
+static void sample_pairs_scalar(const unsigned char *c, size_t n, uint64_t counts[3])
+{
+    uint64_t unequal = 0, x = 0, close = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned u = c[i], v = c[i + 3];
+        unequal += (u != v);
+        x += (u != v) & ((u < v) ^ (v & 1));
+        close += ((u ^ v) < 2);
+    }
+    counts[0] += unequal;
+    counts[1] += x;
+    counts[2] += close;
+}
+
+#ifdef DETECT_X86_DISPATCH
+
+/* SSE2: 16 pairs per step, compares give 0/-1 per byte which are
+ * subtracted into 8 bit counters; every 255 steps the counters are
+ * summed into 64 bit lanes with PSADBW before they can wrap
+ */
+static void sample_pairs_sse2(const unsigned char *c, size_t n, uint64_t counts[3])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i high = _mm_set1_epi8((char)0xFE);
+    __m128i equal = zero, x = zero, close = zero;
+    size_t i = 0;
+
+    while (i + 16 <= n)
+    {
+        __m128i equal8 = zero, x8 = zero, close8 = zero;
+        size_t end = (n - i > 16 * 255) ? i + 16 * 255 : n;
+        for (; i + 16 <= end; i += 16)
+        {
+            __m128i u = _mm_loadu_si128((const __m128i *)(c + i));
+            __m128i v = _mm_loadu_si128((const __m128i *)(c + i + 3));
+            __m128i eq = _mm_cmpeq_epi8(u, v);
+            __m128i le = _mm_cmpeq_epi8(_mm_min_epu8(u, v), u);
+            __m128i odd = _mm_cmpeq_epi8(_mm_and_si128(v, one), one);
+            equal8 = _mm_sub_epi8(equal8, eq);
+            x8 = _mm_sub_epi8(x8, _mm_andnot_si128(eq, _mm_xor_si128(le, odd)));
+            close8 = _mm_sub_epi8(close8, _mm_cmpeq_epi8(_mm_and_si128(_mm_xor_si128(u, v), high), zero));
+        }
+        equal = _mm_add_epi64(equal, _mm_sad_epu8(equal8, zero));
+        x = _mm_add_epi64(x, _mm_sad_epu8(x8, zero));
+        close = _mm_add_epi64(close, _mm_sad_epu8(close8, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, equal);
+    counts[0] += i - (lanes[0] + lanes[1]);
+    _mm_storeu_si128((__m128i *)lanes, x);
+    counts[1] += lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i *)lanes, close);
+    counts[2] += lanes[0] + lanes[1];
+    sample_pairs_scalar(c + i, n - i, counts);
+}
+
+/* AVX2: as SSE2 with 32 pairs per step */
+__attribute__((target("avx2")))
+static void sample_pairs_avx2(const unsigned char *c, size_t n, uint64_t counts[3])
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i high = _mm256_set1_epi8((char)0xFE);
+    __m256i equal = zero, x = zero, close = zero;
+    size_t i = 0;
+
+    while (i + 32 <= n)
+    {
+        __m256i equal8 = zero, x8 = zero, close8 = zero;
+        size_t end = (n - i > 32 * 255) ? i + 32 * 255 : n;
+        for (; i + 32 <= end; i += 32)
+        {
+            __m256i u = _mm256_loadu_si256((const __m256i *)(c + i));
+            __m256i v = _mm256_loadu_si256((const __m256i *)(c + i + 3));
+            __m256i eq = _mm256_cmpeq_epi8(u, v);
+            __m256i le = _mm256_cmpeq_epi8(_mm256_min_epu8(u, v), u);
+            __m256i odd = _mm256_cmpeq_epi8(_mm256_and_si256(v, one), one);
+            equal8 = _mm256_sub_epi8(equal8, eq);
+            x8 = _mm256_sub_epi8(x8, _mm256_andnot_si256(eq, _mm256_xor_si256(le, odd)));
+            close8 = _mm256_sub_epi8(close8, _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_xor_si256(u, v), high), zero));
+        }
+        equal = _mm256_add_epi64(equal, _mm256_sad_epu8(equal8, zero));
+        x = _mm256_add_epi64(x, _mm256_sad_epu8(x8, zero));
+        close = _mm256_add_epi64(close, _mm256_sad_epu8(close8, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, equal);
+    counts[0] += i - (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    _mm256_storeu_si256((__m256i *)lanes, x);
+    counts[1] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *)lanes, close);
+    counts[2] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    sample_pairs_scalar(c + i, n - i, counts);
+}
+#endif
+
+/* Kernel picked at start up, scalar until then */
+static void (*sample_pairs_kernel)(const unsigned char *, size_t, uint64_t[3]) = sample_pairs_scalar;
+
+#ifdef DETECT_X86_DISPATCH
+/* Runtime CPU dispatch, done once before main so threads never race on it */
+__attribute__((constructor))
+static void select_detect_kernels(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        sample_pairs_kernel = sample_pairs_avx2;
+    else
+        sample_pairs_kernel = sample_pairs_sse2;
+}
+#endif
+
+/* Histogram of n bytes into four sub-histograms, a run of equal bytes
+ * (flat image areas) then updates four counters instead of waiting on
+ * one. Bytes are taken 8 at a time from a word
+ */
+static void histogram_bytes(const unsigned char *c, size_t n, uint32_t sub[4][256])
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, c + i, 8);
+        sub[0][w & 0xFF]++;
+        sub[1][(w >> 8) & 0xFF]++;
+        sub[2][(w >> 16) & 0xFF]++;
+        sub[3][(w >> 24) & 0xFF]++;
+        sub[0][(w >> 32) & 0xFF]++;
+        sub[1][(w >> 40) & 0xFF]++;
+        sub[2][(w >> 48) & 0xFF]++;
+        sub[3][w >> 56]++;
+    }
+    for (; i < n; i++)
+        sub[0][c[i]]++;
+}
+
+/* Add the sub-histograms into the band histogram and clear them */
+static void fold_histogram(uint32_t sub[4][256], uint64_t hist[256])
+{
+    for (int v = 0; v < 256; v++)
+        hist[v] += (uint64_t)sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+    memset(sub, 0, 4 * 256 * sizeof(uint32_t));
+}
+
+/* Worker: histogram and sample pairs of bands [first, last) */
+static void *detect_slice(void *arg)
+{
+    DetectSlice *slice = arg;
+    const BmpLayout *layout = &slice->image->layout;
+    // 32 bit pixels carry an alpha byte, their colour bytes are gathered into a row first
+    unsigned char *carriers = (layout->bytes_per_pixel == 3) ? NULL : malloc(layout->row_carriers);
+    uint32_t (*sub)[256] = calloc(4, sizeof(*sub));
+
+    slice->status = e_failure;
+    if (sub != NULL && (layout->bytes_per_pixel == 3 || carriers != NULL))
+    {
+        for (int b = slice->first; b < slice->last; b++)
+        {
+            DetectBand *band = &slice->image->bands[b];
+            uint64_t counts[3] = {0};
+            long folded = 0;
+            for (long row = band->first_row; row < band->last_row; row++)
+            {
+                long k = row * (long)layout->row_carriers;
+                const unsigned char *c = slice->image->pixels + (carrier_offset(layout, k) - layout->data_offset);
+                if (carriers != NULL)
+                {
+                    gather_carriers(layout, k, layout->row_carriers, c, carriers);
+                    c = carriers;
+                }
+                histogram_bytes(c, layout->row_carriers, sub);
+                if (layout->row_carriers > 3)
+                    sample_pairs_kernel(c, layout->row_carriers - 3, counts);
+
+                folded += layout->row_carriers;
+                if (folded >= DETECT_FOLD_BYTES)
+                {
+                    fold_histogram(sub, band->hist);
+                    folded = 0;
+                }
+            }
+            fold_histogram(sub, band->hist);
+            band->pairs = (band->last_row - band->first_row) *
+                          (uint64_t)((layout->row_carriers > 3) ? layout->row_carriers - 3 : 0);
+            band->unequal = counts[0];
+            band->x = counts[1];
+            band->close = counts[2];
+        }
+        slice->status = e_success;
+    }
+    free(sub);
+    free(carriers);
+    return NULL;
+}
+
+/* Regularized upper incomplete gamma function Q(a, x): a series for
+ * x < a + 1, a continued fraction (modified Lentz) past it */
+static double upper_gamma_q(double a, double x)
+{
+    if (x <= 0)
+        return 1.0;
+    double scale = exp(-x + a * log(x) - lgamma(a));
+
+    if (x < a + 1)
+    {
+        double term = 1.0 / a, sum = term;
+        for (int n = 1; n < 1000 && term > sum * 1e-12; n++)
+        {
+            term *= x / (a + n);
+            sum += term;
+        }
+        double q = 1.0 - sum * scale;
+        return (q > 0) ? q : 0;
+    }
+
+    double b = x + 1 - a, c = 1e300, d = 1 / b, h = d;
+    for (int n = 1; n < 1000; n++)
+    {
+        double an = -n * (n - a);
+        b += 2;
+        d = an * d + b;
+        if (fabs(d) < 1e-300)
+            d = 1e-300;
+        c = b + an / c;
+        if (fabs(c) < 1e-300)
+            c = 1e-300;
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1) < 1e-12)
+            break;
+    }
+    return h * scale;
+}
+
+/* Chi-square pair of values test: LSB embedding evens out the counts of
+ * 2i and 2i + 1, so a p-value near 1 means the histogram looks embedded.
+ * 0 when too few pairs of values have enough samples */
+static double chi_square_p(const uint64_t hist[256])
+{
+    double chi2 = 0;
+    int categories = 0;
+    for (int i = 0; i < 256; i += 2)
+    {
+        double expected = (hist[i] + hist[i + 1]) / 2.0;
+        if (expected < DETECT_CHI2_MIN_EXPECTED)
+            continue;
+        double diff = hist[i] - expected;
+        chi2 += diff * diff / expected;
+        categories++;
+    }
+    if (categories < 2)
+        return 0;
+    return upper_gamma_q((categories - 1) / 2.0, chi2 / 2);
+}
+
+/* Sample pair analysis: the smaller root of
+ * 2k b^2 + 2(2x - P) b + (y - x) = 0 estimates half the embedding rate */
+static double sample_pair_rate(uint64_t pairs, uint64_t unequal, uint64_t x, uint64_t close)
+{
+    if (close == 0)
+        return 0;
+    double a = 2.0 * close;
+    double b = 2.0 * (2.0 * x - pairs);
+    double c = (double)(unequal - x) - x;
+    double disc = b * b - 4 * a * c;
+    // No real root: take the vertex, the closest the curve gets to zero
+    double beta = (disc < 0) ? -b / (2 * a) : fmin((-b + sqrt(disc)) / (2 * a), (-b - sqrt(disc)) / (2 * a));
+    double rate = 2 * beta;
+    return (rate < 0) ? 0 : (rate > 1) ? 1 : rate;
+}
+
+/* Map the pixel array of a BMP file, else read it through the image stream */
+static Status load_image(const char *fname, DetectImage *image)
+{
+    FILE *fptr = open_image_stream(fname, "rb");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        printf("ERROR:Unable to open %s\n", fname);
+        return e_failure;
+    }
+    if (read_bmp_layout(fptr, &image->layout) == e_failure)
+    {
+        printf("%s: not a supported BMP or PNG\n", fname);
+        fclose(fptr);
+        return e_failure;
+    }
+
+    const BmpLayout *layout = &image->layout;
+    size_t pixel_len = layout->stride * layout->height;
+    size_t map_len = layout->data_offset + pixel_len;
+    struct stat st;
+    if (!is_png_name(fname) && fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= (off_t)map_len)
+    {
+        image->map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+        if (image->map == MAP_FAILED)
+            image->map = NULL;
+    }
+
+    Status ret = e_success;
+    if (image->map != NULL)
+    {
+        madvise(image->map, map_len, MADV_SEQUENTIAL);
+        image->map_len = map_len;
+        image->pixels = (unsigned char *)image->map + layout->data_offset;
+    }
+    else if ((image->buffer = malloc(pixel_len)) == NULL ||
+             fseeko(fptr, layout->data_offset, SEEK_SET) != 0 ||
+             fread(image->buffer, 1, pixel_len, fptr) != pixel_len)
+    {
+        printf("ERROR:Unable to read the pixels of %s\n", fname);
+        ret = e_failure;
+    }
+    else
+    {
+        image->pixels = image->buffer;
+    }
+    fclose(fptr);
+    return ret;
+}
+
+Status detect_image(const char *fname, int num_threads, DetectResult *result)
+{
+    DetectImage *image = calloc(1, sizeof(DetectImage));
+    if (image == NULL)
+        return e_failure;
+    if (load_image(fname, image) == e_failure)
+    {
+        free(image->buffer);
+        free(image);
+        return e_failure;
+    }
+
+    long height = image->layout.height;
+    for (int b = 0; b < DETECT_BANDS; b++)
+    {
+        image->bands[b].first_row = height * b / DETECT_BANDS;
+        image->bands[b].last_row = height * (b + 1) / DETECT_BANDS;
+    }
+
+    int threads = (num_threads > 0) ? num_threads : 1;
+    if (threads > DETECT_BANDS)
+        threads = DETECT_BANDS;
+    DetectSlice *slices = calloc(threads, sizeof(DetectSlice));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    int *started = calloc(threads, sizeof(int));
+    Status ret = (slices != NULL && tids != NULL && started != NULL) ? e_success : e_failure;
+
+    if (ret == e_success)
+    {
+        for (int t = 0; t < threads; t++)
+        {
+            slices[t].image = image;
+            slices[t].first = DETECT_BANDS * t / threads;
+            slices[t].last = DETECT_BANDS * (t + 1) / threads;
+            started[t] = (threads > 1 && pthread_create(&tids[t], NULL, detect_slice, &slices[t]) == 0);
+        }
+        for (int t = 0; t < threads; t++)
+        {
+            // A thread that could not be started runs its slice here
+            if (started[t])
+                pthread_join(tids[t], NULL);
+            else
+                detect_slice(&slices[t]);
+            if (slices[t].status == e_failure)
+                ret = e_failure;
+        }
+    }
+
+    if (ret == e_success)
+    {
+        // Chi-square over a growing run of leading bands, SPA over all of them
+        uint64_t hist[256] = {0};
+        uint64_t pairs = 0, unequal = 0, x = 0, close = 0;
+        long carriers = 0, embedded = 0;
+        int leading = 1;
+        for (int b = 0; b < DETECT_BANDS; b++)
+        {
+            const DetectBand *band = &image->bands[b];
+            if (band->first_row == band->last_row)
+                continue;
+            for (int v = 0; v < 256; v++)
+                hist[v] += band->hist[v];
+            carriers += (band->last_row - band->first_row) * (long)image->layout.row_carriers;
+            if (leading && chi_square_p(hist) >= DETECT_CHI2_THRESHOLD)
+                embedded = carriers;
+            else
+                leading = 0;
+            pairs += band->pairs;
+            unequal += band->unequal;
+            x += band->x;
+            close += band->close;
+        }
+        result->chi2_p = chi_square_p(hist);
+        result->chi2_rate = (carriers > 0) ? (double)embedded / carriers : 0;
+        result->spa_rate = sample_pair_rate(pairs, unequal, x, close);
+        result->rate = result->spa_rate;
+    }
+
+    free(slices);
+    free(tids);
+    free(started);
+    if (image->map != NULL)
+        munmap(image->map, image->map_len);
+    free(image->buffer);
+    free(image);
+    return ret;
+}
+
+Status do_detect(char *fnames[], int num_threads)
+{
+    Status ret = e_success;
+    for (int i = 0; fnames[i] != NULL; i++)
+    {
+        DetectResult result;
+        if (detect_image(fnames[i], num_threads, &result) == e_failure)
+        {
+            ret = e_failure;
+            continue;
+        }
+        printf("%s: rate=%.3f chi2_p=%.4f", fnames[i], result.rate, result.chi2_p);
+        if (result.chi2_rate > 0)
+            printf(" sequential=%.3f", result.chi2_rate);
+        printf("\n");
+    }
+    return ret;
+}
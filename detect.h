@@ -0,0 +1,81 @@
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+#include "bmp_layout.h"
+
+/* Row bands an image is split into, in file order: the unit of work of
+ * a thread and the step of the chi-square length estimate */
+#define DETECT_BANDS 64
+
+/* Pairs of values whose expected count is below this are left out of
+ * the chi-square sum, too few samples to say anything */
+#define DETECT_CHI2_MIN_EXPECTED 5
+
+/* Chi-square p-value from which the leading carriers tested count as a
+ * sequential payload, a significant result: the test is noisy on smooth
+ * covers, whose few values per band look equalised by chance */
+#define DETECT_CHI2_THRESHOLD 0.95
+
+/* Colour bytes histogrammed into 32 bit counters before they are folded
+ * into the 64 bit band histogram, well short of a wrap */
+#define DETECT_FOLD_BYTES (1L << 30)
+
+/*
+ * Statistics of one row band
+ * the histogram of its colour bytes and the sample pair counts of
+ * horizontally adjacent bytes of the same channel (u, v): unequal,
+ * x (v even and u < v, or v odd and u > v; y is the rest of unequal)
+ * and close (u and v equal but for the LSB)
+ */
+typedef struct _DetectBand
+{
+    long first_row;           // To store the first row of the band, in file order
+    long last_row;            // To store one past its last row
+    uint64_t hist[256];       // To store the count of every colour byte value
+    uint64_t pairs;           // To store the sample pairs counted
+    uint64_t unequal;         // To store the pairs with u != v
+    uint64_t x;               // To store the pairs of the SPA set X
+    uint64_t close;           // To store the pairs with u >> 1 == v >> 1
+} DetectBand;
+
+/* Image pixels and their band statistics */
+typedef struct _DetectImage
+{
+    BmpLayout layout;         // To store the pixel layout
+    const unsigned char *pixels; // To store the pixel array, first row in the file first
+    void *map;                // To store the mapped BMP, NULL when read into buffer
+    size_t map_len;           // To store the mapping size
+    unsigned char *buffer;    // To store the pixel array of a PNG or a stream
+    DetectBand bands[DETECT_BANDS]; // To store the statistics of every band
+} DetectImage;
+
+/* Work of one detect thread: bands [first, last) */
+typedef struct _DetectSlice
+{
+    DetectImage *image;       // To store the image the bands belong to
+    int first;                // To store the first band
+    int last;                 // To store one past the last band
+    Status status;            // To store the result of the slice
+} DetectSlice;
+
+/* Estimates for one image, fractions of the carriers holding payload bits */
+typedef struct _DetectResult
+{
+    double spa_rate;          // To store the sample pair analysis estimate
+    double chi2_rate;         // To store the leading carriers passing the chi-square test, 0 if none
+    double chi2_p;            // To store the chi-square p-value of the whole image
+    double rate;              // To store the estimate reported, the SPA one
+} DetectResult;
+
+/* Detect function prototypes */
+
+/* Estimate the LSB embedding rate of one image on num_threads threads */
+Status detect_image(const char *fname, int num_threads, DetectResult *result);
+
+/* Print the estimates of every image named in the NULL terminated list */
+Status do_detect(char *fnames[], int num_threads);
+
+#endif
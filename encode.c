@@ -1,6 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "encode.h"
+#include "block_io.h"
+#include "mmap_io.h"
+#include "lsb_kernels.h"
+#include "parallel_encode.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "stream_io.h"
+#include "png_io.h"
+#include "compress.h"
+#include "aead.h"
+#include "crc32c.h"
+#include "fec.h"
+#include "container.h"
+#include "scatter.h"
 #include "types.h"
 #include "common.h"
 
@@ -8,9 +23,9 @@
 
 /* Get image size
  * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Output: width * height * 3, the colour bytes that can carry bits
+ * Description: the BMP and DIB headers are parsed by read_bmp_layout,
+ * row padding and alpha bytes are not counted
  */
 /*Encoding steps
 1.open the source file,secret file and stego file
@@ -24,11 +39,13 @@
   check if source image can hold secret data
   return success/failure status
 3.copy bmp header to stego image
-  read 54 bytes from source image
-  write 54 bytes to stego image
+  read everything before the pixel array (bfOffBits) from source image
+  write it to stego image
   return success/failure status
 4.encode magic string to stego image
-  read 8 bytes at a time from source image
+  payload goes into carriers, the colour bytes of the pixel array,
+  row padding and alpha bytes are copied through untouched
+  read 8 carriers at a time from source image
   encode each byte of magic string to 8 bytes of image data
   write modified 8 bytes to stego image
   return success/failure status
@@ -59,66 +76,110 @@
 10.close all files
     close source image file,secret file,stego image file
 11.return success/failure status*/
-uint get_image_size_for_bmp(FILE *fptr_image)
+long get_image_size_for_bmp(FILE *fptr_image)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);
+    BmpLayout layout;
+    if (read_bmp_layout(fptr_image, &layout) == e_failure)
+        return 0;
 
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
+    printf("width = %d\n", layout.width);
+    printf("height = %d\n", layout.height);
 
     // Return image capacity
-    return width * height * 3;
+    return layout.capacity;
 }
 
 
 /* Get file size */
-uint get_file_size(FILE *fptr)
+long get_file_size(FILE *fptr)
 {
-    fseek(fptr, 0, SEEK_END); // Find the size of secret file data
-    return ftell(fptr);
+    fseeko(fptr, 0, SEEK_END); // Find the size of secret file data, past 2 GB too
+    return ftello(fptr);
 }
 
 
 /* Validate and store file names */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    if (argv[2] == NULL || strstr(argv[2], ".bmp") == NULL)
+    // "-" is stdin for the source image (or the secret) and stdout for the stego image
+    if (argv[2] == NULL || (!is_stream_name(argv[2]) && strstr(argv[2], ".bmp") == NULL && !is_png_name(argv[2])))
         return e_failure;
     encInfo->src_image_fname = argv[2];
+    int streaming = is_stream_name(argv[2]) || (argv[3] != NULL && argv[4] != NULL && is_stream_name(argv[4]));
 
     if (argv[3] == NULL)
         return e_failure;
-    if (strstr(argv[3], ".txt") == NULL &&
+    if (is_stream_name(argv[3]) && is_stream_name(argv[2]))
+        return e_failure;
+    // Pipelines hand over any payload (/dev/fd/N included), files keep the old list
+    if (!streaming && !is_stream_name(argv[3]) &&
+        strstr(argv[3], ".txt") == NULL &&
         strstr(argv[3], ".c") == NULL &&
         strstr(argv[3], ".h") == NULL &&
         strstr(argv[3], ".sh") == NULL)
         return e_failure;
     encInfo->secret_fname = argv[3];
 
-    // Extract and store extension
+    // Extract and store extension, several secret files go in one container
+    char *extn = strrchr(encInfo->secret_fname, '.');
+    if (extn == NULL || strchr(extn, '/') != NULL)
+        extn = STREAM_DEFAULT_EXTN;
+    if (encInfo->num_extra > 0)
+        extn = CONTAINER_EXTN;
+    if (strlen(extn) >= sizeof(encInfo->extn_secret_file))
+        return e_failure;
+    strcpy(encInfo->extn_secret_file, extn);
 
     if (argv[4] != NULL)
     {
-        if (strstr(argv[4], ".bmp") == NULL)
+        if (!is_stream_name(argv[4]) && strstr(argv[4], ".bmp") == NULL && !is_png_name(argv[4]))
             return e_failure;
         encInfo->stego_image_fname = argv[4];
     }
+    else if (streaming)
+        encInfo->stego_image_fname = STREAM_NAME;
+    else if (is_png_name(argv[2]))
+        encInfo->stego_image_fname = "stego.png";
     else
         encInfo->stego_image_fname = "stego.bmp";
 
+    // 1 LSB per byte unless asked otherwise, that keeps the original layout
+    if (encInfo->format.lsb_bits == 0)
+        encInfo->format.lsb_bits = 1;
+    if (encInfo->compress_level != 0)
+        encInfo->format.flags |= FORMAT_FLAG_COMPRESSED;
+    if (encInfo->passphrase != NULL)
+        encInfo->format.flags |= FORMAT_FLAG_ENCRYPTED;
+    // The permutation is keyed from the passphrase too
+    if (encInfo->use_scatter)
+    {
+        if (encInfo->passphrase == NULL)
+            return e_failure;
+        encInfo->format.flags |= FORMAT_FLAG_SCATTERED;
+    }
+    if (encInfo->use_checksum)
+        encInfo->format.flags |= FORMAT_FLAG_CHECKSUM;
+    if (encInfo->use_fec)
+        encInfo->format.flags |= FORMAT_FLAG_FEC;
+    if (encInfo->num_extra > 0)
+        encInfo->format.flags |= FORMAT_FLAG_CONTAINER;
+    if (select_format(&encInfo->format, encInfo->format.lsb_bits, encInfo->format.flags) == e_failure)
+        return e_failure;
+
+    if (encInfo->io_block_size == 0)
+        encInfo->io_block_size = DEFAULT_IO_BLOCK_SIZE;
+    encInfo->src_io_buffer = NULL;
+    encInfo->stego_io_buffer = NULL;
+
     return e_success;
 }
 
 /* Open all required files */
 Status open_files(EncodeInfo *encInfo)
 {
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+
     // Src Image file
     encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
     // Do Error handling
@@ -151,28 +212,279 @@ Status open_files(EncodeInfo *encInfo)
 
         return e_failure;
     }
+
+    // Block buffering for both images, every encode stage goes through it
+    if (setup_block_io(encInfo->fptr_src_image, &encInfo->src_io_buffer, encInfo->io_block_size) == e_failure ||
+        setup_block_io(encInfo->fptr_stego_image, &encInfo->stego_io_buffer, encInfo->io_block_size) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to set up block I/O\n");
+
+        return e_failure;
+    }
     return e_success;
 }
 
+/* Close all files and free the stream buffers */
+void close_files(EncodeInfo *encInfo)
+{
+    if (encInfo->fptr_src_image != NULL)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret != NULL)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image != NULL)
+        fclose(encInfo->fptr_stego_image);
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+
+    // Buffers must outlive the streams using them
+    if (!encInfo->keep_io_buffers)
+    {
+        free(encInfo->src_io_buffer);
+        free(encInfo->stego_io_buffer);
+        encInfo->src_io_buffer = NULL;
+        encInfo->stego_io_buffer = NULL;
+    }
+}
+
 
 /* Check if source image has enough capacity */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
-    char *extn = strstr(encInfo->secret_fname, ".");
-    int extn_size = strlen(extn);
+    if (read_bmp_layout(encInfo->fptr_src_image, &encInfo->layout) == e_failure)
+    {
+        printf("ERROR:Unsupported BMP image %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    return check_layout_capacity(encInfo);
+}
 
-    int total_bytes = 54 + (strlen(MAGIC_STRING) * 8) + 32 +(extn_size * 8) + 32 +(encInfo->size_secret_file * 8);
+/* Compress the secret file
+ * Input: secret file of size_secret_file bytes, payload bytes the image can hold
+ * Description: the compressed payload goes to a temporary file that replaces
+ * fptr_secret, so every encoder reads it like the original. The automatic
+ * level starts at compress_auto_level and goes to COMPRESS_LEVEL_MAX only
+ * when the result does not fit. A payload that does not shrink is kept
+ * raw and FORMAT_FLAG_COMPRESSED is dropped. A caller that owns both
+ * streams (fptr_spool set) gets its spool rewound and filled instead of
+ * a temporary file, and closes them itself
+ */
+static Status compress_secret_file(EncodeInfo *encInfo, long available)
+{
+    int level = encInfo->compress_level;
+    if (level == COMPRESS_LEVEL_AUTO)
+        level = compress_auto_level(encInfo->size_secret_file);
 
-    if (encInfo->image_capacity > total_bytes)
+    FILE *fptr_spool = NULL;
+    long size;
+    for (;;)
     {
-        return e_success;
+        if (encInfo->fptr_spool != NULL)
+        {
+            fptr_spool = encInfo->fptr_spool;
+            rewind(fptr_spool);
+        }
+        else if ((fptr_spool = tmpfile()) == NULL)
+        {
+            perror("tmpfile");
+            return e_failure;
+        }
+        rewind(encInfo->fptr_secret);
+        size = compress_stream(encInfo->fptr_secret, encInfo->size_secret_file, fptr_spool, level, encInfo->arena);
+        if (size < 0)
+        {
+            if (fptr_spool != encInfo->fptr_spool)
+                fclose(fptr_spool);
+            return e_failure;
+        }
+        if (size <= available || encInfo->compress_level != COMPRESS_LEVEL_AUTO || level == COMPRESS_LEVEL_MAX)
+            break;
+        if (fptr_spool != encInfo->fptr_spool)
+            fclose(fptr_spool);
+        level = COMPRESS_LEVEL_MAX;
+    }
+
+    if (size >= encInfo->size_secret_file)
+    {
+        if (fptr_spool != encInfo->fptr_spool)
+            fclose(fptr_spool);
+        return select_format(&encInfo->format, encInfo->format.lsb_bits, encInfo->format.flags & ~FORMAT_FLAG_COMPRESSED);
+    }
+    if (!encInfo->quiet)
+        printf("INFO: Secret data compressed from %ld to %ld bytes (level %d)\n", encInfo->size_secret_file, size, level);
+    if (fptr_spool != encInfo->fptr_spool)
+        fclose(encInfo->fptr_secret);
+    encInfo->fptr_secret = fptr_spool;
+    encInfo->size_secret_file = size;
+    return e_success;
+}
+
+/* Code the secret data with FEC
+ * Input: secret stream of size_secret_file stored bytes
+ * Description: the coded frames go to a temporary file that replaces
+ * fptr_secret, like a compressed payload. A payload to encrypt is sealed
+ * on its way in, as the encoders would, so the parity covers the sealed
+ * bytes; sealed is set and the encoders take the stream as it is
+ */
+static Status fec_secret_file(EncodeInfo *encInfo)
+{
+    FecEncoder *enc = scratch_alloc(encInfo->arena, sizeof(FecEncoder));
+    FILE *fptr_coded = tmpfile();
+    if (enc == NULL || fptr_coded == NULL)
+    {
+        perror("tmpfile");
+        scratch_free(encInfo->arena, enc);
+        if (fptr_coded != NULL)
+            fclose(fptr_coded);
+        return e_failure;
+    }
+
+    Status ret = e_success;
+    fec_init(enc, fptr_coded);
+    rewind(encInfo->fptr_secret);
+    if (encInfo->format.flags & FORMAT_FLAG_ENCRYPTED)
+    {
+        unsigned char header[AEAD_HEADER_SIZE];
+        unsigned char *segment = scratch_alloc(encInfo->arena, AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+        aead_put_header(&encInfo->aead, header);
+        ret = (segment != NULL) ? fec_write(enc, header, AEAD_HEADER_SIZE) : e_failure;
+        for (long i = 0; ret == e_success && i < aead_segments(&encInfo->aead); i++)
+        {
+            size_t n = aead_segment_length(&encInfo->aead, i);
+            if (fread(segment, 1, n, encInfo->fptr_secret) != n)
+                ret = e_failure;
+            else
+            {
+                aead_seal_segment(&encInfo->aead, i, segment, n);
+                ret = fec_write(enc, segment, n + AEAD_TAG_SIZE);
+            }
+        }
+        scratch_free(encInfo->arena, segment);
+        encInfo->sealed = 1;
     }
     else
+    {
+        for (long left = encInfo->size_secret_file; ret == e_success && left > 0;)
+        {
+            size_t n = (left < SECRET_CHUNK_SIZE) ? left : SECRET_CHUNK_SIZE;
+            if (fread(encInfo->secret_data, 1, n, encInfo->fptr_secret) != n)
+                ret = e_failure;
+            else
+                ret = fec_write(enc, encInfo->secret_data, n);
+            left -= n;
+        }
+    }
+    // The parallel encoder preads the file, nothing may stay in the stdio buffer
+    if (ret == e_success && (fec_finish(enc) == e_failure || fflush(fptr_coded) != 0))
+        ret = e_failure;
+    scratch_free(encInfo->arena, enc);
+    if (ret == e_failure)
+    {
+        fclose(fptr_coded);
+        return e_failure;
+    }
+
+    // Only streams this encode opened are closed, FEC is not offered to callers owning theirs
+    if (encInfo->fptr_spool == NULL)
+        fclose(encInfo->fptr_secret);
+    encInfo->fptr_secret = fptr_coded;
+    encInfo->size_secret_file = fec_coded_size(encInfo->size_secret_file);
+    return e_success;
+}
+
+/* Carriers taken by everything before the secret data */
+long header_carriers_for(const StegFormat *format, int extn_size)
+{
+    // Magic and format words use 1 LSB per carrier, the rest lsb_bits
+    return (strlen(MAGIC_STRING) * 8) + format_words_size(format) +
+           image_bytes_for(4 + extn_size + format_size_field_size(format), format);
+}
+
+/* Check the secret file against the capacity of an already parsed layout */
+Status check_layout_capacity(EncodeInfo *encInfo)
+{
+    if (!encInfo->quiet)
+    {
+        printf("width = %d\n", encInfo->layout.width);
+        printf("height = %d\n", encInfo->layout.height);
+    }
+
+    encInfo->image_capacity = encInfo->layout.capacity;
+    encInfo->sealed = 0;
+    // The container replaces fptr_secret, so every encoder reads it like one file
+    if (encInfo->format.flags & FORMAT_FLAG_CONTAINER)
+    {
+        stats_begin(encInfo->stats, "build_container");
+        FILE *fptr_container = container_build(encInfo->fptr_secret, encInfo->secret_fname, encInfo->extra_fnames,
+                                               encInfo->num_extra);
+        if (fptr_container == NULL)
+        {
+            printf("ERROR:Unable to pack the secret files\n");
+            return e_failure;
+        }
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = fptr_container;
+    }
+    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    int extn_size = strlen(encInfo->extn_secret_file);
+
+    long header_carriers = header_carriers_for(&encInfo->format, extn_size);
+    if (encInfo->format.flags & FORMAT_FLAG_COMPRESSED)
+    {
+        long available = (encInfo->image_capacity - header_carriers) * encInfo->format.lsb_bits / 8 -
+                         format_checksum_size(&encInfo->format);
+        if (encInfo->format.flags & FORMAT_FLAG_FEC)
+            available = fec_data_room(available);
+        if (encInfo->format.flags & FORMAT_FLAG_ENCRYPTED)
+            available -= AEAD_HEADER_SIZE + (available / AEAD_SEGMENT_SIZE + 1) * AEAD_TAG_SIZE;
+        stats_begin(encInfo->stats, "compress_secret_file");
+        if (compress_secret_file(encInfo, available) == e_failure)
+        {
+            printf("ERROR:Unable to compress secret file\n");
+            return e_failure;
+        }
+        header_carriers = header_carriers_for(&encInfo->format, extn_size);
+    }
+    // Sealed payload: salt and nonce, then a tag after every segment
+    if (encInfo->format.flags & FORMAT_FLAG_ENCRYPTED)
+    {
+        stats_begin(encInfo->stats, "derive_key");
+        if (aead_init_seal(&encInfo->aead, encInfo->passphrase, encInfo->size_secret_file) == e_failure)
+        {
+            printf("ERROR:Unable to set up encryption\n");
+            return e_failure;
+        }
+        encInfo->size_secret_file = aead_sealed_size(encInfo->size_secret_file);
+    }
+    // Coded payload: parity for every frame of the stored bytes
+    if (encInfo->format.flags & FORMAT_FLAG_FEC)
+    {
+        stats_begin(encInfo->stats, "fec_secret_file");
+        if (fec_secret_file(encInfo) == e_failure)
+        {
+            printf("ERROR:Unable to code the secret file\n");
+            return e_failure;
+        }
+    }
+    // Stored sizes past the 32 bit field take the 64 bit one
+    if (select_size_field(&encInfo->format, encInfo->size_secret_file) == e_failure)
+        return e_failure;
+    header_carriers = header_carriers_for(&encInfo->format, extn_size);
+    long total_carriers = header_carriers + image_bytes_for(encInfo->size_secret_file + format_checksum_size(&encInfo->format),
+                                                            &encInfo->format);
+
+    if (encInfo->image_capacity < total_carriers)
     {
         return e_failure;
     }
+    // Data carriers are spread over everything after the header fields
+    if (encInfo->format.flags & FORMAT_FLAG_SCATTERED)
+    {
+        stats_begin(encInfo->stats, "derive_scatter_key");
+        return scatter_init(&encInfo->scatter, encInfo->passphrase, &encInfo->layout, header_carriers,
+                            image_bytes_for(1, &encInfo->format));
+    }
+    return e_success;
 }
 
 /* Copy BMP header (54 bytes) */
@@ -184,16 +496,24 @@ Status check_capacity(EncodeInfo *encInfo)
     fwrite(buffer, 54, 1, fptr_dest_image);
     return e_success;
 }*/
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, off_t header_size)
 {
-    char buffer[54];
+    char buffer[1024];
     rewind(fptr_src_image);
 
-    fread(buffer, 54, 1, fptr_src_image);
+    // V4/V5 headers, bitfield masks and gaps all go across as they are
+    while (header_size > 0)
+    {
+        size_t n = (header_size < sizeof(buffer)) ? header_size : sizeof(buffer);
+        if (read_image_block(fptr_src_image, buffer, n) == e_failure)
+            return e_failure;
 
-    fwrite(buffer, 54, 1, fptr_dest_image);
+        if (write_image_block(fptr_dest_image, buffer, n) == e_failure)
+            return e_failure;
+        header_size -= n;
+    }
 
-    if (ftell(fptr_src_image) == ftell(fptr_dest_image))
+    if (ftello(fptr_src_image) == ftello(fptr_dest_image))
     {
         return e_success;
     }
@@ -207,35 +527,47 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 /* Encode a single byte into 8 pixels’ LSBs */
 Status encode_byte_to_lsb(char data, char *image_buffer)
 {
-    for (int i = 0; i < 8; i++)
-    {
-        image_buffer[i] = (image_buffer[i] & (~1)) | ((data >> i) & 1); //set lsb to data bit
-    }
+    encode_bytes_to_lsb(&data, 1, image_buffer); //set lsb to data bit
     return e_success;
 }
 
 /* Encode integer size into 32 pixels’ LSBs */
 Status encode_size_to_lsb(int size, char *imageBuffer)
 {
-    for (int i = 0; i < 32; i++)
-    {
-        imageBuffer[i] = (imageBuffer[i] & (~1)) | ((size >> i) & 1); //set lsb to size bit
-    }
+    // Bit i of size goes to byte i, so the 4 bytes go least significant first
+    char bytes[4] = {size, size >> 8, size >> 16, size >> 24};
+    encode_bytes_to_lsb(bytes, 4, imageBuffer); //set lsb to size bit
+    return e_success;
+}
+
+/* Read the next n carriers of the src image, window keeps the image bytes around them */
+static Status read_next_carriers(EncodeInfo *encInfo, char *window, char *carriers, size_t n)
+{
+    return read_carriers(encInfo->fptr_src_image, &encInfo->layout, encInfo->carrier_pos, n, window, carriers);
+}
+
+/* Write the next n carriers to the stego image and move past them */
+static Status write_next_carriers(EncodeInfo *encInfo, char *window, const char *carriers, size_t n)
+{
+    if (write_carriers(encInfo->fptr_stego_image, &encInfo->layout, encInfo->carrier_pos, n, window, carriers) == e_failure)
+        return e_failure;
+    encInfo->carrier_pos += n;
     return e_success;
 }
 
 /* Encode magic string */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
-    // Move past BMP header
-    fseek(encInfo->fptr_src_image, 54, SEEK_SET);
+    // copy_bmp_header left both images at the first carrier, no seek so pipes work
+    encInfo->carrier_pos = 0;
 
     unsigned char buffer[8];
+    char window[CARRIER_SPAN_MAX(8)];
 
     for (int i = 0; i < strlen(magic_string); i++)
     {
-        // Read 8 bytes from source image
-        if (fread(buffer, 1, 8, encInfo->fptr_src_image) != 8)
+        // Read 8 carriers from source image
+        if (read_next_carriers(encInfo, window, (char *)buffer, 8) == e_failure)
             return e_failure;
 
         // Encode 1 byte (magic_string[i]) into the 8 image bytes
@@ -245,7 +577,8 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
         }
 
         // Write modified bytes into stego image
-        fwrite(buffer, 1, 8, encInfo->fptr_stego_image);
+        if (write_next_carriers(encInfo, window, (char *)buffer, 8) == e_failure)
+            return e_failure;
     }
 
     return e_success;
@@ -264,126 +597,285 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 } */
 
 
+/* Encode format and flags words
+ * Description: only layout version 2 has them, they always use 1 LSB
+ * per byte so the decoder can read them before it knows lsb_bits
+ */
+Status encode_format_words(EncodeInfo *encInfo)
+{
+    char buffer[FORMAT_WORDS_SIZE];
+    char window[CARRIER_SPAN_MAX(FORMAT_WORDS_SIZE)];
+    if (encInfo->format.version < 2)
+        return e_success;
+
+    if (read_next_carriers(encInfo, window, buffer, FORMAT_WORDS_SIZE) == e_failure)
+        return e_failure;
+    encode_uint32_to_nlsb(format_word(&encInfo->format), buffer, 1);
+    encode_uint32_to_nlsb(encInfo->format.flags, buffer + 32, 1);
+    return write_next_carriers(encInfo, window, buffer, FORMAT_WORDS_SIZE);
+}
+
 /* Encode file extension size */
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
     char buffer[32];
-    fread(buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
-    return e_success;
+    char window[CARRIER_SPAN_MAX(32)];
+    size_t len = image_bytes_for(4, &encInfo->format);
+    if (read_next_carriers(encInfo, window, buffer, len) == e_failure)
+        return e_failure;
+    encode_uint32_to_nlsb(size, buffer, encInfo->format.lsb_bits);
+    return write_next_carriers(encInfo, window, buffer, len);
 }
 
 /* Encode file extension */
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
-    char buffer[8];
-    for (int i = 0; i < strlen(file_extn); i++)
-    {
-        fread(buffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(file_extn[i], buffer);
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
-    }
-    return e_success;
+    char buffer[8 * sizeof(encInfo->extn_secret_file)];
+    char window[CARRIER_SPAN_MAX(8 * sizeof(encInfo->extn_secret_file))];
+    size_t extn_size = strlen(file_extn);
+    size_t len = image_bytes_for(extn_size, &encInfo->format);
+
+    if (extn_size > sizeof(encInfo->extn_secret_file))
+        return e_failure;
+    if (read_next_carriers(encInfo, window, buffer, len) == e_failure)
+        return e_failure;
+    encode_bytes_to_nlsb(file_extn, extn_size, buffer, encInfo->format.lsb_bits);
+    return write_next_carriers(encInfo, window, buffer, len);
 }
 
 /* Encode secret file size */
 Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
 {
-    char buffer[32];
-    fread(buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(file_size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
-    return e_success;
+    char buffer[FORMAT_SIZE_FIELD_MAX * 8];
+    char window[CARRIER_SPAN_MAX(FORMAT_SIZE_FIELD_MAX * 8)];
+    size_t len = image_bytes_for(format_size_field_size(&encInfo->format), &encInfo->format);
+    if (read_next_carriers(encInfo, window, buffer, len) == e_failure)
+        return e_failure;
+    encode_size_field(file_size, buffer, &encInfo->format);
+    return write_next_carriers(encInfo, window, buffer, len);
 }
 
-/* Encode secret file data */
-Status encode_secret_file_data(EncodeInfo *encInfo)
+/* Encode data bytes
+ * Description: SECRET_CHUNK_SIZE bytes at a time, each chunk goes into the
+ * next 8 * chunk / lsb_bits carriers of the cover image. Every stored
+ * byte passes here, so the checksum is kept up to date on the way
+ */
+Status encode_data_bytes(EncodeInfo *encInfo, const char *data, size_t n)
 {
-    rewind(encInfo->fptr_secret);
-    fread(encInfo->secret_data, encInfo->size_secret_file, 1, encInfo->fptr_secret); //read secret file data to buffer 
+    char buffer[SECRET_CHUNK_SIZE * 8];
+    char window[CARRIER_SPAN_MAX(SECRET_CHUNK_SIZE * 8)];
 
-    char buffer[8];
-    for (long i = 0; i < encInfo->size_secret_file; i++)
+    if (encInfo->format.flags & FORMAT_FLAG_CHECKSUM)
+        encInfo->checksum = crc32c_update(encInfo->checksum, data, n);
+    while (n > 0)
     {
-        fread(buffer, 8, 1, encInfo->fptr_src_image); 
-        encode_byte_to_lsb(encInfo->secret_data[i], buffer); //encode secret data byte to lsb
-        fwrite(buffer, 8, 1, encInfo->fptr_stego_image);
+        size_t chunk = (n < SECRET_CHUNK_SIZE) ? n : SECRET_CHUNK_SIZE;
+        size_t len = image_bytes_for(chunk, &encInfo->format);
+        if (read_next_carriers(encInfo, window, buffer, len) == e_failure)
+            return e_failure;
+        encode_bytes_to_nlsb(data, chunk, buffer, encInfo->format.lsb_bits); //encode the chunk of secret data to lsb
+        if (write_next_carriers(encInfo, window, buffer, len) == e_failure)
+            return e_failure;
+        data += chunk;
+        n -= chunk;
     }
     return e_success;
 }
 
-/* Copy the remaining image data */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+/* Encode the checksum of all data bytes after them, like the file size */
+Status encode_checksum(EncodeInfo *encInfo)
 {
-    char ch;
-    while (fread(&ch, 1, 1, fptr_src)) //read byte by byte till EOF
+    char buffer[32];
+    char window[CARRIER_SPAN_MAX(32)];
+    size_t len = image_bytes_for(FORMAT_CHECKSUM_SIZE, &encInfo->format);
+    if (!(encInfo->format.flags & FORMAT_FLAG_CHECKSUM))
+        return e_success;
+    if (read_next_carriers(encInfo, window, buffer, len) == e_failure)
+        return e_failure;
+    encode_uint32_to_nlsb(encInfo->checksum, buffer, encInfo->format.lsb_bits);
+    return write_next_carriers(encInfo, window, buffer, len);
+}
+
+/* Encode an encrypted payload
+ * Description: salt and nonce first, then every segment of the secret
+ * file is sealed as soon as it is read and encoded with its tag, so the
+ * file is read once and never exists encrypted anywhere but in the image
+ */
+static Status encode_sealed_file_data(EncodeInfo *encInfo)
+{
+    unsigned char header[AEAD_HEADER_SIZE];
+    unsigned char *segment = scratch_alloc(encInfo->arena, AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    if (segment == NULL)
+        return e_failure;
+
+    aead_put_header(&encInfo->aead, header);
+    Status ret = encode_data_bytes(encInfo, (char *)header, AEAD_HEADER_SIZE);
+    rewind(encInfo->fptr_secret);
+    for (long i = 0; ret == e_success && i < aead_segments(&encInfo->aead); i++)
     {
-        fwrite(&ch, 1, 1, fptr_dest);//write to stego image
+        size_t n = aead_segment_length(&encInfo->aead, i);
+        if (fread(segment, 1, n, encInfo->fptr_secret) != n)
+        {
+            ret = e_failure;
+            break;
+        }
+        aead_seal_segment(&encInfo->aead, i, segment, n);
+        ret = encode_data_bytes(encInfo, (char *)segment, n + AEAD_TAG_SIZE);
     }
-    return e_success;
+    scratch_free(encInfo->arena, segment);
+    return ret;
 }
 
-/* Main encoding driver */
-Status do_encoding(EncodeInfo *encInfo)
+/* Encode secret file data
+ * Description: the secret file is streamed in SECRET_CHUNK_SIZE chunks,
+ * each chunk is encoded into the next 8 * chunk / lsb_bits carriers of the
+ * cover image, so memory use does not depend on the secret file size.
+ * The checksum goes right after the last chunk
+ */
+Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-    if (open_files(encInfo) == e_failure)
+    long remaining = encInfo->size_secret_file;
+
+    encInfo->checksum = 0;
+    if ((encInfo->format.flags & FORMAT_FLAG_ENCRYPTED) && !encInfo->sealed)
+        return (encode_sealed_file_data(encInfo) == e_success) ? encode_checksum(encInfo) : e_failure;
+
+    rewind(encInfo->fptr_secret);
+    while (remaining > 0)
     {
-        printf("ERROR:Unable to open files\n");
-        return e_failure;
+        size_t n = (remaining < SECRET_CHUNK_SIZE) ? remaining : SECRET_CHUNK_SIZE;
+        if (fread(encInfo->secret_data, 1, n, encInfo->fptr_secret) != n) //read next chunk of secret data
+            return e_failure;
+        if (encode_data_bytes(encInfo, encInfo->secret_data, n) == e_failure)
+            return e_failure;
+        remaining -= n;
     }
+    return encode_checksum(encInfo);
+}
 
+/* Copy the remaining image data */
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, size_t block_size)
+{
+    return copy_file_blocks(fptr_src, fptr_dest, block_size); //copy in blocks till EOF
+}
+
+/* Check capacity and encode everything that comes before the secret data */
+Status encode_header_fields(EncodeInfo *encInfo)
+{
+    stats_begin(encInfo->stats, "check_capacity");
     if (check_capacity(encInfo) == e_failure)
     {
         printf("ERROR:Unable to check capacity\n");
         return e_failure;
     }
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    stats_begin(encInfo->stats, "copy_bmp_header");
+    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, carrier_offset(&encInfo->layout, 0)) == e_failure)
     {
         printf("ERROR:Unable to copy BMP header\n");
         return e_failure;
     }
+    return encode_embedded_fields(encInfo);
+}
+
+/* Encode magic string, format words, extension and size from the first carrier on */
+Status encode_embedded_fields(EncodeInfo *encInfo)
+{
+    stats_begin(encInfo->stats, "encode_magic_string");
     if (encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
     {
         printf("ERROR:Unable to encode magic string\n");
         return e_failure;
     }
 
+    stats_begin(encInfo->stats, "encode_format_words");
+    if (encode_format_words(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to encode format words\n");
+        return e_failure;
+    }
+
     int extn_size = strlen(encInfo->extn_secret_file);
 
+    stats_begin(encInfo->stats, "encode_secret_file_extn_size");
     if (encode_secret_file_extn_size(extn_size, encInfo) == e_failure)
     {
         printf("ERROR:Unable to encode secret file extension size\n");
         return e_failure;
     }
 
+    stats_begin(encInfo->stats, "encode_secret_file_extn");
     if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_failure)
     {
         printf("ERROR:Unable to encode secret file extension\n");
         return e_failure;
     }
 
+    stats_begin(encInfo->stats, "encode_secret_file_size");
     if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_failure)
     {
         printf("ERROR:Unable to encode secret file size\n");
         return e_failure;
     }
 
+    return e_success;
+}
+
+/* Run the encoding stages on already opened files */
+static Status encode_stages(EncodeInfo *encInfo)
+{
+    if (encode_header_fields(encInfo) == e_failure)
+        return e_failure;
+
+    stats_begin(encInfo->stats, "encode_secret_file_data");
     if (encode_secret_file_data(encInfo) == e_failure)
     {
         printf("ERROR:Unable to encode secret file data\n");
         return e_failure;
     }
 
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    stats_begin(encInfo->stats, "copy_remaining_img_data");
+    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->io_block_size) == e_failure)
     {
         printf("ERROR:Unable to copy remaining image data\n");
         return e_failure;
     }
 
+    // Make sure the last block reached the stego image
+    if (fflush(encInfo->fptr_stego_image) != 0)
+    {
+        printf("ERROR:Unable to write stego image\n");
+        return e_failure;
+    }
+
     return e_success;
-fclose(encInfo->fptr_src_image);
-fclose(encInfo->fptr_secret);
-fclose(encInfo->fptr_stego_image);
+}
 
-}
\ No newline at end of file
+/* Main encoding driver */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    // PNG scanlines are inflated and deflated in order, one forward pass like a pipe
+    if (is_stream_name(encInfo->src_image_fname) || is_stream_name(encInfo->secret_fname) ||
+        is_stream_name(encInfo->stego_image_fname) || is_png_name(encInfo->src_image_fname) ||
+        is_png_name(encInfo->stego_image_fname))
+        return do_encoding_stream(encInfo);
+    // Scattered carriers are reached at random, through the mapped image
+    if (encInfo->use_mmap || encInfo->format.flags & FORMAT_FLAG_SCATTERED)
+        return do_encoding_mmap(encInfo);
+    if (encInfo->num_threads > 1)
+        return do_encoding_parallel(encInfo);
+
+    stats_begin(encInfo->stats, "open_files");
+    if (open_files(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to open files\n");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    Status ret = encode_stages(encInfo);
+
+    stats_begin(encInfo->stats, "close_files");
+    close_files(encInfo);
+    stats_end(encInfo->stats);
+    return ret;
+}
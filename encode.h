@@ -3,6 +3,15 @@
 #include <stdio.h>
 
 #include "types.h" // Contains user defined types
+#include "stats.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "aead.h"
+#include "scatter.h"
+#include "arena.h"
+
+/* Secret file bytes read and encoded per chunk */
+#define SECRET_CHUNK_SIZE 4096
 
 /*
  * Structure to store information required for
@@ -16,18 +25,44 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname; // To store the src image name
     FILE *fptr_src_image;  // To store the address of the src image
-    uint image_capacity;   // To store the size of image
+    long image_capacity;   // To store the size of image
+    BmpLayout layout;      // To store the pixel layout of the src image
+    long carrier_pos;      // To store the next carrier to encode into
 
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
     FILE *fptr_secret;        // To store the secret file address
     char extn_secret_file[5]; // To store the Secret file extension
-    char secret_data[100];    // To store the secret data
+    char secret_data[SECRET_CHUNK_SIZE]; // To store one chunk of the secret data
     long size_secret_file;    // To store the size of the secret data
+    char **extra_fnames;      // To store more secret files packed with it, NULL for none
+    int num_extra;            // To store the number of extra_fnames
 
     /* Stego Image Info */
     char *stego_image_fname; // To store the dest file name
     FILE *fptr_stego_image;  // To store the address of stego image
+    StegFormat format;       // To store the embedded layout (LSBs per byte, flags)
+
+    /* Block I/O Info */
+    size_t io_block_size;   // To store the I/O block size in bytes
+    char *src_io_buffer;    // To store the src image stream buffer
+    char *stego_io_buffer;  // To store the stego image stream buffer
+    int keep_io_buffers;    // To keep the stream buffers for the next encode
+    int use_mmap;           // To select the memory mapped encoder
+    int num_threads;        // To store the number of encode threads
+    int compress_level;     // To store the compression level, 0 for none
+    const char *passphrase; // To store the encryption passphrase, NULL for none
+    AeadInfo aead;          // To store the key and nonce of an encrypted payload
+    int use_scatter;        // To permute the data carriers with the passphrase
+    ScatterInfo scatter;    // To store the data carrier permutation
+    int use_checksum;       // To add a CRC32C of the data after it
+    uint32_t checksum;      // To store the CRC32C of the data encoded so far
+    int use_fec;            // To Reed-Solomon code the stored data
+    int sealed;             // To store 1 once fptr_secret holds the sealed payload (coded ones)
+    StatsInfo *stats;       // To store per stage counters, NULL when off
+    Arena *arena;           // To store per call scratch buffers, NULL to malloc them
+    FILE *fptr_spool;       // To store a reusable spool for compressed data, NULL for a tmpfile
+    int quiet;              // To skip the INFO lines (library calls)
 
 } EncodeInfo;
 
@@ -42,21 +77,33 @@ Status do_encoding(EncodeInfo *encInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close i/p and o/p files and release their buffers */
+void close_files(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
+/* Carriers taken by the magic string and all fields before the secret data */
+long header_carriers_for(const StegFormat *format, int extn_size);
+
+/* check capacity once encInfo->layout is known */
+Status check_layout_capacity(EncodeInfo *encInfo);
+
 /* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+long get_image_size_for_bmp(FILE *fptr_image);
 
 /* Get file size */
-uint get_file_size(FILE *fptr);
+long get_file_size(FILE *fptr);
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Copy bmp image headers (everything before the pixel array) */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, off_t header_size);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Encode format and flags words (layout version 2 only) */
+Status encode_format_words(EncodeInfo *encInfo);
+
 /*Encode extension size*/
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 
@@ -66,6 +113,18 @@ Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 /* Encode secret file size */
 Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
 
+/* Check capacity and encode all fields before the secret data */
+Status encode_header_fields(EncodeInfo *encInfo);
+
+/* Encode the fields before the secret data, images already at the first carrier */
+Status encode_embedded_fields(EncodeInfo *encInfo);
+
+/* Encode n bytes of data into the next carriers */
+Status encode_data_bytes(EncodeInfo *encInfo, const char *data, size_t n);
+
+/* Encode the checksum of the data after it (with FORMAT_FLAG_CHECKSUM only) */
+Status encode_checksum(EncodeInfo *encInfo);
+
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
@@ -76,6 +135,6 @@ Status encode_byte_to_lsb(char data, char *image_buffer);
 Status encode_size_to_lsb(int size, char *imageBuffer);
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, size_t block_size);
 
 #endif
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <string.h>
+#include "fec.h"
+#include "types.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FEC_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/* GF(256) reduction polynomial x^8 + x^4 + x^3 + x^2 + 1, alpha = 2 */
+#define GF_POLY 0x11D
+
+/* Powers of alpha (twice over, so a sum of two logs needs no mod) and logs */
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+
+/* Generator of the frame code, prod (x + alpha^i) for i < FEC_PARITY,
+ * coefficient of x^i at index i */
+static unsigned char gen_parity[FEC_PARITY + 1];
+
+/* Split product tables of the frame code's feedback taps: tap j multiplies
+ * by gen_parity[FEC_PARITY - 1 - j], tap_lo[j][x] is the product with x and
+ * tap_hi[j][x] the product with x << 4, so a * c = lo[a & 15] ^ hi[a >> 4].
+ * 32 bytes a row, the 16 entries twice, to fill an AVX2 register */
+static unsigned char tap_lo[FEC_PARITY][32];
+static unsigned char tap_hi[FEC_PARITY][32];
+
+/* Function Definitions */
+
+static inline unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    return (a && b) ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+}
+
+static inline unsigned char gf_div(unsigned char a, unsigned char b)
+{
+    return a ? gf_exp[gf_log[a] + 255 - gf_log[b]] : 0;
+}
+
+/* Generator polynomial with nroots roots alpha^0 .. alpha^(nroots - 1) */
+static void build_generator(unsigned char *gen, int nroots)
+{
+    memset(gen, 0, nroots + 1);
+    gen[0] = 1;
+    for (int i = 0; i < nroots; i++)
+    {
+        // gen *= x + alpha^i
+        for (int j = i + 1; j > 0; j--)
+            gen[j] = gen[j - 1] ^ gf_mul(gen[j], gf_exp[i]);
+        gen[0] = gf_mul(gen[0], gf_exp[i]);
+    }
+}
+
+/* Parity of nrows rows of FEC_DEPTH data bytes, one codeword per column
+ * Description: the remainder registers of all the codewords advance
+ * together, par[j] holds register j (the x^(FEC_PARITY - 1 - j)
+ * coefficient) of every column and carries over between calls
+ */
+static void parity_rows_scalar(const unsigned char *rows, size_t nrows, unsigned char par[FEC_PARITY][FEC_DEPTH])
+{
+    for (size_t r = 0; r < nrows; r++, rows += FEC_DEPTH)
+    {
+        for (int i = 0; i < FEC_DEPTH; i++)
+        {
+            unsigned char fb = rows[i] ^ par[0][i];
+            for (int j = 0; j < FEC_PARITY - 1; j++)
+                par[j][i] = par[j + 1][i] ^ tap_lo[j][fb & 15] ^ tap_hi[j][fb >> 4];
+            par[FEC_PARITY - 1][i] = tap_lo[FEC_PARITY - 1][fb & 15] ^ tap_hi[FEC_PARITY - 1][fb >> 4];
+        }
+    }
+}
+
+#ifdef FEC_X86_DISPATCH
+
+/* SSSE3: 16 codewords per register, each tap is two PSHUFB lookups on
+ * the feedback nibbles, which are split once per row */
+__attribute__((target("ssse3")))
+static void parity_rows_ssse3(const unsigned char *rows, size_t nrows, unsigned char par[FEC_PARITY][FEC_DEPTH])
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    for (int col = 0; col < FEC_DEPTH; col += 16)
+    {
+        for (size_t r = 0; r < nrows; r++)
+        {
+            __m128i fb = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(rows + r * FEC_DEPTH + col)),
+                                       _mm_loadu_si128((const __m128i *)(par[0] + col)));
+            __m128i lo = _mm_and_si128(fb, nibble);
+            __m128i hi = _mm_and_si128(_mm_srli_epi64(fb, 4), nibble);
+            for (int j = 0; j < FEC_PARITY; j++)
+            {
+                __m128i prod = _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)tap_lo[j]), lo),
+                                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)tap_hi[j]), hi));
+                if (j + 1 < FEC_PARITY)
+                    prod = _mm_xor_si128(prod, _mm_loadu_si128((const __m128i *)(par[j + 1] + col)));
+                _mm_storeu_si128((__m128i *)(par[j] + col), prod);
+            }
+        }
+    }
+}
+
+/* AVX2: as SSSE3 with 32 codewords per register, VPSHUFB looks up
+ * each 128 bit lane in its own copy of the table */
+__attribute__((target("avx2")))
+static void parity_rows_avx2(const unsigned char *rows, size_t nrows, unsigned char par[FEC_PARITY][FEC_DEPTH])
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    for (int col = 0; col < FEC_DEPTH; col += 32)
+    {
+        for (size_t r = 0; r < nrows; r++)
+        {
+            __m256i fb = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(rows + r * FEC_DEPTH + col)),
+                                          _mm256_loadu_si256((const __m256i *)(par[0] + col)));
+            __m256i lo = _mm256_and_si256(fb, nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi64(fb, 4), nibble);
+            for (int j = 0; j < FEC_PARITY; j++)
+            {
+                __m256i prod = _mm256_xor_si256(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)tap_lo[j]), lo),
+                                                _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)tap_hi[j]), hi));
+                if (j + 1 < FEC_PARITY)
+                    prod = _mm256_xor_si256(prod, _mm256_loadu_si256((const __m256i *)(par[j + 1] + col)));
+                _mm256_storeu_si256((__m256i *)(par[j] + col), prod);
+            }
+        }
+    }
+}
+#endif
+
+/* Kernel picked at start up */
+static void (*parity_kernel)(const unsigned char *, size_t, unsigned char[FEC_PARITY][FEC_DEPTH]) = parity_rows_scalar;
+static const char *kernel_name = "scalar";
+
+/* Field tables, generator and tap tables, then the kernel for this CPU,
+ * all before main so threads never race on them */
+__attribute__((constructor))
+static void init_fec(void)
+{
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    gf_exp[510] = gf_exp[0];
+    gf_exp[511] = gf_exp[1];
+
+    build_generator(gen_parity, FEC_PARITY);
+    for (int j = 0; j < FEC_PARITY; j++)
+    {
+        unsigned char c = gen_parity[FEC_PARITY - 1 - j];
+        for (int v = 0; v < 16; v++)
+        {
+            tap_lo[j][v] = tap_lo[j][v + 16] = gf_mul(c, v);
+            tap_hi[j][v] = tap_hi[j][v + 16] = gf_mul(c, v << 4);
+        }
+    }
+
+#ifdef FEC_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        parity_kernel = parity_rows_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        parity_kernel = parity_rows_ssse3;
+        kernel_name = "ssse3";
+    }
+#endif
+}
+
+/* Repair one codeword of n bytes (data then nroots parity) in place
+ * Description: syndromes by Horner, Berlekamp-Massey for the error
+ * locator, Chien search for its roots and Forney for the error values.
+ * Returns the bytes repaired, -1 when there are more errors than the
+ * code can find (the codeword may then be partly changed)
+ */
+static int correct_codeword(unsigned char *cw, int n, int nroots)
+{
+    unsigned char syn[FEC_PARITY];
+    unsigned char any = 0;
+    for (int i = 0; i < nroots; i++)
+    {
+        unsigned char s = 0;
+        for (int j = 0; j < n; j++)
+            s = gf_mul(s, gf_exp[i]) ^ cw[j];
+        syn[i] = s;
+        any |= s;
+    }
+    if (any == 0)
+        return 0;
+
+    unsigned char lambda[FEC_PARITY + 1] = {1};
+    unsigned char prev[FEC_PARITY + 1] = {1};
+    unsigned char saved[FEC_PARITY + 1];
+    unsigned char b = 1;
+    int len = 0, shift = 1;
+    for (int k = 0; k < nroots; k++)
+    {
+        unsigned char d = syn[k];
+        for (int i = 1; i <= len; i++)
+            d ^= gf_mul(lambda[i], syn[k - i]);
+        if (d == 0)
+        {
+            shift++;
+            continue;
+        }
+        unsigned char coef = gf_div(d, b);
+        memcpy(saved, lambda, sizeof(saved));
+        for (int i = 0; i + shift <= nroots; i++)
+            lambda[i + shift] ^= gf_mul(coef, prev[i]);
+        if (2 * len <= k)
+        {
+            len = k + 1 - len;
+            memcpy(prev, saved, sizeof(prev));
+            b = d;
+            shift = 1;
+        }
+        else
+            shift++;
+    }
+    if (len > nroots / 2)
+        return -1;
+
+    // Error evaluator omega = syn * lambda mod x^nroots
+    unsigned char omega[FEC_PARITY] = {0};
+    for (int i = 0; i < nroots; i++)
+        for (int j = 0; j <= i && j <= len; j++)
+            omega[i] ^= gf_mul(syn[i - j], lambda[j]);
+
+    int found = 0;
+    for (int j = 0; j < n && found < len; j++)
+    {
+        // Byte j is the coefficient of x^(n - 1 - j), its locator is alpha^that
+        int power = n - 1 - j;
+        unsigned char xinv = gf_exp[(255 - power) % 255];
+        unsigned char value = 0, slope = 0, om = 0, xp = 1;
+        for (int i = 0; i <= len; i++)
+        {
+            value ^= gf_mul(lambda[i], xp);
+            // Formal derivative keeps the odd terms
+            if (i & 1)
+                slope ^= gf_mul(lambda[i], gf_div(xp, xinv));
+            xp = gf_mul(xp, xinv);
+        }
+        if (value != 0)
+            continue;
+        if (slope == 0)
+            return -1;
+        xp = 1;
+        for (int i = 0; i < nroots; i++)
+        {
+            om ^= gf_mul(omega[i], xp);
+            xp = gf_mul(xp, xinv);
+        }
+        cw[j] ^= gf_mul(gf_exp[power], gf_div(om, slope));
+        found++;
+    }
+    return (found == len) ? found : -1;
+}
+
+size_t fec_frame_size(size_t m)
+{
+    return m + FEC_PARITY * ((m < FEC_DEPTH) ? m : FEC_DEPTH);
+}
+
+long fec_coded_size(long size)
+{
+    return size / FEC_FRAME_DATA * FEC_FRAME_SIZE + fec_frame_size(size % FEC_FRAME_DATA);
+}
+
+long fec_data_size(long coded)
+{
+    long rest = coded % FEC_FRAME_SIZE;
+    long m;
+    // Past FEC_DEPTH data bytes a frame has every parity column
+    if (rest > (FEC_PARITY + 1) * FEC_DEPTH)
+        m = rest - FEC_PARITY * FEC_DEPTH;
+    else if (rest % (FEC_PARITY + 1) == 0)
+        m = rest / (FEC_PARITY + 1);
+    else
+        return -1;
+    return coded / FEC_FRAME_SIZE * FEC_FRAME_DATA + m;
+}
+
+long fec_data_room(long room)
+{
+    if (room <= 0)
+        return 0;
+    long rest = room % FEC_FRAME_SIZE;
+    long m = (rest > (FEC_PARITY + 1) * FEC_DEPTH) ? rest - FEC_PARITY * FEC_DEPTH : rest / (FEC_PARITY + 1);
+    return room / FEC_FRAME_SIZE * FEC_FRAME_DATA + m;
+}
+
+/* Parity registers of a frame of m data bytes, a short last row is
+ * padded with zeros */
+static void frame_parity(const unsigned char *frame, size_t m, unsigned char par[FEC_PARITY][FEC_DEPTH])
+{
+    memset(par, 0, FEC_PARITY * FEC_DEPTH);
+    parity_kernel(frame, m / FEC_DEPTH, par);
+    if (m % FEC_DEPTH)
+    {
+        unsigned char row[FEC_DEPTH] = {0};
+        memcpy(row, frame + m / FEC_DEPTH * FEC_DEPTH, m % FEC_DEPTH);
+        parity_kernel(row, 1, par);
+    }
+}
+
+void fec_encode_frame(unsigned char *frame, size_t m)
+{
+    unsigned char par[FEC_PARITY][FEC_DEPTH];
+    size_t columns = (m < FEC_DEPTH) ? m : FEC_DEPTH;
+
+    frame_parity(frame, m, par);
+    for (int j = 0; j < FEC_PARITY; j++)
+        memcpy(frame + m + j * columns, par[j], columns);
+}
+
+/* Frames are checked by coding their data again: a codeword whose stored
+ * parity matches has all zero syndromes and needs no more work, only the
+ * others are gathered and repaired */
+Status fec_correct_frame(unsigned char *frame, size_t m, long *corrected)
+{
+    unsigned char par[FEC_PARITY][FEC_DEPTH];
+    unsigned char cw[255];
+    size_t columns = (m < FEC_DEPTH) ? m : FEC_DEPTH;
+    size_t rows = (m + FEC_DEPTH - 1) / FEC_DEPTH;
+    const unsigned char *parity = frame + m;
+
+    frame_parity(frame, m, par);
+    for (size_t i = 0; i < columns; i++)
+    {
+        int clean = 1;
+        for (int j = 0; j < FEC_PARITY && clean; j++)
+            clean = (par[j][i] == parity[j * columns + i]);
+        if (clean)
+            continue;
+
+        // Rows past the data of a short frame are zeros that were never stored
+        for (size_t r = 0; r < rows; r++)
+            cw[r] = (r * FEC_DEPTH + i < m) ? frame[r * FEC_DEPTH + i] : 0;
+        for (int j = 0; j < FEC_PARITY; j++)
+            cw[rows + j] = parity[j * columns + i];
+        int fixed = correct_codeword(cw, rows + FEC_PARITY, FEC_PARITY);
+        if (fixed < 0 || ((rows - 1) * FEC_DEPTH + i >= m && cw[rows - 1] != 0))
+            return e_failure;
+
+        for (size_t r = 0; r < rows; r++)
+        {
+            if (r * FEC_DEPTH + i < m)
+                frame[r * FEC_DEPTH + i] = cw[r];
+        }
+        for (int j = 0; j < FEC_PARITY; j++)
+            frame[m + j * columns + i] = cw[rows + j];
+        *corrected += fixed;
+    }
+    return e_success;
+}
+
+void fec_encode_block(const unsigned char *data, size_t k, unsigned char *parity, int nroots)
+{
+    unsigned char gen[FEC_PARITY + 1];
+    build_generator(gen, nroots);
+    memset(parity, 0, nroots);
+    for (size_t i = 0; i < k; i++)
+    {
+        unsigned char fb = data[i] ^ parity[0];
+        memmove(parity, parity + 1, nroots - 1);
+        parity[nroots - 1] = 0;
+        for (int j = 0; j < nroots; j++)
+            parity[j] ^= gf_mul(fb, gen[nroots - 1 - j]);
+    }
+}
+
+Status fec_correct_block(unsigned char *block, size_t n, int nroots)
+{
+    return (correct_codeword(block, n, nroots) < 0) ? e_failure : e_success;
+}
+
+void fec_init(FecEncoder *enc, FILE *fptr)
+{
+    enc->fptr = fptr;
+    enc->len = 0;
+}
+
+Status fec_write(FecEncoder *enc, const void *data, size_t n)
+{
+    const unsigned char *bytes = data;
+    while (n > 0)
+    {
+        size_t chunk = FEC_FRAME_DATA - enc->len;
+        if (chunk > n)
+            chunk = n;
+        memcpy(enc->frame + enc->len, bytes, chunk);
+        enc->len += chunk;
+        bytes += chunk;
+        n -= chunk;
+        if (enc->len == FEC_FRAME_DATA)
+        {
+            fec_encode_frame(enc->frame, FEC_FRAME_DATA);
+            if (fwrite(enc->frame, 1, FEC_FRAME_SIZE, enc->fptr) != FEC_FRAME_SIZE)
+                return e_failure;
+            enc->len = 0;
+        }
+    }
+    return e_success;
+}
+
+Status fec_finish(FecEncoder *enc)
+{
+    if (enc->len == 0)
+        return e_success;
+    size_t size = fec_frame_size(enc->len);
+    fec_encode_frame(enc->frame, enc->len);
+    if (fwrite(enc->frame, 1, size, enc->fptr) != size)
+        return e_failure;
+    enc->len = 0;
+    return e_success;
+}
+
+const char *fec_kernel_name(void)
+{
+    return kernel_name;
+}
@@ -0,0 +1,85 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+
+/* Parity bytes per codeword, any 16 damaged bytes of it are repaired */
+#define FEC_PARITY 32
+
+/* Data bytes of a full codeword, RS(255, 223) over GF(256) */
+#define FEC_CODEWORD_DATA (255 - FEC_PARITY)
+
+/* Codewords interleaved in a frame: data byte p of a frame belongs to
+ * codeword p % FEC_DEPTH, so a run of FEC_DEPTH * 16 damaged bytes is
+ * spread over every codeword of the frame and still repaired */
+#define FEC_DEPTH 64
+
+/* Data bytes of a full frame */
+#define FEC_FRAME_DATA (FEC_CODEWORD_DATA * FEC_DEPTH)
+
+/* Coded bytes of a full frame */
+#define FEC_FRAME_SIZE (FEC_FRAME_DATA + FEC_PARITY * FEC_DEPTH)
+
+/* Parity bytes after the file size field, any 4 damaged bytes of the
+ * field and its parity are repaired */
+#define FEC_SIZE_PARITY 8
+
+/*
+ * Coded payload
+ * the data is cut into frames of FEC_FRAME_DATA bytes (the last one may
+ * be shorter). A frame of m data bytes is stored as the m bytes as they
+ * are, then FEC_PARITY parity rows of min(m, FEC_DEPTH) bytes: byte i of
+ * parity row j is parity byte j of codeword i. Codeword i holds data bytes
+ * i, i + FEC_DEPTH, ... of the frame, those missing from the last row of
+ * a short frame count as zeros and are not stored
+ */
+typedef struct _FecEncoder
+{
+    FILE *fptr;               // To store the stream the coded frames go to
+    unsigned char frame[FEC_FRAME_SIZE]; // To store the frame being filled, data then parity
+    size_t len;               // To store the data bytes in frame
+} FecEncoder;
+
+/* FEC function prototypes */
+
+/* Coded bytes of a frame of m data bytes */
+size_t fec_frame_size(size_t m);
+
+/* Coded bytes of size data bytes */
+long fec_coded_size(long size);
+
+/* Data bytes coded into coded bytes, -1 if no data size codes to it */
+long fec_data_size(long coded);
+
+/* Most data bytes whose coded size fits in room bytes */
+long fec_data_room(long room);
+
+/* Fill in the parity rows of a frame whose m data bytes are in place */
+void fec_encode_frame(unsigned char *frame, size_t m);
+
+/* Repair a coded frame of m data bytes in place, corrected gets the
+ * bytes changed, e_failure if a codeword has too many damaged bytes */
+Status fec_correct_frame(unsigned char *frame, size_t m, long *corrected);
+
+/* Parity bytes of one short codeword of k data bytes (k + nroots <= 255) */
+void fec_encode_block(const unsigned char *data, size_t k, unsigned char *parity, int nroots);
+
+/* Repair a short codeword of n bytes (data then nroots parity) in place,
+ * e_failure if it has too many damaged bytes */
+Status fec_correct_block(unsigned char *block, size_t n, int nroots);
+
+/* Start coding into fptr */
+void fec_init(FecEncoder *enc, FILE *fptr);
+
+/* Code n more data bytes, full frames are written as they fill */
+Status fec_write(FecEncoder *enc, const void *data, size_t n);
+
+/* Code and write the last, possibly short, frame */
+Status fec_finish(FecEncoder *enc);
+
+/* Name of the kernel picked for this CPU */
+const char *fec_kernel_name(void);
+
+#endif
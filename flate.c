@@ -0,0 +1,918 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "flate.h"
+#include "types.h"
+
+/* Inflate steps */
+#define INFLATE_HEADER 0
+#define INFLATE_BLOCK 1
+#define INFLATE_STORED 2
+#define INFLATE_CODES 3
+#define INFLATE_TRAILER 4
+#define INFLATE_DONE 5
+
+/* Adler-32 modulus, and the most bytes summed before the sums must be reduced */
+#define ADLER_MOD 65521
+#define ADLER_NMAX 5552
+
+/* Longest code of the literal/length and distance codes, and of the code length code */
+#define MAX_CODE_BITS 15
+#define MAX_CL_BITS 7
+
+/* Code length alphabet */
+#define CL_CODES 19
+
+/* Length and distance codes: first value and extra bits */
+static const uint16_t len_base[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                      31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                       193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/* Order the code length code lengths are stored in */
+static const uint8_t cl_order[CL_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+/* Length symbol of each match length, distance code by dist_index */
+static uint16_t len_symbol[FLATE_MAX_MATCH + 1];
+static uint8_t dist_code[512];
+
+/* Decode tables of the fixed Huffman codes */
+static FlateTable fixed_lit;
+static FlateTable fixed_dist;
+
+/* Function Definitions */
+
+/*Inflate steps
+1.check the zlib header: deflate, 32 KB window at most, no dictionary
+2.read a block header
+  stored: byte align, LEN and its complement, then LEN raw bytes
+  fixed: the code tables built at start up
+  dynamic: code length code, then the literal/length and distance
+  code lengths run length coded with it
+3.decode symbols: a literal goes out, a length and distance copy
+  from the window, end of block goes back to 2 unless it was the last
+4.check the Adler-32 after the last block
+Deflate steps
+1.append input to the window, slide it down 32 KB when it is full
+2.hash the 3 bytes at each position, walk the chain of earlier
+  positions with that hash for the longest match
+3.collect literals and length/distance pairs
+4.every FLATE_BLOCK_SYMBOLS symbols write a block with Huffman codes
+  built from their frequencies (15 bits at most), the code lengths
+  run length coded
+5.end with the last block, byte align and the Adler-32*/
+
+uint32_t adler32_update(uint32_t adler, const unsigned char *data, size_t n)
+{
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n > 0)
+    {
+        size_t k = (n < ADLER_NMAX) ? n : ADLER_NMAX;
+        n -= k;
+        while (k-- > 0)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+/* Codes go out most significant bit first into an LSB first bit stream */
+static uint32_t reverse_bits(uint32_t code, int len)
+{
+    uint32_t rev = 0;
+    for (int i = 0; i < len; i++, code >>= 1)
+        rev = (rev << 1) | (code & 1);
+    return rev;
+}
+
+/* Decode table for the code lengths of n symbols, e_failure if they over-subscribe */
+static Status build_table(FlateTable *table, const uint8_t *lengths, int n)
+{
+    uint16_t offset[16];
+    memset(table->count, 0, sizeof(table->count));
+    for (int s = 0; s < n; s++)
+        table->count[lengths[s]]++;
+    table->count[0] = 0;
+
+    // An incomplete code is allowed, its unused codes fail when met
+    int left = 1;
+    for (int len = 1; len <= MAX_CODE_BITS; len++)
+    {
+        left = (left << 1) - table->count[len];
+        if (left < 0)
+            return e_failure;
+    }
+
+    offset[1] = 0;
+    for (int len = 1; len < MAX_CODE_BITS; len++)
+        offset[len + 1] = offset[len] + table->count[len];
+    for (int s = 0; s < n; s++)
+    {
+        if (lengths[s] != 0)
+            table->symbol[offset[lengths[s]]++] = s;
+    }
+
+    // Short codes fill every fast entry their bits start
+    memset(table->fast, 0, sizeof(table->fast));
+    uint32_t code = 0;
+    int index = 0;
+    for (int len = 1; len <= FLATE_FAST_BITS; len++, code <<= 1)
+    {
+        for (int i = 0; i < table->count[len]; i++, code++)
+        {
+            uint16_t entry = (table->symbol[index++] << 4) | len;
+            for (uint32_t j = reverse_bits(code, len); j < (1u << FLATE_FAST_BITS); j += 1u << len)
+                table->fast[j] = entry;
+        }
+    }
+    return e_success;
+}
+
+/* Index of a distance in dist_code */
+static int dist_index(int dist)
+{
+    return (dist <= 256) ? dist - 1 : 256 + ((dist - 1) >> 7);
+}
+
+/* Code tables and fixed Huffman codes, built once before main so threads never race on them */
+__attribute__((constructor))
+static void init_flate_tables(void)
+{
+    uint8_t lengths[FLATE_LIT_CODES];
+
+    // A later code wins, so 258 gets its own code (285)
+    for (int code = 0; code < 29; code++)
+    {
+        for (int len = len_base[code]; len < len_base[code] + (1 << len_extra[code]) && len <= FLATE_MAX_MATCH; len++)
+            len_symbol[len] = 257 + code;
+    }
+    for (int code = 0; code < 30; code++)
+    {
+        for (int dist = dist_base[code]; dist < dist_base[code] + (1 << dist_extra[code]); dist++)
+            dist_code[dist_index(dist)] = code;
+    }
+
+    for (int s = 0; s < FLATE_LIT_CODES; s++)
+        lengths[s] = (s < 144) ? 8 : (s < 256) ? 9 : (s < 280) ? 7 : 8;
+    build_table(&fixed_lit, lengths, FLATE_LIT_CODES);
+    memset(lengths, 5, FLATE_DIST_CODES);
+    build_table(&fixed_dist, lengths, FLATE_DIST_CODES);
+}
+
+/* Top the bit buffer up to 57 bits or more, or as far as the stream goes */
+static Status fill_bits(Inflater *inf)
+{
+    while (inf->num_bits <= 56)
+    {
+        if (inf->in_pos == inf->in_len)
+        {
+            if (inf->in_end)
+                break;
+            long n = inf->source(inf->arg, inf->in, FLATE_IN_SIZE);
+            if (n < 0)
+                return e_failure;
+            if (n == 0)
+            {
+                inf->in_end = 1;
+                break;
+            }
+            inf->in_pos = 0;
+            inf->in_len = n;
+        }
+        inf->bits |= (uint64_t)inf->in[inf->in_pos++] << inf->num_bits;
+        inf->num_bits += 8;
+    }
+    return e_success;
+}
+
+/* Next n bits (n <= 32), e_failure if the stream ends first */
+static Status get_bits(Inflater *inf, int n, uint32_t *value)
+{
+    if (inf->num_bits < n && (fill_bits(inf) == e_failure || inf->num_bits < n))
+        return e_failure;
+    *value = inf->bits & ((1ull << n) - 1);
+    inf->bits >>= n;
+    inf->num_bits -= n;
+    return e_success;
+}
+
+/* Next symbol of table's code, -1 if the bits are no code or the stream ends */
+static int decode_symbol(Inflater *inf, const FlateTable *table)
+{
+    if (inf->num_bits < MAX_CODE_BITS && fill_bits(inf) == e_failure)
+        return -1;
+    uint16_t entry = table->fast[inf->bits & ((1u << FLATE_FAST_BITS) - 1)];
+    if (entry != 0)
+    {
+        int len = entry & 15;
+        if (len > inf->num_bits)
+            return -1;
+        inf->bits >>= len;
+        inf->num_bits -= len;
+        return entry >> 4;
+    }
+
+    // Longer codes one bit at a time, codes of one length are consecutive
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAX_CODE_BITS && len <= inf->num_bits; len++)
+    {
+        code |= (inf->bits >> (len - 1)) & 1;
+        int count = table->count[len];
+        if (code - first < count)
+        {
+            inf->bits >>= len;
+            inf->num_bits -= len;
+            return table->symbol[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+/* Code tables of a dynamic block */
+static Status read_dynamic_tables(Inflater *inf)
+{
+    uint8_t lengths[FLATE_LIT_CODES + FLATE_DIST_CODES];
+    uint8_t cl_lengths[CL_CODES] = {0};
+    uint32_t hlit, hdist, hclen, value;
+
+    if (get_bits(inf, 5, &hlit) == e_failure || get_bits(inf, 5, &hdist) == e_failure ||
+        get_bits(inf, 4, &hclen) == e_failure)
+        return e_failure;
+    hlit += 257;
+    hdist += 1;
+    hclen += 4;
+    if (hlit > 286 || hdist > 30)
+        return e_failure;
+    for (uint32_t i = 0; i < hclen; i++)
+    {
+        if (get_bits(inf, 3, &value) == e_failure)
+            return e_failure;
+        cl_lengths[cl_order[i]] = value;
+    }
+
+    // The distance table holds the code length code until the real one is built
+    if (build_table(&inf->dist, cl_lengths, CL_CODES) == e_failure)
+        return e_failure;
+    for (uint32_t n = 0; n < hlit + hdist;)
+    {
+        int sym = decode_symbol(inf, &inf->dist);
+        if (sym < 0)
+            return e_failure;
+        if (sym < 16)
+        {
+            lengths[n++] = sym;
+            continue;
+        }
+        int len = 0;
+        uint32_t repeat;
+        if (sym == 16)
+        {
+            if (n == 0 || get_bits(inf, 2, &repeat) == e_failure)
+                return e_failure;
+            len = lengths[n - 1];
+            repeat += 3;
+        }
+        else if (sym == 17)
+        {
+            if (get_bits(inf, 3, &repeat) == e_failure)
+                return e_failure;
+            repeat += 3;
+        }
+        else
+        {
+            if (get_bits(inf, 7, &repeat) == e_failure)
+                return e_failure;
+            repeat += 11;
+        }
+        if (n + repeat > hlit + hdist)
+            return e_failure;
+        while (repeat-- > 0)
+            lengths[n++] = len;
+    }
+
+    // A block without an end of block code could never end
+    if (lengths[256] == 0)
+        return e_failure;
+    if (build_table(&inf->lit, lengths, hlit) == e_failure || build_table(&inf->dist, lengths + hlit, hdist) == e_failure)
+        return e_failure;
+    return e_success;
+}
+
+/* Start of a block */
+static Status read_block_header(Inflater *inf)
+{
+    uint32_t value, nlen;
+    if (get_bits(inf, 3, &value) == e_failure)
+        return e_failure;
+    inf->last = value & 1;
+    switch (value >> 1)
+    {
+    case 0:
+        // Stored: LEN and NLEN start on a byte
+        inf->bits >>= inf->num_bits % 8;
+        inf->num_bits -= inf->num_bits % 8;
+        if (get_bits(inf, 16, &value) == e_failure || get_bits(inf, 16, &nlen) == e_failure || value != (~nlen & 0xFFFF))
+            return e_failure;
+        inf->stored_left = value;
+        inf->state = INFLATE_STORED;
+        return e_success;
+    case 1:
+        inf->lit = fixed_lit;
+        inf->dist = fixed_dist;
+        inf->state = INFLATE_CODES;
+        return e_success;
+    case 2:
+        if (read_dynamic_tables(inf) == e_failure)
+            return e_failure;
+        inf->state = INFLATE_CODES;
+        return e_success;
+    default:
+        return e_failure;
+    }
+}
+
+/* Hand out one byte and keep it in the window */
+static void put_byte(Inflater *inf, unsigned char *out, size_t *done, unsigned char byte)
+{
+    out[(*done)++] = byte;
+    inf->window[inf->total++ & (FLATE_WINDOW_SIZE - 1)] = byte;
+}
+
+void inflate_init(Inflater *inf, FlateSource source, void *arg)
+{
+    inf->source = source;
+    inf->arg = arg;
+    inf->in_pos = 0;
+    inf->in_len = 0;
+    inf->in_end = 0;
+    inf->bits = 0;
+    inf->num_bits = 0;
+    inf->state = INFLATE_HEADER;
+    inf->last = 0;
+    inf->stored_left = 0;
+    inf->copy_len = 0;
+    inf->copy_dist = 0;
+    inf->total = 0;
+    inf->adler = 1;
+}
+
+long inflate_read(Inflater *inf, unsigned char *out, size_t n)
+{
+    size_t done = 0, summed = 0;
+    uint32_t value;
+
+    while (done < n && inf->state != INFLATE_DONE)
+    {
+        switch (inf->state)
+        {
+        case INFLATE_HEADER:
+            // CMF then FLG, together a multiple of 31
+            if (get_bits(inf, 16, &value) == e_failure)
+                return -1;
+            if ((value & 0x0F) != 8 || ((value >> 4) & 0x0F) > 7 || (value & 0x2000) ||
+                (((value & 0xFF) << 8) | (value >> 8)) % 31 != 0)
+                return -1;
+            inf->state = INFLATE_BLOCK;
+            break;
+
+        case INFLATE_BLOCK:
+            if (inf->last)
+                inf->state = INFLATE_TRAILER;
+            else if (read_block_header(inf) == e_failure)
+                return -1;
+            break;
+
+        case INFLATE_STORED:
+            // Whole bytes still in the bit buffer first, then straight from the input
+            while (inf->stored_left > 0 && done < n && inf->num_bits >= 8)
+            {
+                put_byte(inf, out, &done, inf->bits & 0xFF);
+                inf->bits >>= 8;
+                inf->num_bits -= 8;
+                inf->stored_left--;
+            }
+            while (inf->stored_left > 0 && done < n)
+            {
+                if (inf->in_pos == inf->in_len && (fill_bits(inf) == e_failure || inf->num_bits < 8))
+                    return -1;
+                if (inf->num_bits >= 8)
+                    break;
+                put_byte(inf, out, &done, inf->in[inf->in_pos++]);
+                inf->stored_left--;
+            }
+            if (inf->stored_left == 0)
+                inf->state = INFLATE_BLOCK;
+            break;
+
+        case INFLATE_CODES:
+            if (inf->copy_len > 0)
+            {
+                while (inf->copy_len > 0 && done < n)
+                {
+                    put_byte(inf, out, &done, inf->window[(inf->total - inf->copy_dist) & (FLATE_WINDOW_SIZE - 1)]);
+                    inf->copy_len--;
+                }
+                break;
+            }
+            int sym = decode_symbol(inf, &inf->lit);
+            if (sym < 0)
+                return -1;
+            if (sym < 256)
+            {
+                put_byte(inf, out, &done, sym);
+            }
+            else if (sym == 256)
+            {
+                inf->state = INFLATE_BLOCK;
+            }
+            else
+            {
+                uint32_t len_bits, dist_bits;
+                sym -= 257;
+                if (sym >= 29 || get_bits(inf, len_extra[sym], &len_bits) == e_failure)
+                    return -1;
+                int dist = decode_symbol(inf, &inf->dist);
+                if (dist < 0 || dist >= 30 || get_bits(inf, dist_extra[dist], &dist_bits) == e_failure)
+                    return -1;
+                inf->copy_len = len_base[sym] + len_bits;
+                inf->copy_dist = dist_base[dist] + dist_bits;
+                if ((uint64_t)inf->copy_dist > inf->total)
+                    return -1;
+            }
+            break;
+
+        case INFLATE_TRAILER:
+            // Adler-32, big endian, on the next byte
+            inf->bits >>= inf->num_bits % 8;
+            inf->num_bits -= inf->num_bits % 8;
+            if (get_bits(inf, 32, &value) == e_failure)
+                return -1;
+            inf->adler = adler32_update(inf->adler, out + summed, done - summed);
+            summed = done;
+            if (inf->adler != __builtin_bswap32(value))
+                return -1;
+            inf->state = INFLATE_DONE;
+            break;
+        }
+    }
+    inf->adler = adler32_update(inf->adler, out + summed, done - summed);
+    return done;
+}
+
+/* Hand the collected output to the sink */
+static void flush_out(Deflater *def)
+{
+    if (def->out_len > 0 && !def->failed && def->sink(def->arg, def->out, def->out_len) == e_failure)
+        def->failed = 1;
+    def->out_len = 0;
+}
+
+/* Append n bits (n <= 32), lowest first */
+static void put_bits(Deflater *def, uint32_t value, int n)
+{
+    def->bits |= (uint64_t)value << def->num_bits;
+    def->num_bits += n;
+    while (def->num_bits >= 8)
+    {
+        def->out[def->out_len++] = def->bits & 0xFF;
+        def->bits >>= 8;
+        def->num_bits -= 8;
+        if (def->out_len == FLATE_OUT_SIZE)
+            flush_out(def);
+    }
+}
+
+/* Code lengths of n symbols from their frequencies, none longer than limit
+ * Description: Huffman's construction with two queues over the symbols
+ * sorted by frequency (leaves, then merged nodes in the order made).
+ * Too deep a tree is built again from halved frequencies, which flattens
+ * it. A lone symbol gets a partner, so every code is complete
+ */
+static void build_code_lengths(const uint32_t *freq, int n, int limit, uint8_t *lengths)
+{
+    uint64_t keys[FLATE_LIT_CODES];
+    uint32_t scaled[FLATE_LIT_CODES];
+    uint32_t weight[2 * FLATE_LIT_CODES];
+    int parent[2 * FLATE_LIT_CODES];
+    int depth[2 * FLATE_LIT_CODES];
+    int leaf[FLATE_LIT_CODES];
+    int count = 0;
+
+    memset(lengths, 0, n);
+    for (int s = 0; s < n; s++)
+    {
+        scaled[s] = freq[s];
+        if (freq[s] != 0)
+            count++;
+    }
+    if (count == 0)
+        return;
+    if (count == 1)
+    {
+        for (int s = 0; s < n; s++)
+        {
+            if (freq[s] != 0)
+            {
+                lengths[s] = 1;
+                lengths[s == 0 ? 1 : 0] = 1;
+            }
+        }
+        return;
+    }
+
+    for (;;)
+    {
+        int k = 0;
+        for (int s = 0; s < n; s++)
+        {
+            if (scaled[s] != 0)
+                keys[k++] = ((uint64_t)scaled[s] << 16) | s;
+        }
+        // Insertion sort, at most FLATE_LIT_CODES symbols and mostly in order
+        for (int i = 1; i < count; i++)
+        {
+            uint64_t key = keys[i];
+            int j = i;
+            for (; j > 0 && keys[j - 1] > key; j--)
+                keys[j] = keys[j - 1];
+            keys[j] = key;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            leaf[i] = keys[i] & 0xFFFF;
+            weight[i] = keys[i] >> 16;
+        }
+
+        int next_leaf = 0, next_node = count, made = count;
+        for (int i = 0; i < count - 1; i++)
+        {
+            int pick[2];
+            for (int j = 0; j < 2; j++)
+            {
+                if (next_leaf < count && (next_node >= made || weight[next_leaf] <= weight[next_node]))
+                    pick[j] = next_leaf++;
+                else
+                    pick[j] = next_node++;
+            }
+            weight[made] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = made;
+            made++;
+        }
+
+        // Parents come after their children, the root last
+        int max_depth = 0;
+        depth[made - 1] = 0;
+        for (int i = made - 2; i >= 0; i--)
+        {
+            depth[i] = depth[parent[i]] + 1;
+            if (i < count && depth[i] > max_depth)
+                max_depth = depth[i];
+        }
+        if (max_depth <= limit)
+        {
+            for (int i = 0; i < count; i++)
+                lengths[leaf[i]] = depth[i];
+            return;
+        }
+        for (int s = 0; s < n; s++)
+        {
+            if (scaled[s] != 0)
+                scaled[s] = (scaled[s] >> 1) | 1;
+        }
+    }
+}
+
+/* Canonical codes for the code lengths, bit reversed for put_bits */
+static void make_codes(const uint8_t *lengths, int n, uint16_t *codes)
+{
+    uint16_t bl_count[MAX_CODE_BITS + 1] = {0};
+    uint16_t next[MAX_CODE_BITS + 1];
+    for (int s = 0; s < n; s++)
+        bl_count[lengths[s]]++;
+    bl_count[0] = 0;
+
+    uint32_t code = 0;
+    for (int len = 1; len <= MAX_CODE_BITS; len++)
+    {
+        code = (code + bl_count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int s = 0; s < n; s++)
+    {
+        if (lengths[s] != 0)
+            codes[s] = reverse_bits(next[lengths[s]]++, lengths[s]);
+    }
+}
+
+/* Run length code the code lengths with symbols 16 (repeat), 17 and 18 (zeros) */
+static int rle_lengths(const uint8_t *lengths, int n, uint8_t *syms, uint8_t *extras)
+{
+    int count = 0;
+    for (int i = 0; i < n;)
+    {
+        int len = lengths[i], run = 1;
+        while (i + run < n && lengths[i + run] == len)
+            run++;
+        i += run;
+        if (len == 0)
+        {
+            while (run >= 11)
+            {
+                int r = (run < 138) ? run : 138;
+                syms[count] = 18;
+                extras[count++] = r - 11;
+                run -= r;
+            }
+            if (run >= 3)
+            {
+                syms[count] = 17;
+                extras[count++] = run - 3;
+                run = 0;
+            }
+        }
+        else
+        {
+            syms[count] = len;
+            extras[count++] = 0;
+            run--;
+            while (run >= 3)
+            {
+                int r = (run < 6) ? run : 6;
+                syms[count] = 16;
+                extras[count++] = r - 3;
+                run -= r;
+            }
+        }
+        while (run-- > 0)
+        {
+            syms[count] = len;
+            extras[count++] = 0;
+        }
+    }
+    return count;
+}
+
+/* Write the collected symbols as one dynamic Huffman block */
+static void write_block(Deflater *def, int final)
+{
+    uint32_t lit_freq[FLATE_LIT_CODES] = {0}, dist_freq[FLATE_DIST_CODES] = {0}, cl_freq[CL_CODES] = {0};
+    uint8_t lengths[FLATE_LIT_CODES + FLATE_DIST_CODES], cl_lengths[CL_CODES];
+    uint16_t lit_codes[FLATE_LIT_CODES], dist_codes[FLATE_DIST_CODES], cl_codes[CL_CODES];
+    uint8_t syms[FLATE_LIT_CODES + FLATE_DIST_CODES], extras[FLATE_LIT_CODES + FLATE_DIST_CODES];
+
+    for (size_t i = 0; i < def->num_syms; i++)
+    {
+        if (def->sym_dist[i] == 0)
+        {
+            lit_freq[def->sym_lit[i]]++;
+        }
+        else
+        {
+            lit_freq[len_symbol[def->sym_lit[i]]]++;
+            dist_freq[dist_code[dist_index(def->sym_dist[i])]]++;
+        }
+    }
+    lit_freq[256] = 1;
+    // A block of literals still sends a distance code
+    if (def->num_syms == 0 || memcmp(dist_freq, (uint32_t[FLATE_DIST_CODES]){0}, sizeof(dist_freq)) == 0)
+        dist_freq[0] = 1;
+
+    uint8_t *lit_lengths = lengths, dist_lengths[FLATE_DIST_CODES];
+    build_code_lengths(lit_freq, 286, MAX_CODE_BITS, lit_lengths);
+    build_code_lengths(dist_freq, 30, MAX_CODE_BITS, dist_lengths);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && lit_lengths[hlit - 1] == 0)
+        hlit--;
+    while (hdist > 1 && dist_lengths[hdist - 1] == 0)
+        hdist--;
+    memcpy(lengths + hlit, dist_lengths, hdist);
+    make_codes(lit_lengths, hlit, lit_codes);
+    make_codes(dist_lengths, hdist, dist_codes);
+
+    // Literal/length and distance code lengths run together
+    int num_cl = rle_lengths(lengths, hlit + hdist, syms, extras);
+    for (int i = 0; i < num_cl; i++)
+        cl_freq[syms[i]]++;
+    build_code_lengths(cl_freq, CL_CODES, MAX_CL_BITS, cl_lengths);
+    make_codes(cl_lengths, CL_CODES, cl_codes);
+    int hclen = CL_CODES;
+    while (hclen > 4 && cl_lengths[cl_order[hclen - 1]] == 0)
+        hclen--;
+
+    put_bits(def, final, 1);
+    put_bits(def, 2, 2);
+    put_bits(def, hlit - 257, 5);
+    put_bits(def, hdist - 1, 5);
+    put_bits(def, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++)
+        put_bits(def, cl_lengths[cl_order[i]], 3);
+    for (int i = 0; i < num_cl; i++)
+    {
+        put_bits(def, cl_codes[syms[i]], cl_lengths[syms[i]]);
+        if (syms[i] >= 16)
+            put_bits(def, extras[i], (syms[i] == 16) ? 2 : (syms[i] == 17) ? 3 : 7);
+    }
+
+    for (size_t i = 0; i < def->num_syms; i++)
+    {
+        int value = def->sym_lit[i];
+        int dist = def->sym_dist[i];
+        if (dist == 0)
+        {
+            put_bits(def, lit_codes[value], lit_lengths[value]);
+            continue;
+        }
+        int sym = len_symbol[value];
+        put_bits(def, lit_codes[sym], lit_lengths[sym]);
+        if (len_extra[sym - 257])
+            put_bits(def, value - len_base[sym - 257], len_extra[sym - 257]);
+        int code = dist_code[dist_index(dist)];
+        put_bits(def, dist_codes[code], dist_lengths[code]);
+        if (dist_extra[code])
+            put_bits(def, dist - dist_base[code], dist_extra[code]);
+    }
+    put_bits(def, lit_codes[256], lit_lengths[256]);
+    def->num_syms = 0;
+}
+
+/* Hash of the 3 bytes at p */
+static uint32_t hash3(const unsigned char *p)
+{
+    return ((uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16)) * 2654435761u) >> (32 - FLATE_HASH_BITS);
+}
+
+/* Put window position pos at the head of its hash chain */
+static void insert_position(Deflater *def, size_t pos)
+{
+    uint32_t h = hash3(def->window + pos);
+    def->prev[pos & (FLATE_WINDOW_SIZE - 1)] = def->head[h];
+    def->head[h] = pos;
+}
+
+/* Longest match for the bytes at pos within the last 32 KB, 0 if none reaches FLATE_MIN_MATCH */
+static int find_match(Deflater *def, size_t pos, int *dist)
+{
+    size_t max = def->end - pos;
+    if (max > FLATE_MAX_MATCH)
+        max = FLATE_MAX_MATCH;
+    if (max < FLATE_MIN_MATCH)
+        return 0;
+
+    const unsigned char *cur = def->window + pos;
+    size_t best = 0;
+    int32_t cand = def->head[hash3(cur)];
+    for (int chain = def->chain_length; cand >= 0 && chain > 0; chain--)
+    {
+        if (pos - cand > FLATE_WINDOW_SIZE)
+            break;
+        const unsigned char *p = def->window + cand;
+        if (p[best] == cur[best] && p[0] == cur[0])
+        {
+            // Eight bytes at a time, the first differing byte ends the match
+            size_t len = 0;
+            while (len + 8 <= max)
+            {
+                uint64_t a, b;
+                memcpy(&a, p + len, 8);
+                memcpy(&b, cur + len, 8);
+                if (a != b)
+                {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                    len += __builtin_clzll(a ^ b) >> 3;
+#else
+                    len += __builtin_ctzll(a ^ b) >> 3;
+#endif
+                    break;
+                }
+                len += 8;
+            }
+            if (len + 8 > max)
+            {
+                while (len < max && p[len] == cur[len])
+                    len++;
+            }
+            if (len > best)
+            {
+                best = len;
+                *dist = pos - cand;
+                if (len == max)
+                    break;
+            }
+        }
+        // A slot reused by a newer position ends the chain
+        int32_t next = def->prev[cand & (FLATE_WINDOW_SIZE - 1)];
+        if (next >= cand)
+            break;
+        cand = next;
+    }
+    return (best >= FLATE_MIN_MATCH) ? best : 0;
+}
+
+/* Compress window bytes from start up to limit */
+static void compress_window(Deflater *def, size_t limit)
+{
+    while (def->start < limit)
+    {
+        size_t pos = def->start;
+        int dist = 0;
+        int len = find_match(def, pos, &dist);
+        if (pos + FLATE_MIN_MATCH <= def->end)
+            insert_position(def, pos);
+        if (len > 0)
+        {
+            def->sym_lit[def->num_syms] = len;
+            def->sym_dist[def->num_syms++] = dist;
+            for (size_t i = pos + 1; i < pos + len && i + FLATE_MIN_MATCH <= def->end; i++)
+                insert_position(def, i);
+            def->start += len;
+        }
+        else
+        {
+            def->sym_lit[def->num_syms] = def->window[pos];
+            def->sym_dist[def->num_syms++] = 0;
+            def->start++;
+        }
+        if (def->num_syms == FLATE_BLOCK_SYMBOLS)
+            write_block(def, 0);
+    }
+}
+
+/* Drop the oldest 32 KB of the window */
+static void slide_window(Deflater *def)
+{
+    memmove(def->window, def->window + FLATE_WINDOW_SIZE, def->end - FLATE_WINDOW_SIZE);
+    def->start -= FLATE_WINDOW_SIZE;
+    def->end -= FLATE_WINDOW_SIZE;
+    for (int i = 0; i < (1 << FLATE_HASH_BITS); i++)
+        def->head[i] = (def->head[i] >= FLATE_WINDOW_SIZE) ? def->head[i] - FLATE_WINDOW_SIZE : -1;
+    for (int i = 0; i < FLATE_WINDOW_SIZE; i++)
+        def->prev[i] = (def->prev[i] >= FLATE_WINDOW_SIZE) ? def->prev[i] - FLATE_WINDOW_SIZE : -1;
+}
+
+Status deflate_init(Deflater *def, FlateSink sink, void *arg, int level)
+{
+    if (level < 1 || level > 9)
+        return e_failure;
+    def->sink = sink;
+    def->arg = arg;
+    def->chain_length = 1 << (level - 1);
+    def->start = 0;
+    def->end = 0;
+    memset(def->head, 0xFF, sizeof(def->head));
+    memset(def->prev, 0xFF, sizeof(def->prev));
+    def->num_syms = 0;
+    def->adler = 1;
+    def->bits = 0;
+    def->num_bits = 0;
+    def->out_len = 0;
+    def->failed = 0;
+
+    // Deflate with a 32 KB window, default level, no dictionary
+    put_bits(def, 0x78, 8);
+    put_bits(def, 0x9C, 8);
+    return e_success;
+}
+
+Status deflate_write(Deflater *def, const unsigned char *data, size_t n)
+{
+    def->adler = adler32_update(def->adler, data, n);
+    while (n > 0)
+    {
+        // Full window: compress all but the look ahead of a longest match, then slide
+        if (def->end == sizeof(def->window))
+        {
+            compress_window(def, def->end - FLATE_MAX_MATCH);
+            slide_window(def);
+        }
+        size_t k = sizeof(def->window) - def->end;
+        if (k > n)
+            k = n;
+        memcpy(def->window + def->end, data, k);
+        def->end += k;
+        data += k;
+        n -= k;
+    }
+    return def->failed ? e_failure : e_success;
+}
+
+Status deflate_finish(Deflater *def)
+{
+    compress_window(def, def->end);
+    write_block(def, 1);
+    if (def->num_bits % 8 != 0)
+        put_bits(def, 0, 8 - def->num_bits % 8);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        put_bits(def, (def->adler >> shift) & 0xFF, 8);
+    flush_out(def);
+    return def->failed ? e_failure : e_success;
+}
@@ -0,0 +1,129 @@
+#ifndef FLATE_H
+#define FLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Farthest back a match can reach */
+#define FLATE_WINDOW_SIZE 32768
+
+/* Shortest and longest match */
+#define FLATE_MIN_MATCH 3
+#define FLATE_MAX_MATCH 258
+
+/* Compressed bytes read from the source per refill */
+#define FLATE_IN_SIZE 16384
+
+/* Compressed bytes collected before they go to the sink */
+#define FLATE_OUT_SIZE 16384
+
+/* Symbols collected before a block is written */
+#define FLATE_BLOCK_SYMBOLS 16384
+
+/* Match finder hash table size */
+#define FLATE_HASH_BITS 15
+
+/* Level used when none is given, the match search tries 1 << (level - 1) earlier positions */
+#define FLATE_LEVEL_DEFAULT 6
+
+/* Code bits looked up at once when decoding */
+#define FLATE_FAST_BITS 10
+
+/* Literal/length and distance alphabets (with the two unused codes of each) */
+#define FLATE_LIT_CODES 288
+#define FLATE_DIST_CODES 32
+
+/* Source of compressed bytes: up to size bytes into buf, 0 at the end, -1 on error */
+typedef long (*FlateSource)(void *arg, unsigned char *buf, size_t size);
+
+/* Sink of compressed bytes */
+typedef Status (*FlateSink)(void *arg, const unsigned char *data, size_t n);
+
+/* Huffman decode table of one alphabet */
+typedef struct _FlateTable
+{
+    uint16_t fast[1 << FLATE_FAST_BITS]; // To store symbol << 4 | length of the codes up to FLATE_FAST_BITS, 0 for longer ones
+    uint16_t count[16];                  // To store the number of codes of each length
+    uint16_t symbol[FLATE_LIT_CODES];    // To store the symbols in canonical order
+} FlateTable;
+
+/*
+ * Streaming zlib inflate (RFC 1950/1951)
+ * inflate_read pulls compressed bytes from the source as it needs them
+ * and stops on a symbol boundary once the caller's buffer is full, a
+ * match that does not fit is finished by the next call. Memory is the
+ * 32 KB window, one input buffer and two decode tables
+ */
+typedef struct _Inflater
+{
+    FlateSource source;       // To store where compressed bytes come from
+    void *arg;                // To store the source argument
+    unsigned char in[FLATE_IN_SIZE]; // To store compressed bytes not used yet
+    size_t in_pos;            // To store the next byte of in
+    size_t in_len;            // To store the bytes in in
+    int in_end;               // To store 1 once the source has no more bytes
+    uint64_t bits;            // To store bits read ahead, next bit lowest
+    int num_bits;             // To store the number of bits in bits
+    int state;                // To store the INFLATE_* step
+    int last;                 // To store 1 in the final block
+    long stored_left;         // To store the bytes left in a stored block
+    int copy_len;             // To store the bytes left of a match
+    int copy_dist;            // To store the distance of that match
+    unsigned char window[FLATE_WINDOW_SIZE]; // To store the last 32 KB produced
+    uint64_t total;           // To store the bytes produced so far
+    uint32_t adler;           // To store the Adler-32 of the bytes produced
+    FlateTable lit;           // To store the literal/length code of the block
+    FlateTable dist;          // To store the distance code of the block
+} Inflater;
+
+/*
+ * Streaming zlib deflate
+ * input goes into a 64 KB window (32 KB of history, the rest look
+ * ahead), a hash chain finds matches, the symbols of FLATE_BLOCK_SYMBOLS
+ * go out as one block with its own Huffman codes
+ */
+typedef struct _Deflater
+{
+    FlateSink sink;           // To store where compressed bytes go
+    void *arg;                // To store the sink argument
+    int chain_length;         // To store the candidates tried per match search
+    unsigned char window[2 * FLATE_WINDOW_SIZE]; // To store history and look ahead
+    size_t start;             // To store the next window byte to compress
+    size_t end;               // To store the bytes in the window
+    int32_t head[1 << FLATE_HASH_BITS]; // To store the last position of each hash, -1 for none
+    int32_t prev[FLATE_WINDOW_SIZE];    // To store the previous position with the same hash
+    uint16_t sym_lit[FLATE_BLOCK_SYMBOLS];  // To store literals, or match lengths
+    uint16_t sym_dist[FLATE_BLOCK_SYMBOLS]; // To store match distances, 0 for a literal
+    size_t num_syms;          // To store the symbols collected
+    uint32_t adler;           // To store the Adler-32 of the input
+    uint64_t bits;            // To store bits not written yet, next bit lowest
+    int num_bits;             // To store the number of bits in bits
+    unsigned char out[FLATE_OUT_SIZE]; // To store compressed bytes for the sink
+    size_t out_len;           // To store the bytes in out
+    int failed;               // To store 1 once the sink failed
+} Deflater;
+
+/* Flate function prototypes */
+
+/* Adler-32 of n more bytes */
+uint32_t adler32_update(uint32_t adler, const unsigned char *data, size_t n);
+
+/* Start inflating the zlib stream read from source */
+void inflate_init(Inflater *inf, FlateSource source, void *arg);
+
+/* Inflate up to n bytes into out, return the bytes produced (fewer only
+ * at the end of the stream, whose checksum is then checked), -1 on a
+ * damaged or cut stream */
+long inflate_read(Inflater *inf, unsigned char *out, size_t n);
+
+/* Start a zlib stream to sink, level 1 (fastest) to 9 */
+Status deflate_init(Deflater *def, FlateSink sink, void *arg, int level);
+
+/* Compress n more bytes */
+Status deflate_write(Deflater *def, const unsigned char *data, size_t n);
+
+/* Compress what is left, end the stream and hand everything to the sink */
+Status deflate_finish(Deflater *def);
+
+#endif
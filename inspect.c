@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include "inspect.h"
+#include "decode.h"
+#include "encode.h"
+#include "aead.h"
+#include "png_io.h"
+#include "fec.h"
+#include "types.h"
+#include "common.h"
+
+/* Function Definitions */
+
+/*Inspect steps
+1.open the image read only with a small stdio buffer
+2.parse the BMP headers to find the carriers
+3.seek to the first carrier and decode magic string, format words,
+  extn size, extn and file size with the decoder's own field functions
+  (a few hundred carriers, usually inside the first buffer)
+4.reject a file size the image cannot hold, a chance magic match
+  in a plain image lands there
+5.print one line: payload fields, "no payload" or "not a supported BMP"
+Capacity steps
+1.parse the BMP headers only
+2.usable bytes = carriers left after the header fields (with the
+  longest extension) times lsb_bits / 8, less the checksum, the wider
+  size field past 2 GB, the FEC parity and the sealing overhead when
+  asked for*/
+
+/* Flag names for the inspect line */
+static void print_flags(uint32_t flags)
+{
+    const char *sep = "";
+    if (flags == 0)
+        printf("none");
+    if (flags & FORMAT_FLAG_COMPRESSED)
+    {
+        printf("%scompressed", sep);
+        sep = ",";
+    }
+    if (flags & FORMAT_FLAG_ENCRYPTED)
+    {
+        printf("%sencrypted", sep);
+        sep = ",";
+    }
+    if (flags & FORMAT_FLAG_SCATTERED)
+    {
+        printf("%sscattered", sep);
+        sep = ",";
+    }
+    if (flags & FORMAT_FLAG_CHECKSUM)
+    {
+        printf("%schecksum", sep);
+        sep = ",";
+    }
+    if (flags & FORMAT_FLAG_CONTAINER)
+    {
+        printf("%scontainer", sep);
+        sep = ",";
+    }
+    if (flags & FORMAT_FLAG_SIZE64)
+    {
+        printf("%ssize64", sep);
+        sep = ",";
+    }
+    if (flags & FORMAT_FLAG_FEC)
+        printf("%sfec", sep);
+}
+
+void print_payload_line(const char *fname, const DecodeInfo *decInfo)
+{
+    // size counts the stored bytes, compressed and/or sealed ones included
+    printf("%s: payload version=%d bits=%d flags=", fname, decInfo->format.version, decInfo->format.lsb_bits);
+    print_flags(decInfo->format.flags);
+    printf(" extn=%s size=%ld\n", decInfo->extn_secret_file, decInfo->size_secret_file);
+}
+
+Status inspect_payload_fields(DecodeInfo *decInfo)
+{
+    if (fseeko(decInfo->fptr_stego_image, carrier_offset(&decInfo->layout, 0), SEEK_SET) != 0)
+        return e_failure;
+    if (decode_magic_string(MAGIC_STRING, decInfo) == e_failure ||
+        decode_format_words(decInfo) == e_failure ||
+        decode_secret_file_extn_size(decInfo) == e_failure ||
+        decode_secret_file_extn(decInfo) == e_failure ||
+        decode_secret_file_size(decInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    if (decInfo->size_secret_file < 0 ||
+        decInfo->carrier_pos + (long)image_bytes_for(decInfo->size_secret_file + format_checksum_size(&decInfo->format),
+                                                      &decInfo->format) >
+            decInfo->layout.capacity)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+Status inspect_image(const char *fname)
+{
+    DecodeInfo decInfo = {0};
+    decInfo.stego_image_fname = (char *)fname;
+    decInfo.fptr_stego_image = open_image_stream(fname, "rb");
+    if (decInfo.fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        printf("ERROR:Unable to open %s\n", fname);
+        return e_failure;
+    }
+    // A PNG stream stays unbuffered, it only reads forward
+    if (!is_png_name(fname))
+        setvbuf(decInfo.fptr_stego_image, NULL, _IOFBF, INSPECT_BUFFER_SIZE);
+
+    if (read_bmp_layout(decInfo.fptr_stego_image, &decInfo.layout) == e_failure)
+    {
+        printf("%s: not a supported BMP or PNG\n", fname);
+    }
+    else if (inspect_payload_fields(&decInfo) == e_failure)
+    {
+        printf("%s: no payload\n", fname);
+    }
+    else
+    {
+        print_payload_line(fname, &decInfo);
+    }
+    fclose(decInfo.fptr_stego_image);
+    return e_success;
+}
+
+Status do_inspect(char *fnames[])
+{
+    Status ret = e_success;
+    for (int i = 0; fnames[i] != NULL; i++)
+    {
+        if (inspect_image(fnames[i]) == e_failure)
+            ret = e_failure;
+    }
+    return ret;
+}
+
+long payload_capacity(const BmpLayout *layout, const StegFormat *format)
+{
+    long carriers = layout->capacity - header_carriers_for(format, CAPACITY_EXTN_SIZE);
+    if (carriers <= 0)
+        return 0;
+    long bytes = carriers * format->lsb_bits / 8 - format_checksum_size(format);
+
+    // Past the 32 bit size field the 64 bit one takes 4 more data bytes
+    if (!(format->flags & FORMAT_FLAG_SIZE64) && bytes > FORMAT_SIZE32_MAX)
+        bytes = (bytes - 4 > FORMAT_SIZE32_MAX) ? bytes - 4 : FORMAT_SIZE32_MAX;
+
+    // Coded payloads lose the parity bytes of every frame
+    if (format->flags & FORMAT_FLAG_FEC)
+        bytes = fec_data_room(bytes);
+
+    // Largest payload whose sealed size still fits, a few steps down at most
+    if (format->flags & FORMAT_FLAG_ENCRYPTED)
+    {
+        long plain = -1;
+        while (bytes >= AEAD_HEADER_SIZE + AEAD_TAG_SIZE && (plain = aead_plain_size(bytes)) < 0)
+            bytes--;
+        bytes = (plain < 0) ? 0 : plain;
+    }
+    return bytes;
+}
+
+Status do_capacity(char *fnames[], int lsb_bits, uint32_t flags)
+{
+    StegFormat format;
+    if (select_format(&format, lsb_bits, flags) == e_failure)
+        return e_failure;
+
+    Status ret = e_success;
+    for (int i = 0; fnames[i] != NULL; i++)
+    {
+        BmpLayout layout;
+        FILE *fptr = open_image_stream(fnames[i], "rb");
+        if (fptr == NULL)
+        {
+            perror("fopen");
+            printf("ERROR:Unable to open %s\n", fnames[i]);
+            ret = e_failure;
+            continue;
+        }
+        if (!is_png_name(fnames[i]))
+            setvbuf(fptr, NULL, _IOFBF, INSPECT_BUFFER_SIZE);
+        if (read_bmp_layout(fptr, &layout) == e_failure)
+            printf("%s: not a supported BMP or PNG\n", fnames[i]);
+        else
+            printf("%s: capacity=%ld bits=%d width=%d height=%d carriers=%ld\n", fnames[i],
+                   payload_capacity(&layout, &format), lsb_bits, layout.width, layout.height, layout.capacity);
+        fclose(fptr);
+    }
+    return ret;
+}
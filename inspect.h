@@ -0,0 +1,47 @@
+#ifndef INSPECT_H
+#define INSPECT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "decode.h"
+
+/* stdio buffer of an inspected image, the BMP headers and every field
+ * before the secret data fit in it for common images */
+#define INSPECT_BUFFER_SIZE 4096
+
+/* Extension bytes counted by --capacity, the longest the encoder stores */
+#define CAPACITY_EXTN_SIZE 4
+
+/*
+ * Inspecting and capacity probing
+ * both only parse the BMP headers and (for inspect) decode the fields
+ * in front of the secret data, so an image costs a few KB of reads
+ * however large it is. Nothing is written, each image gives one line
+ * on stdout
+ */
+
+/* Inspect function prototypes */
+
+/* Decode the fields before the secret data of an image whose layout is
+ * read, e_failure if there is no payload (or a chance magic match) */
+Status inspect_payload_fields(DecodeInfo *decInfo);
+
+/* Print the one line summary of the payload fields decoded from fname */
+void print_payload_line(const char *fname, const DecodeInfo *decInfo);
+
+/* Print the embedded fields of one image, e_failure if it cannot be read */
+Status inspect_image(const char *fname);
+
+/* Inspect every image named in the NULL terminated list */
+Status do_inspect(char *fnames[]);
+
+/* Secret data bytes an image with this layout can hold in format, 0 if none */
+long payload_capacity(const BmpLayout *layout, const StegFormat *format);
+
+/* Print the capacity of every image named in the NULL terminated list */
+Status do_capacity(char *fnames[], int lsb_bits, uint32_t flags);
+
+#endif
@@ -0,0 +1,343 @@
+#include <stdint.h>
+#include <string.h>
+#include "lsb_kernels.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LSB_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/* One bit per image byte, bit 0 of every byte of a little endian word */
+#define LSB_MASK 0x0101010101010101ULL
+
+/* Function Definitions */
+
+/* Spread the 8 bits of b to bit 0 of the 8 bytes of a word
+ * Description: bit i of b ends up at bit 8 * i, in three shift/mask
+ * rounds (4 bits, then 2, then 1)
+ */
+static inline uint64_t spread_bits(unsigned char b)
+{
+    uint64_t x = b;
+    x = (x | (x << 28)) & 0x0000000F0000000FULL;
+    x = (x | (x << 14)) & 0x0003000300030003ULL;
+    x = (x | (x << 7)) & LSB_MASK;
+    return x;
+}
+
+/* Gather bit 0 of the 8 bytes of a word back into one byte
+ * Description: the multiply moves bit 8 * i to bit 56 + i, the partial
+ * products never overlap so no carries disturb the top byte
+ */
+static inline unsigned char gather_bits(uint64_t x)
+{
+    return ((x & LSB_MASK) * 0x0102040810204080ULL) >> 56;
+}
+
+/* Portable kernel, one payload byte per 64 bit word */
+static void encode_scalar(const char *data, size_t n, char *image_buffer)
+{
+    for (size_t i = 0; i < n; i++, image_buffer += 8)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint64_t v;
+        memcpy(&v, image_buffer, 8);
+        v = (v & ~LSB_MASK) | spread_bits(data[i]);
+        memcpy(image_buffer, &v, 8);
+#else
+        for (int bit = 0; bit < 8; bit++)
+            image_buffer[bit] = (image_buffer[bit] & ~1) | ((data[i] >> bit) & 1);
+#endif
+    }
+}
+
+static void decode_scalar(char *data, size_t n, const unsigned char *image_buffer)
+{
+    for (size_t i = 0; i < n; i++, image_buffer += 8)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint64_t v;
+        memcpy(&v, image_buffer, 8);
+        data[i] = gather_bits(v);
+#else
+        unsigned char ch = 0;
+        for (int bit = 0; bit < 8; bit++)
+            ch |= (image_buffer[bit] & 1) << bit;
+        data[i] = ch;
+#endif
+    }
+}
+
+#ifdef LSB_X86_DISPATCH
+
+/* SSE2: one 16 byte vector carries 2 payload bytes
+ * Encode replicates every payload byte 8 times with unpacks, then
+ * turns "bit i of byte is set" into 0/1 with a compare against 1 << i
+ */
+static inline __m128i spread_sse2(__m128i rep)
+{
+    const __m128i bits = _mm_set1_epi64x(0x8040201008040201LL);
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(rep, bits), bits), _mm_set1_epi8(1));
+}
+
+static inline void merge_sse2(char *image_buffer, __m128i rep)
+{
+    __m128i v = _mm_loadu_si128((__m128i *)image_buffer);
+    v = _mm_or_si128(_mm_andnot_si128(_mm_set1_epi8(1), v), spread_sse2(rep));
+    _mm_storeu_si128((__m128i *)image_buffer, v);
+}
+
+static void encode_sse2(const char *data, size_t n, char *image_buffer)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, image_buffer += 128)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i d8[2] = {_mm_unpacklo_epi8(d, d), _mm_unpackhi_epi8(d, d)};
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i d16lo = _mm_unpacklo_epi16(d8[h], d8[h]);
+            __m128i d16hi = _mm_unpackhi_epi16(d8[h], d8[h]);
+            merge_sse2(image_buffer + h * 64, _mm_unpacklo_epi32(d16lo, d16lo));
+            merge_sse2(image_buffer + h * 64 + 16, _mm_unpackhi_epi32(d16lo, d16lo));
+            merge_sse2(image_buffer + h * 64 + 32, _mm_unpacklo_epi32(d16hi, d16hi));
+            merge_sse2(image_buffer + h * 64 + 48, _mm_unpackhi_epi32(d16hi, d16hi));
+        }
+    }
+    encode_scalar(data + i, n - i, image_buffer);
+}
+
+/* Decode shifts every LSB up to bit 7 and collects them with movemask */
+static void decode_sse2(char *data, size_t n, const unsigned char *image_buffer)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2, image_buffer += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)image_buffer);
+        uint16_t m = _mm_movemask_epi8(_mm_slli_epi64(v, 7));
+        memcpy(data + i, &m, 2);
+    }
+    decode_scalar(data + i, n - i, image_buffer);
+}
+
+/* AVX2: one 32 byte vector carries 4 payload bytes, pshufb replicates */
+__attribute__((target("avx2")))
+static void encode_avx2(const char *data, size_t n, char *image_buffer)
+{
+    const __m256i idx = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                         2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, image_buffer += 32)
+    {
+        int32_t w;
+        memcpy(&w, data + i, 4);
+        __m256i rep = _mm256_shuffle_epi8(_mm256_set1_epi32(w), idx);
+        __m256i s = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(rep, bits), bits), one);
+        __m256i v = _mm256_loadu_si256((__m256i *)image_buffer);
+        v = _mm256_or_si256(_mm256_andnot_si256(one, v), s);
+        _mm256_storeu_si256((__m256i *)image_buffer, v);
+    }
+    encode_scalar(data + i, n - i, image_buffer);
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(char *data, size_t n, const unsigned char *image_buffer)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, image_buffer += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)image_buffer);
+        uint32_t m = _mm256_movemask_epi8(_mm256_slli_epi64(v, 7));
+        memcpy(data + i, &m, 4);
+    }
+    decode_scalar(data + i, n - i, image_buffer);
+}
+
+/* AVX-512BW: 8 payload bytes are directly a 64 lane byte mask */
+__attribute__((target("avx512f,avx512bw")))
+static void encode_avx512(const char *data, size_t n, char *image_buffer)
+{
+    const __m512i one = _mm512_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, image_buffer += 64)
+    {
+        uint64_t k;
+        memcpy(&k, data + i, 8);
+        __m512i v = _mm512_loadu_si512((void *)image_buffer);
+        v = _mm512_or_si512(_mm512_andnot_si512(one, v), _mm512_maskz_mov_epi8(k, one));
+        _mm512_storeu_si512((void *)image_buffer, v);
+    }
+    encode_scalar(data + i, n - i, image_buffer);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void decode_avx512(char *data, size_t n, const unsigned char *image_buffer)
+{
+    const __m512i one = _mm512_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8, image_buffer += 64)
+    {
+        uint64_t k = _mm512_test_epi8_mask(_mm512_loadu_si512((const void *)image_buffer), one);
+        memcpy(data + i, &k, 8);
+    }
+    decode_scalar(data + i, n - i, image_buffer);
+}
+
+#endif
+
+/* Spread the low 64 / (8 / bits) bits of x into groups of bits at the
+ * bottom of every byte (bits = 2: 16 payload bits, bits = 4: 32)
+ */
+static inline uint64_t spread_groups(uint64_t x, int bits)
+{
+    if (bits == 2)
+    {
+        x = (x | (x << 24)) & 0x000000FF000000FFULL;
+        x = (x | (x << 12)) & 0x000F000F000F000FULL;
+        x = (x | (x << 6)) & 0x0303030303030303ULL;
+    }
+    else
+    {
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    }
+    return x;
+}
+
+/* Inverse of spread_groups */
+static inline uint64_t gather_groups(uint64_t x, int bits)
+{
+    if (bits == 2)
+    {
+        x &= 0x0303030303030303ULL;
+        x = (x | (x >> 6)) & 0x000F000F000F000FULL;
+        x = (x | (x >> 12)) & 0x000000FF000000FFULL;
+        x = (x | (x >> 24)) & 0xFFFFULL;
+    }
+    else
+    {
+        x &= 0x0F0F0F0F0F0F0F0FULL;
+        x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x >> 16)) & 0xFFFFFFFFULL;
+    }
+    return x;
+}
+
+/* Packed 2 and 4 bit kernels, one 64 bit word of image bytes per step
+ * (2 payload bytes at 2 bits, 4 payload bytes at 4 bits)
+ */
+static void encode_packed(const char *data, size_t n, char *image_buffer, int bits)
+{
+    const size_t per_word = bits;
+    const uint64_t mask = (bits == 2) ? 0x0303030303030303ULL : 0x0F0F0F0F0F0F0F0FULL;
+    size_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + per_word <= n; i += per_word, image_buffer += 8)
+    {
+        uint64_t x = 0, v;
+        memcpy(&x, data + i, per_word);
+        memcpy(&v, image_buffer, 8);
+        v = (v & ~mask) | spread_groups(x, bits);
+        memcpy(image_buffer, &v, 8);
+    }
+#endif
+    // Tail (and big endian hosts): one group at a time
+    unsigned char group_mask = (1 << bits) - 1;
+    for (; i < n; i++)
+    {
+        for (int shift = 0; shift < 8; shift += bits, image_buffer++)
+            *image_buffer = (*image_buffer & ~group_mask) | ((data[i] >> shift) & group_mask);
+    }
+}
+
+static void decode_packed(char *data, size_t n, const unsigned char *image_buffer, int bits)
+{
+    const size_t per_word = bits;
+    size_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + per_word <= n; i += per_word, image_buffer += 8)
+    {
+        uint64_t v;
+        memcpy(&v, image_buffer, 8);
+        uint64_t x = gather_groups(v, bits);
+        memcpy(data + i, &x, per_word);
+    }
+#endif
+    unsigned char group_mask = (1 << bits) - 1;
+    for (; i < n; i++)
+    {
+        unsigned char ch = 0;
+        for (int shift = 0; shift < 8; shift += bits, image_buffer++)
+            ch |= (*image_buffer & group_mask) << shift;
+        data[i] = ch;
+    }
+}
+
+/* Kernels picked at start up, scalar until then */
+static void (*encode_kernel)(const char *, size_t, char *) = encode_scalar;
+static void (*decode_kernel)(char *, size_t, const unsigned char *) = decode_scalar;
+static const char *kernel_name = "scalar";
+
+#ifdef LSB_X86_DISPATCH
+/* Runtime CPU dispatch, done once before main so threads never race on it */
+__attribute__((constructor))
+static void select_lsb_kernels(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        encode_kernel = encode_avx512;
+        decode_kernel = decode_avx512;
+        kernel_name = "avx512bw";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        encode_kernel = encode_avx2;
+        decode_kernel = decode_avx2;
+        kernel_name = "avx2";
+    }
+    else
+    {
+        encode_kernel = encode_sse2;
+        decode_kernel = decode_sse2;
+        kernel_name = "sse2";
+    }
+}
+#endif
+
+void encode_bytes_to_lsb(const char *data, size_t n, char *image_buffer)
+{
+    encode_kernel(data, n, image_buffer);
+}
+
+void decode_bytes_from_lsb(char *data, size_t n, const unsigned char *image_buffer)
+{
+    decode_kernel(data, n, image_buffer);
+}
+
+void encode_bytes_to_nlsb(const char *data, size_t n, char *image_buffer, int bits)
+{
+    if (bits == 1)
+        encode_kernel(data, n, image_buffer);
+    else
+        encode_packed(data, n, image_buffer, bits);
+}
+
+void decode_bytes_from_nlsb(char *data, size_t n, const unsigned char *image_buffer, int bits)
+{
+    if (bits == 1)
+        decode_kernel(data, n, image_buffer);
+    else
+        decode_packed(data, n, image_buffer, bits);
+}
+
+const char *lsb_kernel_name(void)
+{
+    return kernel_name;
+}
@@ -0,0 +1,27 @@
+#ifndef LSB_KERNELS_H
+#define LSB_KERNELS_H
+
+#include <stddef.h>
+
+/* Payload bytes handled per kernel call by the encode/decode stages */
+#define LSB_BATCH_SIZE 64
+
+/* LSB kernel function prototypes */
+
+/* Encode n payload bytes into the LSBs of 8 * n image bytes (LSB first) */
+void encode_bytes_to_lsb(const char *data, size_t n, char *image_buffer);
+
+/* Decode n payload bytes from the LSBs of 8 * n image bytes (LSB first) */
+void decode_bytes_from_lsb(char *data, size_t n, const unsigned char *image_buffer);
+
+/* Encode n payload bytes into the low bits LSBs of 8 * n / bits image bytes,
+ * bits is 1, 2 or 4; low bits of the payload go first */
+void encode_bytes_to_nlsb(const char *data, size_t n, char *image_buffer, int bits);
+
+/* Decode n payload bytes from the low bits LSBs of 8 * n / bits image bytes */
+void decode_bytes_from_nlsb(char *data, size_t n, const unsigned char *image_buffer, int bits);
+
+/* Name of the kernel picked for this CPU */
+const char *lsb_kernel_name(void);
+
+#endif
@@ -1,23 +1,237 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "encode.h"
 #include "decode.h"
+#include "parallel_encode.h"
+#include "batch.h"
+#include "stats.h"
+#include "stream_io.h"
+#include "compress.h"
+#include "aead.h"
+#include "inspect.h"
+#include "container.h"
+#include "scan.h"
+#include "detect.h"
+#include "serve.h"
 #include "types.h"
 #include "common.h"
 
 // Function declaration
 OperationType check_operation_type(char *symbol);
+int strip_option(char *argv[], const char *option);
+char *strip_option_value(char *argv[], const char *option);
+int strip_option_values(char *argv[], const char *option, char **values[]);
 
 int main(int argc, char *argv[])
 {
+    // Options can appear anywhere, strip them before positional args are read
+    int use_mmap = strip_option(argv, "--mmap");
+    int use_stats = strip_option(argv, "--stats");
+    char *threads = strip_option_value(argv, "--threads");
+    char *offset = strip_option_value(argv, "--offset");
+    char *length = strip_option_value(argv, "--length");
+    char *bits = strip_option_value(argv, "--bits");
+    char *level = strip_option_value(argv, "--compress-level");
+    int compress_level = strip_option(argv, "--compress") ? COMPRESS_LEVEL_AUTO : 0;
+    char *key_fname = strip_option_value(argv, "--key-file");
+    int use_scatter = strip_option(argv, "--scatter");
+    int use_checksum = strip_option(argv, "--checksum");
+    int use_fec = strip_option(argv, "--fec");
+    int list_entries = strip_option(argv, "--list");
+    char *entry_name = strip_option_value(argv, "--entry");
+    int keep_mode = strip_option(argv, "--keep-mode");
+    char *connect_path = strip_option_value(argv, "--connect");
+    // The --add values stay in argv, past the end of the other args
+    char **extra_fnames;
+    int num_extra = strip_option_values(argv, "--add", &extra_fnames);
+    if (level != NULL)
+    {
+        compress_level = atoi(level);
+        if (compress_level < COMPRESS_LEVEL_MIN || compress_level > COMPRESS_LEVEL_MAX)
+        {
+            printf("ERROR: --compress-level must be 1 to 9.\n");
+            return e_failure;
+        }
+    }
+    for (argc = 0; argv[argc] != NULL; argc++)
+        ;
+
+    // Passphrase is read from a file so it never shows up in the process list
+    char passphrase[AEAD_MAX_PASSPHRASE];
+    if (key_fname != NULL && aead_read_passphrase(key_fname, passphrase, sizeof(passphrase)) == e_failure)
+    {
+        printf("ERROR: Unable to read a passphrase from %s.\n", key_fname);
+        return e_failure;
+    }
+    if (use_scatter && key_fname == NULL)
+    {
+        printf("ERROR: --scatter needs --key-file.\n");
+        return e_failure;
+    }
+
     if (argc < 3)
     {
         printf("Usage:\n");
         printf("  For Encoding: ./steg -e <source_image.bmp> <secret.txt> [output_stego.bmp]\n"); 
         printf("  For Decoding: ./steg -d <stego_image.bmp> [output.txt]\n");
+        printf("  For Batches : ./steg -b <manifest.txt | -> (one -e/-d command per line)\n");
+        printf("  Packing     : ./steg -e <source_image.bmp> <secret> [output_stego.bmp] --add <file>...\n");
+        printf("                (one container of named files), -d extracts them all into\n");
+        printf("                [output_dir], --list shows them, --entry NAME extracts one\n");
+        printf("  Inspecting  : ./steg -i <stego_image.bmp>... (header fields only, one line per image)\n");
+        printf("  Scanning    : ./steg -s <dir>... (every file under dir carrying a payload, one\n");
+        printf("                line each as with -i, header reads batched through io_uring)\n");
+        printf("  Detecting   : ./steg --detect <image.bmp>... (estimated LSB embedding rate from\n");
+        printf("                sample pair analysis, chi-square flags a sequential payload,\n");
+        printf("                honours --threads)\n");
+        printf("  Capacity    : ./steg --capacity <image.bmp>... (secret bytes that fit, honours\n");
+        printf("                --bits, --compress and --key-file, counts a 4 byte extension)\n");
+        printf("  Verifying   : ./steg --verify <stego_image.bmp>... (checks the embedded checksum,\n");
+        printf("                writes nothing, needs --key-file only for --scatter images)\n");
+        printf("  Streaming   : any image or payload name may be - for stdin/stdout, e.g.\n");
+        printf("                cat cover.bmp | ./steg -e - /dev/fd/3 - 3<secret.txt > stego.bmp\n");
+        printf("                messages go to stderr when an output is stdout\n");
+        printf("  Serving     : ./steg --serve <socket> (a daemon answering -e/-d/-i requests with\n");
+        printf("                the files passed over the Unix socket, --threads workers)\n");
+        printf("  PNG images  : 8 bit RGB or RGBA .png files work wherever a .bmp does, a PNG\n");
+        printf("                cover gives a PNG stego image (not with --scatter)\n");
+        printf("Options:\n");
+        printf("  --mmap       encode/decode through memory mapped images (same source and output encodes in place)\n");
+        printf("  --threads N  encode/decode the secret data on N threads (0 = all cores),\n");
+        printf("               with -b: run N manifest lines at a time\n");
+        printf("  --bits N     encode only: hide N bits (1, 2 or 4) in each image byte,\n");
+        printf("               decoding finds N in the embedded header\n");
+        printf("  --compress   encode only: compress the secret data first (level picked\n");
+        printf("               from its size), decoding decompresses it\n");
+        printf("  --compress-level N  as --compress with a fixed level, 1 (fast) to 9 (small)\n");
+        printf("  --key-file F encrypt (encode) or decrypt (decode) the secret data with\n");
+        printf("               ChaCha20-Poly1305, the passphrase is the first line of F\n");
+        printf("  --scatter    encode only, with --key-file: spread the secret data over\n");
+        printf("               the whole image in an order keyed by the passphrase\n");
+        printf("  --checksum   encode only: add a CRC32C of the stored data after it, decoding\n");
+        printf("               the whole payload checks it\n");
+        printf("  --fec        encode only: add Reed-Solomon parity (about 14%%) so decoding\n");
+        printf("               repairs damaged payload bytes, up to 1024 in a row\n");
+        printf("  --add F      encode only: pack F with the secret file, may repeat\n");
+        printf("  --list       decode only: list the files of a container, extract nothing\n");
+        printf("  --entry NAME decode only: extract the container file NAME (to [output.txt]\n");
+        printf("               or NAME), --offset/--length then count within it\n");
+        printf("  --keep-mode  decode only: give extracted container files back their\n");
+        printf("               executable bit (files are never extracted over existing ones)\n");
+        printf("  --connect S  run -e, -d or -i through the server on socket S (BMP images,\n");
+        printf("               not with --fec, --add or --mmap)\n");
+        printf("  --stats      print per stage counters as one JSON line on stderr\n");
+        printf("  --offset N   decode only: first payload byte to extract\n");
+        printf("  --length N   decode only: number of payload bytes to extract\n");
         return 1;
     }
 
+    // With the stego image or payload on stdout, keep stdout for the data
+    char *output = NULL;
+    if (strcmp(argv[1], "-e") == 0 && argc > 3)
+        output = (argc > 4) ? argv[4] : argv[2];
+    else if (strcmp(argv[1], "-d") == 0)
+        output = (argc > 3) ? argv[3] : argv[2];
+    if (is_stream_name(output) && divert_stdout_messages() == e_failure)
+        return e_failure;
+
+    // Long running server, or one command run by it
+    if (strcmp(argv[1], "--serve") == 0)
+    {
+        int num_threads = (threads != NULL) ? atoi(threads) : 0;
+        if (num_threads <= 0)
+            num_threads = default_thread_count();
+        return do_serve(argv[2], num_threads);
+    }
+    if (connect_path != NULL)
+    {
+        if (use_fec || num_extra > 0 || use_mmap)
+        {
+            printf("ERROR: --connect does not take --fec, --add or --mmap.\n");
+            return e_failure;
+        }
+        static ServeRequest options;
+        options.lsb_bits = (bits != NULL) ? atoi(bits) : 0;
+        options.compress_level = compress_level;
+        options.use_scatter = use_scatter;
+        options.use_checksum = use_checksum;
+        options.offset = (offset != NULL) ? strtol(offset, NULL, 0) : 0;
+        options.length = (length != NULL) ? strtol(length, NULL, 0) : 0;
+        if (key_fname != NULL)
+            strcpy(options.passphrase, passphrase);
+        return do_client(connect_path, argv, &options);
+    }
+
+    // Header fields, capacity or checksum only, nothing is written
+    if (strcmp(argv[1], "-i") == 0 || strcmp(argv[1], "--inspect") == 0)
+    {
+        return do_inspect(argv + 2);
+    }
+    if (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "--scan") == 0)
+    {
+        return do_scan(argv + 2);
+    }
+    if (strcmp(argv[1], "--detect") == 0)
+    {
+        int num_threads = (threads != NULL) ? atoi(threads) : 1;
+        if (num_threads <= 0)
+            num_threads = default_thread_count();
+        return do_detect(argv + 2, num_threads);
+    }
+    if (strcmp(argv[1], "--verify") == 0)
+    {
+        return do_verify(argv + 2, (key_fname != NULL) ? passphrase : NULL);
+    }
+    if (strcmp(argv[1], "--capacity") == 0)
+    {
+        uint32_t flags = (compress_level ? FORMAT_FLAG_COMPRESSED : 0) |
+                         (key_fname != NULL ? FORMAT_FLAG_ENCRYPTED : 0) |
+                         (use_scatter ? FORMAT_FLAG_SCATTERED : 0) |
+                         (use_checksum ? FORMAT_FLAG_CHECKSUM : 0) |
+                         (use_fec ? FORMAT_FLAG_FEC : 0);
+        int lsb_bits = (bits != NULL) ? atoi(bits) : 1;
+        if (validate_lsb_bits(lsb_bits) == e_failure)
+        {
+            printf("ERROR: --bits must be 1, 2 or 4.\n");
+            return e_failure;
+        }
+        if (do_capacity(argv + 2, lsb_bits, flags) == e_failure)
+        {
+            printf("ERROR: Unable to report the capacity.\n");
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    // Batch of encode/decode operations from a manifest
+    if (strcmp(argv[1], "-b") == 0)
+    {
+        printf("INFO: Selected Batch...\n");
+
+        BatchInfo batchInfo = {0};
+        batchInfo.use_mmap = use_mmap;
+        batchInfo.lsb_bits = (bits != NULL) ? atoi(bits) : 0;
+        batchInfo.compress_level = compress_level;
+        batchInfo.passphrase = (key_fname != NULL) ? passphrase : NULL;
+        batchInfo.use_scatter = use_scatter;
+        batchInfo.use_checksum = use_checksum;
+        batchInfo.use_fec = use_fec;
+        if (threads != NULL)
+        {
+            batchInfo.num_threads = atoi(threads);
+            if (batchInfo.num_threads <= 0)
+                batchInfo.num_threads = default_thread_count();
+        }
+
+        if (read_and_validate_batch_args(argv, &batchInfo) == e_failure)
+        {
+            printf("ERROR: Invalid batch arguments.\n");
+            return e_failure;
+        }
+        return do_batch(&batchInfo);
+    }
+
     // Identify operation type: encode or decode
     OperationType op_type = check_operation_type(argv[1]);
 
@@ -25,7 +239,30 @@ int main(int argc, char *argv[])
     {
         printf("INFO: Selected Encoding...\n");
 
-        EncodeInfo encInfo;
+        EncodeInfo encInfo = {0};
+        encInfo.use_mmap = use_mmap;
+        encInfo.format.lsb_bits = (bits != NULL) ? atoi(bits) : 0;
+        encInfo.compress_level = compress_level;
+        encInfo.passphrase = (key_fname != NULL) ? passphrase : NULL;
+        encInfo.use_scatter = use_scatter;
+        encInfo.use_checksum = use_checksum;
+        encInfo.use_fec = use_fec;
+        encInfo.extra_fnames = extra_fnames;
+        encInfo.num_extra = num_extra;
+        if (bits != NULL && validate_lsb_bits(encInfo.format.lsb_bits) == e_failure)
+        {
+            printf("ERROR: --bits must be 1, 2 or 4.\n");
+            return e_failure;
+        }
+        StatsInfo stats;
+        if (use_stats && stats_init(&stats, "encode") == e_success)
+            encInfo.stats = &stats;
+        if (threads != NULL)
+        {
+            encInfo.num_threads = atoi(threads);
+            if (encInfo.num_threads <= 0)
+                encInfo.num_threads = default_thread_count();
+        }
 
         if (read_and_validate_encode_args(argv, &encInfo) == e_success) //validate args
         {
@@ -38,6 +275,12 @@ int main(int argc, char *argv[])
             {
                 printf("ERROR: Encoding failed.\n");
             }
+            if (encInfo.stats != NULL)
+            {
+                stats_end(encInfo.stats);
+                stats_emit_json(encInfo.stats, stderr);
+                stats_close(encInfo.stats);
+            }
         }
         else
         {
@@ -49,11 +292,31 @@ int main(int argc, char *argv[])
     {
         printf("INFO: Selected Decoding...\n");
 
-        DecodeInfo decInfo;
+        DecodeInfo decInfo = {0};
+        decInfo.use_mmap = use_mmap;
+        decInfo.keep_mode = keep_mode;
+        decInfo.passphrase = (key_fname != NULL) ? passphrase : NULL;
+        StatsInfo stats;
+        if (use_stats && stats_init(&stats, "decode") == e_success)
+            decInfo.stats = &stats;
+        if (threads != NULL)
+        {
+            decInfo.num_threads = atoi(threads);
+            if (decInfo.num_threads <= 0)
+                decInfo.num_threads = default_thread_count();
+        }
+        decInfo.payload_offset = (offset != NULL) ? strtol(offset, NULL, 0) : 0;
+        decInfo.payload_length = (length != NULL) ? strtol(length, NULL, 0) : -1;
+        if (decInfo.payload_offset < 0)
+        {
+            printf("ERROR: Invalid payload offset.\n");
+            return e_failure;
+        }
 
         if (read_and_validate_decode_args(argv, &decInfo) == e_success)
         {
-            if (do_decoding(&decInfo) == e_success)
+            // A container payload is extracted file by file, others as before
+            if (do_container_decoding(&decInfo, entry_name, list_entries, argv[3]) == e_success)
             {
                 printf("INFO: Decoding completed successfully!\n");
             }
@@ -61,6 +324,12 @@ int main(int argc, char *argv[])
             {
                 printf("ERROR: Decoding failed.\n");
             }
+            if (decInfo.stats != NULL)
+            {
+                stats_end(decInfo.stats);
+                stats_emit_json(decInfo.stats, stderr);
+                stats_close(decInfo.stats);
+            }
         }
         else
         {
@@ -77,6 +346,38 @@ int main(int argc, char *argv[])
     return e_success;
 }
 
+/* Function: strip_option_values
+ * Purpose : Remove every "option value" from the NULL terminated argv,
+ *           move the values in order behind its NULL, point *values at
+ *           them (NULL terminated too) and return how many there were
+ */
+int strip_option_values(char *argv[], const char *option, char **values[])
+{
+    int count = 0;
+    int j = 0;
+    // argv[0..j) keeps the other args, argv[j..j+count) the values so far
+    for (int i = 0; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], option) == 0 && argv[i + 1] != NULL)
+            argv[j + count++] = argv[++i];
+        else
+        {
+            char *arg = argv[i];
+            memmove(argv + j + 1, argv + j, count * sizeof(char *));
+            argv[j++] = arg;
+        }
+    }
+    // Each value freed its option's slot, so both NULLs fit
+    if (count > 0)
+    {
+        memmove(argv + j + 1, argv + j, count * sizeof(char *));
+        argv[j + count + 1] = NULL;
+    }
+    argv[j] = NULL;
+    *values = argv + j + (count > 0);
+    return count;
+}
+
 /* Function: check_operation_type
  * Purpose : Identify whether operation is encode or decode
  */
@@ -95,3 +396,41 @@ OperationType check_operation_type(char *symbol)
         return e_unsupported;
     }
 }
+
+/* Function: strip_option
+ * Purpose : Remove every occurrence of option from the NULL terminated
+ *           argv, return 1 if it was present
+ */
+int strip_option(char *argv[], const char *option)
+{
+    int found = 0;
+    int j = 0;
+    for (int i = 0; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], option) == 0)
+            found = 1;
+        else
+            argv[j++] = argv[i];
+    }
+    argv[j] = NULL;
+    return found;
+}
+
+/* Function: strip_option_value
+ * Purpose : Remove "option value" from the NULL terminated argv and
+ *           return value, NULL if the option is absent
+ */
+char *strip_option_value(char *argv[], const char *option)
+{
+    char *value = NULL;
+    int j = 0;
+    for (int i = 0; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], option) == 0 && argv[i + 1] != NULL)
+            value = argv[++i];
+        else
+            argv[j++] = argv[i];
+    }
+    argv[j] = NULL;
+    return value;
+}
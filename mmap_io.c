@@ -0,0 +1,605 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include "mmap_io.h"
+#include "block_io.h"
+#include "lsb_kernels.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "aead.h"
+#include "scatter.h"
+#include "crc32c.h"
+#include "types.h"
+#include "common.h"
+
+/* Payload bytes decoded per chunk from the map */
+#define MMAP_CHUNK_SIZE 4096
+
+/* Function Definitions */
+
+/*mmap encoding steps
+1.open source image, secret file and stego image
+  same image for source and stego means encode in place
+2.check capacity of source image
+3.clone source image to stego image
+  reflink (FICLONE) when the filesystem can share extents
+  else copy in kernel through copy_file_blocks
+4.map header + payload region of the stego image
+  only the pages holding payload LSBs are mapped and dirtied
+5.encode magic string, format words, extn size, extn, file size and data
+  straight into the mapped carriers (colour bytes), through a scratch
+  copy only when row padding or alpha bytes sit between them
+  scattered data maps the whole pixel array and goes through the
+  cell permutation one batch of carriers at a time
+6.unmap and close all files*/
+
+/* Magic string is stored MSB first, as in encode_magic_string */
+static void encode_magic_byte(char data, char *image_buffer)
+{
+    for (int bit = 7; bit >= 0; bit--)
+    {
+        image_buffer[7 - bit] = (image_buffer[7 - bit] & 0xFE) | ((data >> bit) & 1);
+    }
+}
+
+/* Magic string is read MSB first, as in decode_magic_string */
+static char decode_magic_byte(const unsigned char *image_buffer)
+{
+    unsigned char ch = 0;
+    for (int bit = 0; bit < 8; bit++)
+    {
+        ch = (ch << 1) | (image_buffer[bit] & 1);
+    }
+    return ch;
+}
+
+/* Give the stego image the same contents as the source image */
+static Status clone_image(EncodeInfo *encInfo)
+{
+#ifdef FICLONE
+    // Reflink: no data is copied, extents are shared until written
+    if (ioctl(fileno(encInfo->fptr_stego_image), FICLONE, fileno(encInfo->fptr_src_image)) == 0)
+        return e_success;
+#endif
+    rewind(encInfo->fptr_src_image);
+    if (copy_file_blocks(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->io_block_size) == e_failure)
+        return e_failure;
+    return (fflush(encInfo->fptr_stego_image) == 0) ? e_success : e_failure;
+}
+
+/* Carriers k .. k + n - 1 of the map: in place when the layout is contiguous,
+ * else gathered into scratch (put_map_carriers copies them back) */
+static void *map_carriers(const BmpLayout *layout, const void *image, long k, size_t n, void *scratch)
+{
+    const char *window = (const char *)image + carrier_offset(layout, k);
+    void *carriers = layout->contiguous ? (void *)window : scratch;
+    gather_carriers(layout, k, n, window, carriers);
+    return carriers;
+}
+
+/* Put carriers from map_carriers back into the map */
+static void put_map_carriers(const BmpLayout *layout, void *image, long k, size_t n, const void *carriers)
+{
+    scatter_carriers(layout, k, n, carriers, (char *)image + carrier_offset(layout, k));
+}
+
+/* Data carriers k .. k + n - 1: from the scatter batch when there is one, else as map_carriers */
+static void *map_data_carriers(const BmpLayout *layout, ScatterBatch *batch, const void *image, long k, size_t n,
+                               void *scratch, int writable)
+{
+    if (batch != NULL)
+        return scatter_batch_carriers(batch, k, n, writable);
+    return map_carriers(layout, image, k, n, scratch);
+}
+
+/* Put carriers from map_data_carriers back into the map (a scatter batch writes them back itself) */
+static void put_data_carriers(const BmpLayout *layout, ScatterBatch *batch, void *image, long k, size_t n,
+                              const void *carriers)
+{
+    if (batch == NULL)
+        put_map_carriers(layout, image, k, n, carriers);
+}
+
+/* Carriers taken by everything before the secret data */
+static size_t header_carriers(EncodeInfo *encInfo)
+{
+    return header_carriers_for(&encInfo->format, strlen(encInfo->extn_secret_file));
+}
+
+/* Encode n data bytes into the map from carrier *k on, SECRET_CHUNK_SIZE at a time */
+static void encode_bytes_into_map(EncodeInfo *encInfo, char *image, long *k, const char *data, size_t n, char *scratch,
+                                  ScatterBatch *batch)
+{
+    if (encInfo->format.flags & FORMAT_FLAG_CHECKSUM)
+        encInfo->checksum = crc32c_update(encInfo->checksum, data, n);
+    while (n > 0)
+    {
+        size_t chunk = (n < SECRET_CHUNK_SIZE) ? n : SECRET_CHUNK_SIZE;
+        size_t len = image_bytes_for(chunk, &encInfo->format);
+        char *carriers = map_data_carriers(&encInfo->layout, batch, image, *k, len, scratch, 1);
+        encode_bytes_to_nlsb(data, chunk, carriers, encInfo->format.lsb_bits);
+        put_data_carriers(&encInfo->layout, batch, image, *k, len, carriers);
+        *k += len;
+        data += chunk;
+        n -= chunk;
+    }
+}
+
+/* Seal the secret file segment by segment straight into the map, as in encode_sealed_file_data */
+static Status encode_sealed_into_map(EncodeInfo *encInfo, char *image, long *k, char *scratch, ScatterBatch *batch)
+{
+    unsigned char header[AEAD_HEADER_SIZE];
+    unsigned char *segment = scratch_alloc(encInfo->arena, AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    if (segment == NULL)
+        return e_failure;
+
+    aead_put_header(&encInfo->aead, header);
+    encode_bytes_into_map(encInfo, image, k, (char *)header, AEAD_HEADER_SIZE, scratch, batch);
+    rewind(encInfo->fptr_secret);
+    for (long i = 0; i < aead_segments(&encInfo->aead); i++)
+    {
+        size_t n = aead_segment_length(&encInfo->aead, i);
+        if (fread(segment, 1, n, encInfo->fptr_secret) != n)
+        {
+            scratch_free(encInfo->arena, segment);
+            return e_failure;
+        }
+        aead_seal_segment(&encInfo->aead, i, segment, n);
+        encode_bytes_into_map(encInfo, image, k, (char *)segment, n + AEAD_TAG_SIZE, scratch, batch);
+    }
+    scratch_free(encInfo->arena, segment);
+    return e_success;
+}
+
+/* Encode all the fields into the mapped image bytes */
+Status encode_into_map(EncodeInfo *encInfo, char *image)
+{
+    const BmpLayout *layout = &encInfo->layout;
+    char scratch[SECRET_CHUNK_SIZE * 8];
+    long k = header_carriers(encInfo);
+
+    // Header fields all fit in one run of carriers
+    char *carriers = map_carriers(layout, image, 0, k, scratch);
+    char *pos = carriers;
+
+    for (int i = 0; i < strlen(MAGIC_STRING); i++, pos += 8)
+        encode_magic_byte(MAGIC_STRING[i], pos);
+
+    const StegFormat *format = &encInfo->format;
+    if (format->version >= 2)
+    {
+        encode_uint32_to_nlsb(format_word(format), pos, 1);
+        encode_uint32_to_nlsb(format->flags, pos + 32, 1);
+        pos += FORMAT_WORDS_SIZE;
+    }
+
+    int extn_size = strlen(encInfo->extn_secret_file);
+    encode_uint32_to_nlsb(extn_size, pos, format->lsb_bits);
+    pos += image_bytes_for(4, format);
+
+    encode_bytes_to_nlsb(encInfo->extn_secret_file, extn_size, pos, format->lsb_bits);
+    pos += image_bytes_for(extn_size, format);
+
+    encode_size_field(encInfo->size_secret_file, pos, format);
+    put_map_carriers(layout, image, 0, k, carriers);
+
+    // Scattered carriers go through a batch that writes them back as it moves on
+    ScatterBatch *batch = NULL;
+    if (format->flags & FORMAT_FLAG_SCATTERED)
+    {
+        batch = scatter_batch_open(&encInfo->scatter, layout, image,
+                                   k + image_bytes_for(encInfo->size_secret_file + format_checksum_size(format), format),
+                                   encInfo->arena);
+        if (batch == NULL)
+            return e_failure;
+    }
+    Status ret = e_success;
+    encInfo->checksum = 0;
+    if ((format->flags & FORMAT_FLAG_ENCRYPTED) && !encInfo->sealed)
+    {
+        ret = encode_sealed_into_map(encInfo, image, &k, scratch, batch);
+    }
+    else
+    {
+        // Secret data is streamed in chunks, as in encode_secret_file_data
+        long remaining = encInfo->size_secret_file;
+        rewind(encInfo->fptr_secret);
+        while (remaining > 0)
+        {
+            size_t n = (remaining < SECRET_CHUNK_SIZE) ? remaining : SECRET_CHUNK_SIZE;
+            if (fread(encInfo->secret_data, 1, n, encInfo->fptr_secret) != n)
+            {
+                ret = e_failure;
+                break;
+            }
+            encode_bytes_into_map(encInfo, image, &k, encInfo->secret_data, n, scratch, batch);
+            remaining -= n;
+        }
+    }
+
+    // Checksum right after the data, through the batch when scattered
+    if (ret == e_success && (format->flags & FORMAT_FLAG_CHECKSUM))
+    {
+        size_t len = image_bytes_for(FORMAT_CHECKSUM_SIZE, format);
+        carriers = map_data_carriers(layout, batch, image, k, len, scratch, 1);
+        encode_uint32_to_nlsb(encInfo->checksum, carriers, format->lsb_bits);
+        put_data_carriers(layout, batch, image, k, len, carriers);
+    }
+    scatter_batch_close(batch);
+    return ret;
+}
+
+/* mmap encoding driver */
+Status do_encoding_mmap(EncodeInfo *encInfo)
+{
+    int in_place = (strcmp(encInfo->src_image_fname, encInfo->stego_image_fname) == 0);
+
+    stats_begin(encInfo->stats, "open_files");
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, in_place ? "r+b" : "rb");
+    if (encInfo->fptr_src_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    if (encInfo->fptr_secret == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+        close_files(encInfo);
+        return e_failure;
+    }
+    if (!in_place)
+    {
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w+b");
+        if (encInfo->fptr_stego_image == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
+            close_files(encInfo);
+            return e_failure;
+        }
+    }
+
+    stats_begin(encInfo->stats, "check_capacity");
+    if (check_capacity(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to check capacity\n");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    stats_begin(encInfo->stats, "clone_image");
+    if (!in_place && clone_image(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to copy source image\n");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    FILE *fptr_map = in_place ? encInfo->fptr_src_image : encInfo->fptr_stego_image;
+    int scattered = (encInfo->format.flags & FORMAT_FLAG_SCATTERED) != 0;
+    size_t map_len = carrier_offset(&encInfo->layout,
+                                    header_carriers(encInfo) +
+                                        image_bytes_for(encInfo->size_secret_file + format_checksum_size(&encInfo->format),
+                                                        &encInfo->format));
+    if (scattered)
+        map_len = carrier_offset(&encInfo->layout, encInfo->layout.capacity);
+
+    struct stat st;
+    if (fstat(fileno(fptr_map), &st) != 0 || st.st_size < map_len)
+    {
+        printf("ERROR:Stego image is smaller than its header claims\n");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    // Only the header and payload region, the rest of the image is never touched
+    // (scattered data can land anywhere in the pixel array)
+    stats_begin(encInfo->stats, "map_image");
+    char *image = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fptr_map), 0);
+    if (image == MAP_FAILED)
+    {
+        perror("mmap");
+        close_files(encInfo);
+        return e_failure;
+    }
+    madvise(image, map_len, scattered ? MADV_WILLNEED : MADV_SEQUENTIAL);
+
+    stats_begin(encInfo->stats, "encode_into_map");
+    Status ret = encode_into_map(encInfo, image);
+    if (ret == e_failure)
+        printf("ERROR:Unable to encode secret file data\n");
+
+    stats_begin(encInfo->stats, "unmap_image");
+    if (munmap(image, map_len) != 0)
+        ret = e_failure;
+    close_files(encInfo);
+    stats_end(encInfo->stats);
+    return ret;
+}
+
+/* Check that len more carriers are inside the image */
+static Status map_has(long pos, size_t len, long capacity)
+{
+    return (pos + len <= capacity) ? e_success : e_failure;
+}
+
+/* Data bytes of the map for decode_payload_stages */
+typedef struct _MapReader
+{
+    DecodeInfo *decInfo;        // decoder, gives the layout and format
+    const unsigned char *image; // mapped stego image
+    long pos;                   // next carrier
+    unsigned char *scratch;     // MMAP_CHUNK_SIZE * 8 bytes for map_carriers
+    ScatterBatch *batch;        // scattered data carriers, NULL if they are in order
+} MapReader;
+
+static Status read_map_data(void *arg, char *data, size_t n)
+{
+    MapReader *reader = arg;
+    const StegFormat *format = &reader->decInfo->format;
+    while (n > 0)
+    {
+        size_t chunk = (n < MMAP_CHUNK_SIZE) ? n : MMAP_CHUNK_SIZE;
+        size_t len = image_bytes_for(chunk, format);
+        decode_bytes_from_nlsb(data, chunk,
+                               map_data_carriers(&reader->decInfo->layout, reader->batch, reader->image, reader->pos, len,
+                                                 reader->scratch, 0),
+                               format->lsb_bits);
+        reader->pos += len;
+        data += chunk;
+        n -= chunk;
+    }
+    return e_success;
+}
+
+static Status skip_map_data(void *arg, long n)
+{
+    MapReader *reader = arg;
+    reader->pos += image_bytes_for(n, &reader->decInfo->format);
+    return e_success;
+}
+
+/* Decode compressed, sealed or scattered data from carrier pos on through decode_payload_stages */
+static Status decode_map_payload(DecodeInfo *decInfo, const unsigned char *image, long pos, unsigned char *scratch)
+{
+    MapReader map_reader = {decInfo, image, pos, scratch, NULL};
+    ScatterInfo scatter;
+
+    if (decInfo->format.flags & FORMAT_FLAG_SCATTERED)
+    {
+        if (decInfo->passphrase == NULL)
+        {
+            printf("ERROR:Secret data is scattered, give the passphrase with --key-file\n");
+            return e_failure;
+        }
+        stats_begin(decInfo->stats, "derive_scatter_key");
+        if (scatter_init(&scatter, decInfo->passphrase, &decInfo->layout, pos, image_bytes_for(1, &decInfo->format)) == e_failure)
+        {
+            return e_failure;
+        }
+        map_reader.batch = scatter_batch_open(&scatter, &decInfo->layout, (void *)image,
+                                              pos + image_bytes_for(decInfo->size_secret_file +
+                                                                        format_checksum_size(&decInfo->format),
+                                                                    &decInfo->format),
+                                              decInfo->arena);
+        if (map_reader.batch == NULL)
+        {
+            return e_failure;
+        }
+        stats_begin(decInfo->stats, "decode_scattered_data");
+    }
+
+    DataReader reader = {read_map_data, skip_map_data, &map_reader};
+    Status ret = decode_payload_stages(decInfo, &reader);
+    scatter_batch_close(map_reader.batch);
+    return ret;
+}
+
+/* Decode all the fields from the mapped image bytes
+ * pos counts carriers, every read goes through map_carriers */
+Status decode_from_map(DecodeInfo *decInfo, const unsigned char *image, size_t map_len)
+{
+    BmpLayout *layout = &decInfo->layout;
+    unsigned char scratch[MMAP_CHUNK_SIZE * 8];
+    long pos = 0;
+    int magic_len = strlen(MAGIC_STRING);
+
+    // Headers and the whole pixel array must be inside the file
+    if (parse_bmp_layout(image, map_len, layout) == e_failure ||
+        carrier_offset(layout, layout->capacity) > map_len)
+    {
+        printf("ERROR:Unsupported BMP image %s\n", decInfo->stego_image_fname);
+        return e_failure;
+    }
+    long capacity = layout->capacity;
+
+    if (map_has(pos, magic_len * 8, capacity) == e_failure)
+        return e_failure;
+    const unsigned char *carriers = map_carriers(layout, image, pos, magic_len * 8, scratch);
+    for (int i = 0; i < magic_len; i++, pos += 8)
+    {
+        if (decode_magic_byte(carriers + i * 8) != MAGIC_STRING[i])
+        {
+            printf("ERROR:Unable to decode magic string\n");
+            return e_failure;
+        }
+    }
+
+    // Format word, or the extension size of a version 1 layout, see decode_format_words
+    StegFormat *format = &decInfo->format;
+    if (map_has(pos, 32, capacity) == e_failure)
+        return e_failure;
+    uint32_t word = decode_uint32_from_nlsb(map_carriers(layout, image, pos, 32, scratch), 1);
+    pos += 32;
+    if (parse_format_word(word, format) == e_failure)
+    {
+        format->version = 1;
+        format->lsb_bits = 1;
+        format->flags = 0;
+        decInfo->extn_size = word;
+    }
+    else
+    {
+        if (format->version != FORMAT_VERSION || validate_lsb_bits(format->lsb_bits) == e_failure ||
+            map_has(pos, 32 + image_bytes_for(4, format), capacity) == e_failure)
+        {
+            printf("ERROR:Unsupported embedded format\n");
+            return e_failure;
+        }
+        format->flags = decode_uint32_from_nlsb(map_carriers(layout, image, pos, 32, scratch), 1);
+        pos += 32;
+        if ((format->flags & ~FORMAT_KNOWN_FLAGS) != 0)
+        {
+            printf("ERROR:Unsupported embedded format\n");
+            return e_failure;
+        }
+        decInfo->extn_size = decode_uint32_from_nlsb(map_carriers(layout, image, pos, image_bytes_for(4, format), scratch),
+                                                     format->lsb_bits);
+        pos += image_bytes_for(4, format);
+    }
+    if (decInfo->extn_size < 0 || decInfo->extn_size >= sizeof(decInfo->extn_secret_file) ||
+        map_has(pos, image_bytes_for(decInfo->extn_size, format), capacity) == e_failure)
+    {
+        printf("ERROR:Unable to decode secret file extension size\n");
+        return e_failure;
+    }
+
+    carriers = map_carriers(layout, image, pos, image_bytes_for(decInfo->extn_size, format), scratch);
+    decode_bytes_from_nlsb(decInfo->extn_secret_file, decInfo->extn_size, carriers, format->lsb_bits);
+    pos += image_bytes_for(decInfo->extn_size, format);
+    decInfo->extn_secret_file[decInfo->extn_size] = '\0';
+
+    size_t size_len = image_bytes_for(format_size_field_size(format), format);
+    if (map_has(pos, size_len, capacity) == e_failure)
+        return e_failure;
+    uint64_t size = decode_size_field(map_carriers(layout, image, pos, size_len, scratch), format);
+    decInfo->size_secret_file = (size > FORMAT_SIZE_MAX) ? -1 : (long)size;
+    pos += size_len;
+    if (decInfo->size_secret_file < 0 ||
+        map_has(pos, image_bytes_for(decInfo->size_secret_file + format_checksum_size(format), format), capacity) ==
+            e_failure)
+    {
+        printf("ERROR:Unable to decode secret file size\n");
+        return e_failure;
+    }
+
+    // Compressed, sealed or scattered data (or a verify) goes through the shared stages,
+    // map_has covered all of it
+    if (decInfo->verify_only ||
+        format->flags & (FORMAT_FLAG_COMPRESSED | FORMAT_FLAG_ENCRYPTED | FORMAT_FLAG_SCATTERED | FORMAT_FLAG_FEC))
+        return decode_map_payload(decInfo, image, pos, scratch);
+
+    // Jump to the requested part, decode in chunks and write each chunk out in one go
+    char chunk[MMAP_CHUNK_SIZE];
+    long start, remaining;
+    get_payload_range(decInfo, &start, &remaining);
+    int summed = (format->flags & FORMAT_FLAG_CHECKSUM) && remaining == decInfo->size_secret_file;
+    uint32_t crc = 0;
+    pos += image_bytes_for(start, format);
+    while (remaining > 0)
+    {
+        size_t n = (remaining < MMAP_CHUNK_SIZE) ? remaining : MMAP_CHUNK_SIZE;
+        size_t len = image_bytes_for(n, format);
+        decode_bytes_from_nlsb(chunk, n, map_carriers(layout, image, pos, len, scratch), format->lsb_bits);
+        pos += len;
+        if (fwrite(chunk, 1, n, decInfo->fptr_output) != n)
+            return e_failure;
+        if (summed)
+            crc = crc32c_update(crc, chunk, n);
+        remaining -= n;
+    }
+    if (!summed)
+        return e_success;
+    uint32_t stored = decode_uint32_from_nlsb(map_carriers(layout, image, pos, image_bytes_for(FORMAT_CHECKSUM_SIZE, format),
+                                                           scratch),
+                                              format->lsb_bits);
+    return check_data_checksum(stored, crc);
+}
+
+/* mmap decoding driver */
+Status do_decoding_mmap(DecodeInfo *decInfo)
+{
+    stats_begin(decInfo->stats, "open_decode_files");
+    if (open_decode_files(decInfo) == e_failure)
+    {
+        printf("ERROR:Unable to open files\n");
+        return e_failure;
+    }
+
+    struct stat st;
+    if (fstat(fileno(decInfo->fptr_stego_image), &st) != 0 || st.st_size <= 54)
+    {
+        printf("ERROR:Unable to read stego image\n");
+        close_decode_files(decInfo);
+        return e_failure;
+    }
+
+    // Pages are faulted in only as far as the payload reaches
+    size_t map_len = st.st_size;
+    stats_begin(decInfo->stats, "map_image");
+    unsigned char *image = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fileno(decInfo->fptr_stego_image), 0);
+    if (image == MAP_FAILED)
+    {
+        perror("mmap");
+        close_decode_files(decInfo);
+        return e_failure;
+    }
+    madvise(image, map_len, MADV_SEQUENTIAL);
+
+    stats_begin(decInfo->stats, "decode_from_map");
+    Status ret = decode_from_map(decInfo, image, map_len);
+    if (ret == e_failure)
+        printf("ERROR:Unable to decode secret file data\n");
+    else
+        print_decode_result(decInfo);
+
+    stats_begin(decInfo->stats, "unmap_image");
+    munmap(image, map_len);
+    close_decode_files(decInfo);
+    stats_end(decInfo->stats);
+    return ret;
+}
+
+/* Scattered data for the stdio, stream and parallel decoders
+ * Description: the header fields were read in order up to carrier_pos,
+ * the data carriers are all over the pixel array so the stego image is
+ * mapped for them
+ */
+Status decode_scattered_data(DecodeInfo *decInfo)
+{
+    unsigned char scratch[MMAP_CHUNK_SIZE * 8];
+    struct stat st;
+
+    size_t map_len = carrier_offset(&decInfo->layout, decInfo->layout.capacity);
+    if (fstat(fileno(decInfo->fptr_stego_image), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < map_len)
+    {
+        printf("ERROR:Scattered secret data needs the stego image as a file\n");
+        return e_failure;
+    }
+
+    stats_begin(decInfo->stats, "map_image");
+    unsigned char *image = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fileno(decInfo->fptr_stego_image), 0);
+    if (image == MAP_FAILED)
+    {
+        perror("mmap");
+        return e_failure;
+    }
+    madvise(image, map_len, MADV_WILLNEED);
+
+    Status ret = decode_map_payload(decInfo, image, decInfo->carrier_pos, scratch);
+    munmap(image, map_len);
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef MMAP_IO_H
+#define MMAP_IO_H
+
+#include "encode.h"
+#include "decode.h"
+#include "types.h"
+
+/* Memory mapped encode/decode function prototypes */
+
+/* Encode by mapping the stego image and changing only the payload LSBs */
+Status do_encoding_mmap(EncodeInfo *encInfo);
+
+/* Decode straight from the mapped pages of the stego image */
+Status do_decoding_mmap(DecodeInfo *decInfo);
+
+/* Encode all the fields into an image in memory (mapped or not), the
+ * layout, format and secret stream already set up by check_layout_capacity */
+Status encode_into_map(EncodeInfo *encInfo, char *image);
+
+/* Decode all the fields from map_len bytes of a stego image in memory */
+Status decode_from_map(DecodeInfo *decInfo, const unsigned char *image, size_t map_len);
+
+/* Decode scattered secret data, header fields already decoded up to carrier_pos */
+Status decode_scattered_data(DecodeInfo *decInfo);
+
+#endif
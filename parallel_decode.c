@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "parallel_decode.h"
+#include "parallel_encode.h"
+#include "block_io.h"
+#include "lsb_kernels.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "aead.h"
+#include "crc32c.h"
+#include "types.h"
+
+/* Work for one decode thread: payload bytes [start, end) */
+typedef struct _DecodeSlice
+{
+    int fd_stego;      // stego image, read with pread
+    int fd_output;     // output file, written with pwrite
+    long data_carrier; // carrier where the secret data starts
+    const BmpLayout *layout;  // pixel layout, places the carriers in the image
+    const StegFormat *format; // embedded layout, gives the LSBs per carrier
+    const AeadInfo *aead;     // key and nonce of a sealed payload, NULL if not encrypted
+    StatsInfo *stats;  // per stage counters, NULL when off
+    long out_start;    // payload byte that goes to output offset 0
+    long start;        // first payload byte of this slice
+    long end;          // one past the last payload byte
+    long out_end;      // one past the last payload byte of the whole range
+    int summed;        // 1 to checksum the data bytes read
+    uint32_t crc;      // CRC32C of the data bytes of the slice
+    long crc_len;      // data bytes of the slice
+    Status status;     // result of the slice
+} DecodeSlice;
+
+/* Function Definitions */
+
+/*Parallel decoding steps
+1.open files and decode the header fields on the calling thread
+2.clip --offset/--length to the decoded size
+3.split the range into one slice per thread
+4.each worker preads the window of 8 / lsb_bits carriers per payload byte, decodes
+  them and pwrites the bytes at their place in the output file
+5.join workers, a decode of the whole data combines their checksums in
+  data order and checks the result against the one after the data
+6.close all files
+a sealed payload is split by segment instead: the calling thread decodes
+the salt and nonce, each worker opens the segments of its slice and
+pwrites the part of them inside the range*/
+
+/* Worker: decode one slice chunk by chunk */
+static void *decode_slice(void *arg)
+{
+    DecodeSlice *slice = arg;
+    char *data = malloc(PARALLEL_CHUNK_SIZE);
+    unsigned char *image = malloc(PARALLEL_CHUNK_SIZE * 8);
+    unsigned char *window = malloc(CARRIER_SPAN_MAX(PARALLEL_CHUNK_SIZE * 8));
+
+    slice->status = e_failure;
+    if (data != NULL && image != NULL && window != NULL)
+    {
+        long i;
+        for (i = slice->start; i < slice->end; i += PARALLEL_CHUNK_SIZE)
+        {
+            size_t n = slice->end - i;
+            if (n > PARALLEL_CHUNK_SIZE)
+                n = PARALLEL_CHUNK_SIZE;
+
+            long k = slice->data_carrier + image_bytes_for(i, slice->format);
+            if (read_carriers_at(slice->fd_stego, slice->layout, k, image_bytes_for(n, slice->format), window, image) == e_failure)
+                break;
+            decode_bytes_from_nlsb(data, n, image, slice->format->lsb_bits);
+            if (write_block_at(slice->fd_output, data, n, i - slice->out_start) == e_failure)
+                break;
+            if (slice->summed)
+                slice->crc = crc32c_update(slice->crc, data, n);
+            slice->crc_len += n;
+        }
+        if (i >= slice->end)
+            slice->status = e_success;
+    }
+
+    free(data);
+    free(image);
+    free(window);
+    return NULL;
+}
+
+/* Worker: open the segments holding payload bytes [start, end) */
+static void *decode_sealed_slice(void *arg)
+{
+    DecodeSlice *slice = arg;
+    unsigned char *segment = malloc(AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    unsigned char *image = malloc((AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE) * 8);
+    unsigned char *window = malloc(CARRIER_SPAN_MAX((AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE) * 8));
+
+    slice->status = e_failure;
+    if (segment != NULL && image != NULL && window != NULL)
+    {
+        long i = slice->start / AEAD_SEGMENT_SIZE;
+        long seg_start;
+        for (seg_start = i * (long)AEAD_SEGMENT_SIZE; seg_start < slice->end; i++, seg_start += AEAD_SEGMENT_SIZE)
+        {
+            size_t n = aead_segment_length(slice->aead, i);
+            long k = slice->data_carrier + image_bytes_for(aead_segment_offset(i) - AEAD_HEADER_SIZE, slice->format);
+            if (read_carriers_at(slice->fd_stego, slice->layout, k, image_bytes_for(n + AEAD_TAG_SIZE, slice->format),
+                                 window, image) == e_failure)
+                break;
+            decode_bytes_from_nlsb((char *)segment, n + AEAD_TAG_SIZE, image, slice->format->lsb_bits);
+            if (slice->summed)
+                slice->crc = crc32c_update(slice->crc, segment, n + AEAD_TAG_SIZE);
+            slice->crc_len += n + AEAD_TAG_SIZE;
+            if (aead_open_segment(slice->aead, i, segment, n) == e_failure)
+                break;
+
+            long from = (slice->start > seg_start) ? slice->start : seg_start;
+            long to = (slice->out_end < seg_start + (long)n) ? slice->out_end : seg_start + (long)n;
+            if (from < to && write_block_at(slice->fd_output, segment + (from - seg_start), to - from,
+                                            from - slice->out_start) == e_failure)
+                break;
+        }
+        if (seg_start >= slice->end)
+            slice->status = e_success;
+    }
+
+    free(segment);
+    free(image);
+    free(window);
+    return NULL;
+}
+
+/* Thread entry: run the slice with its own cache miss counter for the stats */
+static void *decode_slice_thread(void *arg)
+{
+    DecodeSlice *slice = arg;
+    int perf_fd = stats_worker_open(slice->stats);
+
+    if (slice->aead != NULL)
+        decode_sealed_slice(slice);
+    else
+        decode_slice(slice);
+    stats_worker_close(slice->stats, perf_fd);
+    return NULL;
+}
+
+/* Decode the requested payload range, the header is already decoded */
+static Status decode_data_parallel(DecodeInfo *decInfo)
+{
+    AeadInfo aead;
+    long start, count;
+    long unit_chunk = PARALLEL_CHUNK_SIZE;
+    int sealed = (decInfo->format.flags & FORMAT_FLAG_ENCRYPTED) != 0;
+    long data_start = decInfo->carrier_pos;
+    uint32_t crc = 0;
+
+    // Salt and nonce come first, the range is in plaintext bytes
+    if (sealed)
+    {
+        unsigned char header[AEAD_HEADER_SIZE];
+        if (decInfo->passphrase == NULL)
+        {
+            printf("ERROR:Secret data is encrypted, give the passphrase with --key-file\n");
+            return e_failure;
+        }
+        if (decode_data_bytes(decInfo, (char *)header, AEAD_HEADER_SIZE) == e_failure ||
+            aead_init_open(&aead, decInfo->passphrase, header, decInfo->size_secret_file) == e_failure)
+            return e_failure;
+        clip_payload_range(decInfo, aead.plain_size, &start, &count);
+        unit_chunk = AEAD_SEGMENT_SIZE;
+        crc = crc32c_update(crc, header, AEAD_HEADER_SIZE);
+    }
+    else
+    {
+        get_payload_range(decInfo, &start, &count);
+    }
+
+    // Only a decode of everything sees every stored byte, slice checksums join in data order
+    int summed = (decInfo->format.flags & FORMAT_FLAG_CHECKSUM) && start == 0 &&
+                 count == (sealed ? aead.plain_size : decInfo->size_secret_file);
+    long data_carrier = decInfo->carrier_pos;
+
+    int threads = decInfo->num_threads;
+    if (threads > count / unit_chunk + 1)
+        threads = count / unit_chunk + 1;
+
+    // Slices start on segment boundaries of the payload, so no segment is opened twice
+    long base = sealed ? start / unit_chunk * unit_chunk : start;
+    long span = start + count - base;
+    long per_thread = (span + threads - 1) / threads;
+    per_thread = (per_thread + unit_chunk - 1) / unit_chunk * unit_chunk;
+
+    DecodeSlice *slices = calloc(threads, sizeof(DecodeSlice));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    int *started = calloc(threads, sizeof(int));
+    if (slices == NULL || tids == NULL || started == NULL)
+    {
+        free(slices);
+        free(tids);
+        free(started);
+        return e_failure;
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        long first = (t * per_thread < span) ? t * per_thread : span;
+        long last = (first + per_thread < span) ? first + per_thread : span;
+        slices[t].fd_stego = fileno(decInfo->fptr_stego_image);
+        slices[t].fd_output = fileno(decInfo->fptr_output);
+        slices[t].data_carrier = data_carrier;
+        slices[t].layout = &decInfo->layout;
+        slices[t].format = &decInfo->format;
+        slices[t].aead = sealed ? &aead : NULL;
+        slices[t].stats = decInfo->stats;
+        slices[t].out_start = start;
+        slices[t].start = (base + first > start) ? base + first : start;
+        slices[t].end = base + last;
+        slices[t].out_end = start + count;
+        slices[t].summed = summed;
+        started[t] = (pthread_create(&tids[t], NULL, decode_slice_thread, &slices[t]) == 0);
+    }
+
+    Status ret = e_success;
+    for (int t = 0; t < threads; t++)
+    {
+        // A thread that could not be started runs its slice here
+        if (started[t])
+            pthread_join(tids[t], NULL);
+        else if (sealed)
+            decode_sealed_slice(&slices[t]);
+        else
+            decode_slice(&slices[t]);
+        if (slices[t].status == e_failure)
+            ret = e_failure;
+        crc = crc32c_combine(crc, slices[t].crc, slices[t].crc_len);
+    }
+    if (sealed && ret == e_failure)
+        printf("ERROR:Secret data failed authentication (wrong passphrase or damaged image)\n");
+    memset(&aead, 0, sizeof(aead));
+
+    // Checksum follows the data, read it through the stream like the header fields
+    if (ret == e_success && summed)
+    {
+        decInfo->carrier_pos = data_start + image_bytes_for(decInfo->size_secret_file, &decInfo->format);
+        if (fseeko(decInfo->fptr_stego_image, carrier_offset(&decInfo->layout, decInfo->carrier_pos), SEEK_SET) != 0 ||
+            decode_checksum(decInfo, crc) == e_failure)
+            ret = e_failure;
+    }
+
+    free(slices);
+    free(tids);
+    free(started);
+    return ret;
+}
+
+/* Parallel decoding driver */
+Status do_decoding_parallel(DecodeInfo *decInfo)
+{
+    stats_begin(decInfo->stats, "open_decode_files");
+    if (open_decode_files(decInfo) == e_failure)
+    {
+        printf("ERROR:Unable to open files\n");
+        return e_failure;
+    }
+
+    Status ret = decode_header_fields(decInfo);
+    if (ret == e_success)
+    {
+        // A compressed payload only decompresses from its start, on this thread,
+        // scattered carriers go through the mapped image, verifying reads the
+        // stored bytes in one pass, coded frames are repaired in order
+        stats_begin(decInfo->stats, "decode_data_parallel");
+        if (decInfo->verify_only || decInfo->format.flags & (FORMAT_FLAG_COMPRESSED | FORMAT_FLAG_SCATTERED | FORMAT_FLAG_FEC))
+            ret = decode_secret_file_data(decInfo);
+        else
+            ret = decode_data_parallel(decInfo);
+        if (ret == e_failure)
+            printf("ERROR:Unable to decode secret file data\n");
+        else
+            print_decode_result(decInfo);
+    }
+
+    stats_begin(decInfo->stats, "close_decode_files");
+    close_decode_files(decInfo);
+    stats_end(decInfo->stats);
+    return ret;
+}
@@ -0,0 +1,12 @@
+#ifndef PARALLEL_DECODE_H
+#define PARALLEL_DECODE_H
+
+#include "decode.h"
+#include "types.h"
+
+/* Parallel decode function prototypes */
+
+/* Decode with the requested payload range split across num_threads workers */
+Status do_decoding_parallel(DecodeInfo *decInfo);
+
+#endif
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "parallel_encode.h"
+#include "block_io.h"
+#include "lsb_kernels.h"
+#include "steg_format.h"
+#include "bmp_layout.h"
+#include "aead.h"
+#include "crc32c.h"
+#include "types.h"
+
+/* Work for one encode thread: payload bytes [start, end) */
+typedef struct _EncodeSlice
+{
+    int fd_secret;     // secret file, read with pread
+    int fd_src;        // source image, read with pread
+    int fd_stego;      // stego image, written with pwrite
+    long data_carrier; // carrier where the secret data starts
+    const BmpLayout *layout;  // pixel layout, places the carriers in the image
+    const StegFormat *format; // embedded layout, gives the LSBs per carrier
+    const AeadInfo *aead;     // key and nonce of a sealed payload, NULL if not encrypted
+    StatsInfo *stats;  // per stage counters, NULL when off
+    long start;        // first payload byte (or segment when sealed) of this slice
+    long end;          // one past the last payload byte (or segment)
+    uint32_t crc;      // CRC32C of the data bytes of the slice (with FORMAT_FLAG_CHECKSUM)
+    long crc_len;      // data bytes of the slice
+    Status status;     // result of the slice
+} EncodeSlice;
+
+/* Function Definitions */
+
+/*Parallel encoding steps
+1.open files and encode the header fields on the calling thread
+  magic, extn size, extn and file size fix where the data starts
+2.split the secret data into one slice per thread
+  payload byte i always lands in carriers data_carrier + 8 * i / lsb_bits,
+  so a slice owns its own image window (carrier_offset gives it)
+3.each worker preads its secret bytes and image window,
+  encodes them and pwrites the window back at the same offset
+4.the calling thread copies the image tail meanwhile
+5.join workers, combine their checksums in data order and encode the
+  result after the data
+6.close all files
+a sealed payload is split by segment instead: the calling thread encodes
+the salt and nonce, each worker preads whole plaintext segments, seals
+them and encodes them with their tags at their place in the image*/
+
+int default_thread_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+}
+
+/* Encode n data bytes that start at data byte offset, PARALLEL_CHUNK_SIZE at a time */
+static Status encode_bytes_at(EncodeSlice *slice, const char *data, size_t n, long offset, char *image, char *window)
+{
+    while (n > 0)
+    {
+        size_t chunk = (n < PARALLEL_CHUNK_SIZE) ? n : PARALLEL_CHUNK_SIZE;
+        long k = slice->data_carrier + image_bytes_for(offset, slice->format);
+        size_t len = image_bytes_for(chunk, slice->format);
+
+        if (read_carriers_at(slice->fd_src, slice->layout, k, len, window, image) == e_failure)
+            return e_failure;
+        encode_bytes_to_nlsb(data, chunk, image, slice->format->lsb_bits);
+        if (write_carriers_at(slice->fd_stego, slice->layout, k, len, window, image) == e_failure)
+            return e_failure;
+        data += chunk;
+        offset += chunk;
+        n -= chunk;
+    }
+    return e_success;
+}
+
+/* Worker: encode one slice chunk by chunk */
+static void *encode_slice(void *arg)
+{
+    EncodeSlice *slice = arg;
+    char *secret = malloc(PARALLEL_CHUNK_SIZE);
+    char *image = malloc(PARALLEL_CHUNK_SIZE * 8);
+    char *window = malloc(CARRIER_SPAN_MAX(PARALLEL_CHUNK_SIZE * 8));
+
+    slice->status = e_failure;
+    if (secret != NULL && image != NULL && window != NULL)
+    {
+        long i;
+        for (i = slice->start; i < slice->end; i += PARALLEL_CHUNK_SIZE)
+        {
+            size_t n = slice->end - i;
+            if (n > PARALLEL_CHUNK_SIZE)
+                n = PARALLEL_CHUNK_SIZE;
+            if (read_block_at(slice->fd_secret, secret, n, i) == e_failure ||
+                encode_bytes_at(slice, secret, n, i, image, window) == e_failure)
+                break;
+            if (slice->format->flags & FORMAT_FLAG_CHECKSUM)
+                slice->crc = crc32c_update(slice->crc, secret, n);
+            slice->crc_len += n;
+        }
+        if (i >= slice->end)
+            slice->status = e_success;
+    }
+
+    free(secret);
+    free(image);
+    free(window);
+    return NULL;
+}
+
+/* Worker: seal and encode segments [start, end), data offsets count from the first segment */
+static void *encode_sealed_slice(void *arg)
+{
+    EncodeSlice *slice = arg;
+    char *segment = malloc(AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE);
+    char *image = malloc(PARALLEL_CHUNK_SIZE * 8);
+    char *window = malloc(CARRIER_SPAN_MAX(PARALLEL_CHUNK_SIZE * 8));
+
+    slice->status = e_failure;
+    if (segment != NULL && image != NULL && window != NULL)
+    {
+        long i;
+        for (i = slice->start; i < slice->end; i++)
+        {
+            size_t n = aead_segment_length(slice->aead, i);
+            if (n > 0 && read_block_at(slice->fd_secret, segment, n, i * (long)AEAD_SEGMENT_SIZE) == e_failure)
+                break;
+            aead_seal_segment(slice->aead, i, (unsigned char *)segment, n);
+            if (encode_bytes_at(slice, segment, n + AEAD_TAG_SIZE, aead_segment_offset(i) - AEAD_HEADER_SIZE,
+                                image, window) == e_failure)
+                break;
+            if (slice->format->flags & FORMAT_FLAG_CHECKSUM)
+                slice->crc = crc32c_update(slice->crc, segment, n + AEAD_TAG_SIZE);
+            slice->crc_len += n + AEAD_TAG_SIZE;
+        }
+        if (i >= slice->end)
+            slice->status = e_success;
+    }
+
+    free(segment);
+    free(image);
+    free(window);
+    return NULL;
+}
+
+/* Thread entry: run the slice with its own cache miss counter for the stats */
+static void *encode_slice_thread(void *arg)
+{
+    EncodeSlice *slice = arg;
+    int perf_fd = stats_worker_open(slice->stats);
+
+    if (slice->aead != NULL)
+        encode_sealed_slice(slice);
+    else
+        encode_slice(slice);
+    stats_worker_close(slice->stats, perf_fd);
+    return NULL;
+}
+
+/* Encode the checksum at carrier k, positional like the slices */
+static Status encode_checksum_at(EncodeInfo *encInfo, long k)
+{
+    char buffer[32];
+    char window[CARRIER_SPAN_MAX(32)];
+    size_t len = image_bytes_for(FORMAT_CHECKSUM_SIZE, &encInfo->format);
+
+    if (read_carriers_at(fileno(encInfo->fptr_src_image), &encInfo->layout, k, len, window, buffer) == e_failure)
+        return e_failure;
+    encode_uint32_to_nlsb(encInfo->checksum, buffer, encInfo->format.lsb_bits);
+    return write_carriers_at(fileno(encInfo->fptr_stego_image), &encInfo->layout, k, len, window, buffer);
+}
+
+/* Encode the secret data and the image tail, files already hold the header */
+static Status encode_data_parallel(EncodeInfo *encInfo)
+{
+    // A coded payload was sealed before its parity was added
+    const AeadInfo *aead = (encInfo->format.flags & FORMAT_FLAG_ENCRYPTED) && !encInfo->sealed ? &encInfo->aead : NULL;
+    long size = encInfo->size_secret_file;
+    long data_start = encInfo->carrier_pos;
+
+    // Salt and nonce go through the stream like the header fields
+    encInfo->checksum = 0;
+    if (aead != NULL)
+    {
+        unsigned char header[AEAD_HEADER_SIZE];
+        aead_put_header(aead, header);
+        if (encode_data_bytes(encInfo, (char *)header, AEAD_HEADER_SIZE) == e_failure)
+            return e_failure;
+    }
+
+    // Header fields went through the stream, push them out before pwrite starts
+    if (fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+
+    long data_carrier = encInfo->carrier_pos;
+
+    // Work is split in payload bytes, or in whole segments when sealed
+    long units = (aead != NULL) ? aead_segments(aead) : size;
+    long unit_chunk = (aead != NULL) ? 1 : PARALLEL_CHUNK_SIZE;
+
+    // No point in threads that would get less than one chunk
+    int threads = encInfo->num_threads;
+    if (threads > units / unit_chunk + 1)
+        threads = units / unit_chunk + 1;
+
+    long per_thread = (units + threads - 1) / threads;
+    per_thread = (per_thread + unit_chunk - 1) / unit_chunk * unit_chunk;
+
+    EncodeSlice *slices = calloc(threads, sizeof(EncodeSlice));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    int *started = calloc(threads, sizeof(int));
+    if (slices == NULL || tids == NULL || started == NULL)
+    {
+        free(slices);
+        free(tids);
+        free(started);
+        return e_failure;
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        slices[t].fd_secret = fileno(encInfo->fptr_secret);
+        slices[t].fd_src = fileno(encInfo->fptr_src_image);
+        slices[t].fd_stego = fileno(encInfo->fptr_stego_image);
+        slices[t].data_carrier = data_carrier;
+        slices[t].layout = &encInfo->layout;
+        slices[t].format = &encInfo->format;
+        slices[t].aead = aead;
+        slices[t].stats = encInfo->stats;
+        slices[t].start = (t * per_thread < units) ? t * per_thread : units;
+        slices[t].end = (slices[t].start + per_thread < units) ? slices[t].start + per_thread : units;
+        started[t] = (pthread_create(&tids[t], NULL, encode_slice_thread, &slices[t]) == 0);
+    }
+
+    // Tail of the image goes in parallel with the workers, regions never overlap
+    long checksum_carrier = data_start + image_bytes_for(size, &encInfo->format);
+    off_t data_end = carrier_offset(&encInfo->layout,
+                                    checksum_carrier + image_bytes_for(format_checksum_size(&encInfo->format), &encInfo->format));
+    Status ret = e_success;
+    if (fseeko(encInfo->fptr_src_image, data_end, SEEK_SET) != 0 ||
+        fseeko(encInfo->fptr_stego_image, data_end, SEEK_SET) != 0 ||
+        copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->io_block_size) == e_failure)
+    {
+        printf("ERROR:Unable to copy remaining image data\n");
+        ret = e_failure;
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        // A thread that could not be started runs its slice here
+        if (started[t])
+            pthread_join(tids[t], NULL);
+        else if (aead != NULL)
+            encode_sealed_slice(&slices[t]);
+        else
+            encode_slice(&slices[t]);
+        if (slices[t].status == e_failure)
+            ret = e_failure;
+        encInfo->checksum = crc32c_combine(encInfo->checksum, slices[t].crc, slices[t].crc_len);
+    }
+    // Slice checksums join in data order, the result goes after the data
+    if (ret == e_success && (encInfo->format.flags & FORMAT_FLAG_CHECKSUM) &&
+        encode_checksum_at(encInfo, checksum_carrier) == e_failure)
+        ret = e_failure;
+    if (ret == e_failure)
+        printf("ERROR:Unable to encode secret file data\n");
+
+    free(slices);
+    free(tids);
+    free(started);
+    return ret;
+}
+
+/* Parallel encoding driver */
+Status do_encoding_parallel(EncodeInfo *encInfo)
+{
+    stats_begin(encInfo->stats, "open_files");
+    if (open_files(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to open files\n");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    Status ret = encode_header_fields(encInfo);
+    if (ret == e_success)
+    {
+        stats_begin(encInfo->stats, "encode_data_parallel");
+        ret = encode_data_parallel(encInfo);
+    }
+
+    if (ret == e_success && fflush(encInfo->fptr_stego_image) != 0)
+    {
+        printf("ERROR:Unable to write stego image\n");
+        ret = e_failure;
+    }
+
+    stats_begin(encInfo->stats, "close_files");
+    close_files(encInfo);
+    stats_end(encInfo->stats);
+    return ret;
+}
@@ -0,0 +1,18 @@
+#ifndef PARALLEL_ENCODE_H
+#define PARALLEL_ENCODE_H
+
+#include "encode.h"
+#include "types.h"
+
+/* Payload bytes a worker encodes per pread/pwrite round (64 KB) */
+#define PARALLEL_CHUNK_SIZE (64 * 1024)
+
+/* Parallel encode function prototypes */
+
+/* Encode with the secret data split across num_threads workers */
+Status do_encoding_parallel(EncodeInfo *encInfo);
+
+/* Number of worker threads to use when 0 (all online cores) is asked for */
+int default_thread_count(void);
+
+#endif
@@ -0,0 +1,815 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "png_io.h"
+#include "stream_io.h"
+#include "bmp_layout.h"
+#include "block_io.h"
+#include "flate.h"
+#include "types.h"
+
+/* IHDR fields of the PNGs handled: 8 bits per sample, deflate, adaptive filters, no interlace */
+#define PNG_IHDR_SIZE 13
+#define PNG_COLOUR_RGB 2
+#define PNG_COLOUR_RGBA 6
+
+/* Largest chunk length allowed by the format */
+#define PNG_MAX_CHUNK_LENGTH 0x7FFFFFFFu
+
+/* Smallest bfOffBits given, read_bmp_layout reads this much before seeking to the pixels */
+#define PNG_MIN_HEADER_SIZE (BMP_FILE_HEADER_SIZE + BMP_MAX_DIB_SIZE)
+
+/* CRC-32 (IEEE, reflected) of PNG chunks */
+static uint32_t png_crc_table[256];
+
+/* Function Definitions */
+
+/*PNG read steps
+1.check the signature, read IHDR: 8 bit RGB or RGBA, no interlace
+2.keep the ancillary chunks up to the first IDAT, any other
+  critical chunk than PLTE is not understood
+3.build the BMP header: file header, BITMAPINFOHEADER, masks, then
+  the signature and kept chunks, padded past PNG_MIN_HEADER_SIZE
+4.read the header, then rows: inflate the filter byte and scanline,
+  undo the filter against the row above, pad the row to 4 bytes
+5.after the last row the zlib stream has to end and its Adler-32 match
+PNG write steps
+1.collect the BMP header, it must carry the PNG signature
+2.write the signature, IHDR and the kept chunks
+3.filter each row (none, sub, up, average, paeth, whichever has the
+  smallest sum of absolute values) and deflate it
+4.after the last row end the zlib stream, write the last IDAT and IEND*/
+
+/* CRC table, built once before main */
+__attribute__((constructor))
+static void init_png_crc_table(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        png_crc_table[n] = c;
+    }
+}
+
+/* CRC-32 of n more bytes, start and end with the value inverted */
+static uint32_t png_crc_update(uint32_t crc, const unsigned char *data, size_t n)
+{
+    while (n-- > 0)
+        crc = png_crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+int is_png_name(const char *fname)
+{
+    size_t len = (fname != NULL) ? strlen(fname) : 0;
+    return len >= strlen(PNG_EXTN) && strcasecmp(fname + len - strlen(PNG_EXTN), PNG_EXTN) == 0;
+}
+
+/* Read a chunk's length and type */
+static Status read_chunk_header(FILE *fptr, uint32_t *length, unsigned char type[4])
+{
+    unsigned char field[8];
+    if (read_image_block(fptr, field, sizeof(field)) == e_failure)
+        return e_failure;
+    *length = get_be32(field);
+    memcpy(type, field + 4, 4);
+    return (*length <= PNG_MAX_CHUNK_LENGTH) ? e_success : e_failure;
+}
+
+/* Read a chunk's CRC and check it against the one worked out */
+static Status check_chunk_crc(FILE *fptr, uint32_t crc)
+{
+    unsigned char field[4];
+    if (read_image_block(fptr, field, sizeof(field)) == e_failure)
+        return e_failure;
+    return (get_be32(field) == (crc ^ 0xFFFFFFFFu)) ? e_success : e_failure;
+}
+
+/* Read a whole chunk body into data and check its CRC */
+static Status read_chunk_data(FILE *fptr, const unsigned char type[4], unsigned char *data, uint32_t length)
+{
+    if (read_image_block(fptr, data, length) == e_failure)
+        return e_failure;
+    uint32_t crc = png_crc_update(0xFFFFFFFFu, type, 4);
+    return check_chunk_crc(fptr, png_crc_update(crc, data, length));
+}
+
+/* IDAT bytes for the inflater, the chunks are followed one after another */
+static long read_idat(void *arg, unsigned char *buf, size_t size)
+{
+    PngReader *png = arg;
+    unsigned char type[4];
+
+    while (png->chunk_left == 0)
+    {
+        if (!png->in_idat)
+            return 0;
+        if (check_chunk_crc(png->fptr, png->crc) == e_failure || read_chunk_header(png->fptr, &png->chunk_left, type) == e_failure)
+            return -1;
+        if (memcmp(type, "IDAT", 4) != 0)
+        {
+            png->in_idat = 0;
+            png->chunk_left = 0;
+            return 0;
+        }
+        png->crc = png_crc_update(0xFFFFFFFFu, type, 4);
+    }
+
+    if (size > png->chunk_left)
+        size = png->chunk_left;
+    if (read_image_block(png->fptr, buf, size) == e_failure)
+        return -1;
+    png->crc = png_crc_update(png->crc, buf, size);
+    png->chunk_left -= size;
+    return size;
+}
+
+/* Build the BMP header of the PNG from IHDR and the kept chunks */
+static Status build_bmp_header(PngReader *png, uint32_t width, const unsigned char *kept, size_t kept_len)
+{
+    size_t size = PNG_GAP_OFFSET + PNG_SIGNATURE_SIZE + kept_len;
+    if (size < PNG_MIN_HEADER_SIZE)
+        size = PNG_MIN_HEADER_SIZE;
+    size = (size + 3) & ~(size_t)3;
+
+    png->header = calloc(1, size);
+    if (png->header == NULL)
+    {
+        perror("calloc");
+        return e_failure;
+    }
+    png->header_size = size;
+
+    unsigned char *h = png->header;
+    uint64_t image_size = (uint64_t)png->stride * png->height;
+    h[0] = 'B';
+    h[1] = 'M';
+    put_le32(h + 2, (size + image_size <= UINT32_MAX) ? size + image_size : 0);
+    put_le32(h + 10, size);
+
+    // BITMAPINFOHEADER, a negative height for the top-down rows
+    put_le32(h + 14, 40);
+    put_le32(h + 18, width);
+    put_le32(h + 22, (uint32_t)-(int32_t)png->height);
+    h[26] = 1;
+    h[28] = png->channels * 8;
+    put_le32(h + 30, (png->channels == 4) ? 3 : 0);
+    put_le32(h + 34, (image_size <= UINT32_MAX) ? image_size : 0);
+    put_le32(h + 38, 2835);
+    put_le32(h + 42, 2835);
+    if (png->channels == 4)
+    {
+        put_le32(h + 54, 0x000000FF);
+        put_le32(h + 58, 0x0000FF00);
+        put_le32(h + 62, 0x00FF0000);
+    }
+
+    memcpy(h + PNG_GAP_OFFSET, PNG_SIGNATURE, PNG_SIGNATURE_SIZE);
+    if (kept_len > 0)
+        memcpy(h + PNG_GAP_OFFSET + PNG_SIGNATURE_SIZE, kept, kept_len);
+    return e_success;
+}
+
+/* Read the chunks before the image data
+ * Description: checks IHDR, keeps the ancillary chunks (and PLTE, a
+ * suggested palette for truecolour) up to PNG_MAX_KEPT_CHUNKS bytes and
+ * stops inside the first IDAT, with its header read
+ */
+static Status read_png_header(PngReader *png)
+{
+    unsigned char signature[PNG_SIGNATURE_SIZE], ihdr[PNG_IHDR_SIZE], type[4];
+    unsigned char *kept = NULL;
+    size_t kept_len = 0;
+    uint32_t length;
+    Status ret = e_failure;
+
+    if (read_image_block(png->fptr, signature, PNG_SIGNATURE_SIZE) == e_failure ||
+        memcmp(signature, PNG_SIGNATURE, PNG_SIGNATURE_SIZE) != 0)
+        return e_failure;
+    if (read_chunk_header(png->fptr, &length, type) == e_failure || memcmp(type, "IHDR", 4) != 0 ||
+        length != PNG_IHDR_SIZE || read_chunk_data(png->fptr, type, ihdr, PNG_IHDR_SIZE) == e_failure)
+        return e_failure;
+
+    uint32_t width = get_be32(ihdr), height = get_be32(ihdr + 4);
+    if (ihdr[8] != 8 || (ihdr[9] != PNG_COLOUR_RGB && ihdr[9] != PNG_COLOUR_RGBA) || ihdr[10] != 0 || ihdr[11] != 0 ||
+        ihdr[12] != 0)
+        return e_failure;
+    // Sizes the BMP fields can hold
+    if (width == 0 || height == 0 || width > INT32_MAX / 4 || height > INT32_MAX)
+        return e_failure;
+    png->channels = (ihdr[9] == PNG_COLOUR_RGBA) ? 4 : 3;
+    png->row_bytes = (size_t)width * png->channels;
+    png->stride = (png->row_bytes + 3) & ~(size_t)3;
+    png->height = height;
+
+    for (;;)
+    {
+        if (read_chunk_header(png->fptr, &length, type) == e_failure)
+            break;
+        if (memcmp(type, "IDAT", 4) == 0)
+        {
+            png->chunk_left = length;
+            png->crc = png_crc_update(0xFFFFFFFFu, type, 4);
+            png->in_idat = 1;
+            ret = build_bmp_header(png, width, kept, kept_len);
+            break;
+        }
+        // Uppercase first letter: critical, the image cannot be read without it
+        if ((type[0] & 0x20) == 0 && memcmp(type, "PLTE", 4) != 0)
+            break;
+
+        if (kept_len + 12 + length <= PNG_MAX_KEPT_CHUNKS)
+        {
+            unsigned char *grown = realloc(kept, kept_len + 12 + length);
+            if (grown == NULL)
+            {
+                perror("realloc");
+                break;
+            }
+            kept = grown;
+            put_be32(kept + kept_len, length);
+            memcpy(kept + kept_len + 4, type, 4);
+            // Body and CRC are kept as read, once the CRC checks
+            if (read_image_block(png->fptr, kept + kept_len + 8, length + 4) == e_failure ||
+                get_be32(kept + kept_len + 8 + length) !=
+                    (png_crc_update(0xFFFFFFFFu, kept + kept_len + 4, length + 4) ^ 0xFFFFFFFFu))
+                break;
+            kept_len += 12 + length;
+        }
+        else if (skip_image_bytes(png->fptr, (off_t)length + 4) == e_failure)
+        {
+            break;
+        }
+    }
+    free(kept);
+    return ret;
+}
+
+static int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return (pb <= pc) ? b : c;
+}
+
+/* Undo the filter of a scanline, line[0] is the filter type */
+static Status unfilter_row(unsigned char *line, const unsigned char *prev, size_t n, int bpp)
+{
+    unsigned char *x = line + 1;
+    switch (line[0])
+    {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = bpp; i < n; i++)
+            x[i] += x[i - bpp];
+        break;
+    case 2:
+        for (size_t i = 0; i < n; i++)
+            x[i] += prev[i];
+        break;
+    case 3:
+        for (size_t i = 0; i < n; i++)
+            x[i] += ((i >= (size_t)bpp ? x[i - bpp] : 0) + prev[i]) >> 1;
+        break;
+    case 4:
+        for (size_t i = 0; i < n; i++)
+            x[i] += (i >= (size_t)bpp) ? paeth(x[i - bpp], prev[i], prev[i - bpp]) : prev[i];
+        break;
+    default:
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Inflate and unfilter the next row into cur */
+static Status next_row(PngReader *png)
+{
+    unsigned char *swap = png->prev;
+    png->prev = png->cur;
+    png->cur = swap;
+    if (inflate_read(&png->inf, png->cur, png->row_bytes + 1) != (long)(png->row_bytes + 1) ||
+        unfilter_row(png->cur, png->prev + 1, png->row_bytes, png->channels) == e_failure)
+        return e_failure;
+
+    // The image data has to end, checksum and all, with the last row
+    unsigned char extra;
+    if (png->row == png->height - 1 && inflate_read(&png->inf, &extra, 1) < 0)
+        return e_failure;
+    png->row_pos = 0;
+    return e_success;
+}
+
+static ssize_t png_read(void *cookie, char *buf, size_t size)
+{
+    PngReader *png = cookie;
+    size_t done = 0;
+
+    while (done < size)
+    {
+        if ((size_t)png->pos < png->header_size)
+        {
+            size_t n = png->header_size - png->pos;
+            if (n > size - done)
+                n = size - done;
+            memcpy(buf + done, png->header + png->pos, n);
+            done += n;
+            png->pos += n;
+            continue;
+        }
+        if (png->row_pos == png->stride)
+        {
+            if (png->row + 1 >= png->height)
+                break;
+            png->row++;
+            if (next_row(png) == e_failure)
+            {
+                printf("ERROR:Damaged PNG image data\n");
+                return -1;
+            }
+        }
+
+        // Scanline bytes, then the zero padding of the row
+        size_t n = png->stride - png->row_pos;
+        if (n > size - done)
+            n = size - done;
+        size_t k = (png->row_pos < png->row_bytes) ? png->row_bytes - png->row_pos : 0;
+        if (k > n)
+            k = n;
+        memcpy(buf + done, png->cur + 1 + png->row_pos, k);
+        memset(buf + done + k, 0, n - k);
+        png->row_pos += n;
+        done += n;
+        png->pos += n;
+    }
+    return done;
+}
+
+/* Seek forward only, by reading through the bytes, ftell is SEEK_CUR 0 */
+static int png_read_seek(void *cookie, off64_t *offset, int whence)
+{
+    PngReader *png = cookie;
+    char buffer[4096];
+    off_t target;
+
+    if (whence == SEEK_SET)
+        target = *offset;
+    else if (whence == SEEK_CUR)
+        target = png->pos + *offset;
+    else
+        target = -1;
+    if (target < png->pos)
+    {
+        errno = ESPIPE;
+        return -1;
+    }
+    while (png->pos < target)
+    {
+        size_t n = (target - png->pos < (off_t)sizeof(buffer)) ? target - png->pos : sizeof(buffer);
+        ssize_t got = png_read(png, buffer, n);
+        if (got <= 0)
+            return -1;
+    }
+    *offset = png->pos;
+    return 0;
+}
+
+static void free_png_reader(PngReader *png)
+{
+    if (png->fptr != NULL && png->fptr != stdin)
+        fclose(png->fptr);
+    free(png->header);
+    free(png->cur);
+    free(png->prev);
+    free(png);
+}
+
+static int png_read_close(void *cookie)
+{
+    free_png_reader(cookie);
+    return 0;
+}
+
+/* Open the PNG on fptr for reading as a BMP, fptr is closed with it */
+static FILE *open_png_reader(FILE *fptr, const char *fname)
+{
+    PngReader *png = calloc(1, sizeof(PngReader));
+    if (png == NULL)
+    {
+        perror("calloc");
+        if (fptr != stdin)
+            fclose(fptr);
+        return NULL;
+    }
+    png->fptr = fptr;
+    if (read_png_header(png) == e_failure)
+    {
+        errno = EINVAL;
+        printf("ERROR:Unsupported PNG image %s (8 bit RGB or RGBA, not interlaced)\n", fname);
+        free_png_reader(png);
+        return NULL;
+    }
+
+    // The row before the first is all zeros for the filters
+    png->cur = calloc(1, png->row_bytes + 1);
+    png->prev = calloc(1, png->row_bytes + 1);
+    if (png->cur == NULL || png->prev == NULL)
+    {
+        perror("calloc");
+        free_png_reader(png);
+        return NULL;
+    }
+    inflate_init(&png->inf, read_idat, png);
+    png->row = -1;
+    png->row_pos = png->stride;
+
+    cookie_io_functions_t io = {png_read, NULL, png_read_seek, png_read_close};
+    FILE *bmp = fopencookie(png, "rb", io);
+    if (bmp == NULL)
+    {
+        perror("fopencookie");
+        free_png_reader(png);
+        return NULL;
+    }
+    // Unbuffered, so stdio seeks land exactly where the caller asked
+    setvbuf(bmp, NULL, _IONBF, 0);
+    return bmp;
+}
+
+/* Write one chunk */
+static Status write_chunk(PngWriter *png, const char *type, const unsigned char *data, size_t length)
+{
+    unsigned char field[8];
+    put_be32(field, length);
+    memcpy(field + 4, type, 4);
+    uint32_t crc = png_crc_update(png_crc_update(0xFFFFFFFFu, field + 4, 4), data, length);
+    if (write_image_block(png->fptr, field, sizeof(field)) == e_failure ||
+        (length > 0 && write_image_block(png->fptr, data, length) == e_failure))
+        return e_failure;
+    put_be32(field, crc ^ 0xFFFFFFFFu);
+    return write_image_block(png->fptr, field, 4);
+}
+
+/* Compressed bytes from the deflater, written out an IDAT at a time */
+static Status write_idat(void *arg, const unsigned char *data, size_t n)
+{
+    PngWriter *png = arg;
+    while (n > 0)
+    {
+        size_t k = sizeof(png->idat) - png->idat_len;
+        if (k > n)
+            k = n;
+        memcpy(png->idat + png->idat_len, data, k);
+        png->idat_len += k;
+        data += k;
+        n -= k;
+        if (png->idat_len == sizeof(png->idat))
+        {
+            if (write_chunk(png, "IDAT", png->idat, png->idat_len) == e_failure)
+                return e_failure;
+            png->idat_len = 0;
+        }
+    }
+    return e_success;
+}
+
+/* Check the collected BMP header and start the PNG */
+static Status start_png(PngWriter *png)
+{
+    BmpLayout layout;
+    unsigned char ihdr[PNG_IHDR_SIZE];
+    const unsigned char *h = png->header;
+
+    if (png->header_size < PNG_GAP_OFFSET + PNG_SIGNATURE_SIZE ||
+        memcmp(h + PNG_GAP_OFFSET, PNG_SIGNATURE, PNG_SIGNATURE_SIZE) != 0)
+    {
+        printf("ERROR:PNG stego image needs a PNG cover\n");
+        return e_failure;
+    }
+    if (parse_bmp_layout(h, png->header_size, &layout) == e_failure || !layout.top_down)
+        return e_failure;
+    png->channels = layout.bytes_per_pixel;
+    png->row_bytes = (size_t)layout.width * png->channels;
+    png->stride = layout.stride;
+    png->height = layout.height;
+
+    put_be32(ihdr, layout.width);
+    put_be32(ihdr + 4, layout.height);
+    ihdr[8] = 8;
+    ihdr[9] = (png->channels == 4) ? PNG_COLOUR_RGBA : PNG_COLOUR_RGB;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    if (write_image_block(png->fptr, PNG_SIGNATURE, PNG_SIGNATURE_SIZE) == e_failure ||
+        write_chunk(png, "IHDR", ihdr, PNG_IHDR_SIZE) == e_failure)
+        return e_failure;
+
+    // The kept chunks come whole, CRC included, up to the zero padding
+    size_t pos = PNG_GAP_OFFSET + PNG_SIGNATURE_SIZE;
+    while (pos + 12 <= png->header_size && h[pos + 4] != 0)
+    {
+        size_t length = get_be32(h + pos);
+        if (length > png->header_size - pos - 12)
+            return e_failure;
+        if (write_image_block(png->fptr, h + pos, length + 12) == e_failure)
+            return e_failure;
+        pos += length + 12;
+    }
+
+    png->cur = calloc(1, png->row_bytes);
+    png->prev = calloc(1, png->row_bytes);
+    png->trial = malloc(png->row_bytes + 1);
+    png->best = malloc(png->row_bytes + 1);
+    if (png->cur == NULL || png->prev == NULL || png->trial == NULL || png->best == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+    return deflate_init(&png->def, write_idat, png, FLATE_LEVEL_DEFAULT);
+}
+
+/* Apply filter type to the current row into out, return its sum of absolute values */
+static uint64_t filter_row(const PngWriter *png, int type, unsigned char *out)
+{
+    const unsigned char *x = png->cur, *prev = png->prev;
+    size_t n = png->row_bytes;
+    int bpp = png->channels;
+    uint64_t sum = 0;
+
+    out[0] = type;
+    for (size_t i = 0; i < n; i++)
+    {
+        int a = (i >= (size_t)bpp) ? x[i - bpp] : 0;
+        int c = (i >= (size_t)bpp) ? prev[i - bpp] : 0;
+        int pred;
+        switch (type)
+        {
+        case 1:
+            pred = a;
+            break;
+        case 2:
+            pred = prev[i];
+            break;
+        case 3:
+            pred = (a + prev[i]) >> 1;
+            break;
+        case 4:
+            pred = paeth(a, prev[i], c);
+            break;
+        default:
+            pred = 0;
+            break;
+        }
+        out[1 + i] = x[i] - pred;
+        sum += (out[1 + i] < 128) ? out[1 + i] : 256 - out[1 + i];
+    }
+    return sum;
+}
+
+/* Filter and compress the completed row, end the PNG after the last one */
+static Status finish_row(PngWriter *png)
+{
+    uint64_t best_sum = UINT64_MAX;
+    for (int type = 0; type <= 4; type++)
+    {
+        uint64_t sum = filter_row(png, type, png->trial);
+        if (sum < best_sum)
+        {
+            best_sum = sum;
+            unsigned char *swap = png->best;
+            png->best = png->trial;
+            png->trial = swap;
+        }
+    }
+    if (deflate_write(&png->def, png->best, png->row_bytes + 1) == e_failure)
+        return e_failure;
+
+    unsigned char *swap = png->prev;
+    png->prev = png->cur;
+    png->cur = swap;
+    png->row_pos = 0;
+    if (++png->row < png->height)
+        return e_success;
+
+    if (deflate_finish(&png->def) == e_failure ||
+        (png->idat_len > 0 && write_chunk(png, "IDAT", png->idat, png->idat_len) == e_failure) ||
+        write_chunk(png, "IEND", NULL, 0) == e_failure || fflush(png->fptr) != 0)
+        return e_failure;
+    png->finished = 1;
+    return e_success;
+}
+
+/* Take the next BMP bytes: header first, then rows */
+static Status take_bytes(PngWriter *png, const unsigned char *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (png->header_size == 0 || png->header_len < png->header_size)
+        {
+            // bfOffBits in the file header says how much header there is
+            if (png->header_size == 0)
+            {
+                size_t n = (size < 14 - png->header_len) ? size : 14 - png->header_len;
+                memcpy(png->file_header + png->header_len, data, n);
+                png->header_len += n;
+                data += n;
+                size -= n;
+                if (png->header_len < 14)
+                    continue;
+                size_t header_size = png->file_header[10] | (png->file_header[11] << 8) |
+                                     (png->file_header[12] << 16) | ((size_t)png->file_header[13] << 24);
+                if (header_size < PNG_GAP_OFFSET + PNG_SIGNATURE_SIZE || header_size > STREAM_MAX_HEADER_SIZE ||
+                    (png->header = malloc(header_size)) == NULL)
+                {
+                    printf("ERROR:PNG stego image needs a PNG cover\n");
+                    return e_failure;
+                }
+                memcpy(png->header, png->file_header, 14);
+                png->header_size = header_size;
+                continue;
+            }
+            size_t n = png->header_size - png->header_len;
+            if (n > size)
+                n = size;
+            memcpy(png->header + png->header_len, data, n);
+            png->header_len += n;
+            data += n;
+            size -= n;
+            if (png->header_len == png->header_size && start_png(png) == e_failure)
+                return e_failure;
+            continue;
+        }
+
+        // Anything after the last row is not part of the image
+        if (png->finished)
+            return e_success;
+        size_t n = png->stride - png->row_pos;
+        if (n > size)
+            n = size;
+        if (png->row_pos < png->row_bytes)
+        {
+            size_t k = (n < png->row_bytes - png->row_pos) ? n : png->row_bytes - png->row_pos;
+            memcpy(png->cur + png->row_pos, data, k);
+        }
+        png->row_pos += n;
+        data += n;
+        size -= n;
+        if (png->row_pos == png->stride && finish_row(png) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+static ssize_t png_write(void *cookie, const char *buf, size_t size)
+{
+    PngWriter *png = cookie;
+    if (png->failed || take_bytes(png, (const unsigned char *)buf, size) == e_failure)
+    {
+        png->failed = 1;
+        return -1;
+    }
+    png->pos += size;
+    return size;
+}
+
+/* Only ftell, SEEK_CUR 0, is answered */
+static int png_write_seek(void *cookie, off64_t *offset, int whence)
+{
+    PngWriter *png = cookie;
+    if (whence != SEEK_CUR || *offset != 0)
+    {
+        errno = ESPIPE;
+        return -1;
+    }
+    *offset = png->pos;
+    return 0;
+}
+
+static int png_write_close(void *cookie)
+{
+    PngWriter *png = cookie;
+    // A PNG cut short has no IEND, the close reports it
+    int ret = (png->finished && !png->failed) ? 0 : -1;
+    if (fclose(png->fptr) != 0)
+        ret = -1;
+    free(png->header);
+    free(png->cur);
+    free(png->prev);
+    free(png->trial);
+    free(png->best);
+    free(png);
+    return ret;
+}
+
+/* Open the PNG for writing from a BMP */
+static FILE *open_png_writer(const char *fname)
+{
+    PngWriter *png = calloc(1, sizeof(PngWriter));
+    if (png == NULL)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    png->fptr = open_stream(fname, "wb");
+    if (png->fptr == NULL)
+    {
+        free(png);
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {NULL, png_write, png_write_seek, png_write_close};
+    FILE *fptr = fopencookie(png, "wb", io);
+    if (fptr == NULL)
+    {
+        perror("fopencookie");
+        fclose(png->fptr);
+        free(png);
+        return NULL;
+    }
+    return fptr;
+}
+
+static ssize_t replay_read(void *cookie, char *buf, size_t size)
+{
+    PngReplay *replay = cookie;
+    if (replay->pos < replay->len)
+    {
+        size_t n = (replay->len - replay->pos < size) ? replay->len - replay->pos : size;
+        memcpy(buf, replay->head + replay->pos, n);
+        replay->pos += n;
+        return n;
+    }
+    size_t n = fread(buf, 1, size, replay->fptr);
+    return (n == 0 && ferror(replay->fptr)) ? -1 : (ssize_t)n;
+}
+
+static int replay_close(void *cookie)
+{
+    PngReplay *replay = cookie;
+    int ret = (replay->fptr != stdin) ? fclose(replay->fptr) : 0;
+    free(replay);
+    return ret;
+}
+
+FILE *open_png_stream_after(FILE *fptr, const unsigned char *head, size_t len, const char *fname)
+{
+    PngReplay *replay = calloc(1, sizeof(PngReplay));
+    cookie_io_functions_t io = {replay_read, NULL, NULL, replay_close};
+    FILE *replay_fptr = NULL;
+    if (replay != NULL && len <= sizeof(replay->head))
+    {
+        replay->fptr = fptr;
+        memcpy(replay->head, head, len);
+        replay->len = len;
+        replay_fptr = fopencookie(replay, "rb", io);
+    }
+    if (replay_fptr == NULL)
+    {
+        perror("fopencookie");
+        free(replay);
+        if (fptr != stdin)
+            fclose(fptr);
+        return NULL;
+    }
+    return open_png_reader(replay_fptr, fname);
+}
+
+FILE *open_png_stream(const char *fname, const char *mode)
+{
+    if (mode[0] != 'r')
+        return open_png_writer(fname);
+    FILE *fptr = open_stream(fname, "rb");
+    return (fptr == NULL) ? NULL : open_png_reader(fptr, fname);
+}
+
+FILE *open_image_stream(const char *fname, const char *mode)
+{
+    return is_png_name(fname) ? open_png_stream(fname, mode) : open_stream(fname, mode);
+}
@@ -0,0 +1,122 @@
+#ifndef PNG_IO_H
+#define PNG_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+#include "flate.h"
+
+/* File name extension of PNG images */
+#define PNG_EXTN ".png"
+
+/* Signature every PNG starts with */
+#define PNG_SIGNATURE "\x89PNG\r\n\x1a\n"
+#define PNG_SIGNATURE_SIZE 8
+
+/* Where the PNG signature and chunks sit in the BMP header of a PNG,
+ * right after a BITMAPINFOHEADER and its three masks */
+#define PNG_GAP_OFFSET (14 + 40 + 12)
+
+/* Most ancillary chunk bytes carried from a PNG cover to the stego PNG,
+ * chunks past it are dropped */
+#define PNG_MAX_KEPT_CHUNKS (1024 * 1024)
+
+/* Compressed bytes per IDAT chunk written */
+#define PNG_IDAT_SIZE 65536
+
+/*
+ * PNG read as a BMP
+ * an 8 bit RGB or RGBA, non interlaced PNG reads as a top-down BMP whose
+ * rows are the unfiltered scanlines, padded to 4 bytes: 24 bit BI_RGB
+ * (the bytes stay R, G, B) or 32 bit BI_BITFIELDS with masks picking
+ * R, G, B and skipping alpha. The header gap after the masks holds the
+ * PNG signature and the ancillary chunks before the first IDAT, so the
+ * writer can tell a PNG cover and keep them. IDAT data is inflated one
+ * scanline at a time as the rows are read; the stream only reads forward
+ */
+typedef struct _PngReader
+{
+    FILE *fptr;               // To store the PNG file
+    Inflater inf;             // To store the inflate state of the IDAT data
+    uint32_t chunk_left;      // To store the IDAT bytes left in the current chunk
+    uint32_t crc;             // To store the CRC-32 of the current chunk so far
+    int in_idat;              // To store 1 while IDAT chunks follow
+    unsigned char *header;    // To store the BMP header
+    size_t header_size;       // To store its size, bfOffBits
+    int channels;             // To store 3 (RGB) or 4 (RGBA)
+    size_t row_bytes;         // To store bytes per scanline, filter byte excluded
+    size_t stride;            // To store bytes per BMP row, padding included
+    long height;              // To store the number of rows
+    long row;                 // To store the row being read
+    size_t row_pos;           // To store the bytes of that row read, stride once it is done
+    unsigned char *cur;       // To store the filter byte and scanline of the row
+    unsigned char *prev;      // To store the scanline before it, zeros for the first
+    off_t pos;                // To store the BMP offset of the next byte read
+} PngReader;
+
+/*
+ * BMP written as a PNG
+ * takes the BMP bytes a PngReader produced (possibly changed in the
+ * carriers), writes the PNG signature, IHDR and the kept chunks once
+ * the header is in, then filters each row as it completes (the filter
+ * with the smallest sum of absolute values) and deflates it into IDAT
+ * chunks. The last row ends the stream and writes IEND
+ */
+typedef struct _PngWriter
+{
+    FILE *fptr;               // To store the PNG file
+    Deflater def;             // To store the deflate state of the IDAT data
+    unsigned char *header;    // To store the BMP header being collected
+    size_t header_size;       // To store its size, 0 until bfOffBits is in
+    size_t header_len;        // To store the header bytes collected
+    unsigned char file_header[14]; // To store the BMP file header until header is allocated
+    int channels;             // To store 3 (RGB) or 4 (RGBA)
+    size_t row_bytes;         // To store bytes per scanline, filter byte excluded
+    size_t stride;            // To store bytes per BMP row, padding included
+    long height;              // To store the number of rows
+    long row;                 // To store the row being written
+    size_t row_pos;           // To store the bytes of that row written
+    unsigned char *cur;       // To store the scanline of the row
+    unsigned char *prev;      // To store the scanline before it
+    unsigned char *trial;     // To store the row under the filter being tried
+    unsigned char *best;      // To store the row under the best filter so far
+    unsigned char idat[PNG_IDAT_SIZE]; // To store compressed bytes of the next IDAT chunk
+    size_t idat_len;          // To store the bytes in idat
+    int finished;             // To store 1 once IEND is written
+    int failed;               // To store 1 after an error, the PNG is incomplete
+    off_t pos;                // To store the BMP bytes written
+} PngWriter;
+
+/*
+ * Bytes read before a stream was found to hold a PNG
+ * a stream has no .png name to go by, its first bytes are read as a
+ * BMP file header and the signature tells it is a PNG; the PNG reader
+ * then reads them again from here before the rest of the stream
+ */
+typedef struct _PngReplay
+{
+    FILE *fptr;               // To store the stream the rest is read from
+    unsigned char head[16];   // To store the bytes already read
+    size_t len;               // To store the bytes in head
+    size_t pos;               // To store the bytes of head replayed
+} PngReplay;
+
+/* PNG function prototypes */
+
+/* Check if a file name ends in .png */
+int is_png_name(const char *fname);
+
+/* Open a PNG as a BMP stream ("rb") or a stream that turns the BMP of a
+ * PNG cover into a PNG ("wb"), "-" is stdin/stdout as with open_stream */
+FILE *open_png_stream(const char *fname, const char *mode);
+
+/* Open a PNG as a BMP stream over fptr, whose first len bytes (at most
+ * 16) were already read into head. fptr is closed with the stream, or
+ * at once when it is not a supported PNG */
+FILE *open_png_stream_after(FILE *fptr, const unsigned char *head, size_t len, const char *fname);
+
+/* open_png_stream for a .png name, else open_stream */
+FILE *open_image_stream(const char *fname, const char *mode);
+
+#endif
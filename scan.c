@@ -0,0 +1,536 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "scan.h"
+#include "inspect.h"
+#include "decode.h"
+#include "bmp_layout.h"
+#include "png_io.h"
+#include "steg_format.h"
+#include "types.h"
+#include "common.h"
+
+/* Function Definitions */
+
+/*Scan steps
+1.walk the tree depth first, every regular file is a candidate
+  (forensic sweeps cannot trust extensions), links are not followed
+2.keep SCAN_QUEUE_DEPTH files in flight through io_uring: openat,
+  read of the first SCAN_READ_SIZE bytes, close, all submitted in
+  batches with one io_uring_enter per round of completions
+3.in memory: parse the BMP headers, a header too big for the first
+  read gets one more read of exactly what the fields need
+4.decode magic string, format words, extn size, extn and file size
+  from the bytes read with the --inspect field decoder
+5.an 8 bit RGB/RGBA PNG is found by its signature and checked through
+  the PNG reader after the close, its pixels have to be inflated
+6.print one --inspect line per payload (in completion order), then
+  the totals
+kernels without io_uring (or the three ops) get the same steps with
+blocking open/pread/close, one file at a time*/
+
+/* Carriers the fields before the secret data can take: magic, the two
+ * format words, extn size, the longest extn and a 64 bit file size at
+ * 1 LSB per byte, more LSBs only take fewer */
+static long field_carriers(void)
+{
+    DecodeInfo decInfo;
+    return strlen(MAGIC_STRING) * 8 + FORMAT_WORDS_SIZE + 32 + (sizeof(decInfo.extn_secret_file) - 1) * 8 + 64;
+}
+
+/* Bytes from the start of the file that hold the headers and the fields, 0 if it is no supported BMP */
+static long bytes_needed(const unsigned char *data, long len)
+{
+    BmpLayout layout;
+    if (parse_bmp_layout(data, len, &layout) == e_failure)
+        return 0;
+    long carriers = (field_carriers() < layout.capacity) ? field_carriers() : layout.capacity;
+    off_t need = carrier_offset(&layout, carriers);
+    return (need < SCAN_MAX_READ_SIZE) ? need : SCAN_MAX_READ_SIZE;
+}
+
+/* Check if the first bytes are those of a PNG the reader handles (8 bit RGB/RGBA, not interlaced) */
+static int is_png_candidate(const unsigned char *data, long len)
+{
+    return len >= 29 && memcmp(data, PNG_SIGNATURE, PNG_SIGNATURE_SIZE) == 0 && memcmp(data + 12, "IHDR", 4) == 0 &&
+           data[24] == 8 && (data[25] == 2 || data[25] == 6) && data[28] == 0;
+}
+
+/* Decode the fields of an open image stream whose headers come first, print a payload line */
+static void check_image_stream(const char *path, FILE *fptr, ScanCounts *counts)
+{
+    DecodeInfo decInfo = {0};
+    decInfo.stego_image_fname = (char *)path;
+    decInfo.fptr_stego_image = fptr;
+    if (read_bmp_layout(fptr, &decInfo.layout) == e_success && inspect_payload_fields(&decInfo) == e_success)
+    {
+        print_payload_line(path, &decInfo);
+        counts->payloads++;
+    }
+}
+
+/* Check the first len bytes of a BMP */
+static void check_bmp_bytes(const char *path, unsigned char *data, long len, ScanCounts *counts)
+{
+    if (len <= 0)
+        return;
+    FILE *fptr = fmemopen(data, len, "rb");
+    if (fptr == NULL)
+    {
+        perror("fmemopen");
+        return;
+    }
+    check_image_stream(path, fptr, counts);
+    fclose(fptr);
+}
+
+/* Check a PNG, its scanlines are inflated up to the fields */
+static void check_png(const char *path, ScanCounts *counts)
+{
+    FILE *fptr = open_png_stream(path, "rb");
+    if (fptr == NULL)
+    {
+        counts->unreadable++;
+        return;
+    }
+    check_image_stream(path, fptr, counts);
+    fclose(fptr);
+}
+
+/* Keep a directory to read later */
+static Status walk_push(ScanWalk *walk, const char *path)
+{
+    if (walk->num_pending == walk->max_pending)
+    {
+        size_t max = walk->max_pending ? walk->max_pending * 2 : 64;
+        char **grown = realloc(walk->pending, max * sizeof(char *));
+        if (grown == NULL)
+        {
+            perror("realloc");
+            return e_failure;
+        }
+        walk->pending = grown;
+        walk->max_pending = max;
+    }
+    if ((walk->pending[walk->num_pending] = strdup(path)) == NULL)
+    {
+        perror("strdup");
+        return e_failure;
+    }
+    walk->num_pending++;
+    return e_success;
+}
+
+/* Start the walk at each of the NULL terminated dirs, the first one first */
+static Status walk_init(ScanWalk *walk, char *dirs[])
+{
+    int count = 0;
+    memset(walk, 0, sizeof(ScanWalk));
+    while (dirs[count] != NULL)
+        count++;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (walk_push(walk, dirs[i]) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/* Next regular file of the walk into path, 0 once the walk is over */
+static int walk_next(ScanWalk *walk, char path[PATH_MAX], ScanCounts *counts)
+{
+    for (;;)
+    {
+        if (walk->dir == NULL)
+        {
+            if (walk->num_pending == 0)
+                return 0;
+            char *next = walk->pending[--walk->num_pending];
+            snprintf(walk->dir_path, sizeof(walk->dir_path), "%s", next);
+            free(next);
+            walk->dir = opendir(walk->dir_path);
+            if (walk->dir == NULL)
+            {
+                // A file named on the command line is scanned on its own
+                if (errno == ENOTDIR)
+                {
+                    snprintf(path, PATH_MAX, "%s", walk->dir_path);
+                    return 1;
+                }
+                counts->unreadable++;
+            }
+            continue;
+        }
+
+        struct dirent *entry = readdir(walk->dir);
+        if (entry == NULL)
+        {
+            closedir(walk->dir);
+            walk->dir = NULL;
+            continue;
+        }
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if (snprintf(path, PATH_MAX, "%s/%s", walk->dir_path, entry->d_name) >= PATH_MAX)
+        {
+            counts->unreadable++;
+            continue;
+        }
+
+        // d_type saves a stat per entry, some file systems leave it unknown
+        int type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN && lstat(path, &st) == 0)
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        if (type == DT_DIR)
+        {
+            if (walk_push(walk, path) == e_failure)
+                counts->unreadable++;
+        }
+        else if (type == DT_REG)
+        {
+            return 1;
+        }
+    }
+}
+
+static void walk_free(ScanWalk *walk)
+{
+    if (walk->dir != NULL)
+        closedir(walk->dir);
+    for (size_t i = 0; i < walk->num_pending; i++)
+        free(walk->pending[i]);
+    free(walk->pending);
+}
+
+/* Open, read and check one file with blocking calls */
+static void scan_file_blocking(ScanSlot *slot, ScanCounts *counts)
+{
+    int fd = open(slot->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        counts->unreadable++;
+        return;
+    }
+    slot->len = pread(fd, slot->buffer, SCAN_READ_SIZE, 0);
+    if (slot->len < 0)
+    {
+        counts->unreadable++;
+        close(fd);
+        return;
+    }
+
+    long need = bytes_needed(slot->buffer, slot->len);
+    if (need > slot->len && slot->len == SCAN_READ_SIZE && (slot->big = malloc(need)) != NULL)
+    {
+        long len = pread(fd, slot->big, need, 0);
+        check_bmp_bytes(slot->path, slot->big, len, counts);
+        free(slot->big);
+        slot->big = NULL;
+    }
+    else if (need > 0)
+    {
+        check_bmp_bytes(slot->path, slot->buffer, slot->len, counts);
+    }
+    close(fd);
+    if (is_png_candidate(slot->buffer, slot->len))
+        check_png(slot->path, counts);
+}
+
+#ifdef __linux__
+/* Set up the rings, e_failure if the kernel has no io_uring or misses an op the scan uses */
+static Status ring_init(ScanRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(ScanRing));
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return e_failure;
+
+    // openat, read and close came together (5.6), with the probe
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    int supported = probe != NULL && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported)
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        return e_failure;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // Newer kernels map both rings at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_map_size > ring->sq_map_size)
+            ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    ring->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP)
+                       ? ring->sq_map
+                       : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                              IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        perror("mmap");
+        if (ring->sq_map != MAP_FAILED)
+            munmap(ring->sq_map, ring->sq_map_size);
+        if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+            munmap(ring->cq_map, ring->cq_map_size);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        ring->fd = -1;
+        return e_failure;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return e_success;
+}
+
+static void ring_free(ScanRing *ring)
+{
+    if (ring->fd < 0)
+        return;
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/* Queue one operation for slot index, submitted by the next ring_submit */
+static void ring_queue(ScanRing *ring, int op, int fd, const void *addr, unsigned len, int open_flags, unsigned index)
+{
+    // One entry per slot and one op per slot at a time, the ring never fills
+    unsigned tail = *ring->sq_tail;
+    unsigned pos = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[pos];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->open_flags = open_flags;
+    sqe->user_data = index;
+    ring->sq_array[pos] = pos;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+/* Submit what is queued and wait for at least one completion */
+static Status ring_submit(ScanRing *ring)
+{
+    for (;;)
+    {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0)
+        {
+            ring->to_submit -= ret;
+            return e_success;
+        }
+        if (errno != EINTR)
+        {
+            perror("io_uring_enter");
+            return e_failure;
+        }
+    }
+}
+
+/* Move a slot on after its operation completed with res */
+static void slot_complete(ScanRing *ring, ScanSlot *slots, unsigned index, int res, ScanCounts *counts)
+{
+    ScanSlot *slot = &slots[index];
+    switch (slot->state)
+    {
+    case SCAN_SLOT_OPEN:
+        if (res < 0)
+        {
+            counts->unreadable++;
+            slot->state = SCAN_SLOT_FREE;
+            return;
+        }
+        slot->fd = res;
+        slot->len = 0;
+        ring_queue(ring, IORING_OP_READ, slot->fd, slot->buffer, SCAN_READ_SIZE, 0, index);
+        slot->state = SCAN_SLOT_READ;
+        return;
+
+    case SCAN_SLOT_READ:
+        if (res < 0)
+        {
+            counts->unreadable++;
+        }
+        else if (slot->big == NULL)
+        {
+            // A header past the first read takes one more, for exactly the bytes needed
+            slot->len = res;
+            long need = bytes_needed(slot->buffer, slot->len);
+            if (need > slot->len && slot->len == SCAN_READ_SIZE && (slot->big = malloc(need)) != NULL)
+            {
+                ring_queue(ring, IORING_OP_READ, slot->fd, slot->big, need, 0, index);
+                return;
+            }
+            if (need > 0)
+                check_bmp_bytes(slot->path, slot->buffer, slot->len, counts);
+        }
+        else
+        {
+            check_bmp_bytes(slot->path, slot->big, res, counts);
+        }
+        ring_queue(ring, IORING_OP_CLOSE, slot->fd, NULL, 0, 0, index);
+        slot->state = SCAN_SLOT_CLOSE;
+        return;
+
+    case SCAN_SLOT_CLOSE:
+        free(slot->big);
+        slot->big = NULL;
+        slot->fd = -1;
+        if (is_png_candidate(slot->buffer, slot->len))
+            check_png(slot->path, counts);
+        slot->state = SCAN_SLOT_FREE;
+        return;
+    }
+}
+
+/* Scan through the rings, keeping every slot busy while the walk has files */
+static Status scan_with_ring(ScanRing *ring, ScanWalk *walk, ScanSlot *slots, ScanCounts *counts)
+{
+    int walking = 1;
+    for (;;)
+    {
+        int in_flight = 0;
+        for (unsigned i = 0; i < SCAN_QUEUE_DEPTH; i++)
+        {
+            if (slots[i].state == SCAN_SLOT_FREE && walking)
+            {
+                walking = walk_next(walk, slots[i].path, counts);
+                if (walking)
+                {
+                    counts->files++;
+                    slots[i].len = 0;
+                    ring_queue(ring, IORING_OP_OPENAT, AT_FDCWD, slots[i].path, 0, O_RDONLY | O_CLOEXEC, i);
+                    slots[i].state = SCAN_SLOT_OPEN;
+                }
+            }
+            if (slots[i].state != SCAN_SLOT_FREE)
+                in_flight++;
+        }
+        if (in_flight == 0)
+            return e_success;
+
+        if (ring_submit(ring) == e_failure)
+            return e_failure;
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            slot_complete(ring, slots, cqe->user_data, cqe->res, counts);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+#else
+static Status ring_init(ScanRing *ring, unsigned entries)
+{
+    (void)entries;
+    ring->fd = -1;
+    return e_failure;
+}
+
+static void ring_free(ScanRing *ring)
+{
+    (void)ring;
+}
+
+static Status scan_with_ring(ScanRing *ring, ScanWalk *walk, ScanSlot *slots, ScanCounts *counts)
+{
+    (void)ring;
+    (void)walk;
+    (void)slots;
+    (void)counts;
+    return e_failure;
+}
+#endif
+
+Status do_scan(char *dirs[])
+{
+    ScanWalk walk;
+    ScanRing ring;
+    ScanCounts counts = {0};
+    Status ret = e_success;
+
+    if (dirs[0] == NULL)
+    {
+        printf("ERROR: --scan needs a directory.\n");
+        return e_failure;
+    }
+    ScanSlot *slots = calloc(SCAN_QUEUE_DEPTH, sizeof(ScanSlot));
+    if (slots == NULL)
+    {
+        perror("calloc");
+        return e_failure;
+    }
+    if (walk_init(&walk, dirs) == e_failure)
+    {
+        walk_free(&walk);
+        free(slots);
+        return e_failure;
+    }
+
+    if (ring_init(&ring, SCAN_QUEUE_DEPTH) == e_success)
+    {
+        ret = scan_with_ring(&ring, &walk, slots, &counts);
+        ring_free(&ring);
+    }
+    else
+    {
+        printf("INFO: io_uring is not available, scanning with blocking reads\n");
+        while (walk_next(&walk, slots[0].path, &counts))
+        {
+            counts.files++;
+            scan_file_blocking(&slots[0], &counts);
+        }
+    }
+
+    printf("INFO: Scanned %ld files, %ld with a payload, %ld unreadable\n", counts.files, counts.payloads,
+           counts.unreadable);
+    walk_free(&walk);
+    free(slots);
+    return ret;
+}
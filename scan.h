@@ -0,0 +1,93 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* Files in flight at once, each holds one ring entry */
+#define SCAN_QUEUE_DEPTH 256
+
+/* Bytes read from the start of every file: the BMP headers and every
+ * field before the secret data of common images */
+#define SCAN_READ_SIZE 4096
+
+/* Most bytes read from a file with a bigger header (ICC profiles, gaps) */
+#define SCAN_MAX_READ_SIZE (16 * 1024 * 1024)
+
+/* Slot steps */
+#define SCAN_SLOT_FREE 0
+#define SCAN_SLOT_OPEN 1
+#define SCAN_SLOT_READ 2
+#define SCAN_SLOT_CLOSE 3
+
+/*
+ * Directory walk
+ * depth first, one directory open at a time: the ones still to visit
+ * are kept as paths. Symbolic links are not followed
+ */
+typedef struct _ScanWalk
+{
+    DIR *dir;                 // To store the directory being read, NULL between directories
+    char dir_path[PATH_MAX];  // To store its path
+    char **pending;           // To store paths of directories still to read
+    size_t num_pending;       // To store how many there are
+    size_t max_pending;       // To store the room in pending
+} ScanWalk;
+
+/* One file on its way through open, read and close */
+typedef struct _ScanSlot
+{
+    int state;                // To store the SCAN_SLOT_* step
+    int fd;                   // To store the open file, -1 before
+    char path[PATH_MAX];      // To store the file path
+    unsigned char buffer[SCAN_READ_SIZE]; // To store the first bytes of the file
+    unsigned char *big;       // To store a longer read when the header needs it, NULL if not
+    long len;                 // To store the bytes read
+} ScanSlot;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * io_uring submission and completion rings
+ * mapped straight from the kernel, no liburing: an entry per slot,
+ * the slot index rides in user_data
+ */
+typedef struct _ScanRing
+{
+    int fd;                   // To store the ring fd, -1 when the kernel has no io_uring
+    unsigned *sq_head;        // To store the submission head, moved by the kernel
+    unsigned *sq_tail;        // To store the submission tail, moved here
+    unsigned *sq_mask;        // To store the submission ring mask
+    unsigned *sq_array;       // To store the submission index array
+    struct io_uring_sqe *sqes; // To store the submission entries
+    unsigned *cq_head;        // To store the completion head, moved here
+    unsigned *cq_tail;        // To store the completion tail, moved by the kernel
+    unsigned *cq_mask;        // To store the completion ring mask
+    struct io_uring_cqe *cqes; // To store the completion entries
+    void *sq_map;             // To store the submission ring mapping
+    size_t sq_map_size;       // To store its size
+    void *cq_map;             // To store the completion ring mapping, sq_map when shared
+    size_t cq_map_size;       // To store its size
+    size_t sqes_size;         // To store the size of the entries mapping
+    unsigned to_submit;       // To store entries queued since the last submit
+} ScanRing;
+
+/* Totals of one scan */
+typedef struct _ScanCounts
+{
+    long files;               // To store the regular files looked at
+    long payloads;            // To store the files found carrying a payload
+    long unreadable;          // To store the files that could not be opened or read
+} ScanCounts;
+
+/* Scan function prototypes */
+
+/* Walk the trees under the NULL terminated dirs and print every file
+ * carrying a payload, one line each like --inspect, then the totals */
+Status do_scan(char *dirs[]);
+
+#endif
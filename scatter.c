@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "scatter.h"
+#include "aead.h"
+#include "types.h"
+
+/* Salt of the permutation key, the image has nowhere to keep a random one
+ * before the scattered carriers */
+#define SCATTER_SALT "steg carrier scatter"
+
+/* Function Definitions */
+
+/*Scatter steps
+1.key = PBKDF2-HMAC-SHA256(passphrase, fixed salt), split into round keys
+2.logical carrier k (k >= base) is carrier (k - base) % cell of logical
+  cell (k - base) / cell, which sits at image cell P(cell number)
+  P = Feistel rounds over a power of two left half and a right half
+  just big enough to cover the cells, repeated while the result is
+  outside them (cycle walking keeps it a permutation)
+3.carriers are loaded a batch at a time: all image offsets of the batch
+  are worked out, then the carriers are gathered (and later put back)
+  in one loop*/
+
+/* Round function: the top half of a keyed multiply depends on every input bit */
+static uint32_t round_hash(uint64_t half, uint64_t key)
+{
+    return ((half ^ key) * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+/* One pass of the permutation over [0, 2^left_bits * right_size)
+ * x = right * 2^left_bits + left, the left half is mixed modulo the power
+ * of two, the right half modulo right_size, so no round divides */
+static uint64_t feistel(const ScatterInfo *scatter, uint64_t x)
+{
+    uint64_t mask = (1ull << scatter->left_bits) - 1;
+    uint64_t left = x & mask;
+    uint64_t right = x >> scatter->left_bits;
+
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+    {
+        left = (left + round_hash(right, scatter->round_key[2 * r])) & mask;
+        right += ((uint64_t)round_hash(left, scatter->round_key[2 * r + 1]) * scatter->right_size) >> 32;
+        right = (right >= scatter->right_size) ? right - scatter->right_size : right;
+    }
+    return (right << scatter->left_bits) | left;
+}
+
+Status scatter_init(ScatterInfo *scatter, const char *passphrase, const BmpLayout *layout, long base, int cell)
+{
+    unsigned char key[AEAD_KEY_SIZE];
+
+    if (base > layout->capacity || cell <= 0)
+        return e_failure;
+    scatter->base = base;
+    scatter->cell = cell;
+    scatter->domain = (layout->capacity - base) / cell;
+
+    // Left half about the square root of the domain, the right half just
+    // big enough, so at most 2^left_bits points lie outside the domain
+    int bits = 2;
+    while (bits < 62 && (1l << bits) < scatter->domain)
+        bits++;
+    scatter->left_bits = (bits + 1) / 2;
+    scatter->right_size = (scatter->domain + (1l << scatter->left_bits) - 1) >> scatter->left_bits;
+    if (scatter->right_size == 0)
+        scatter->right_size = 1;
+
+    // 64 key bits per half round
+    aead_derive_key(passphrase, (const unsigned char *)SCATTER_SALT, strlen(SCATTER_SALT), key);
+    for (int i = 0; i < 2 * SCATTER_ROUNDS; i++)
+    {
+        uint64_t word = 0;
+        for (int j = 7; j >= 0; j--)
+            word = (word << 8) | key[8 * i + j];
+        scatter->round_key[i] = word;
+    }
+    memset(key, 0, sizeof(key));
+    return e_success;
+}
+
+/* Image cell of logical cell i */
+static uint64_t permute_cell(const ScatterInfo *scatter, uint64_t i)
+{
+    uint64_t x = feistel(scatter, i);
+
+    // Cycle walking, rarely more than one pass
+    while (x >= (uint64_t)scatter->domain)
+        x = feistel(scatter, x);
+    return x;
+}
+
+long scatter_position(const ScatterInfo *scatter, long k)
+{
+    long i = k - scatter->base;
+    return scatter->base + permute_cell(scatter, i / scatter->cell) * scatter->cell + i % scatter->cell;
+}
+
+ScatterBatch *scatter_batch_open(const ScatterInfo *scatter, const BmpLayout *layout, void *image, long end,
+                                 Arena *arena)
+{
+    ScatterBatch *batch = scratch_alloc(arena, sizeof(ScatterBatch));
+    if (batch == NULL)
+        return NULL;
+    batch->arena = arena;
+    batch->scatter = scatter;
+    batch->layout = layout;
+    batch->image = image;
+    batch->end = end;
+    batch->first = -1;
+    batch->n = 0;
+    batch->dirty = 0;
+    return batch;
+}
+
+/* Put changed carriers back */
+static void flush_batch(ScatterBatch *batch)
+{
+    if (batch->dirty)
+    {
+        for (size_t i = 0; i < batch->n; i++)
+            batch->image[batch->offset[i]] = batch->carriers[i];
+    }
+    batch->dirty = 0;
+}
+
+/* Load whole cells from the one holding logical carrier k */
+static void load_batch(ScatterBatch *batch, long k)
+{
+    const ScatterInfo *scatter = batch->scatter;
+    const BmpLayout *layout = batch->layout;
+    int cell = scatter->cell;
+    long first = k - (k - scatter->base) % cell;
+    long n = batch->end - first;
+    if (n > SCATTER_BATCH_SIZE / cell * cell)
+        n = SCATTER_BATCH_SIZE / cell * cell;
+
+    flush_batch(batch);
+    batch->first = first;
+    batch->n = n;
+
+    // Offsets first, one Feistel pass per cell
+    for (long i = 0; i < n; i += cell)
+    {
+        long pos = scatter->base + permute_cell(scatter, (first - scatter->base + i) / cell) * cell;
+        if (layout->contiguous)
+        {
+            off_t offset = carrier_offset(layout, pos);
+            for (int j = 0; j < cell; j++)
+                batch->offset[i + j] = offset + j;
+        }
+        else
+        {
+            for (int j = 0; j < cell; j++)
+                batch->offset[i + j] = carrier_offset(layout, pos + j);
+        }
+    }
+
+    // Then the loads, none depends on another
+    for (long i = 0; i < n; i++)
+        batch->carriers[i] = batch->image[batch->offset[i]];
+}
+
+unsigned char *scatter_batch_carriers(ScatterBatch *batch, long k, size_t n, int writable)
+{
+    if (batch->first < 0 || k < batch->first || k + n > batch->first + batch->n)
+        load_batch(batch, k);
+    if (writable)
+        batch->dirty = 1;
+    return batch->carriers + (k - batch->first);
+}
+
+void scatter_batch_close(ScatterBatch *batch)
+{
+    if (batch == NULL)
+        return;
+    flush_batch(batch);
+    scratch_free(batch->arena, batch);
+}
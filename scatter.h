@@ -0,0 +1,81 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "bmp_layout.h"
+#include "arena.h"
+#include "types.h"
+
+/* Feistel round pairs, each rewrites both halves (2 pairs = 4 rounds) */
+#define SCATTER_ROUNDS 2
+
+/* Most carriers in one batch */
+#define SCATTER_BATCH_SIZE (64 * 1024)
+
+/*
+ * Keyed carrier permutation
+ * the carriers after the header fields are split into cells of
+ * image_bytes_for(1) carriers, the carriers of one payload byte. Cells
+ * are visited in the order of a Feistel permutation keyed from the
+ * passphrase: logical cell i sits at image cell P(i). P works on a
+ * rectangle just covering the cells and walks the cycle until it lands
+ * inside them, so P(i) costs O(1) (barely over one Feistel pass on
+ * average) and needs no tables. A payload byte stays in one cell, one
+ * cache line of the image, so scattering costs one miss per byte
+ */
+typedef struct _ScatterInfo
+{
+    uint64_t round_key[2 * SCATTER_ROUNDS]; // To store the key of each half round
+    int left_bits;        // To store the bits of the left half
+    uint64_t right_size;  // To store the range of the right half
+    long base;            // To store the first scattered carrier
+    int cell;             // To store the carriers per cell
+    long domain;          // To store the number of cells
+} ScatterInfo;
+
+/*
+ * Cache of scattered carriers
+ * a batch holds up to SCATTER_BATCH_SIZE consecutive logical carriers.
+ * Loading it works out every image offset first and then gathers the
+ * carriers in one loop of independent loads, so the cache misses of a
+ * batch overlap instead of following each other. Callers work on the
+ * logical carriers in the batch like on any carrier buffer
+ */
+typedef struct _ScatterBatch
+{
+    const ScatterInfo *scatter; // To store the permutation
+    const BmpLayout *layout;    // To store the layout that places the carriers
+    unsigned char *image;       // To store the mapped image
+    long end;                   // To store one past the last logical carrier in use
+    long first;                 // To store the first logical carrier loaded
+    size_t n;                   // To store the carriers loaded
+    int dirty;                  // To store 1 when carriers changed since the load
+    Arena *arena;               // To store the arena the batch came from, NULL if malloced
+    unsigned char carriers[SCATTER_BATCH_SIZE]; // To store the loaded carriers, logical order
+    off_t offset[SCATTER_BATCH_SIZE];           // To store the image offset of each loaded carrier
+} ScatterBatch;
+
+/* Scatter function prototypes */
+
+/* Key the permutation of the cells (of cell carriers each) from carrier base
+ * to the end of the image from the passphrase */
+Status scatter_init(ScatterInfo *scatter, const char *passphrase, const BmpLayout *layout, long base, int cell);
+
+/* Image carrier that holds logical carrier k (k >= base) */
+long scatter_position(const ScatterInfo *scatter, long k);
+
+/* Batch over the mapped image for logical carriers base .. end - 1, taken
+ * from arena (NULL to malloc it), NULL if out of memory */
+ScatterBatch *scatter_batch_open(const ScatterInfo *scatter, const BmpLayout *layout, void *image, long end,
+                                 Arena *arena);
+
+/* Logical carriers k .. k + n - 1 (n <= SCATTER_BATCH_SIZE - cell), loading
+ * them when they are not loaded yet. With writable set the changes go back
+ * to the image when the batch moves on or is closed */
+unsigned char *scatter_batch_carriers(ScatterBatch *batch, long k, size_t n, int writable);
+
+/* Write back changed carriers and give the batch back */
+void scatter_batch_close(ScatterBatch *batch);
+
+#endif
@@ -0,0 +1,824 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "serve.h"
+#include "steg.h"
+#include "decode.h"
+#include "inspect.h"
+#include "stream_io.h"
+#include "block_io.h"
+#include "types.h"
+
+/* epoll tags of the listening socket and the wake eventfd, connection
+ * slots tag their own events with the slot number */
+#define SERVE_LISTEN_TAG SERVE_MAX_CONNECTIONS
+#define SERVE_WAKE_TAG (SERVE_MAX_CONNECTIONS + 1)
+
+/* Events the dispatcher takes from one epoll_wait */
+#define SERVE_EVENTS 64
+
+/* Longest extension the encoder stores, as read_and_validate_encode_args checks it */
+#define SERVE_EXTN_MAX 4
+
+/* Per worker state, its library context stays warm between requests */
+typedef struct _ServeWorker
+{
+    ServeInfo *serveInfo; // shared queue and counters
+    StegCtx *ctx;         // arena, streams and spool reused by every request
+    pthread_t tid;
+    int started;
+} ServeWorker;
+
+/* Server of the signal handler */
+static ServeInfo *signal_server;
+
+/* Function Definitions */
+
+/*Serve steps
+1.bind a SOCK_SEQPACKET Unix socket (0600, a stale one from a dead
+  server is replaced), start num_threads workers with a library
+  context each
+2.the dispatcher waits on the socket and every connection with
+  epoll; a connection is armed one shot, so it is queued once per
+  request and only one worker at a time reads it
+3.a worker takes the next queued connection, receives the request
+  and its fds, runs it on its context (images and shared memory
+  buffers are mapped, nothing is copied through the socket), replies
+  with status and timing and arms the connection again
+4.on SIGINT/SIGTERM (serve_stop) the workers finish the request they
+  hold, every connection is closed and the socket removed
+Client steps
+1.open the files of a -e/-d/-i command line
+2.send them with the request, print the reply like the command line*/
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Map all of fd, *len gets its size, populate when every page is touched
+ * (one fault for the lot instead of one per page)
+ * The buffer must be sealed at its size: a client shrinking a mapped
+ * buffer mid request would kill the server with SIGBUS */
+static void *map_fd(int fd, int prot, int populate, size_t *len)
+{
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW))
+    {
+        printf("ERROR:Shared memory buffer is not sealed against shrinking and growing\n");
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        printf("ERROR:Unable to map an empty or unreadable buffer\n");
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, prot, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    *len = st.st_size;
+    return data;
+}
+
+/* Encode between shared memory buffers, no stego buffer encodes the cover in place */
+static Status encode_shm(ServeWorker *worker, const StegOptions *opts, const ServeRequest *request, const int fds[],
+                         int nfds, ServeReply *reply)
+{
+    size_t cover_len = 0, secret_size = 0, stego_len = 0;
+    int in_place = (nfds == 2);
+    char *cover = map_fd(fds[0], in_place ? PROT_READ | PROT_WRITE : PROT_READ, !in_place, &cover_len);
+    char *secret = map_fd(fds[1], PROT_READ, 0, &secret_size);
+    char *stego = in_place ? cover : map_fd(fds[2], PROT_READ | PROT_WRITE, 1, &stego_len);
+    size_t secret_len = request->secret_len ? request->secret_len : secret_size;
+    Status ret = e_failure;
+
+    if (in_place)
+        stego_len = cover_len;
+    if (cover != NULL && secret != NULL && stego != NULL)
+    {
+        if (secret_len > secret_size || stego_len < cover_len)
+            printf("ERROR:Secret or stego buffer is too small\n");
+        else
+            ret = steg_encode_buffer(worker->ctx, opts, cover, cover_len, secret, secret_len, stego);
+    }
+    reply->size = cover_len;
+    if (stego != NULL && !in_place)
+        munmap(stego, stego_len);
+    if (secret != NULL)
+        munmap(secret, secret_size);
+    if (cover != NULL)
+        munmap(cover, cover_len);
+    return ret;
+}
+
+/* Decode a shared memory stego image into a shared memory output buffer */
+static Status decode_shm(ServeWorker *worker, const StegOptions *opts, const int fds[], ServeReply *reply)
+{
+    size_t stego_len = 0, out_size = 0, out_len = 0;
+    unsigned char *stego = map_fd(fds[0], PROT_READ, 0, &stego_len);
+    unsigned char *out = map_fd(fds[1], PROT_READ | PROT_WRITE, 0, &out_size);
+    Status ret = e_failure;
+
+    if (stego != NULL && out != NULL)
+        ret = steg_decode_buffer(worker->ctx, opts, stego, stego_len, out, out_size, &out_len);
+    reply->size = out_len;
+    if (out != NULL)
+        munmap(out, out_size);
+    if (stego != NULL)
+        munmap(stego, stego_len);
+    return ret;
+}
+
+/* Private copy of all of fd, *len gets its size
+ * A file cannot be sealed, one shrunk under a mapping would raise SIGBUS */
+static unsigned char *read_fd(int fd, size_t *len)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        printf("ERROR:Unable to read an empty or unreadable file\n");
+        return NULL;
+    }
+    unsigned char *data = malloc(st.st_size);
+    if (data == NULL || read_block_at(fd, data, st.st_size, 0) == e_failure)
+    {
+        printf("ERROR:Unable to read the stego image\n");
+        free(data);
+        return NULL;
+    }
+    *len = st.st_size;
+    return data;
+}
+
+/* Header fields and capacity of a stego image, an image without a payload gets size -1 */
+static Status inspect_fd(ServeWorker *worker, int fd, int shm, ServeReply *reply)
+{
+    size_t len = 0;
+    unsigned char *stego = shm ? map_fd(fd, PROT_READ, 0, &len) : read_fd(fd, &len);
+    if (stego == NULL)
+        return e_failure;
+
+    StegPayloadInfo info;
+    reply->capacity = steg_capacity(stego, len, NULL);
+    reply->size = -1;
+    if (reply->capacity >= 0 && steg_inspect_buffer(worker->ctx, stego, len, &info) == e_success)
+    {
+        reply->version = info.version;
+        reply->lsb_bits = info.lsb_bits;
+        reply->flags = info.flags;
+        reply->size = info.size;
+        strcpy(reply->extn, info.extn);
+    }
+    if (shm)
+        munmap(stego, len);
+    else
+        free(stego);
+    if (reply->capacity < 0)
+    {
+        printf("ERROR:Unsupported BMP image <buffer>\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Run one request on the worker's context */
+static Status run_request(ServeWorker *worker, ServeRequest *request, const int fds[], int nfds, ServeReply *reply)
+{
+    StegOptions opts = {0};
+    int shm = (request->flags & SERVE_FLAG_SHM) != 0;
+    Status ret = e_failure;
+    struct stat st;
+
+    request->extn[sizeof(request->extn) - 1] = '\0';
+    request->passphrase[sizeof(request->passphrase) - 1] = '\0';
+    opts.lsb_bits = request->lsb_bits;
+    opts.compress_level = request->compress_level;
+    opts.passphrase = (request->passphrase[0] != '\0') ? request->passphrase : NULL;
+    opts.use_scatter = request->use_scatter;
+    opts.use_checksum = request->use_checksum;
+    opts.extn = (request->extn[0] != '\0') ? request->extn : NULL;
+    opts.offset = request->offset;
+    opts.length = request->length;
+    if (opts.offset < 0 || opts.length < 0)
+    {
+        printf("ERROR:Invalid payload offset or length\n");
+        return e_failure;
+    }
+
+    switch (request->op)
+    {
+    case SERVE_OP_ENCODE:
+        if (nfds != 2 && nfds != 3)
+            break;
+        if (shm)
+            return encode_shm(worker, &opts, request, fds, nfds, reply);
+        ret = steg_encode_fd(worker->ctx, &opts, fds[0], fds[1], (nfds == 3) ? fds[2] : fds[0]);
+        if (fstat(fds[0], &st) == 0)
+            reply->size = st.st_size;
+        return ret;
+    case SERVE_OP_DECODE:
+        if (nfds != 2)
+            break;
+        if (shm)
+            ret = decode_shm(worker, &opts, fds, reply);
+        else
+        {
+            ret = steg_decode_fd(worker->ctx, &opts, fds[0], fds[1]);
+            reply->size = steg_ctx_output_len(worker->ctx);
+        }
+        strcpy(reply->extn, steg_ctx_extn(worker->ctx));
+        return ret;
+    case SERVE_OP_INSPECT:
+        if (nfds != 1)
+            break;
+        return inspect_fd(worker, fds[0], shm, reply);
+    default:
+        printf("ERROR:Unknown request %u\n", request->op);
+        return e_failure;
+    }
+    printf("ERROR:Request %u carries %d fds\n", request->op, nfds);
+    return e_failure;
+}
+
+/* Receive one request and the fds attached to it, the message length
+ * (-1 for a malformed one), 0 when the peer closed, -2 if none waits */
+static ssize_t receive_request(int sock, ServeRequest *request, int fds[], int *nfds)
+{
+    union
+    {
+        char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {request, sizeof(ServeRequest)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do
+        n = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    *nfds = 0;
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? -2 : 0;
+
+    // Every fd that came is kept to be closed, past SERVE_MAX_FDS (the
+    // control buffer rounds up) they are closed here and the request refused
+    int extra = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*nfds < SERVE_MAX_FDS)
+                fds[(*nfds)++] = fd;
+            else
+            {
+                close(fd);
+                extra = 1;
+            }
+        }
+    }
+    if (n > 0 && (n != sizeof(ServeRequest) || extra || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+                  request->magic != SERVE_MAGIC))
+        return -1;
+    return n;
+}
+
+/* Close a connection and free its slot */
+static void close_connection(ServeInfo *serveInfo, int slot)
+{
+    pthread_mutex_lock(&serveInfo->lock);
+    close(serveInfo->conns[slot].fd);
+    serveInfo->conns[slot].fd = -1;
+    pthread_mutex_unlock(&serveInfo->lock);
+}
+
+/* Answer the request waiting on a connection slot */
+static void serve_connection(ServeWorker *worker, int slot, int sock, uint64_t ready_ns)
+{
+    ServeInfo *serveInfo = worker->serveInfo;
+    ServeRequest request;
+    ServeReply reply = {0};
+    int fds[SERVE_MAX_FDS];
+    int nfds;
+
+    ssize_t n = receive_request(sock, &request, fds, &nfds);
+    if (n == 0)
+    {
+        close_connection(serveInfo, slot);
+        return;
+    }
+    if (n > 0 || n == -1)
+    {
+        uint64_t start = now_ns();
+        reply.magic = SERVE_MAGIC;
+        reply.status = e_failure;
+        if (n > 0)
+        {
+            reply.id = request.id;
+            reply.status = run_request(worker, &request, fds, nfds, &reply);
+        }
+        else
+        {
+            printf("ERROR:Malformed request\n");
+        }
+        memset(request.passphrase, 0, sizeof(request.passphrase));
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+        reply.queue_ns = start - ready_ns;
+        reply.run_ns = now_ns() - start;
+
+        if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+        {
+            close_connection(serveInfo, slot);
+            return;
+        }
+        pthread_mutex_lock(&serveInfo->lock);
+        serveInfo->served++;
+        if (reply.status == e_failure)
+            serveInfo->failed++;
+        pthread_mutex_unlock(&serveInfo->lock);
+    }
+
+    // Armed again only now, so its next request goes to one worker after this reply
+    struct epoll_event ev = {EPOLLIN | EPOLLONESHOT, {.u32 = slot}};
+    if (epoll_ctl(serveInfo->epoll_fd, EPOLL_CTL_MOD, sock, &ev) != 0)
+        close_connection(serveInfo, slot);
+}
+
+/* Worker: answer queued connections until the server stops */
+static void *serve_worker(void *arg)
+{
+    ServeWorker *worker = arg;
+    ServeInfo *serveInfo = worker->serveInfo;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&serveInfo->lock);
+        while (serveInfo->count == 0 && !serveInfo->stopping)
+            pthread_cond_wait(&serveInfo->ready, &serveInfo->lock);
+        if (serveInfo->stopping)
+        {
+            pthread_mutex_unlock(&serveInfo->lock);
+            break;
+        }
+        int slot = serveInfo->queue[serveInfo->head];
+        serveInfo->head = (serveInfo->head + 1) % SERVE_MAX_CONNECTIONS;
+        serveInfo->count--;
+        int sock = serveInfo->conns[slot].fd;
+        uint64_t ready_ns = serveInfo->conns[slot].ready_ns;
+        pthread_mutex_unlock(&serveInfo->lock);
+
+        serve_connection(worker, slot, sock, ready_ns);
+    }
+    return NULL;
+}
+
+/* Take a new connection into a free slot, armed for its first request */
+static void accept_connection(ServeInfo *serveInfo)
+{
+    int sock = accept4(serveInfo->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0)
+        return;
+
+    pthread_mutex_lock(&serveInfo->lock);
+    int slot = 0;
+    while (slot < SERVE_MAX_CONNECTIONS && serveInfo->conns[slot].fd >= 0)
+        slot++;
+    if (slot < SERVE_MAX_CONNECTIONS)
+        serveInfo->conns[slot].fd = sock;
+    pthread_mutex_unlock(&serveInfo->lock);
+
+    struct epoll_event ev = {EPOLLIN | EPOLLONESHOT, {.u32 = slot}};
+    if (slot == SERVE_MAX_CONNECTIONS)
+    {
+        printf("ERROR:%d connections open, refusing another\n", SERVE_MAX_CONNECTIONS);
+        close(sock);
+    }
+    else if (epoll_ctl(serveInfo->epoll_fd, EPOLL_CTL_ADD, sock, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        close_connection(serveInfo, slot);
+    }
+}
+
+/* Stop the workers and release everything serve_open set up */
+static void serve_close(ServeInfo *serveInfo)
+{
+    pthread_mutex_lock(&serveInfo->lock);
+    serveInfo->stopping = 1;
+    pthread_cond_broadcast(&serveInfo->ready);
+    pthread_mutex_unlock(&serveInfo->lock);
+
+    for (int t = 0; serveInfo->workers != NULL && t < serveInfo->num_threads; t++)
+    {
+        if (serveInfo->workers[t].started)
+            pthread_join(serveInfo->workers[t].tid, NULL);
+        steg_ctx_destroy(serveInfo->workers[t].ctx);
+    }
+    free(serveInfo->workers);
+    serveInfo->workers = NULL;
+
+    for (int slot = 0; slot < SERVE_MAX_CONNECTIONS; slot++)
+    {
+        if (serveInfo->conns[slot].fd >= 0)
+            close(serveInfo->conns[slot].fd);
+        serveInfo->conns[slot].fd = -1;
+    }
+    if (serveInfo->epoll_fd >= 0)
+        close(serveInfo->epoll_fd);
+    if (serveInfo->wake_fd >= 0)
+        close(serveInfo->wake_fd);
+    // Set only once bound, the path is ours to remove
+    if (serveInfo->listen_fd >= 0)
+    {
+        close(serveInfo->listen_fd);
+        unlink(serveInfo->socket_path);
+    }
+    serveInfo->epoll_fd = serveInfo->wake_fd = serveInfo->listen_fd = -1;
+    pthread_cond_destroy(&serveInfo->ready);
+    pthread_mutex_destroy(&serveInfo->lock);
+}
+
+/* Bind and listen on the socket path, replacing the socket of a server that is gone */
+static int listen_socket(const char *socket_path)
+{
+    struct sockaddr_un addr = {0};
+    struct stat st;
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        printf("ERROR:Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    // Only this user may connect, requests carry passphrases
+    mode_t mask = umask(077);
+    int bound = (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    if (!bound && errno == EADDRINUSE)
+    {
+        int probe = serve_connect(socket_path);
+        if (probe >= 0)
+        {
+            close(probe);
+            printf("ERROR:A server is already listening on %s\n", socket_path);
+        }
+        else if (lstat(socket_path, &st) != 0 || !S_ISSOCK(st.st_mode))
+        {
+            // Only a stale socket is ours to replace, never a file at that path
+            printf("ERROR:%s exists and is not a socket\n", socket_path);
+            errno = EADDRINUSE;
+        }
+        else if (unlink(socket_path) == 0)
+        {
+            bound = (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        }
+    }
+    umask(mask);
+    if (!bound || listen(sock, SERVE_BACKLOG) != 0)
+    {
+        if (errno != EADDRINUSE)
+            perror("bind");
+        if (bound)
+            unlink(socket_path);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+Status serve_open(ServeInfo *serveInfo)
+{
+    pthread_mutex_init(&serveInfo->lock, NULL);
+    pthread_cond_init(&serveInfo->ready, NULL);
+    for (int slot = 0; slot < SERVE_MAX_CONNECTIONS; slot++)
+        serveInfo->conns[slot].fd = -1;
+    serveInfo->head = serveInfo->count = serveInfo->stopping = 0;
+    serveInfo->served = serveInfo->failed = 0;
+    serveInfo->workers = NULL;
+    if (serveInfo->num_threads <= 0)
+        serveInfo->num_threads = 1;
+
+    serveInfo->listen_fd = listen_socket(serveInfo->socket_path);
+    serveInfo->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    serveInfo->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event listen_ev = {EPOLLIN, {.u32 = SERVE_LISTEN_TAG}};
+    struct epoll_event wake_ev = {EPOLLIN, {.u32 = SERVE_WAKE_TAG}};
+    if (serveInfo->listen_fd < 0 || serveInfo->epoll_fd < 0 || serveInfo->wake_fd < 0 ||
+        epoll_ctl(serveInfo->epoll_fd, EPOLL_CTL_ADD, serveInfo->listen_fd, &listen_ev) != 0 ||
+        epoll_ctl(serveInfo->epoll_fd, EPOLL_CTL_ADD, serveInfo->wake_fd, &wake_ev) != 0)
+    {
+        printf("ERROR:Unable to listen on %s\n", serveInfo->socket_path);
+        serve_close(serveInfo);
+        return e_failure;
+    }
+
+    // Contexts are made before any request, the first one finds them warm
+    serveInfo->workers = calloc(serveInfo->num_threads, sizeof(ServeWorker));
+    int any_started = 0;
+    for (int t = 0; serveInfo->workers != NULL && t < serveInfo->num_threads; t++)
+    {
+        ServeWorker *worker = &serveInfo->workers[t];
+        worker->serveInfo = serveInfo;
+        worker->ctx = steg_ctx_create();
+        worker->started = (worker->ctx != NULL && pthread_create(&worker->tid, NULL, serve_worker, worker) == 0);
+        any_started |= worker->started;
+    }
+    if (!any_started)
+    {
+        printf("ERROR:Unable to start the workers\n");
+        serve_close(serveInfo);
+        return e_failure;
+    }
+    return e_success;
+}
+
+Status serve_run(ServeInfo *serveInfo)
+{
+    struct epoll_event events[SERVE_EVENTS];
+    int stop = 0;
+
+    while (!stop)
+    {
+        int n = epoll_wait(serveInfo->epoll_fd, events, SERVE_EVENTS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            perror("epoll_wait");
+            break;
+        }
+
+        uint64_t ready_ns = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t tag = events[i].data.u32;
+            if (tag == SERVE_WAKE_TAG)
+            {
+                stop = 1;
+            }
+            else if (tag == SERVE_LISTEN_TAG)
+            {
+                accept_connection(serveInfo);
+            }
+            else
+            {
+                // One shot: the slot is disarmed until its worker replies, it is never queued twice
+                pthread_mutex_lock(&serveInfo->lock);
+                serveInfo->conns[tag].ready_ns = ready_ns;
+                serveInfo->queue[(serveInfo->head + serveInfo->count) % SERVE_MAX_CONNECTIONS] = tag;
+                serveInfo->count++;
+                pthread_cond_signal(&serveInfo->ready);
+                pthread_mutex_unlock(&serveInfo->lock);
+            }
+        }
+    }
+
+    serve_close(serveInfo);
+    printf("INFO: Served %ld requests, %ld failed\n", serveInfo->served, serveInfo->failed);
+    return e_success;
+}
+
+void serve_stop(ServeInfo *serveInfo)
+{
+    uint64_t one = 1;
+    if (write(serveInfo->wake_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+static void stop_on_signal(int sig)
+{
+    (void)sig;
+    if (signal_server != NULL)
+        serve_stop(signal_server);
+}
+
+Status do_serve(const char *socket_path, int num_threads)
+{
+    static ServeInfo serveInfo;
+    serveInfo.socket_path = socket_path;
+    serveInfo.num_threads = num_threads;
+    if (serve_open(&serveInfo) == e_failure)
+        return e_failure;
+
+    // A client gone before its reply must not kill the server
+    struct sigaction sa = {0};
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    signal_server = &serveInfo;
+    sa.sa_handler = stop_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // One line per message, the log of a daemon is read while it runs
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("INFO: Serving on %s with %d workers\n", socket_path, serveInfo.num_threads);
+    return serve_run(&serveInfo);
+}
+
+int serve_connect(const char *socket_path)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+Status serve_call(int sock, const ServeRequest *request, const int fds[], int nfds, ServeReply *reply)
+{
+    union
+    {
+        char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {(void *)request, sizeof(ServeRequest)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(ServeRequest))
+        return e_failure;
+    ssize_t n;
+    do
+        n = recv(sock, reply, sizeof(ServeReply), 0);
+    while (n < 0 && errno == EINTR);
+    return (n == sizeof(ServeReply) && reply->magic == SERVE_MAGIC && reply->id == request->id) ? e_success : e_failure;
+}
+
+Status do_client(const char *socket_path, char *argv[], const ServeRequest *options)
+{
+    ServeRequest request = *options;
+    ServeReply reply;
+    FILE *files[SERVE_MAX_FDS] = {NULL};
+    int fds[SERVE_MAX_FDS];
+    int nfds = 0;
+    const char *target = NULL;
+
+    request.magic = SERVE_MAGIC;
+    request.id = getpid();
+    if (strcmp(argv[1], "-e") == 0 && argv[2] != NULL && argv[3] != NULL)
+    {
+        // Same extension rule as read_and_validate_encode_args
+        char *extn = strrchr(argv[3], '.');
+        if (extn == NULL || strchr(extn, '/') != NULL)
+            extn = STREAM_DEFAULT_EXTN;
+        if (strlen(extn) > SERVE_EXTN_MAX)
+        {
+            printf("ERROR:Extension %s is longer than %d bytes\n", extn, SERVE_EXTN_MAX);
+            return e_failure;
+        }
+        strcpy(request.extn, extn);
+        request.op = SERVE_OP_ENCODE;
+        target = (argv[4] != NULL) ? argv[4] : "stego.bmp";
+        int in_place = (strcmp(argv[2], target) == 0);
+        files[nfds++] = open_stream(argv[2], in_place ? "r+b" : "rb");
+        files[nfds++] = open_stream(argv[3], "rb");
+        if (!in_place)
+            files[nfds++] = open_stream(target, "w+b");
+    }
+    else if (strcmp(argv[1], "-d") == 0 && argv[2] != NULL)
+    {
+        request.op = SERVE_OP_DECODE;
+        target = (argv[3] != NULL) ? argv[3] : "decoded.txt";
+        files[nfds++] = open_stream(argv[2], "rb");
+        files[nfds++] = open_stream(target, "wb");
+    }
+    else if ((strcmp(argv[1], "-i") == 0 || strcmp(argv[1], "--inspect") == 0) && argv[2] != NULL)
+    {
+        request.op = SERVE_OP_INSPECT;
+        target = argv[2];
+        files[nfds++] = open_stream(argv[2], "rb");
+    }
+    else
+    {
+        printf("ERROR:--connect serves -e, -d and -i only\n");
+        return e_failure;
+    }
+
+    Status ret = e_success;
+    for (int i = 0; i < nfds; i++)
+    {
+        if (files[i] == NULL)
+        {
+            perror("fopen");
+            ret = e_failure;
+        }
+        else
+        {
+            fds[i] = fileno(files[i]);
+        }
+    }
+
+    uint64_t start = now_ns();
+    int sock = (ret == e_success) ? serve_connect(socket_path) : -1;
+    if (ret == e_success && sock < 0)
+    {
+        perror("connect");
+        printf("ERROR:Unable to connect to %s\n", socket_path);
+        ret = e_failure;
+    }
+    if (ret == e_success && serve_call(sock, &request, fds, nfds, &reply) == e_failure)
+    {
+        printf("ERROR:No reply from %s\n", socket_path);
+        ret = e_failure;
+    }
+    double round_trip_ms = (now_ns() - start) / 1e6;
+    memset(request.passphrase, 0, sizeof(request.passphrase));
+    if (sock >= 0)
+        close(sock);
+    for (int i = 0; i < nfds; i++)
+    {
+        if (files[i] != NULL)
+            fclose(files[i]);
+    }
+    if (ret == e_failure)
+        return e_failure;
+
+    reply.extn[sizeof(reply.extn) - 1] = '\0';
+    if (reply.status != e_success)
+    {
+        printf("ERROR:Server could not run the request, its log has the reason\n");
+        ret = e_failure;
+    }
+    else if (request.op == SERVE_OP_ENCODE)
+    {
+        printf("INFO: Encoded %s into %s\n", argv[3], target);
+    }
+    else if (request.op == SERVE_OP_DECODE)
+    {
+        printf("INFO: Decoded %lld bytes (stored extension %s) to %s\n", (long long)reply.size, reply.extn, target);
+    }
+    else if (reply.size < 0)
+    {
+        printf("%s: no payload\n", target);
+    }
+    else
+    {
+        DecodeInfo decInfo = {0};
+        decInfo.format.version = reply.version;
+        decInfo.format.lsb_bits = reply.lsb_bits;
+        decInfo.format.flags = reply.flags;
+        decInfo.size_secret_file = reply.size;
+        strcpy(decInfo.extn_secret_file, reply.extn);
+        print_payload_line(target, &decInfo);
+    }
+    printf("INFO: Served in %.3f ms (%.3f ms queued, %.3f ms round trip)\n", reply.run_ns / 1e6, reply.queue_ns / 1e6,
+           round_trip_ms);
+    return ret;
+}
@@ -0,0 +1,128 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "aead.h"
+
+/* First word of every request and reply, "STGS" */
+#define SERVE_MAGIC 0x53475453u
+
+/* Connections served at once, more are closed as they come */
+#define SERVE_MAX_CONNECTIONS 1024
+
+/* fds a request carries at most: cover, secret and stego of an encode */
+#define SERVE_MAX_FDS 3
+
+/* Listen backlog of the socket */
+#define SERVE_BACKLOG 128
+
+/* Request operations */
+#define SERVE_OP_ENCODE 1
+#define SERVE_OP_DECODE 2
+#define SERVE_OP_INSPECT 3
+
+/* Request flag: the fds are shared memory buffers (memfd sealed with
+ * F_SEAL_SHRINK | F_SEAL_GROW), mapped rather than read and written as files */
+#define SERVE_FLAG_SHM 0x1u
+
+/*
+ * Protocol
+ * a SOCK_SEQPACKET Unix socket, one ServeRequest per message with its
+ * fds attached (SCM_RIGHTS), one ServeReply back per request in order.
+ *   encode:  cover, secret[, stego]  no stego fd encodes the cover in place
+ *   decode:  stego, output
+ *   inspect: stego
+ * With SERVE_FLAG_SHM the images and the secret are mapped: secret_len
+ * bytes of the secret buffer are encoded (0 for all of it), the stego
+ * buffer must be as large as the cover and a decode fills the output
+ * buffer, whose size is the most it takes. Unsealed buffers are refused,
+ * one shrunk under the mapping would kill the server. Without it the stego image
+ * is a file the server sizes, the secret and the output may be pipes.
+ * The socket is created 0600, the passphrase travels in the request
+ */
+typedef struct _ServeRequest
+{
+    uint32_t magic;           // To store SERVE_MAGIC
+    uint32_t id;              // To store the caller's tag, echoed in the reply
+    uint32_t op;              // To store the SERVE_OP_* operation
+    uint32_t flags;           // To store the SERVE_FLAG_* bits
+    int32_t lsb_bits;         // To store the LSBs per image byte of an encode, 0 for 1
+    int32_t compress_level;   // To store the compression level of an encode, 0 for none
+    int32_t use_scatter;      // To permute the data carriers of an encode
+    int32_t use_checksum;     // To add a checksum to an encode
+    int64_t offset;           // To store the first payload byte a decode extracts
+    int64_t length;           // To store the payload bytes a decode extracts, 0 for all
+    uint64_t secret_len;      // To store the secret bytes of a shared memory encode, 0 for all
+    char extn[8];             // To store the extension of an encode, "" for the default
+    char passphrase[AEAD_MAX_PASSPHRASE]; // To store the passphrase, "" for none
+} ServeRequest;
+
+/* Result of one request */
+typedef struct _ServeReply
+{
+    uint32_t magic;           // To store SERVE_MAGIC
+    uint32_t id;              // To store the id of the request
+    int32_t status;           // To store e_success or e_failure
+    int32_t version;          // To store the format version of an inspected payload
+    int32_t lsb_bits;         // To store its LSBs per image byte
+    uint32_t flags;           // To store its FORMAT_FLAG_* bits
+    int64_t size;             // To store the stego bytes, decoded bytes or stored payload size
+    int64_t capacity;         // To store the plain capacity of an inspected image
+    uint64_t queue_ns;        // To store the time from the request arriving to a worker taking it
+    uint64_t run_ns;          // To store the time the worker spent on it
+    char extn[10];            // To store the extension of a decoded or inspected payload
+} ServeReply;
+
+/* Connection slot */
+typedef struct _ServeConn
+{
+    int fd;                   // To store the connection, -1 for a free slot
+    uint64_t ready_ns;        // To store when its next request was seen
+} ServeConn;
+
+/* Server state shared by the dispatcher and the workers */
+typedef struct _ServeInfo
+{
+    const char *socket_path;  // To store the path the socket is bound to
+    int num_threads;          // To store the number of workers
+    int listen_fd;            // To store the listening socket
+    int epoll_fd;             // To store the readiness set of the socket and connections
+    int wake_fd;              // To store the eventfd serve_stop writes
+    pthread_mutex_t lock;     // To serialise the queue, the slots and counters
+    pthread_cond_t ready;     // To wake a worker for a queued connection
+    ServeConn conns[SERVE_MAX_CONNECTIONS]; // To store every connection slot
+    int queue[SERVE_MAX_CONNECTIONS]; // To store the slots with a request waiting, a ring
+    int head;                 // To store the first queued slot
+    int count;                // To store the queued slots
+    int stopping;             // To store 1 once the workers should exit
+    struct _ServeWorker *workers; // To store the worker threads
+    long served;              // To store the requests answered
+    long failed;              // To store the requests that failed
+} ServeInfo;
+
+/* Serve function prototypes */
+
+/* Bind the socket and start the workers, each with a warm library context */
+Status serve_open(ServeInfo *serveInfo);
+
+/* Dispatch requests until serve_stop, then stop the workers and close everything */
+Status serve_run(ServeInfo *serveInfo);
+
+/* Ask serve_run to return, safe from a signal handler */
+void serve_stop(ServeInfo *serveInfo);
+
+/* Serve on socket_path with num_threads workers until SIGINT/SIGTERM */
+Status do_serve(const char *socket_path, int num_threads);
+
+/* Connected client socket, -1 on failure */
+int serve_connect(const char *socket_path);
+
+/* Send a request with nfds fds and wait for its reply */
+Status serve_call(int sock, const ServeRequest *request, const int fds[], int nfds, ServeReply *reply);
+
+/* Run one -e/-d/-i command line (argv[1] on) through the server */
+Status do_client(const char *socket_path, char *argv[], const ServeRequest *options);
+
+#endif
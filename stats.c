@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "stats.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Take a snapshot of the process counters
+ * Description: wall time from CLOCK_MONOTONIC, syscall and byte counts
+ * from /proc/self/io, faults and context switches from getrusage,
+ * cache misses from the perf counter when the kernel allows one
+ * The reads of the snapshot itself come after the counts it took, cost
+ * gets them (when not NULL) so the stage they land in can leave them out
+ */
+static void take_snapshot(StatsInfo *stats, StageStats *snap, StageStats *cost)
+{
+    struct timespec ts;
+    struct rusage ru;
+    StageStats own;
+
+    memset(snap, 0, sizeof(StageStats));
+    memset(&own, 0, sizeof(StageStats));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    snap->wall_ms = ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+
+    // Read whole with read() rather than stdio, to know what it cost
+    int fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        char text[512];
+        size_t len = 0;
+        ssize_t n;
+        do
+        {
+            n = read(fd, text + len, sizeof(text) - 1 - len);
+            own.read_calls++;
+            if (n > 0)
+                len += n;
+        } while (n > 0 && len < sizeof(text) - 1);
+        close(fd);
+        text[len] = '\0';
+        own.read_bytes = len;
+
+        char key[32];
+        long long value;
+        int used = 0;
+        const char *pos = text;
+        while (sscanf(pos, "%31[^:]: %lld%n", key, &value, &used) == 2)
+        {
+            if (strcmp(key, "rchar") == 0)
+                snap->read_bytes = value;
+            else if (strcmp(key, "wchar") == 0)
+                snap->write_bytes = value;
+            else if (strcmp(key, "syscr") == 0)
+                snap->read_calls = value;
+            else if (strcmp(key, "syscw") == 0)
+                snap->write_calls = value;
+            pos += used;
+            pos += strspn(pos, "\n");
+        }
+    }
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        snap->minor_faults = ru.ru_minflt;
+        snap->major_faults = ru.ru_majflt;
+        snap->vol_ctx_switches = ru.ru_nvcsw;
+        snap->invol_ctx_switches = ru.ru_nivcsw;
+    }
+
+    snap->cache_misses = -1;
+    if (stats->perf_fd >= 0)
+    {
+        own.read_calls++;
+        if (read(stats->perf_fd, &snap->cache_misses, sizeof(long long)) == sizeof(long long))
+            own.read_bytes += sizeof(long long);
+        else
+            snap->cache_misses = -1;
+    }
+    if (snap->cache_misses >= 0)
+        snap->cache_misses += __atomic_load_n(&stats->worker_misses, __ATOMIC_ACQUIRE);
+    if (cost != NULL)
+        *cost = own;
+}
+
+/* end - start - cost of an I/O counter, 0 rather than below it */
+static long long counter_diff(long long end, long long start, long long cost)
+{
+    long long diff = end - start - cost;
+    return (diff > 0) ? diff : 0;
+}
+
+/* Cache miss counter of the calling thread only, -1 if the kernel refuses one
+ * Description: not inherited, an inherited count reaches the parent only
+ * when the child exits, so it would land in whatever stage runs then
+ */
+static int open_cache_counter(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/* Counters in end minus start, less what taking the start snapshot cost */
+static void snapshot_diff(StageStats *out, const StageStats *end, const StageStats *start, const StageStats *overhead)
+{
+    out->wall_ms = end->wall_ms - start->wall_ms;
+    out->read_bytes = counter_diff(end->read_bytes, start->read_bytes, overhead->read_bytes);
+    out->write_bytes = counter_diff(end->write_bytes, start->write_bytes, overhead->write_bytes);
+    out->read_calls = counter_diff(end->read_calls, start->read_calls, overhead->read_calls);
+    out->write_calls = counter_diff(end->write_calls, start->write_calls, overhead->write_calls);
+    out->minor_faults = end->minor_faults - start->minor_faults;
+    out->major_faults = end->major_faults - start->major_faults;
+    out->vol_ctx_switches = end->vol_ctx_switches - start->vol_ctx_switches;
+    out->invol_ctx_switches = end->invol_ctx_switches - start->invol_ctx_switches;
+    out->cache_misses = (end->cache_misses >= 0 && start->cache_misses >= 0) ? end->cache_misses - start->cache_misses : -1;
+}
+
+Status stats_init(StatsInfo *stats, const char *op)
+{
+    memset(stats, 0, sizeof(StatsInfo));
+    stats->op = op;
+    stats->perf_fd = -1;
+
+    // Workers open their own counters (stats_worker_open)
+    stats->perf_fd = open_cache_counter();
+    return e_success;
+}
+
+void stats_begin(StatsInfo *stats, const char *name)
+{
+    if (stats == NULL)
+        return;
+    stats_end(stats);
+    if (stats->num_stages == STATS_MAX_STAGES)
+        return;
+
+    stats->stages[stats->num_stages].name = name;
+    stats->stage_open = 1;
+    take_snapshot(stats, &stats->start, &stats->overhead);
+}
+
+void stats_end(StatsInfo *stats)
+{
+    if (stats == NULL || !stats->stage_open)
+        return;
+
+    StageStats end;
+    take_snapshot(stats, &end, NULL);
+    StageStats *stage = &stats->stages[stats->num_stages++];
+    snapshot_diff(stage, &end, &stats->start, &stats->overhead);
+    stats->stage_open = 0;
+}
+
+void stats_emit_json(StatsInfo *stats, FILE *fptr)
+{
+    double total_ms = 0;
+    for (int i = 0; i < stats->num_stages; i++)
+        total_ms += stats->stages[i].wall_ms;
+
+    fprintf(fptr, "{\"op\":\"%s\",\"total_ms\":%.3f,\"stages\":[", stats->op, total_ms);
+    for (int i = 0; i < stats->num_stages; i++)
+    {
+        StageStats *stage = &stats->stages[i];
+        fprintf(fptr,
+                "%s{\"name\":\"%s\",\"wall_ms\":%.3f,\"read_bytes\":%lld,\"write_bytes\":%lld,"
+                "\"read_calls\":%lld,\"write_calls\":%lld,\"minor_faults\":%ld,\"major_faults\":%ld,"
+                "\"vol_ctx_switches\":%ld,\"invol_ctx_switches\":%ld,\"cache_misses\":",
+                i ? "," : "", stage->name, stage->wall_ms, stage->read_bytes, stage->write_bytes,
+                stage->read_calls, stage->write_calls, stage->minor_faults, stage->major_faults,
+                stage->vol_ctx_switches, stage->invol_ctx_switches);
+        if (stage->cache_misses >= 0)
+            fprintf(fptr, "%lld}", stage->cache_misses);
+        else
+            fprintf(fptr, "null}");
+    }
+    fprintf(fptr, "]}\n");
+    fflush(fptr);
+}
+
+int stats_worker_open(StatsInfo *stats)
+{
+    // No counter on the calling thread means no stage reports cache misses
+    if (stats == NULL || stats->perf_fd < 0)
+        return -1;
+    return open_cache_counter();
+}
+
+void stats_worker_close(StatsInfo *stats, int perf_fd)
+{
+    long long count;
+
+    if (perf_fd < 0)
+        return;
+    if (read(perf_fd, &count, sizeof(long long)) == sizeof(long long))
+        __atomic_add_fetch(&stats->worker_misses, count, __ATOMIC_RELEASE);
+    close(perf_fd);
+}
+
+void stats_close(StatsInfo *stats)
+{
+    if (stats->perf_fd >= 0)
+        close(stats->perf_fd);
+    stats->perf_fd = -1;
+}
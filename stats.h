@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Most stages one operation can record */
+#define STATS_MAX_STAGES 24
+
+/* Counters of one stage, or a snapshot of the process counters */
+typedef struct _StageStats
+{
+    const char *name;        // stage name
+    double wall_ms;          // wall clock time
+    long long read_bytes;    // bytes read through read syscalls (rchar)
+    long long write_bytes;   // bytes written through write syscalls (wchar)
+    long long read_calls;    // read syscalls (syscr)
+    long long write_calls;   // write syscalls (syscw)
+    long minor_faults;       // page faults served without I/O
+    long major_faults;       // page faults that needed I/O
+    long vol_ctx_switches;   // voluntary context switches (blocking)
+    long invol_ctx_switches; // involuntary context switches (preemption)
+    long long cache_misses;  // hardware cache misses, -1 if unavailable
+} StageStats;
+
+/*
+ * Structure to store the per stage counters
+ * of one encode or decode operation
+ */
+typedef struct _StatsInfo
+{
+    const char *op;                       // "encode" or "decode"
+    int num_stages;                       // stages recorded so far
+    int stage_open;                       // a stage is running
+    StageStats stages[STATS_MAX_STAGES];  // recorded stages
+    StageStats start;                     // snapshot at stage start
+    StageStats overhead;                  // reads of the start snapshot itself
+    int perf_fd;                          // cache miss counter of the calling thread, -1 if none
+    long long worker_misses;              // cache misses of the workers that finished
+} StatsInfo;
+
+/* Stats function prototypes */
+
+/* Prepare stats for one operation */
+Status stats_init(StatsInfo *stats, const char *op);
+
+/* Start a stage, ending the running one; no-op on NULL stats */
+void stats_begin(StatsInfo *stats, const char *name);
+
+/* End the running stage; no-op on NULL stats */
+void stats_end(StatsInfo *stats);
+
+/* Write all stages as one JSON object line */
+void stats_emit_json(StatsInfo *stats, FILE *fptr);
+
+/*
+ * Cache misses of a --threads worker: each worker opens its own counter
+ * and adds it to worker_misses as it finishes, before the join. A stage
+ * reports the calling thread plus the workers that finished inside it
+ */
+
+/* Counter for the calling worker thread, -1 if none or stats is NULL */
+int stats_worker_open(StatsInfo *stats);
+
+/* Add the worker's count to the stats and close its counter */
+void stats_worker_close(StatsInfo *stats, int perf_fd);
+
+/* Release the counters */
+void stats_close(StatsInfo *stats);
+
+#endif
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include "steg.h"
+#include "encode.h"
+#include "decode.h"
+#include "mmap_io.h"
+#include "stream_io.h"
+#include "inspect.h"
+#include "compress.h"
+#include "scatter.h"
+#include "arena.h"
+#include "aead.h"
+#include "types.h"
+
+/* Name the messages of the shared stages give a buffer or fd image */
+#define STEG_IMAGE_NAME "<buffer>"
+
+/*
+ * Stream over memory or an fd
+ * the stages read the secret and write decoded data through stdio, a
+ * context keeps one unbuffered stream of each kind (fopencookie) and
+ * points it at the next buffer or fd, so no call opens a FILE
+ */
+typedef struct _StegStream
+{
+    unsigned char *data; // To store the buffer, NULL when on an fd
+    size_t size;         // To store the buffer size
+    size_t len;          // To store the bytes the buffer holds
+    off_t pos;           // To store the stream position in the buffer
+    int fd;              // To store the fd, -1 when on a buffer
+    int growable;        // To let writes past size grow the buffer
+    int full;            // To store 1 once a write did not fit the buffer
+} StegStream;
+
+struct _StegCtx
+{
+    EncodeInfo enc;     // To store the encoder state, reused by every encode
+    DecodeInfo dec;     // To store the decoder state, reused by every decode
+    Arena arena;        // To store the scratch buffers of one call
+    StegStream secret;  // To store where the secret data comes from
+    StegStream output;  // To store where decoded data goes
+    StegStream spool;   // To store the compressed secret data
+    FILE *fptr_secret;  // To store the stream over secret
+    FILE *fptr_output;  // To store the stream over output
+    FILE *fptr_spool;   // To store the stream over spool
+};
+
+/* Options of a call given none */
+static const StegOptions default_options;
+
+/* Function Definitions */
+
+/*Library encode steps
+1.reset the context's EncodeInfo, point its secret stream at the
+  secret buffer (or fd), its spool and arena at the context's own
+2.parse the BMP headers of the cover in memory
+3.check capacity, compress, seal and key the scatter permutation as
+  the command line does (check_layout_capacity), scratch from the arena
+4.copy the cover to the stego buffer (or reflink the fd)
+5.encode every field straight into the stego bytes (encode_into_map)
+Library decode steps
+1.reset the context's DecodeInfo, point its output stream at the
+  output buffer (or fd)
+2.decode every field from the stego bytes (decode_from_map), the
+  stages write through the output stream
+Library inspect steps
+1.point the secret stream at the stego bytes, it stands in for the
+  image file of the inspect stages
+2.decode the fields before the secret data (inspect_payload_fields)*/
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size)
+{
+    StegStream *stream = cookie;
+    if (stream->fd >= 0)
+        return read(stream->fd, buf, size);
+    size_t n = (stream->pos < stream->len) ? stream->len - stream->pos : 0;
+    if (n > size)
+        n = size;
+    memcpy(buf, stream->data + stream->pos, n);
+    stream->pos += n;
+    return n;
+}
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t size)
+{
+    StegStream *stream = cookie;
+    if (stream->fd >= 0)
+    {
+        // Pipes and sockets take it in pieces
+        size_t done = 0;
+        while (done < size)
+        {
+            ssize_t n = write(stream->fd, buf + done, size - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        // Counted for steg_ctx_output_len, an fd stream is never read back
+        stream->len += done;
+        return done;
+    }
+    if (stream->pos + size > stream->size)
+    {
+        size_t grown = (stream->size * 2 > stream->pos + size) ? stream->size * 2 : stream->pos + size;
+        unsigned char *data = stream->growable ? realloc(stream->data, grown) : NULL;
+        if (data == NULL)
+        {
+            stream->full = 1;
+            return 0;
+        }
+        stream->data = data;
+        stream->size = grown;
+    }
+    memcpy(stream->data + stream->pos, buf, size);
+    stream->pos += size;
+    if (stream->pos > stream->len)
+        stream->len = stream->pos;
+    return size;
+}
+
+static int stream_seek(void *cookie, off64_t *offset, int whence)
+{
+    StegStream *stream = cookie;
+    if (stream->fd >= 0)
+    {
+        off_t pos = lseek(stream->fd, *offset, whence);
+        if (pos < 0)
+            return -1;
+        *offset = pos;
+        return 0;
+    }
+    off_t base = (whence == SEEK_SET) ? 0 : (whence == SEEK_CUR) ? stream->pos : (off_t)stream->len;
+    if (base + *offset < 0)
+        return -1;
+    stream->pos = base + *offset;
+    *offset = stream->pos;
+    return 0;
+}
+
+/* Unbuffered stream over cookie, data moves straight between the stages and the buffer */
+static FILE *open_ctx_stream(StegStream *stream, const char *mode)
+{
+    cookie_io_functions_t io = {stream_read, stream_write, stream_seek, NULL};
+    FILE *fptr = fopencookie(stream, mode, io);
+    if (fptr != NULL)
+        setvbuf(fptr, NULL, _IONBF, 0);
+    return fptr;
+}
+
+/* Point a stream at a buffer (data may be NULL for the spool) or an fd */
+static void point_stream(FILE *fptr, StegStream *stream, const void *data, size_t size, size_t len, int fd)
+{
+    if (!stream->growable)
+    {
+        stream->data = (unsigned char *)data;
+        stream->size = size;
+    }
+    stream->len = len;
+    stream->pos = 0;
+    stream->fd = fd;
+    stream->full = 0;
+    clearerr(fptr);
+
+    // Through stdio, so it drops the offset it kept from the last call
+    if (fd < 0)
+        fseeko(fptr, 0, SEEK_SET);
+}
+
+StegCtx *steg_ctx_create(void)
+{
+    StegCtx *ctx = calloc(1, sizeof(StegCtx));
+    if (ctx == NULL)
+        return NULL;
+
+    // One block per scratch user that can be live at once
+    size_t sizes[] = {AEAD_SEGMENT_SIZE + AEAD_TAG_SIZE, sizeof(ScatterBatch), compress_scratch_size()};
+    ctx->secret.fd = ctx->output.fd = ctx->spool.fd = -1;
+    ctx->spool.growable = 1;
+    if (arena_init(&ctx->arena, arena_size_for(sizes, sizeof(sizes) / sizeof(sizes[0]))) == e_failure)
+    {
+        free(ctx);
+        return NULL;
+    }
+    ctx->fptr_secret = open_ctx_stream(&ctx->secret, "r");
+    ctx->fptr_output = open_ctx_stream(&ctx->output, "w");
+    ctx->fptr_spool = open_ctx_stream(&ctx->spool, "w+");
+    if (ctx->fptr_secret == NULL || ctx->fptr_output == NULL || ctx->fptr_spool == NULL)
+    {
+        steg_ctx_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void steg_ctx_destroy(StegCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    if (ctx->fptr_secret != NULL)
+        fclose(ctx->fptr_secret);
+    if (ctx->fptr_output != NULL)
+        fclose(ctx->fptr_output);
+    if (ctx->fptr_spool != NULL)
+        fclose(ctx->fptr_spool);
+    arena_free(&ctx->arena);
+    free(ctx->spool.data);
+    memset(ctx, 0, sizeof(StegCtx));
+    free(ctx);
+}
+
+/* Format flags asked for by opts, as read_and_validate_encode_args sets them */
+static Status options_format(const StegOptions *opts, StegFormat *format)
+{
+    uint32_t flags = 0;
+    if (opts->compress_level != 0)
+    {
+        if (opts->compress_level != COMPRESS_LEVEL_AUTO &&
+            (opts->compress_level < COMPRESS_LEVEL_MIN || opts->compress_level > COMPRESS_LEVEL_MAX))
+        {
+            printf("ERROR:Compression level must be %d to %d\n", COMPRESS_LEVEL_MIN, COMPRESS_LEVEL_MAX);
+            return e_failure;
+        }
+        flags |= FORMAT_FLAG_COMPRESSED;
+    }
+    if (opts->passphrase != NULL)
+        flags |= FORMAT_FLAG_ENCRYPTED;
+    if (opts->use_scatter)
+    {
+        if (opts->passphrase == NULL)
+        {
+            printf("ERROR:Scattering needs a passphrase\n");
+            return e_failure;
+        }
+        flags |= FORMAT_FLAG_SCATTERED;
+    }
+    if (opts->use_checksum)
+        flags |= FORMAT_FLAG_CHECKSUM;
+    return select_format(format, opts->lsb_bits ? opts->lsb_bits : 1, flags);
+}
+
+/* Layout of a BMP in memory whose whole pixel array is there */
+static Status memory_layout(const void *image, size_t len, BmpLayout *layout)
+{
+    if (parse_bmp_layout(image, len, layout) == e_failure || carrier_offset(layout, layout->capacity) > len)
+    {
+        printf("ERROR:Unsupported BMP image %s\n", STEG_IMAGE_NAME);
+        return e_failure;
+    }
+    return e_success;
+}
+
+long steg_capacity(const void *cover, size_t cover_len, const StegOptions *opts)
+{
+    StegFormat format;
+    BmpLayout layout;
+    if (opts == NULL)
+        opts = &default_options;
+    if (parse_bmp_layout(cover, cover_len, &layout) == e_failure || options_format(opts, &format) == e_failure)
+        return -1;
+    return payload_capacity(&layout, &format);
+}
+
+/* Encode the secret stream (already pointed) into stego, a copy of cover
+ * unless stego == cover */
+static Status encode_image(StegCtx *ctx, const StegOptions *opts, const unsigned char *cover, size_t cover_len,
+                           char *stego)
+{
+    EncodeInfo *encInfo = &ctx->enc;
+    if (opts == NULL)
+        opts = &default_options;
+
+    memset(encInfo, 0, sizeof(EncodeInfo));
+    encInfo->src_image_fname = STEG_IMAGE_NAME;
+    encInfo->stego_image_fname = STEG_IMAGE_NAME;
+    encInfo->secret_fname = STEG_IMAGE_NAME;
+    encInfo->fptr_secret = ctx->fptr_secret;
+    encInfo->fptr_spool = ctx->fptr_spool;
+    encInfo->arena = &ctx->arena;
+    encInfo->quiet = 1;
+    encInfo->compress_level = opts->compress_level;
+    encInfo->passphrase = opts->passphrase;
+    encInfo->use_scatter = opts->use_scatter;
+    encInfo->use_checksum = opts->use_checksum;
+
+    const char *extn = (opts->extn != NULL) ? opts->extn : STREAM_DEFAULT_EXTN;
+    if (strlen(extn) >= sizeof(encInfo->extn_secret_file))
+    {
+        printf("ERROR:Extension %s is longer than %zu bytes\n", extn, sizeof(encInfo->extn_secret_file) - 1);
+        return e_failure;
+    }
+    strcpy(encInfo->extn_secret_file, extn);
+    if (options_format(opts, &encInfo->format) == e_failure || memory_layout(cover, cover_len, &encInfo->layout) == e_failure)
+        return e_failure;
+
+    arena_reset(&ctx->arena);
+    point_stream(ctx->fptr_spool, &ctx->spool, NULL, 0, 0, -1);
+    if (check_layout_capacity(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to check capacity\n");
+        memset(&encInfo->aead, 0, sizeof(AeadInfo));
+        return e_failure;
+    }
+
+    if (stego != (const char *)cover)
+        memcpy(stego, cover, cover_len);
+    Status ret = encode_into_map(encInfo, stego);
+    if (ret == e_failure)
+        printf("ERROR:Unable to encode secret file data\n");
+    memset(&encInfo->aead, 0, sizeof(AeadInfo));
+    memset(&encInfo->scatter, 0, sizeof(ScatterInfo));
+    return ret;
+}
+
+Status steg_encode_buffer(StegCtx *ctx, const StegOptions *opts, const void *cover, size_t cover_len, const void *secret,
+                          size_t secret_len, void *stego)
+{
+    point_stream(ctx->fptr_secret, &ctx->secret, secret, secret_len, secret_len, -1);
+    return encode_image(ctx, opts, cover, cover_len, stego);
+}
+
+Status steg_encode_fd(StegCtx *ctx, const StegOptions *opts, int fd_cover, int fd_secret, int fd_stego)
+{
+    struct stat st;
+    int in_place = (fd_cover == fd_stego);
+    if (fstat(fd_cover, &st) != 0 || st.st_size <= 0)
+    {
+        printf("ERROR:Unable to read cover image\n");
+        return e_failure;
+    }
+    size_t len = st.st_size;
+
+    // Reflink when the filesystem shares extents, then encode the clone in place like --mmap
+    int cloned = 0;
+#ifdef FICLONE
+    if (!in_place && ioctl(fd_stego, FICLONE, fd_cover) == 0)
+        cloned = 1;
+#endif
+    char *cover = NULL;
+    if (!in_place && !cloned)
+    {
+        if (ftruncate(fd_stego, len) != 0)
+        {
+            perror("ftruncate");
+            return e_failure;
+        }
+        cover = mmap(NULL, len, PROT_READ, MAP_SHARED, fd_cover, 0);
+        if (cover == MAP_FAILED)
+        {
+            perror("mmap");
+            return e_failure;
+        }
+        madvise(cover, len, MADV_SEQUENTIAL);
+    }
+    // Always the stego fd, the cover fd is written only when it is the stego one
+    char *stego = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd_stego, 0);
+    if (stego == MAP_FAILED)
+    {
+        perror("mmap");
+        if (cover != NULL)
+            munmap(cover, len);
+        return e_failure;
+    }
+
+    point_stream(ctx->fptr_secret, &ctx->secret, NULL, 0, 0, fd_secret);
+    Status ret = encode_image(ctx, opts, (cover != NULL) ? (unsigned char *)cover : (unsigned char *)stego, len, stego);
+    if (munmap(stego, len) != 0)
+        ret = e_failure;
+    if (cover != NULL)
+        munmap(cover, len);
+    return ret;
+}
+
+/* Decode stego into the output stream (already pointed) */
+static Status decode_image(StegCtx *ctx, const StegOptions *opts, const unsigned char *stego, size_t stego_len)
+{
+    DecodeInfo *decInfo = &ctx->dec;
+    if (opts == NULL)
+        opts = &default_options;
+
+    memset(decInfo, 0, sizeof(DecodeInfo));
+    decInfo->stego_image_fname = STEG_IMAGE_NAME;
+    decInfo->output_fname = STEG_IMAGE_NAME;
+    decInfo->fptr_output = ctx->fptr_output;
+    decInfo->keep_output = 1;
+    decInfo->arena = &ctx->arena;
+    decInfo->passphrase = opts->passphrase;
+    decInfo->payload_offset = opts->offset;
+    decInfo->payload_length = (opts->length > 0) ? opts->length : -1;
+
+    arena_reset(&ctx->arena);
+    Status ret = decode_from_map(decInfo, stego, stego_len);
+    if (ctx->output.full)
+    {
+        printf("ERROR:Output buffer of %zu bytes is too small\n", ctx->output.size);
+        ret = e_failure;
+    }
+    else if (ret == e_failure)
+    {
+        printf("ERROR:Unable to decode secret file data\n");
+    }
+    return ret;
+}
+
+Status steg_decode_buffer(StegCtx *ctx, const StegOptions *opts, const void *stego, size_t stego_len, void *out,
+                          size_t out_size, size_t *out_len)
+{
+    point_stream(ctx->fptr_output, &ctx->output, out, out_size, 0, -1);
+    Status ret = decode_image(ctx, opts, stego, stego_len);
+    *out_len = ctx->output.len;
+    return ret;
+}
+
+Status steg_decode_fd(StegCtx *ctx, const StegOptions *opts, int fd_stego, int fd_output)
+{
+    struct stat st;
+    if (fstat(fd_stego, &st) != 0 || st.st_size <= 0)
+    {
+        printf("ERROR:Unable to read stego image\n");
+        return e_failure;
+    }
+    size_t len = st.st_size;
+    unsigned char *stego = mmap(NULL, len, PROT_READ, MAP_SHARED, fd_stego, 0);
+    if (stego == MAP_FAILED)
+    {
+        perror("mmap");
+        return e_failure;
+    }
+    madvise(stego, len, MADV_SEQUENTIAL);
+
+    point_stream(ctx->fptr_output, &ctx->output, NULL, 0, 0, fd_output);
+    Status ret = decode_image(ctx, opts, stego, len);
+    munmap(stego, len);
+    return ret;
+}
+
+Status steg_inspect_buffer(StegCtx *ctx, const void *stego, size_t stego_len, StegPayloadInfo *info)
+{
+    DecodeInfo *decInfo = &ctx->dec;
+
+    memset(decInfo, 0, sizeof(DecodeInfo));
+    decInfo->stego_image_fname = STEG_IMAGE_NAME;
+    if (memory_layout(stego, stego_len, &decInfo->layout) == e_failure)
+        return e_failure;
+    point_stream(ctx->fptr_secret, &ctx->secret, stego, stego_len, stego_len, -1);
+    decInfo->fptr_stego_image = ctx->fptr_secret;
+    Status ret = inspect_payload_fields(decInfo);
+    decInfo->fptr_stego_image = NULL;
+    if (ret == e_failure)
+        return e_failure;
+
+    info->version = decInfo->format.version;
+    info->lsb_bits = decInfo->format.lsb_bits;
+    info->flags = decInfo->format.flags;
+    info->size = decInfo->size_secret_file;
+    strcpy(info->extn, decInfo->extn_secret_file);
+    return e_success;
+}
+
+size_t steg_ctx_output_len(const StegCtx *ctx)
+{
+    return ctx->output.len;
+}
+
+const char *steg_ctx_extn(const StegCtx *ctx)
+{
+    return ctx->dec.extn_secret_file;
+}
@@ -0,0 +1,85 @@
+#ifndef STEG_H
+#define STEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Library interface
+ * a context holds everything an encode or decode needs besides the
+ * images and the payload: the EncodeInfo/DecodeInfo it reuses, a scratch
+ * arena sized for the sealed segment, the scatter batch and the
+ * (de)compressor, and the streams the shared stages read the secret from
+ * and write decoded data to. Once created, a context encodes and decodes
+ * buffers (or open fds) with no malloc and no file opens; only a
+ * compressed payload bigger than any before grows the compression spool.
+ * Images go through the memory mapped encoder/decoder, so the stego bytes
+ * are the ones the command line writes with --mmap.
+ * A context is not thread safe, give every thread its own. Errors are
+ * reported on stdout like the command line ones
+ */
+typedef struct _StegCtx StegCtx;
+
+/* Options of one encode or decode, all zero for the defaults */
+typedef struct _StegOptions
+{
+    int lsb_bits;           // LSBs per image byte, 0 for 1
+    int compress_level;     // compression level or COMPRESS_LEVEL_AUTO, 0 for none
+    const char *passphrase; // passphrase of an encrypted payload, NULL for none
+    int use_scatter;        // permute the data carriers with the passphrase
+    int use_checksum;       // add a CRC32C of the data after it
+    const char *extn;       // extension stored with the payload, NULL for STREAM_DEFAULT_EXTN
+    long offset;            // first payload byte a decode extracts
+    long length;            // payload bytes a decode extracts, 0 for all
+} StegOptions;
+
+/* Header fields of the payload of a stego image */
+typedef struct _StegPayloadInfo
+{
+    int version;            // embedded format version
+    int lsb_bits;           // LSBs per image byte
+    uint32_t flags;         // FORMAT_FLAG_* bits of the payload
+    long size;              // stored bytes, compressed and/or sealed ones included
+    char extn[10];          // extension stored with the payload
+} StegPayloadInfo;
+
+/* Library function prototypes */
+
+/* New context with its arena and streams, NULL if out of memory */
+StegCtx *steg_ctx_create(void);
+
+/* Release a context and everything it owns */
+void steg_ctx_destroy(StegCtx *ctx);
+
+/* Payload bytes a BMP of cover_len bytes holds with opts, -1 if it is not a supported BMP */
+long steg_capacity(const void *cover, size_t cover_len, const StegOptions *opts);
+
+/* Encode secret_len bytes of secret into a copy of the BMP cover, written
+ * to stego (cover_len bytes, stego == cover encodes in place) */
+Status steg_encode_buffer(StegCtx *ctx, const StegOptions *opts, const void *cover, size_t cover_len, const void *secret,
+                          size_t secret_len, void *stego);
+
+/* Decode the payload (or the opts->offset/length part of it) of a stego
+ * BMP into out, *out_len gets the bytes written, e_failure when they do
+ * not fit out_size */
+Status steg_decode_buffer(StegCtx *ctx, const StegOptions *opts, const void *stego, size_t stego_len, void *out,
+                          size_t out_size, size_t *out_len);
+
+/* Encode all of the seekable fd_secret into the BMP on fd_cover, written
+ * to fd_stego (fd_stego == fd_cover encodes in place) */
+Status steg_encode_fd(StegCtx *ctx, const StegOptions *opts, int fd_cover, int fd_secret, int fd_stego);
+
+/* Decode the payload of the stego BMP on fd_stego to fd_output (a file, pipe or socket) */
+Status steg_decode_fd(StegCtx *ctx, const StegOptions *opts, int fd_stego, int fd_output);
+
+/* Header fields of the payload of a stego BMP, e_failure if it carries none */
+Status steg_inspect_buffer(StegCtx *ctx, const void *stego, size_t stego_len, StegPayloadInfo *info);
+
+/* Bytes the last decode by ctx wrote, to its buffer or fd */
+size_t steg_ctx_output_len(const StegCtx *ctx);
+
+/* Extension stored with the last payload decoded by ctx */
+const char *steg_ctx_extn(const StegCtx *ctx);
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include "steg_format.h"
+#include "lsb_kernels.h"
+#include "fec.h"
+#include "types.h"
+
+/* Function Definitions */
+
+Status validate_lsb_bits(int lsb_bits)
+{
+    // Only divisors of 8, so every payload byte fills whole image bytes
+    if (lsb_bits == 1 || lsb_bits == 2 || lsb_bits == 4)
+        return e_success;
+    return e_failure;
+}
+
+Status select_format(StegFormat *format, int lsb_bits, uint32_t flags)
+{
+    if (validate_lsb_bits(lsb_bits) == e_failure || (flags & ~FORMAT_KNOWN_FLAGS) != 0)
+        return e_failure;
+
+    format->version = (lsb_bits == 1 && flags == 0) ? 1 : FORMAT_VERSION;
+    format->lsb_bits = lsb_bits;
+    format->flags = flags;
+    return e_success;
+}
+
+uint32_t format_word(const StegFormat *format)
+{
+    return ((uint32_t)FORMAT_SIGNATURE << 16) | (format->version << 8) | format->lsb_bits;
+}
+
+Status parse_format_word(uint32_t word, StegFormat *format)
+{
+    if ((word >> 16) != FORMAT_SIGNATURE)
+        return e_failure;
+
+    format->version = (word >> 8) & 0xFF;
+    format->lsb_bits = word & 0xFF;
+    format->flags = 0;
+    return e_success;
+}
+
+size_t format_words_size(const StegFormat *format)
+{
+    return (format->version >= 2) ? FORMAT_WORDS_SIZE : 0;
+}
+
+Status select_size_field(StegFormat *format, long size)
+{
+    if (size <= FORMAT_SIZE32_MAX)
+        return e_success;
+    return select_format(format, format->lsb_bits, format->flags | FORMAT_FLAG_SIZE64);
+}
+
+size_t format_size_field_size(const StegFormat *format)
+{
+    size_t size = (format->flags & FORMAT_FLAG_SIZE64) ? 8 : 4;
+    return (format->flags & FORMAT_FLAG_FEC) ? size + FEC_SIZE_PARITY : size;
+}
+
+size_t format_checksum_size(const StegFormat *format)
+{
+    return (format->flags & FORMAT_FLAG_CHECKSUM) ? FORMAT_CHECKSUM_SIZE : 0;
+}
+
+size_t image_bytes_for(size_t n, const StegFormat *format)
+{
+    return n * 8 / format->lsb_bits;
+}
+
+void encode_uint32_to_nlsb(uint32_t value, char *image_buffer, int bits)
+{
+    char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    encode_bytes_to_nlsb(bytes, 4, image_buffer, bits);
+}
+
+uint32_t decode_uint32_from_nlsb(const unsigned char *image_buffer, int bits)
+{
+    unsigned char bytes[4];
+    decode_bytes_from_nlsb((char *)bytes, 4, image_buffer, bits);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+void encode_size_field(uint64_t size, char *image_buffer, const StegFormat *format)
+{
+    unsigned char bytes[FORMAT_SIZE_FIELD_MAX];
+    size_t n = (format->flags & FORMAT_FLAG_SIZE64) ? 8 : 4;
+    for (size_t i = 0; i < n; i++)
+        bytes[i] = size >> (8 * i);
+    // A damaged size would send the decoder off into the wrong carriers, it gets its own parity
+    if (format->flags & FORMAT_FLAG_FEC)
+        fec_encode_block(bytes, n, bytes + n, FEC_SIZE_PARITY);
+    encode_bytes_to_nlsb((char *)bytes, format_size_field_size(format), image_buffer, format->lsb_bits);
+}
+
+uint64_t decode_size_field(const unsigned char *image_buffer, const StegFormat *format)
+{
+    unsigned char bytes[FORMAT_SIZE_FIELD_MAX];
+    size_t n = (format->flags & FORMAT_FLAG_SIZE64) ? 8 : 4;
+    decode_bytes_from_nlsb((char *)bytes, format_size_field_size(format), image_buffer, format->lsb_bits);
+    if ((format->flags & FORMAT_FLAG_FEC) && fec_correct_block(bytes, n + FEC_SIZE_PARITY, FEC_SIZE_PARITY) == e_failure)
+        return UINT64_MAX;
+
+    uint64_t size = 0;
+    for (size_t i = 0; i < n; i++)
+        size |= (uint64_t)bytes[i] << (8 * i);
+    return size;
+}
@@ -0,0 +1,119 @@
+#ifndef STEG_FORMAT_H
+#define STEG_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include "types.h"
+
+/* Upper 16 bits of the format word ("SG"), an extension size never has them */
+#define FORMAT_SIGNATURE 0x5347
+
+/* Newest embedded layout written by the encoder */
+#define FORMAT_VERSION 2
+
+/* Image bytes taken by the format and flags words (32 bits each, 1 LSB) */
+#define FORMAT_WORDS_SIZE 64
+
+/* Flags word bits */
+#define FORMAT_FLAG_COMPRESSED 0x1u // data is a compressed payload, see compress.h
+#define FORMAT_FLAG_ENCRYPTED 0x2u  // data is a sealed payload, see aead.h
+#define FORMAT_FLAG_SCATTERED 0x4u  // data carriers are permuted, see scatter.h
+#define FORMAT_FLAG_CHECKSUM 0x8u   // a CRC32C of the data follows it, see crc32c.h
+#define FORMAT_FLAG_CONTAINER 0x10u // data is an index and several named files, see container.h
+#define FORMAT_FLAG_SIZE64 0x20u    // file size is a 64 bit field
+#define FORMAT_FLAG_FEC 0x40u       // data is Reed-Solomon coded, see fec.h
+
+/* Data bytes of the checksum after the data */
+#define FORMAT_CHECKSUM_SIZE 4
+
+/* Flags this decoder understands */
+#define FORMAT_KNOWN_FLAGS (FORMAT_FLAG_COMPRESSED | FORMAT_FLAG_ENCRYPTED | FORMAT_FLAG_SCATTERED | \
+                            FORMAT_FLAG_CHECKSUM | FORMAT_FLAG_CONTAINER | FORMAT_FLAG_SIZE64 | FORMAT_FLAG_FEC)
+
+/* Most data bytes of the file size field, a 64 bit size and its FEC parity */
+#define FORMAT_SIZE_FIELD_MAX 16
+
+/* Largest file size of the 32 bit field, older decoders read it signed */
+#define FORMAT_SIZE32_MAX 0x7FFFFFFFL
+
+/* Largest file size a decoder takes, image_bytes_for() stays in range */
+#define FORMAT_SIZE_MAX (LONG_MAX / 8)
+
+/*
+ * Embedded layout
+ * version 1: magic | extn size | extn | file size | data, 1 LSB per byte
+ * version 2: magic | format word | flags word | extn size | extn |
+ *            file size | data | checksum (with FORMAT_FLAG_CHECKSUM)
+ *   magic and the two words always use 1 LSB per byte so a decoder can
+ *   find them, everything after uses lsb_bits LSBs per byte
+ *   format word = FORMAT_SIGNATURE << 16 | version << 8 | lsb_bits
+ *   with FORMAT_FLAG_COMPRESSED, file size counts the compressed bytes
+ *   with FORMAT_FLAG_ENCRYPTED, the (compressed) data is sealed and file
+ *   size counts the sealed bytes
+ *   with FORMAT_FLAG_SCATTERED, the carriers after the file size are cut
+ *   into one cell per data byte and data bytes follow a keyed permutation
+ *   of the cells instead of coming in order
+ *   with FORMAT_FLAG_CHECKSUM, the data is followed by the CRC32C of the
+ *   stored (compressed and/or sealed) data bytes, 4 more data bytes
+ *   least significant first that file size does not count
+ *   with FORMAT_FLAG_CONTAINER, the data before compression and sealing
+ *   is a container: an index of named entries, then their bytes
+ *   with FORMAT_FLAG_SIZE64, file size is 64 bits (low 32 bits first), the
+ *   encoder sets it only for sizes past FORMAT_SIZE32_MAX
+ *   with FORMAT_FLAG_FEC, the stored (compressed and/or sealed) data is
+ *   Reed-Solomon coded in interleaved frames and file size counts the
+ *   coded bytes; the file size field is followed by FEC_SIZE_PARITY
+ *   parity bytes of its own. The checksum is of the coded bytes
+ */
+typedef struct _StegFormat
+{
+    int version;    // layout version, see above
+    int lsb_bits;   // LSBs per image byte after the format words
+    uint32_t flags; // FORMAT_FLAG_* bits of the flags word
+} StegFormat;
+
+/* Format function prototypes */
+
+/* Check a requested number of LSBs per image byte (1, 2 or 4) */
+Status validate_lsb_bits(int lsb_bits);
+
+/* Pick the layout, version 1 whenever nothing needs the format words */
+Status select_format(StegFormat *format, int lsb_bits, uint32_t flags);
+
+/* Build the format word of a version 2 layout */
+uint32_t format_word(const StegFormat *format);
+
+/* Parse the word after the magic string, e_failure if it is not a format word */
+Status parse_format_word(uint32_t word, StegFormat *format);
+
+/* Image bytes taken by the format and flags words, 0 for version 1 */
+size_t format_words_size(const StegFormat *format);
+
+/* Set FORMAT_FLAG_SIZE64 if a file size of size bytes needs it */
+Status select_size_field(StegFormat *format, long size);
+
+/* Data bytes of the file size field, 8 with FORMAT_FLAG_SIZE64, else 4,
+ * plus FEC_SIZE_PARITY with FORMAT_FLAG_FEC */
+size_t format_size_field_size(const StegFormat *format);
+
+/* Data bytes after the data, FORMAT_CHECKSUM_SIZE with a checksum, else 0 */
+size_t format_checksum_size(const StegFormat *format);
+
+/* Image bytes that carry n payload bytes */
+size_t image_bytes_for(size_t n, const StegFormat *format);
+
+/* Encode a 32 bit field into 32 / bits image bytes, least significant bits first */
+void encode_uint32_to_nlsb(uint32_t value, char *image_buffer, int bits);
+
+/* Decode a 32 bit field from 32 / bits image bytes */
+uint32_t decode_uint32_from_nlsb(const unsigned char *image_buffer, int bits);
+
+/* Encode the file size field into image_bytes_for(format_size_field_size()) image bytes */
+void encode_size_field(uint64_t size, char *image_buffer, const StegFormat *format);
+
+/* Decode the file size field, repaired with FORMAT_FLAG_FEC, UINT64_MAX
+ * if it is damaged past repair */
+uint64_t decode_size_field(const unsigned char *image_buffer, const StegFormat *format);
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "stream_io.h"
+#include "encode.h"
+#include "decode.h"
+#include "block_io.h"
+#include "bmp_layout.h"
+#include "compress.h"
+#include "png_io.h"
+#include "types.h"
+
+/* Where data written to "-" goes once messages are moved to stderr */
+static int stdout_fd = STDOUT_FILENO;
+
+/* Function Definitions */
+
+/*Stream encoding steps
+1.open the files, "-" is stdin (source image or secret) or stdout
+  (stego image), anything else is a named file (/dev/fd/N works)
+  sources that cannot seek are read unbuffered, so stdio never reads
+  ahead of the pixel the encoder is at
+2.read the BMP headers up to the pixel array, the layout comes from
+  them and they go straight to the stego image
+  a PNG reads as a BMP (see png_io.h), its stego image is a PNG
+3.secret files that cannot seek are read into memory, their size has
+  to be in the image before their data
+4.check capacity and encode magic string, format words, extn size,
+  extn, file size and data, one forward pass over the carriers
+5.splice the rest of the image from source to stego image
+6.close all files*/
+
+int is_stream_name(const char *fname)
+{
+    return fname != NULL && strcmp(fname, STREAM_NAME) == 0;
+}
+
+/* Divert stdout
+ * Description: the payload or stego image may be going to stdout, so
+ * stdout is kept on a spare fd for open_stream and fd 1 (and with it
+ * every INFO/ERROR printf) is pointed at stderr
+ */
+Status divert_stdout_messages(void)
+{
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+        perror("dup");
+        return e_failure;
+    }
+    stdout_fd = fd;
+    return e_success;
+}
+
+/* Open a named file, or stdin/stdout for "-" */
+FILE *open_stream(const char *fname, const char *mode)
+{
+    if (!is_stream_name(fname))
+        return fopen(fname, mode);
+    if (mode[0] == 'r')
+        return stdin;
+
+    int fd = dup(stdout_fd);
+    return (fd < 0) ? NULL : fdopen(fd, mode);
+}
+
+/* Check if a stream's file can seek (regular files can, pipes and sockets cannot) */
+static int can_seek(FILE *fptr)
+{
+    return lseek(fileno(fptr), 0, SEEK_CUR) >= 0;
+}
+
+/* Buffering for an image read in one pass: block buffered if it can seek,
+ * else unbuffered so the tail can be spliced straight from the fd */
+static Status setup_stream_input(FILE *fptr, char **io_buffer, size_t block_size)
+{
+    if (can_seek(fptr))
+        return setup_block_io(fptr, io_buffer, block_size);
+    return (setvbuf(fptr, NULL, _IONBF, 0) == 0) ? e_success : e_failure;
+}
+
+/* Read the BMP headers
+ * Input: image stream at offset 0, place for the header bytes
+ * Description: reads exactly up to the pixel array (bfOffBits), never
+ * seeks, and parses the layout from the bytes read. A PNG (stdin has no
+ * name to tell) is found by its signature, *fptr is then swapped for a
+ * PNG reader over it, NULL if that fails
+ */
+static Status read_stream_header(FILE **fptr_image, const char *fname, unsigned char **header, BmpLayout *layout)
+{
+    unsigned char file_header[BMP_FILE_HEADER_SIZE];
+    FILE *fptr = *fptr_image;
+
+    if (read_image_block(fptr, file_header, BMP_FILE_HEADER_SIZE) == e_failure)
+        return e_failure;
+    if (memcmp(file_header, PNG_SIGNATURE, PNG_SIGNATURE_SIZE) == 0)
+    {
+        fptr = *fptr_image = open_png_stream_after(fptr, file_header, BMP_FILE_HEADER_SIZE, fname);
+        if (fptr == NULL || read_image_block(fptr, file_header, BMP_FILE_HEADER_SIZE) == e_failure)
+            return e_failure;
+    }
+
+    size_t size = file_header[10] | (file_header[11] << 8) | (file_header[12] << 16) | ((size_t)file_header[13] << 24);
+    if (size < BMP_FILE_HEADER_SIZE || size > STREAM_MAX_HEADER_SIZE)
+        return e_failure;
+
+    *header = malloc(size);
+    if (*header == NULL)
+    {
+        perror("malloc");
+        return e_failure;
+    }
+    memcpy(*header, file_header, BMP_FILE_HEADER_SIZE);
+    if (read_image_block(fptr, *header + BMP_FILE_HEADER_SIZE, size - BMP_FILE_HEADER_SIZE) == e_failure)
+        return e_failure;
+    return parse_bmp_layout(*header, size, layout);
+}
+
+/* Open the secret file
+ * Description: the size of the secret data is encoded before the data,
+ * so a secret that cannot seek is read into spool first (no more than
+ * the image can hold) and encoded from a memory stream over it
+ */
+static Status open_stream_secret(EncodeInfo *encInfo, char **spool)
+{
+    FILE *fptr = open_stream(encInfo->secret_fname, "rb");
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+        return e_failure;
+    }
+
+    struct stat st;
+    if (fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        encInfo->fptr_secret = fptr;
+        return e_success;
+    }
+
+    // Compressed payloads may be bigger than the image, up to the best ratio
+    size_t limit = (size_t)encInfo->layout.capacity * encInfo->format.lsb_bits / 8;
+    if (encInfo->format.flags & FORMAT_FLAG_COMPRESSED)
+        limit *= COMPRESS_MAX_RATIO;
+    size_t size = 0, allocated = 0, n;
+    do
+    {
+        if (size == allocated)
+        {
+            allocated = allocated ? allocated * 2 : SECRET_CHUNK_SIZE;
+            char *grown = realloc(*spool, allocated);
+            if (grown == NULL)
+            {
+                perror("realloc");
+                return e_failure;
+            }
+            *spool = grown;
+        }
+        n = fread(*spool + size, 1, allocated - size, fptr);
+        size += n;
+    } while (n > 0 && size <= limit);
+
+    if (ferror(fptr) || size > limit)
+    {
+        printf("ERROR:Secret data is larger than the image can hold\n");
+        if (fptr != stdin)
+            fclose(fptr);
+        return e_failure;
+    }
+    if (fptr != stdin)
+        fclose(fptr);
+
+    // fmemopen refuses an empty buffer, /dev/null reads as an empty file
+    encInfo->fptr_secret = (size > 0) ? fmemopen(*spool, size, "rb") : fopen("/dev/null", "rb");
+    if (encInfo->fptr_secret == NULL)
+    {
+        perror("fmemopen");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Run the encoding stages over the open streams */
+static Status encode_stream_stages(EncodeInfo *encInfo, unsigned char **header, char **spool)
+{
+    stats_begin(encInfo->stats, "read_stream_header");
+    FILE *fptr_src = encInfo->fptr_src_image;
+    if (read_stream_header(&encInfo->fptr_src_image, encInfo->src_image_fname, header, &encInfo->layout) == e_failure)
+    {
+        printf("ERROR:Unsupported BMP image %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    // A PNG cover found on a stream gives a PNG stego image too, nothing is written yet
+    if (encInfo->fptr_src_image != fptr_src && !is_png_name(encInfo->stego_image_fname))
+    {
+        if (!is_stream_name(encInfo->stego_image_fname))
+        {
+            printf("ERROR:A PNG cover gives a PNG stego image, not %s\n", encInfo->stego_image_fname);
+            return e_failure;
+        }
+        fclose(encInfo->fptr_stego_image);
+        encInfo->fptr_stego_image = open_png_stream(encInfo->stego_image_fname, "wb");
+        if (encInfo->fptr_stego_image == NULL ||
+            setup_block_io(encInfo->fptr_stego_image, &encInfo->stego_io_buffer, encInfo->io_block_size) == e_failure)
+        {
+            printf("ERROR:Unable to open a PNG stego image\n");
+            return e_failure;
+        }
+    }
+
+    stats_begin(encInfo->stats, "open_stream_secret");
+    if (open_stream_secret(encInfo, spool) == e_failure)
+        return e_failure;
+
+    stats_begin(encInfo->stats, "check_capacity");
+    if (check_layout_capacity(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to check capacity\n");
+        return e_failure;
+    }
+
+    stats_begin(encInfo->stats, "copy_bmp_header");
+    if (write_image_block(encInfo->fptr_stego_image, *header, encInfo->layout.data_offset) == e_failure)
+    {
+        printf("ERROR:Unable to copy BMP header\n");
+        return e_failure;
+    }
+
+    if (encode_embedded_fields(encInfo) == e_failure)
+        return e_failure;
+
+    stats_begin(encInfo->stats, "encode_secret_file_data");
+    if (encode_secret_file_data(encInfo) == e_failure)
+    {
+        printf("ERROR:Unable to encode secret file data\n");
+        return e_failure;
+    }
+
+    stats_begin(encInfo->stats, "copy_remaining_img_data");
+    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->io_block_size) == e_failure)
+    {
+        printf("ERROR:Unable to copy remaining image data\n");
+        return e_failure;
+    }
+
+    if (fflush(encInfo->fptr_stego_image) != 0)
+    {
+        printf("ERROR:Unable to write stego image\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Stream encoding driver */
+Status do_encoding_stream(EncodeInfo *encInfo)
+{
+    unsigned char *header = NULL;
+    char *spool = NULL;
+
+    // One forward pass over the carriers cannot place scattered data
+    if (encInfo->format.flags & FORMAT_FLAG_SCATTERED)
+    {
+        printf("ERROR:--scatter needs BMP images as files, not streams or PNGs\n");
+        return e_failure;
+    }
+    int png = is_png_name(encInfo->src_image_fname);
+    if (png && !is_png_name(encInfo->stego_image_fname) && !is_stream_name(encInfo->stego_image_fname))
+    {
+        printf("ERROR:A PNG cover gives a PNG stego image, not %s\n", encInfo->stego_image_fname);
+        return e_failure;
+    }
+
+    stats_begin(encInfo->stats, "open_files");
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->fptr_src_image = open_image_stream(encInfo->src_image_fname, "rb");
+    if (encInfo->fptr_src_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    encInfo->fptr_stego_image = png ? open_png_stream(encInfo->stego_image_fname, "wb")
+                                    : open_image_stream(encInfo->stego_image_fname, "wb");
+    if (encInfo->fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
+        close_files(encInfo);
+        return e_failure;
+    }
+    if (setup_stream_input(encInfo->fptr_src_image, &encInfo->src_io_buffer, encInfo->io_block_size) == e_failure ||
+        setup_block_io(encInfo->fptr_stego_image, &encInfo->stego_io_buffer, encInfo->io_block_size) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to set up block I/O\n");
+        close_files(encInfo);
+        return e_failure;
+    }
+
+    Status ret = encode_stream_stages(encInfo, &header, &spool);
+
+    stats_begin(encInfo->stats, "close_files");
+    close_files(encInfo);
+    free(spool);
+    free(header);
+    stats_end(encInfo->stats);
+    return ret;
+}
+
+/*Stream decoding steps
+1.open the stego image ("-" is stdin, a PNG reads as a BMP) and the
+  output ("-" is stdout), unless the caller keeps its own
+2.read the BMP headers up to the pixel array
+3.decode magic string, format words, extn size, extn, file size
+4.decode the requested part of the data, bytes before it are read
+  and dropped rather than seeked over
+5.read a pipe to its end so the writer does not get SIGPIPE
+6.close all files*/
+
+/* Read whatever is left on a pipe */
+static void drain_stream(FILE *fptr)
+{
+    struct stat st;
+    char buffer[4096];
+    // NULL when a PNG reader could not be set up over it, that closed it
+    if (fptr == NULL || fstat(fileno(fptr), &st) != 0 || !S_ISFIFO(st.st_mode))
+        return;
+    while (fread(buffer, 1, sizeof(buffer), fptr) > 0)
+        ;
+}
+
+/* Stream decoding driver */
+Status do_decoding_stream(DecodeInfo *decInfo)
+{
+    unsigned char *header = NULL;
+    Status ret = e_failure;
+
+    stats_begin(decInfo->stats, "open_decode_files");
+    if (!decInfo->keep_output)
+        decInfo->fptr_output = NULL;
+    decInfo->fptr_stego_image = open_image_stream(decInfo->stego_image_fname, "rb");
+    if (decInfo->fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        return e_failure;
+    }
+    if (decInfo->verify_only)
+        decInfo->fptr_output = NULL;
+    else if (!decInfo->keep_output)
+        decInfo->fptr_output = open_stream(decInfo->output_fname, "wb");
+    if (decInfo->fptr_output == NULL && !decInfo->verify_only)
+    {
+        perror("fopen");
+        close_decode_files(decInfo);
+        return e_failure;
+    }
+    if (!can_seek(decInfo->fptr_stego_image))
+        setvbuf(decInfo->fptr_stego_image, NULL, _IONBF, 0);
+
+    stats_begin(decInfo->stats, "read_stream_header");
+    if (read_stream_header(&decInfo->fptr_stego_image, decInfo->stego_image_fname, &header, &decInfo->layout) ==
+        e_failure)
+    {
+        printf("ERROR:Unsupported BMP image %s\n", decInfo->stego_image_fname);
+    }
+    else if (decode_embedded_fields(decInfo) == e_success)
+    {
+        stats_begin(decInfo->stats, "decode_secret_file_data");
+        if (decode_secret_file_data(decInfo) == e_failure ||
+            (decInfo->fptr_output != NULL && fflush(decInfo->fptr_output) != 0))
+        {
+            printf("ERROR:Unable to decode secret file data\n");
+        }
+        else
+        {
+            print_decode_result(decInfo);
+            ret = e_success;
+        }
+    }
+
+    stats_begin(decInfo->stats, "close_decode_files");
+    drain_stream(decInfo->fptr_stego_image);
+    close_decode_files(decInfo);
+    free(header);
+    stats_end(decInfo->stats);
+    return ret;
+}
@@ -0,0 +1,35 @@
+#ifndef STREAM_IO_H
+#define STREAM_IO_H
+
+#include <stdio.h>
+#include "types.h"
+#include "encode.h"
+#include "decode.h"
+
+/* File name that stands for stdin (inputs) or stdout (outputs) */
+#define STREAM_NAME "-"
+
+/* Extension stored for a payload whose name has none (pipes, /dev/fd/N) */
+#define STREAM_DEFAULT_EXTN ".bin"
+
+/* Largest BMP header (everything before the pixel array) read from a stream */
+#define STREAM_MAX_HEADER_SIZE (16 * 1024 * 1024)
+
+/* Stream function prototypes */
+
+/* Check if a file name is STREAM_NAME */
+int is_stream_name(const char *fname);
+
+/* Open a named file, or stdin (read) / the data stdout (write) for "-" */
+FILE *open_stream(const char *fname, const char *mode);
+
+/* Keep stdout for data: messages printed from now on go to stderr */
+Status divert_stdout_messages(void);
+
+/* Encode in one forward pass, any of the three files may be "-" */
+Status do_encoding_stream(EncodeInfo *encInfo);
+
+/* Decode in one forward pass, stego image and output may be "-" */
+Status do_decoding_stream(DecodeInfo *decInfo);
+
+#endif